@@ -0,0 +1,258 @@
+#pragma once
+//*********************************************
+//Translational alignment of frames before stacking, for capture sets that drift by a few pixels
+//Each frame's shift from the first frame is searched coarse to fine on grayscale pyramids:
+//a small window at the coarsest level, then a step either side at each finer level.
+//Frames are then trimmed in place to the area every frame covers, so no pixels are resampled
+//*********************************************
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Image.h"
+#include "MemoryTracker.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ALIGNMENT_SSE2 1
+#endif
+
+using namespace std;
+
+/// <summary>
+/// Estimated offset of a frame from the reference frame
+/// Pixel (x, y) of the reference shows the same point as pixel (x + dx, y + dy) of the frame
+/// </summary>
+struct FrameShift {
+	int dx = 0, dy = 0; // whole pixel shift, applied when trimming
+	float subpixelX = 0.0f, subpixelY = 0.0f; // finer estimate, within half a pixel of dx and dy
+	float meanDifference = 0.0f; // mean absolute grey level difference at the shift
+};
+
+/// <summary>
+/// Estimates and removes whole pixel drift between frames
+/// </summary>
+class Aligner {
+public:
+	//search window at the coarsest level, in pixels either side, doubling with each finer level
+	static const int kCoarseRadius = 4;
+	//search window at the finer levels, around the doubled shift of the level above
+	static const int kFineRadius = 1;
+	//levels stop halving before either side would drop below this
+	static const unsigned int kMinLevelSize = 32;
+
+	/// <summary>
+	/// Estimate the shift of every frame from the first
+	/// </summary>
+	/// <param name="frames">frames of the same size, left untouched</param>
+	/// <returns>one shift per frame, the first always zero</returns>
+	static vector<FrameShift> estimate(const vector<Image> &frames) {
+		TRACE_ZONE("Estimate alignment");
+		vector<FrameShift> shifts(frames.size());
+		if (frames.size() < 2) {
+			return shifts;
+		}
+		const vector<Gray> reference = pyramid(frames[0]);
+		parallel_for(size_t(1), frames.size(), [&frames, &reference, &shifts](size_t i) {
+			TRACE_ZONE_DETAIL("Align frame", i);
+			const vector<Gray> levels = pyramid(frames[i]);
+			int dx = 0, dy = 0;
+			int radius = kCoarseRadius;
+			unsigned long long scores[3][3];
+			for (size_t level = levels.size(); level-- > 0;) {
+				const Gray &a = reference[level], &b = levels[level];
+				int bestX = dx, bestY = dy;
+				double best = -1.0;
+				for (int y = dy - radius; y <= dy + radius; y++) {
+					for (int x = dx - radius; x <= dx + radius; x++) {
+						const double score = meanAbsoluteDifference(a, b, x, y);
+						if (score >= 0 && (best < 0 || score < best)) {
+							best = score;
+							bestX = x;
+							bestY = y;
+						}
+					}
+				}
+				dx = bestX;
+				dy = bestY;
+				if (level > 0) {
+					dx *= 2;
+					dy *= 2;
+					radius = kFineRadius;
+				} else {
+					shifts[i].meanDifference = (float)best;
+				}
+			}
+			shifts[i].dx = dx;
+			shifts[i].dy = dy;
+			//fit a parabola through the neighbouring scores at full resolution for the subpixel estimate
+			for (int y = -1; y <= 1; y++) {
+				for (int x = -1; x <= 1; x++) {
+					const double score = meanAbsoluteDifference(reference[0], levels[0], dx + x, dy + y);
+					scores[y + 1][x + 1] = score < 0 ? 0 : (unsigned long long)(score * 1024);
+				}
+			}
+			shifts[i].subpixelX = dx + parabolaPeak(scores[1][0], scores[1][1], scores[1][2]);
+			shifts[i].subpixelY = dy + parabolaPeak(scores[0][1], scores[1][1], scores[2][1]);
+		});
+		return shifts;
+	}
+
+	/// <summary>
+	/// Trim every frame in place to the area all of them cover once shifted, so they line up pixel for pixel
+	/// Rows are moved within each frame's own pixel array, nothing is allocated or resampled
+	/// </summary>
+	/// <param name="frames">frames of the same size, trimmed to the same smaller size</param>
+	/// <param name="shifts">shifts from estimate()</param>
+	/// <param name="error">set to the reason if the frames cannot be aligned</param>
+	/// <returns>true if the frames were trimmed</returns>
+	static bool apply(vector<Image> &frames, const vector<FrameShift> &shifts, string &error) {
+		if (frames.empty() || frames.size() != shifts.size()) {
+			error = "there must be one shift per frame";
+			return false;
+		}
+		const int w = (int)frames[0].w, h = (int)frames[0].h;
+		//area of the reference that every shifted frame covers
+		int left = 0, top = 0, right = w, bottom = h;
+		for (const FrameShift &shift : shifts) {
+			left = std::max(left, -shift.dx);
+			top = std::max(top, -shift.dy);
+			right = std::min(right, w - shift.dx);
+			bottom = std::min(bottom, h - shift.dy);
+		}
+		if (right <= left || bottom <= top) {
+			error = "the frames do not overlap once aligned";
+			return false;
+		}
+		const unsigned int newW = right - left, newH = bottom - top;
+		parallel_for(size_t(0), frames.size(), [&frames, &shifts, left, top, newW, newH](size_t i) {
+			Image &frame = frames[i];
+			const size_t oldW = frame.w;
+			//bytes per pixel, monochrome frames are trimmed in their packed layout
+			const size_t pixelBytes = frame.channels == 1 ? 1 : sizeof(Image::Rgb);
+			unsigned char *bytes = frame.samples();
+			//rows only ever move towards the start of the array, so moving them in order is safe
+			for (unsigned int y = 0; y < newH; y++) {
+				const unsigned char *source = bytes + ((size_t)(top + shifts[i].dy + y) * oldW + left + shifts[i].dx) * pixelBytes;
+				memmove(bytes + (size_t)y * newW * pixelBytes, source, newW * pixelBytes);
+			}
+			//the array keeps its size, count the unused end as released so the later release balances
+			const size_t oldEntries = frame.storedPixels();
+			frame.w = newW;
+			frame.h = newH;
+			MemoryTracker::recordRelease((oldEntries - frame.storedPixels()) * sizeof(Image::Rgb));
+			frame.updateModified();
+		});
+		return true;
+	}
+
+private:
+	typedef vector<unsigned char, TrackedAllocator<unsigned char>> GreyLevels;
+
+	/// <summary>
+	/// One level of a grayscale pyramid
+	/// </summary>
+	struct Gray {
+		unsigned int w = 0, h = 0;
+		GreyLevels levels;
+	};
+
+	/// <summary>
+	/// Build the grayscale pyramid of a frame, full resolution first
+	/// </summary>
+	static vector<Gray> pyramid(const Image &frame) {
+		vector<Gray> levels(1);
+		Gray &base = levels[0];
+		base.w = frame.w;
+		base.h = frame.h;
+		base.levels.resize((size_t)frame.w * frame.h);
+		if (frame.channels == 1) {
+			std::copy(frame.samples(), frame.samples() + base.levels.size(), base.levels.begin());
+		} else {
+			for (size_t i = 0; i < base.levels.size(); i++) {
+				const Image::Rgb &p = frame.pixels[i];
+				//integer Rec. 601 luma
+				base.levels[i] = (unsigned char)((77 * p.r + 150 * p.g + 29 * p.b + 128) >> 8);
+			}
+		}
+		while (std::min(levels.back().w, levels.back().h) / 2 >= kMinLevelSize) {
+			const Gray &above = levels.back();
+			Gray half;
+			half.w = above.w / 2;
+			half.h = above.h / 2;
+			half.levels.resize((size_t)half.w * half.h);
+			for (unsigned int y = 0; y < half.h; y++) {
+				const unsigned char *row = above.levels.data() + (size_t)y * 2 * above.w;
+				for (unsigned int x = 0; x < half.w; x++) {
+					half.levels[(size_t)y * half.w + x] = (unsigned char)((row[2 * x] + row[2 * x + 1] + row[above.w + 2 * x] + row[above.w + 2 * x + 1] + 2) / 4);
+				}
+			}
+			levels.push_back(std::move(half));
+		}
+		return levels;
+	}
+
+	/// <summary>
+	/// Sum of absolute differences of two rows of grey levels
+	/// </summary>
+	static unsigned long long rowDifference(const unsigned char *a, const unsigned char *b, const size_t &count) {
+		unsigned long long sum = 0;
+		size_t x = 0;
+#ifdef ALIGNMENT_SSE2
+		//16 pixels at a time, psadbw leaves two partial sums per register
+		__m128i total = _mm_setzero_si128();
+		for (; x + 16 <= count; x += 16) {
+			const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+			const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+			total = _mm_add_epi64(total, _mm_sad_epu8(va, vb));
+		}
+		sum = (unsigned int)_mm_cvtsi128_si32(total) + (unsigned long long)(unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(total, 8));
+#endif
+		for (; x < count; x++) {
+			sum += (unsigned long long)abs((int)a[x] - (int)b[x]);
+		}
+		return sum;
+	}
+
+	/// <summary>
+	/// Mean absolute difference between the reference and a frame shifted by (dx, dy), over the area they share
+	/// </summary>
+	/// <returns>mean difference, negative if they share less than a quarter of the image</returns>
+	static double meanAbsoluteDifference(const Gray &reference, const Gray &frame, const int &dx, const int &dy) {
+		const int left = std::max(0, -dx), right = std::min((int)reference.w, (int)reference.w - dx);
+		const int top = std::max(0, -dy), bottom = std::min((int)reference.h, (int)reference.h - dy);
+		if (right <= left || bottom <= top) {
+			return -1.0;
+		}
+		const unsigned long long area = (unsigned long long)(right - left) * (bottom - top);
+		//tiny overlaps match by chance, so large shifts must still cover most of the image
+		if (area * 4 < (unsigned long long)reference.w * reference.h) {
+			return -1.0;
+		}
+		unsigned long long sum = 0;
+		for (int y = top; y < bottom; y++) {
+			const unsigned char *a = reference.levels.data() + (size_t)y * reference.w + left;
+			const unsigned char *b = frame.levels.data() + (size_t)(y + dy) * frame.w + left + dx;
+			sum += rowDifference(a, b, right - left);
+		}
+		return (double)sum / area;
+	}
+
+	/// <summary>
+	/// Offset of the lowest point of the parabola through three equally spaced scores
+	/// </summary>
+	/// <returns>offset from the middle score, between -0.5 and 0.5</returns>
+	static float parabolaPeak(const unsigned long long &before, const unsigned long long &middle, const unsigned long long &after) {
+		const double curvature = (double)before - 2.0 * middle + (double)after;
+		if (curvature <= 0) {
+			return 0.0f;
+		}
+		const double offset = ((double)before - (double)after) / (2.0 * curvature);
+		return (float)std::max(-0.5, std::min(0.5, offset));
+	}
+};
@@ -0,0 +1,160 @@
+#pragma once
+//*********************************************
+//Fast median previews with a known error, refined to the exact median afterwards
+//The preview counts each pixel's samples into 32 coarse bins of 8 levels and takes the middle of the
+//bin holding the median, so it is never more than kErrorBound levels out. The refinement goes back to
+//the frames but only counts the samples inside that one bin, giving the same result as the median blends
+//*********************************************
+
+#include <string>
+#include <vector>
+#include "Image.h"
+#include "MemoryTracker.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+using namespace std;
+
+/// <summary>
+/// Two pass median of a set of frames, with a bounded error preview after the first pass
+/// </summary>
+class ApproximateMedian {
+private:
+	static const unsigned int kCoarseBins = 32;
+	static const unsigned int kBinWidth = 256 / kCoarseBins;
+
+	vector<Image> &frames;
+	unsigned int w, h;
+	//per channel, the coarse bin holding the median and the median's rank among the samples in it
+	unsigned char *medianBins = nullptr;
+	unsigned int *ranksInBin = nullptr;
+
+	size_t channelCount() const {
+		return (size_t)w * h * 3;
+	}
+
+	static unsigned char channel(const Image::Rgb &pixel, const size_t &c) {
+		return c == 0 ? pixel.r : (c == 1 ? pixel.g : pixel.b);
+	}
+
+	/// <summary>
+	/// Make an output image of the frame size
+	/// </summary>
+	StackedImage makeOutput(char *method) const {
+		StackedImage output(w, h, method);
+		output.setColourDepth(frames[0].getColourDepth());
+		return output;
+	}
+
+public:
+	//most levels a preview channel can differ from the exact median
+	static const unsigned int kErrorBound = kBinWidth / 2;
+
+	/// <summary>
+	/// Prepare to stack a set of frames
+	/// </summary>
+	/// <param name="_frames">frames of the same size, kept by the caller until the refinement is done</param>
+	ApproximateMedian(vector<Image> &_frames) : frames(_frames), w(0), h(0) {
+		if (frames.empty()) {
+			throw new invalid_argument("There must be at least one image to stack");
+		}
+		w = frames[0].w;
+		h = frames[0].h;
+		for (const Image &frame : frames) {
+			if (frame.w != w || frame.h != h) {
+				throw new invalid_argument("Images must all be the same size");
+			}
+		}
+	}
+
+	~ApproximateMedian() {
+		MemoryTracker::release(medianBins, channelCount());
+		MemoryTracker::release(ranksInBin, channelCount());
+	}
+
+	ApproximateMedian(const ApproximateMedian&) = delete;
+	ApproximateMedian& operator=(const ApproximateMedian&) = delete;
+
+	/// <summary>
+	/// Calculate the preview, each channel within kErrorBound levels of the exact median
+	/// </summary>
+	/// <returns>preview image</returns>
+	StackedImage preview() {
+		TRACE_ZONE("Approximate median");
+		if (medianBins == nullptr) {
+			medianBins = MemoryTracker::allocate<unsigned char>(channelCount());
+			ranksInBin = MemoryTracker::allocate<unsigned int>(channelCount());
+		}
+		StackedImage output = makeOutput("Approximate Median Blend");
+		const size_t frameCount = frames.size();
+		//lower median, as in the median blends
+		const unsigned int rank = (unsigned int)(frameCount - 1) / 2;
+		parallel_for(size_t(0), size_t(h), [this, &output, frameCount, rank](size_t y) {
+			for (size_t pixel = y * w; pixel < (y + 1) * w; pixel++) {
+				unsigned int counts[3][kCoarseBins] = {};
+				for (size_t f = 0; f < frameCount; f++) {
+					const Image::Rgb &sample = frames[f].pixels[pixel];
+					counts[0][sample.r / kBinWidth]++;
+					counts[1][sample.g / kBinWidth]++;
+					counts[2][sample.b / kBinWidth]++;
+				}
+				unsigned char result[3];
+				for (size_t c = 0; c < 3; c++) {
+					unsigned int bin = 0, below = 0;
+					while (below + counts[c][bin] <= rank) {
+						below += counts[c][bin];
+						bin++;
+					}
+					medianBins[pixel * 3 + c] = (unsigned char)bin;
+					ranksInBin[pixel * 3 + c] = rank - below;
+					//middle of the bin, so the error is at most half its width
+					result[c] = (unsigned char)(bin * kBinWidth + kErrorBound);
+				}
+				output.pixels[pixel].r = result[0];
+				output.pixels[pixel].g = result[1];
+				output.pixels[pixel].b = result[2];
+			}
+		});
+		output.updateModified();
+		return output;
+	}
+
+	/// <summary>
+	/// Calculate the exact median, using the bins found by preview() so only one bin per channel is counted
+	/// </summary>
+	/// <returns>exact median image, the same as the median blends</returns>
+	StackedImage refine() {
+		if (medianBins == nullptr) {
+			preview().freeMemory();
+		}
+		TRACE_ZONE("Refine median");
+		StackedImage output = makeOutput("Median Blend");
+		const size_t frameCount = frames.size();
+		parallel_for(size_t(0), size_t(h), [this, &output, frameCount](size_t y) {
+			for (size_t pixel = y * w; pixel < (y + 1) * w; pixel++) {
+				unsigned char result[3];
+				for (size_t c = 0; c < 3; c++) {
+					const unsigned int bin = medianBins[pixel * 3 + c];
+					unsigned int counts[kBinWidth] = {};
+					for (size_t f = 0; f < frameCount; f++) {
+						const unsigned char value = channel(frames[f].pixels[pixel], c);
+						if (value / kBinWidth == bin) {
+							counts[value % kBinWidth]++;
+						}
+					}
+					unsigned int level = 0, below = 0;
+					while (below + counts[level] <= ranksInBin[pixel * 3 + c]) {
+						below += counts[level];
+						level++;
+					}
+					result[c] = (unsigned char)(bin * kBinWidth + level);
+				}
+				output.pixels[pixel].r = result[0];
+				output.pixels[pixel].g = result[1];
+				output.pixels[pixel].b = result[2];
+			}
+		});
+		output.updateModified();
+		return output;
+	}
+};
@@ -0,0 +1,1361 @@
+#pragma once
+//*********************************************
+//Non-interactive batch mode
+//Runs stacking and scaling jobs given on the command line or in a JSON manifest without any prompts,
+//and reports the outcome through the exit code so it can be driven by a job runner
+//*********************************************
+
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "Operations.h"
+#include "Pipeline.h"
+#include "JobScheduler.h"
+#include "JobServer.h"
+#include "FrameCache.h"
+#include "ApproximateMedian.h"
+#include "IncrementalStack.h"
+#include "ProgressiveStack.h"
+#include "SlidingMedian.h"
+#include "ResultCache.h"
+#include "Json.h"
+#include "Logger.h"
+#include "Timer.h"
+#include "Utils.h"
+
+using namespace std;
+
+//process exit codes of batch mode
+const int kExitSuccess = 0; // every job succeeded
+const int kExitJobFailed = 1; // at least one job failed
+const int kExitUsage = 2; // bad arguments or manifest, nothing was run
+
+//socket the daemon listens on when no --socket is given, relative to the working directory
+const char *const kDefaultSocket = "image-processing.sock";
+
+/// <summary>
+/// One stacking or scaling job
+/// </summary>
+struct BatchJob {
+	string name; // shown in reports, defaults to the job number
+	string operation; // stack or scale
+	unsigned int method = 0; // numbered method, as in runStackingMethod / runScalingMethod
+	vector<string> inputs; // paths, the file name part may contain * and ? wildcards
+	string output; // path of the PPM to write
+	double scale = 0.0; // scale factor, optional for stack jobs
+	unsigned int scaleMethod = 0; // numbered scaling method for the stacked result, stack jobs only
+	bool useRoi = false; // use a region of interest rather than the whole image
+	unsigned int roiLeft = 0, roiTop = 0, roiWidth = 0, roiHeight = 0;
+	string state; // incremental stack state to carry on from and save, stack jobs only
+	unsigned int window = 0; // frames in a rolling median, 0 to stack every input into one output
+	bool preview = false; // write an approximate median first and refine it in the background, median only
+	string dark; // master dark frame subtracted from every input, empty for none
+	string flat; // master flat frame every input is divided by, empty for none
+	bool align = false; // remove drift between the frames before stacking, stack jobs only
+	bool normalise = false; // scale every frame to the same median brightness while stacking, stack jobs only
+	unsigned int progressive = 0; // downscale factor of a progressive stack's first preview, 0 to stack in one go
+	bool planar = false; // stack and scale in the planar layout rather than interleaved pixels
+	bool mappedOutput = false; // create the output at its final size and map it, so the last stage writes into the file
+};
+
+/// <summary>
+/// Stream buffer that discards everything, used to silence progress output
+/// </summary>
+class NullBuffer : public streambuf {
+protected:
+	int overflow(int c) override {
+		return c;
+	}
+};
+
+/// <summary>
+/// Command line and manifest driven job runner
+/// </summary>
+class BatchMode {
+public:
+	/// <summary>
+	/// Run batch mode from the program arguments
+	/// </summary>
+	/// <param name="argc">argument count</param>
+	/// <param name="argv">arguments, argv[0] is the program</param>
+	/// <returns>process exit code</returns>
+	static int run(int argc, char *argv[]) {
+		vector<string> args(argv + 1, argv + argc);
+		vector<BatchJob> jobs;
+		bool quiet = false;
+		bool stopOnError = false;
+		unsigned int concurrentJobs = 1;
+		//leave half the machine for the operating system and file cache unless told otherwise
+		unsigned long long memoryBudget = MemoryTracker::physicalMemoryBytes() / 2;
+		string reportPath;
+		string command; // serve, stats or stop, empty to run jobs
+		bool useDaemon = false;
+		string socketPath = kDefaultSocket;
+		//decoded frames kept by the daemon, a quarter of the machine unless told otherwise
+		unsigned long long cacheBytes = MemoryTracker::physicalMemoryBytes() > 0 ? MemoryTracker::physicalMemoryBytes() / 4 : 1ULL << 30;
+		string resultCacheDirectory; // empty to always compute outputs
+		unsigned long long resultCacheBytes = 4ULL << 30;
+		LogLevel logLevel = LogLevel::Info;
+		string logFile = "DetailsLog.txt";
+		string logJson;
+		try {
+			BatchJob single;
+			string manifest;
+			string methodName;
+			for (size_t i = 0; i < args.size(); i++) {
+				const string &arg = args[i];
+				if (arg == "--help" || arg == "-h") {
+					printUsage(cout);
+					return kExitSuccess;
+				} else if (arg == "--quiet") {
+					quiet = true;
+				} else if (arg == "--stop-on-error") {
+					stopOnError = true;
+				} else if (arg == "--jobs") {
+					const double value = parseNumber(optionValue(args, i), "--jobs");
+					if (value < 1) {
+						throw runtime_error("--jobs must be at least 1");
+					}
+					concurrentJobs = (unsigned int)value;
+				} else if (arg == "--memory-budget") {
+					memoryBudget = parseByteSize(optionValue(args, i), "--memory-budget");
+				} else if (arg == "--report") {
+					reportPath = optionValue(args, i);
+				} else if (arg == "--result-cache") {
+					resultCacheDirectory = optionValue(args, i);
+				} else if (arg == "--result-cache-size") {
+					resultCacheBytes = parseByteSize(optionValue(args, i), "--result-cache-size");
+				} else if (arg == "--connect") {
+					useDaemon = true;
+				} else if (arg == "--socket") {
+					socketPath = optionValue(args, i);
+				} else if (arg == "--cache-size") {
+					cacheBytes = parseByteSize(optionValue(args, i), "--cache-size");
+				} else if (arg == "--manifest") {
+					manifest = optionValue(args, i);
+				} else if (arg == "--method") {
+					methodName = optionValue(args, i);
+				} else if (arg == "--scale-method") {
+					single.scaleMethod = parseScalingMethod(optionValue(args, i));
+					if (single.scaleMethod == 0) {
+						throw runtime_error("unknown scaling method " + args[i]);
+					}
+				} else if (arg == "--input") {
+					single.inputs.push_back(optionValue(args, i));
+				} else if (arg == "--output") {
+					single.output = optionValue(args, i);
+				} else if (arg == "--scale") {
+					single.scale = parseNumber(optionValue(args, i), "--scale");
+				} else if (arg == "--roi") {
+					parseRoi(optionValue(args, i), single);
+				} else if (arg == "--state") {
+					single.state = optionValue(args, i);
+				} else if (arg == "--preview") {
+					single.preview = true;
+				} else if (arg == "--dark") {
+					single.dark = optionValue(args, i);
+				} else if (arg == "--flat") {
+					single.flat = optionValue(args, i);
+				} else if (arg == "--align") {
+					single.align = true;
+				} else if (arg == "--normalise") {
+					single.normalise = true;
+				} else if (arg == "--layout") {
+					single.planar = parseLayout(optionValue(args, i));
+				} else if (arg == "--mapped-output") {
+					single.mappedOutput = true;
+				} else if (arg == "--progressive") {
+					single.progressive = parseProgressiveFactor(parseNumber(optionValue(args, i), "--progressive"));
+				} else if (arg == "--window") {
+					const double value = parseNumber(optionValue(args, i), "--window");
+					if (value < 1 || value > SlidingMedian::kMaxWindow) {
+						throw runtime_error("--window must be from 1 to " + to_string(SlidingMedian::kMaxWindow));
+					}
+					single.window = (unsigned int)value;
+				} else if (arg == "--log-level") {
+					if (!parseLogLevel(optionValue(args, i), logLevel)) {
+						throw runtime_error("unknown log level " + args[i]);
+					}
+				} else if (arg == "--log-file") {
+					logFile = optionValue(args, i);
+				} else if (arg == "--log-json") {
+					logJson = optionValue(args, i);
+				} else if (arg.compare(0, 2, "--") == 0) {
+					throw runtime_error("unknown option " + arg);
+				} else if (single.operation.empty()) {
+					single.operation = arg;
+				} else {
+					throw runtime_error("unexpected argument " + arg);
+				}
+			}
+
+			if (single.operation == "serve" || single.operation == "stats" || single.operation == "stop") {
+				command = single.operation;
+			} else if (!manifest.empty()) {
+				if (!single.operation.empty() || !single.inputs.empty()) {
+					throw runtime_error("give either a manifest or a single job, not both");
+				}
+				jobs = loadManifest(manifest);
+			} else {
+				//the method name can only be resolved once the operation is known
+				single.name = "1";
+				single.method = parseMethod(single.operation, methodName);
+				validate(single);
+				jobs.push_back(single);
+			}
+		} catch (const exception &e) {
+			cerr << "Error: " << e.what() << "\n\n";
+			printUsage(cerr);
+			return kExitUsage;
+		}
+
+		Logger::instance().setLevel(logLevel);
+		Logger::instance().setOutputs(logFile, logJson);
+
+		//progress messages from the image classes go to cout, so swap it for a null stream when quiet
+		ostream report(cout.rdbuf());
+		NullBuffer nullBuffer;
+		streambuf *original = cout.rdbuf();
+		if (quiet) {
+			cout.rdbuf(&nullBuffer);
+		}
+		unique_ptr<ResultCache> results;
+		if (!resultCacheDirectory.empty() && !useDaemon) {
+			results.reset(new ResultCache(resultCacheDirectory, resultCacheBytes));
+		}
+		if (!command.empty() || useDaemon) {
+			int result;
+			if (command == "serve") {
+				result = serveJobs(socketPath, cacheBytes, results.get(), report);
+			} else if (!command.empty()) {
+				result = sendCommand(socketPath, command, report);
+			} else {
+				result = submitJobs(socketPath, jobs, stopOnError, report);
+			}
+			cout.rdbuf(original);
+			Logger::instance().flush();
+			return result;
+		}
+		vector<ScheduledJob> scheduled;
+		for (const BatchJob &job : jobs) {
+			scheduled.push_back(scheduleJob(job, results.get()));
+		}
+		JobScheduler scheduler(concurrentJobs, memoryBudget == 0 ? ~0ULL : memoryBudget);
+		const vector<JobReport> reports = scheduler.run(scheduled, stopOnError, [&jobs, &report](const JobReport &result) {
+			logJobReport(jobs[result.index], result);
+			if (result.ok) {
+				report << "[ok] " << result.name << ": " << jobs[result.index].operation << " -> " << jobs[result.index].output
+					<< " in " << result.runSeconds << "s (queued " << result.queuedSeconds << "s)\n";
+			} else {
+				report << "[failed] " << result.name << ": " << result.error << "\n";
+			}
+		});
+		const size_t refined = waitForRefinements();
+		cout.rdbuf(original);
+		if (refined > 0) {
+			report << "Refined " << refined << " previews to the exact median\n";
+		}
+
+		size_t succeeded = 0;
+		for (const JobReport &result : reports) {
+			succeeded += result.ok ? 1 : 0;
+		}
+		report << succeeded << " of " << jobs.size() << " jobs succeeded\n";
+		writeSummary(report, reports, scheduled, scheduler.getWallSeconds());
+		if (results) {
+			report << "Result cache: " << results->getHits() << " hits, " << results->getMisses() << " misses\n";
+		}
+		const BufferPoolStatistics pool = BufferPool::instance().statistics();
+		report << "Buffer pool: " << pool.hits << " buffers reused, " << pool.misses << " allocated, " << pool.hugePageBuffers << " on huge pages\n";
+		if (!reportPath.empty()) {
+			writeReport(reportPath, reports, scheduled, scheduler.getWallSeconds(), concurrentJobs, memoryBudget);
+		}
+		Logger::instance().flush();
+		return succeeded == jobs.size() ? kExitSuccess : kExitJobFailed;
+	}
+
+	/// <summary>
+	/// Prepare a job for the scheduler, estimating its peak memory from the input headers
+	/// </summary>
+	/// <param name="job">validated job</param>
+	/// <param name="results">cache of finished outputs, null for none</param>
+	/// <returns>job ready to schedule</returns>
+	static ScheduledJob scheduleJob(const BatchJob &job, ResultCache *results) {
+		ScheduledJob scheduled;
+		scheduled.name = job.name;
+		const unsigned long long pixelSize = sizeof(Image::Rgb);
+		vector<string> paths;
+		for (const string &pattern : job.inputs) {
+			const vector<string> matches = expandFilePattern(pattern);
+			paths.insert(paths.end(), matches.begin(), matches.end());
+		}
+		//inputs that cannot be read are estimated as empty, the job reports the error when it runs
+		unsigned int w = 0, h = 0;
+		if (!paths.empty()) {
+			Image::readPPMSize(paths[0].c_str(), w, h);
+		}
+		const unsigned long long n = paths.size();
+		//only the region of interest of each input is read
+		const unsigned long long sourceW = job.useRoi ? job.roiWidth : w;
+		const unsigned long long sourceH = job.useRoi ? job.roiHeight : h;
+		const unsigned long long pixels = sourceW * sourceH;
+		scheduled.inputPixels = pixels * n;
+		const double scale = job.operation == "scale" || job.scaleMethod != 0 ? job.scale : 0.0;
+		const unsigned long long outputPixels = (unsigned long long)floor(sourceW * scale) * (unsigned long long)floor(sourceH * scale);
+		if (job.progressive != 0) {
+			//every frame and its small copy, the current result and the tiles of one step
+			scheduled.estimatedBytes = ((n + 1) * pixels + n * pixels / (job.progressive * job.progressive)) * pixelSize
+				+ (n + 1) * ProgressiveStack::kTileSize * ProgressiveStack::kTileSize * pixelSize;
+		} else if (job.preview) {
+			//every frame is held until the refinement finishes, plus the preview and the bins found by it
+			scheduled.estimatedBytes = (n + 2) * pixels * pixelSize + 3 * pixels * (1 + sizeof(unsigned int));
+		} else if (job.window != 0) {
+			//the histograms, and the newest and oldest frames of the window
+			scheduled.estimatedBytes = SlidingMedian::stateBytes(pixels) + 2 * pixels * pixelSize;
+		} else if (!job.state.empty()) {
+			//one frame at a time, plus the running sums or up to twice the sorted samples of every frame
+			const unsigned long long state = IncrementalStack::modeForMethod(job.method) == StackMode::Mean ? 3 * pixels * sizeof(uint32_t) : 6 * pixels * n;
+			scheduled.estimatedBytes = 2 * pixels * pixelSize + state;
+		} else if (job.operation == "stack") {
+			//every frame and the output are held, plus the sample arrays of the median and sigma stackers
+			unsigned long long scratch = 0;
+			if (job.method == 2 || job.method == 4) {
+				scratch = 3 * n * pixels;
+			} else if (job.method == 3 || job.method == 5) {
+				//the samples as for the median, and a count of those left per pixel and channel
+				scratch = 3 * pixels * (n + sizeof(unsigned int));
+			}
+			//scaling starts once the stacker has released its frames and scratch space
+			scheduled.estimatedBytes = std::max((n + 1) * pixels * pixelSize + scratch, (pixels + outputPixels) * pixelSize);
+		} else {
+			scheduled.estimatedBytes = (pixels + outputPixels) * pixelSize;
+		}
+		if (!job.dark.empty() || !job.flat.empty()) {
+			//the master frames while they are read, then the dark levels and fixed point gains
+			scheduled.estimatedBytes += w * h * (2 * pixelSize + 9);
+		}
+		scheduled.run = [job, results](string &error) { return runJob(job, error, nullptr, results); };
+		return scheduled;
+	}
+
+	/// <summary>
+	/// Run a single job
+	/// </summary>
+	/// <param name="job">validated job</param>
+	/// <param name="error">set to the reason if the job fails</param>
+	/// <param name="cache">cache to take decoded frames from, null to read every file</param>
+	/// <param name="results">cache of finished outputs, null to always compute them</param>
+	/// <returns>true if the output was written</returns>
+	static bool runJob(const BatchJob &job, string &error, FrameCache *cache = nullptr, ResultCache *results = nullptr) {
+		vector<string> paths;
+		for (const string &pattern : job.inputs) {
+			const vector<string> matches = expandFilePattern(pattern);
+			if (matches.empty()) {
+				error = "no files match " + pattern;
+				return false;
+			}
+			paths.insert(paths.end(), matches.begin(), matches.end());
+		}
+		const string directory = parentDirectory(job.output);
+		if (!directory.empty()) {
+			makeDirectory(directory);
+		}
+
+		if (!job.state.empty()) {
+			return runIncrementalJob(job, paths, error, cache);
+		}
+		if (job.window != 0) {
+			return runWindowJob(job, paths, error, cache);
+		}
+		if (job.preview) {
+			return runPreviewJob(job, paths, error, cache);
+		}
+		if (job.progressive != 0) {
+			return runProgressiveJob(job, paths, error, cache);
+		}
+
+		try {
+			//stages run in memory and only the region of interest is read, nothing is written until the output
+			Pipeline pipeline;
+			pipeline.useFrameCache(cache).useResultCache(results);
+			Calibration calibration;
+			if (!job.dark.empty() || !job.flat.empty()) {
+				if (!calibration.load(job.dark, job.flat, error)) {
+					return false;
+				}
+				pipeline.calibrate(&calibration);
+			}
+			if (job.operation == "stack") {
+				pipeline.stack(job.method, paths);
+				if (job.align) {
+					pipeline.align();
+				}
+				if (job.normalise) {
+					pipeline.normaliseExposure();
+				}
+				if (job.scaleMethod != 0) {
+					pipeline.scale(job.scaleMethod, job.scale);
+				}
+			} else {
+				if (paths.size() != 1) {
+					error = "scaling needs exactly one input image, got " + to_string(paths.size());
+					return false;
+				}
+				pipeline.load(paths[0]).scale(job.method, job.scale);
+			}
+			if (job.useRoi) {
+				pipeline.regionOfInterest(job.roiLeft, job.roiTop, job.roiWidth, job.roiHeight);
+			}
+			if (job.planar) {
+				pipeline.planarLayout();
+			}
+			if (job.mappedOutput) {
+				pipeline.mapOutput();
+			}
+			return pipeline.run(job.output, error);
+		} catch (const exception &e) {
+			error = e.what();
+		} catch (const exception *e) {
+			//the stackers throw their argument errors by pointer
+			error = e->what();
+			delete e;
+		} catch (...) {
+			error = "unexpected error";
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// Add a job's inputs to a saved incremental stack, then save the stack and write its output
+	/// A missing state file starts a new stack, so the first job of a series needs nothing special
+	/// </summary>
+	/// <param name="job">validated stack job with a state file</param>
+	/// <param name="paths">expanded input paths</param>
+	/// <param name="error">set to the reason if the job fails</param>
+	/// <param name="cache">cache to take decoded frames from, null to read every file</param>
+	/// <returns>true if the state was saved and the output written</returns>
+	static bool runIncrementalJob(const BatchJob &job, const vector<string> &paths, string &error, FrameCache *cache) {
+		const StackMode mode = IncrementalStack::modeForMethod(job.method);
+		IncrementalStack stack(mode, job.method == 5 ? kSigmaIterationsSerial : kSigmaIterationsParallel, kSigmaAlpha);
+		ifstream existing(job.state, ios::binary);
+		if (existing.good()) {
+			existing.close();
+			if (!stack.load(job.state, error)) {
+				return false;
+			}
+			if (stack.getMode() != mode) {
+				error = job.state + " was stacked with a different method";
+				return false;
+			}
+		}
+		const unsigned int previous = stack.getFrameCount();
+		for (const string &path : paths) {
+			unsigned int w = 0, h = 0;
+			if (!Image::readPPMSize(path.c_str(), w, h)) {
+				error = "could not read " + path;
+				return false;
+			}
+			Image frame;
+			if (cache != nullptr) {
+				frame = cache->get(path, 0, 0, w, h, true);
+			} else {
+				frame.readPPM(path.c_str());
+				frame.logDetails();
+			}
+			const bool added = frame.pixels != nullptr && stack.addFrame(frame, error);
+			frame.freeMemory();
+			if (!added) {
+				error = error.empty() ? "could not read " + path : path + ": " + error;
+				return false;
+			}
+		}
+		if (!stack.save(job.state, error)) {
+			return false;
+		}
+		cout << "Added " << stack.getFrameCount() - previous << " frames to " << job.state << ", " << stack.getFrameCount() << " in total\n";
+		StackedImage &output = stack.getOutput();
+		if (!output.writePPM(job.output.c_str())) {
+			error = "could not write " + job.output;
+			return false;
+		}
+		output.logDetails();
+		return true;
+	}
+
+	/// <summary>
+	/// Read one whole frame, from the cache if there is one
+	/// </summary>
+	/// <param name="path">ppm file</param>
+	/// <param name="cache">cache to take the frame from, null to read the file</param>
+	/// <returns>the frame, without pixels if it could not be read</returns>
+	static Image readFrame(const string &path, FrameCache *cache) {
+		Image frame;
+		unsigned int w = 0, h = 0;
+		if (!Image::readPPMSize(path.c_str(), w, h)) {
+			return frame;
+		}
+		if (cache != nullptr) {
+			return cache->get(path, 0, 0, w, h, true);
+		}
+		frame.readPPM(path.c_str());
+		frame.logDetails();
+		return frame;
+	}
+
+	/// <summary>
+	/// Write a rolling median of the inputs, one output per input named after it
+	/// Only the newest frame and the one leaving the window are held, the leaving frame is read again
+	/// </summary>
+	/// <param name="job">validated stack job with a window, its output containing *</param>
+	/// <param name="paths">expanded input paths, in time order</param>
+	/// <param name="error">set to the reason if the job fails</param>
+	/// <param name="cache">cache to take decoded frames from, null to read every file</param>
+	/// <returns>true if every output was written</returns>
+	static bool runWindowJob(const BatchJob &job, const vector<string> &paths, string &error, FrameCache *cache) {
+		SlidingMedian stacker(job.window);
+		const size_t star = job.output.find('*');
+		for (size_t i = 0; i < paths.size(); i++) {
+			Image frame = readFrame(paths[i], cache);
+			Image expired;
+			if (stacker.needsExpired()) {
+				expired = readFrame(paths[i - job.window], cache);
+			}
+			const bool pushed = frame.pixels != nullptr && (!stacker.needsExpired() || expired.pixels != nullptr)
+				&& stacker.push(frame, stacker.needsExpired() ? &expired : nullptr, error);
+			frame.freeMemory();
+			expired.freeMemory();
+			if (!pushed) {
+				error = paths[i] + ": " + (error.empty() ? "could not read the frame or the one leaving the window" : error);
+				return false;
+			}
+			const string outputPath = job.output.substr(0, star) + fileStem(paths[i]) + job.output.substr(star + 1);
+			if (!stacker.getOutput().writePPM(outputPath.c_str())) {
+				error = "could not write " + outputPath;
+				return false;
+			}
+		}
+		stacker.getOutput().logDetails();
+		return true;
+	}
+
+	/// <summary>
+	/// Write an approximate median straight away, then replace it with the exact median in the background
+	/// The job finishes with the preview, waitForRefinements() waits for the exact outputs
+	/// </summary>
+	/// <param name="job">validated median stack job with preview set</param>
+	/// <param name="paths">expanded input paths</param>
+	/// <param name="error">set to the reason if the job fails</param>
+	/// <param name="cache">cache to take decoded frames from, null to read every file</param>
+	/// <returns>true if the preview was written</returns>
+	static bool runPreviewJob(const BatchJob &job, const vector<string> &paths, string &error, FrameCache *cache) {
+		//the frames and bins are shared with the refinement, which releases them
+		struct PreviewState {
+			vector<Image> frames;
+			unique_ptr<ApproximateMedian> median;
+			~PreviewState() {
+				freeImages(frames);
+			}
+		};
+		shared_ptr<PreviewState> state = make_shared<PreviewState>();
+		for (const string &path : paths) {
+			state->frames.push_back(readFrame(path, cache));
+			if (state->frames.back().pixels == nullptr) {
+				error = "could not read " + path;
+				return false;
+			}
+		}
+		try {
+			state->median.reset(new ApproximateMedian(state->frames));
+		} catch (const exception *e) {
+			error = e->what();
+			delete e;
+			return false;
+		}
+		StackedImage preview = state->median->preview();
+		const bool written = preview.writePPM(job.output.c_str());
+		preview.freeMemory();
+		if (!written) {
+			error = "could not write " + job.output;
+			return false;
+		}
+		cout << "Preview written to " << job.output << ", within " << ApproximateMedian::kErrorBound << " levels of the median, refining in the background\n";
+		LogRecord record(LogLevel::Info, "Median Preview", "");
+		record.add("Job", "job", job.name).add("Output", "output", job.output).addNumber("Error Bound", "errorBound", ApproximateMedian::kErrorBound);
+		Logger::instance().log(std::move(record));
+
+		const string output = job.output;
+		lock_guard<mutex> guard(refinementLock());
+		refinements().push_back(async(launch::async, [state, output] {
+			StackedImage exact = state->median->refine();
+			//replace the preview in one step, so readers never see a partly written file
+			const string temporary = temporaryPath(output, "refining");
+			bool written = exact.writePPM(temporary.c_str());
+			exact.logDetails();
+			exact.freeMemory();
+			remove(output.c_str());
+			written = written && rename(temporary.c_str(), output.c_str()) == 0;
+			if (!written) {
+				remove(temporary.c_str());
+				Logger::instance().log(LogRecord(LogLevel::Error, "Median Preview", "could not write the refined median to " + output));
+			}
+			return written;
+		}));
+		return true;
+	}
+
+	/// <summary>
+	/// Stack progressively, replacing the output with each improved result until the full resolution one is written
+	/// </summary>
+	/// <param name="job">validated stack job with a progressive factor</param>
+	/// <param name="paths">expanded input paths</param>
+	/// <param name="error">set to the reason if the job fails</param>
+	/// <param name="cache">cache to take decoded frames from, null to read every file</param>
+	/// <returns>true if the full resolution output was written</returns>
+	static bool runProgressiveJob(const BatchJob &job, const vector<string> &paths, string &error, FrameCache *cache) {
+		ProgressiveStack stack(job.method, job.progressive);
+		for (const string &path : paths) {
+			Image frame = readFrame(path, cache);
+			if (frame.pixels == nullptr) {
+				error = "could not read " + path;
+				return false;
+			}
+			stack.addFrame(frame);
+		}
+		Timer timer;
+		timer.start();
+		bool written = true;
+		StackedImage result;
+		try {
+			result = stack.run([&job, &timer, &written](StackedImage &current, const unsigned int &tilesDone, const unsigned int &tileCount) {
+				//replace the output in one step, so readers never see a partly written file
+				const string temporary = temporaryPath(job.output, "progress");
+				written = written && current.writePPM(temporary.c_str());
+				remove(job.output.c_str());
+				written = written && rename(temporary.c_str(), job.output.c_str()) == 0;
+				timer.stop();
+				cout << (tilesDone == 0 ? "Preview" : "Refined " + to_string(tilesDone) + " of " + to_string(tileCount) + " tiles")
+					<< " written to " << job.output << " after " << timer.getSeconds() << "s\n";
+			});
+		} catch (const exception *e) {
+			error = e->what();
+			delete e;
+			return false;
+		}
+		result.logDetails();
+		result.freeMemory();
+		if (!written) {
+			error = "could not write " + job.output;
+		}
+		return written;
+	}
+
+	/// <summary>
+	/// Wait for every background refinement started by preview jobs
+	/// </summary>
+	/// <returns>number of refined outputs written</returns>
+	static size_t waitForRefinements() {
+		vector<future<bool>> pending;
+		{
+			lock_guard<mutex> guard(refinementLock());
+			pending.swap(refinements());
+		}
+		size_t written = 0;
+		for (future<bool> &refinement : pending) {
+			written += refinement.get() ? 1 : 0;
+		}
+		return written;
+	}
+
+	/// <summary>
+	/// Collect the background refinements that have finished, without waiting for the others
+	/// </summary>
+	/// <returns>number of finished refinements whose outputs were written</returns>
+	static size_t reapRefinements() {
+		lock_guard<mutex> guard(refinementLock());
+		vector<future<bool>> &pending = refinements();
+		size_t written = 0;
+		for (auto it = pending.begin(); it != pending.end();) {
+			if (it->wait_for(chrono::seconds(0)) == future_status::ready) {
+				written += it->get() ? 1 : 0;
+				it = pending.erase(it);
+			} else {
+				++it;
+			}
+		}
+		return written;
+	}
+
+	/// <summary>
+	/// Read and validate every job in a manifest
+	/// The manifest is either an array of jobs or an object with a "jobs" array, e.g.
+	/// {"jobs": [{"operation": "stack", "method": "median", "input": "Images/ImageStacker_set1/*.ppm", "output": "out/set1.ppm"},
+	///           {"operation": "scale", "method": "bicubic", "scale": 2, "roi": [0, 0, 100, 100], "input": "in.ppm", "output": "out/zoom.ppm"},
+	///           {"operation": "stack", "method": "median", "roi": [0, 0, 100, 100], "scaleMethod": "bicubic", "scale": 4, "input": "Images/ImageStacker_set1/*.ppm", "output": "out/set1zoom.ppm"}]}
+	/// </summary>
+	/// <param name="path">manifest file</param>
+	/// <returns>jobs in manifest order</returns>
+	static vector<BatchJob> loadManifest(const string &path) {
+		const JsonValue root = JsonValue::parseFile(path);
+		const JsonValue *list = root.isArray() ? &root : root.find("jobs");
+		if (list == nullptr || !list->isArray()) {
+			throw runtime_error(path + " must be an array of jobs or an object with a jobs array");
+		}
+		vector<BatchJob> jobs;
+		for (size_t i = 0; i < list->items.size(); i++) {
+			try {
+				jobs.push_back(jobFromJson(list->items[i], i + 1));
+			} catch (const exception &e) {
+				throw runtime_error("job " + to_string(i + 1) + ": " + e.what());
+			}
+		}
+		if (jobs.empty()) {
+			throw runtime_error(path + " has no jobs");
+		}
+		return jobs;
+	}
+
+	/// <summary>
+	/// Build a job from its JSON description
+	/// </summary>
+	/// <param name="value">job object</param>
+	/// <param name="number">position of the job, used as its default name</param>
+	/// <returns>validated job</returns>
+	static BatchJob jobFromJson(const JsonValue &value, const size_t &number) {
+		if (!value.isObject()) {
+			throw runtime_error("must be an object");
+		}
+		BatchJob job;
+		job.name = value.find("name") != nullptr ? stringMember(value, "name") : to_string(number);
+		job.operation = stringMember(value, "operation");
+		const JsonValue *method = value.find("method");
+		if (method == nullptr) {
+			throw runtime_error("method is missing");
+		}
+		job.method = parseMethod(job.operation, method->isNumber() ? to_string((int)method->number) : method->text);
+		const JsonValue *input = value.find("input");
+		if (input != nullptr && input->isString()) {
+			job.inputs.push_back(input->text);
+		} else if (input != nullptr && input->isArray()) {
+			for (const JsonValue &item : input->items) {
+				if (!item.isString()) {
+					throw runtime_error("input must only contain strings");
+				}
+				job.inputs.push_back(item.text);
+			}
+		}
+		job.output = stringMember(value, "output");
+		if (const JsonValue *scale = value.find("scale")) {
+			if (!scale->isNumber()) {
+				throw runtime_error("scale must be a number");
+			}
+			job.scale = scale->number;
+		}
+		if (value.find("scaleMethod") != nullptr) {
+			job.scaleMethod = parseScalingMethod(stringMember(value, "scaleMethod"));
+			if (job.scaleMethod == 0) {
+				throw runtime_error("unknown scaleMethod " + stringMember(value, "scaleMethod"));
+			}
+		}
+		if (const JsonValue *roi = value.find("roi")) {
+			if (!roi->isArray() || roi->items.size() != 4) {
+				throw runtime_error("roi must be [left, top, width, height]");
+			}
+			unsigned int *fields[] = { &job.roiLeft, &job.roiTop, &job.roiWidth, &job.roiHeight };
+			for (size_t i = 0; i < 4; i++) {
+				if (!roi->items[i].isNumber() || roi->items[i].number < 0 || roi->items[i].number > numeric_limits<unsigned int>::max()) {
+					throw runtime_error("roi values must be non-negative numbers up to " + to_string(numeric_limits<unsigned int>::max()));
+				}
+				*fields[i] = (unsigned int)roi->items[i].number;
+			}
+			job.useRoi = true;
+		}
+		if (value.find("state") != nullptr) {
+			job.state = stringMember(value, "state");
+		}
+		if (const JsonValue *preview = value.find("preview")) {
+			if (!preview->isBoolean()) {
+				throw runtime_error("preview must be true or false");
+			}
+			job.preview = preview->boolean;
+		}
+		if (value.find("dark") != nullptr) {
+			job.dark = stringMember(value, "dark");
+		}
+		if (value.find("flat") != nullptr) {
+			job.flat = stringMember(value, "flat");
+		}
+		if (const JsonValue *align = value.find("align")) {
+			if (!align->isBoolean()) {
+				throw runtime_error("align must be true or false");
+			}
+			job.align = align->boolean;
+		}
+		if (const JsonValue *normalise = value.find("normalise")) {
+			if (!normalise->isBoolean()) {
+				throw runtime_error("normalise must be true or false");
+			}
+			job.normalise = normalise->boolean;
+		}
+		if (value.find("layout") != nullptr) {
+			job.planar = parseLayout(stringMember(value, "layout"));
+		}
+		if (const JsonValue *mappedOutput = value.find("mappedOutput")) {
+			if (!mappedOutput->isBoolean()) {
+				throw runtime_error("mappedOutput must be true or false");
+			}
+			job.mappedOutput = mappedOutput->boolean;
+		}
+		if (const JsonValue *progressive = value.find("progressive")) {
+			if (!progressive->isNumber()) {
+				throw runtime_error("progressive must be a number");
+			}
+			job.progressive = parseProgressiveFactor(progressive->number);
+		}
+		if (const JsonValue *window = value.find("window")) {
+			if (!window->isNumber() || window->number < 1 || window->number > SlidingMedian::kMaxWindow) {
+				throw runtime_error("window must be a number from 1 to " + to_string(SlidingMedian::kMaxWindow));
+			}
+			job.window = (unsigned int)window->number;
+		}
+		validate(job);
+		return job;
+	}
+
+	/// <summary>
+	/// Check a job has everything it needs, throwing if not
+	/// </summary>
+	/// <param name="job">job to check</param>
+	static void validate(const BatchJob &job) {
+		if (job.operation != "stack" && job.operation != "scale") {
+			throw runtime_error(job.operation.empty() ? "operation is missing, use stack or scale" : "unknown operation " + job.operation);
+		}
+		if (job.method == 0) {
+			throw runtime_error("unknown or missing " + job.operation + " method");
+		}
+		if (job.inputs.empty()) {
+			throw runtime_error("no input given");
+		}
+		if (job.output.empty()) {
+			throw runtime_error("no output given");
+		}
+		if (job.operation == "scale" && job.scale <= 0) {
+			throw runtime_error("scale jobs need a scale factor above 0");
+		}
+		if (job.operation == "scale" && job.scaleMethod != 0) {
+			throw runtime_error("scale jobs give their scaling method as method");
+		}
+		if (job.operation == "stack" && (job.scaleMethod != 0) != (job.scale != 0)) {
+			throw runtime_error("scaling a stacked image needs both a scale method and a scale factor above 0");
+		}
+		if (job.operation == "stack" && job.scale < 0) {
+			throw runtime_error("the scale factor must be above 0");
+		}
+		if (!job.state.empty() && job.operation != "stack") {
+			throw runtime_error("only stack jobs can keep a state");
+		}
+		if (!job.state.empty() && (job.useRoi || job.scaleMethod != 0)) {
+			throw runtime_error("incremental stacks cannot be combined with a region of interest or scaling");
+		}
+		if (job.window != 0 && (job.operation != "stack" || (job.method != 2 && job.method != 4))) {
+			throw runtime_error("a window is only for median stack jobs");
+		}
+		if (job.window != 0 && (job.useRoi || job.scaleMethod != 0 || !job.state.empty())) {
+			throw runtime_error("a rolling median cannot be combined with a region of interest, scaling or a state");
+		}
+		if (job.preview && (job.operation != "stack" || (job.method != 2 && job.method != 4))) {
+			throw runtime_error("previews are only for median stack jobs");
+		}
+		if (job.preview && (job.useRoi || job.scaleMethod != 0 || !job.state.empty() || job.window != 0)) {
+			throw runtime_error("a preview cannot be combined with a region of interest, scaling, a state or a window");
+		}
+		if ((!job.dark.empty() || !job.flat.empty()) && (!job.state.empty() || job.window != 0 || job.preview || job.progressive != 0)) {
+			throw runtime_error("calibration cannot be combined with a state, window, preview or progressive stacking");
+		}
+		if (job.align && (job.operation != "stack" || !job.state.empty() || job.window != 0 || job.preview || job.progressive != 0)) {
+			throw runtime_error("alignment is only for stack jobs without a state, window, preview or progressive stacking");
+		}
+		if (job.normalise && (job.operation != "stack" || !job.state.empty() || job.window != 0 || job.preview || job.progressive != 0)) {
+			throw runtime_error("exposure normalisation is only for stack jobs without a state, window, preview or progressive stacking");
+		}
+		if (hasExtension(job.output, ".pfm") && (!job.state.empty() || job.window != 0 || job.preview || job.progressive != 0)) {
+			throw runtime_error("a .pfm output cannot be combined with a state, window, preview or progressive stacking");
+		}
+		if (job.planar && (job.normalise || hasExtension(job.output, ".pfm") || !job.state.empty() || job.window != 0 || job.preview || job.progressive != 0)) {
+			throw runtime_error("the planar layout cannot be combined with normalisation, a .pfm output, a state, window, preview or progressive stacking");
+		}
+		if (job.mappedOutput && (hasExtension(job.output, ".pfm") || !job.state.empty() || job.window != 0 || job.preview || job.progressive != 0)) {
+			//those write their outputs more than once, or as floats
+			throw runtime_error("a mapped output cannot be combined with a .pfm output, a state, window, preview or progressive stacking");
+		}
+		if (job.progressive != 0 && job.operation != "stack") {
+			throw runtime_error("only stack jobs can be progressive");
+		}
+		if (job.progressive != 0 && (job.useRoi || job.scaleMethod != 0 || !job.state.empty() || job.window != 0 || job.preview)) {
+			throw runtime_error("a progressive stack cannot be combined with a region of interest, scaling, a state, a window or a preview");
+		}
+		if (job.window != 0 && job.output.find('*') == string::npos) {
+			throw runtime_error("a rolling median writes one output per input, put * in the output where the input name goes");
+		}
+	}
+
+	/// <summary>
+	/// Run as a daemon, serving jobs from clients until asked to stop
+	/// Decoded frames are kept in a cache and the worker threads stay alive between jobs
+	/// </summary>
+	/// <param name="socketPath">socket to listen on</param>
+	/// <param name="cacheBytes">most bytes of decoded frames to keep</param>
+	/// <param name="results">cache of finished outputs, null for none</param>
+	/// <param name="report">stream for status messages</param>
+	/// <returns>process exit code</returns>
+	static int serveJobs(const string &socketPath, const unsigned long long &cacheBytes, ResultCache *results, ostream &report) {
+		FrameCache cache(cacheBytes);
+		atomic<unsigned long long> jobCount(0);
+		string error;
+		const bool served = JobServer::serve(socketPath, [&cache, &jobCount, results](const string &request, const JobServer::Reply &reply) {
+			return handleRequest(request, reply, cache, results, jobCount);
+		}, error, [&socketPath, &cacheBytes, &report] {
+			report << "Listening on " << socketPath << " with a " << bytesToAppropriate(cacheBytes).str() << " frame cache\n" << flush;
+		});
+		if (!served) {
+			report << "Error: " << error << "\n";
+			return kExitJobFailed;
+		}
+		waitForRefinements();
+		report << "Daemon stopped after " << jobCount << " jobs\n";
+		return kExitSuccess;
+	}
+
+	/// <summary>
+	/// Handle one request sent to the daemon: a job in manifest form, or a command such as {"command": "stats"}
+	/// </summary>
+	/// <param name="request">request line</param>
+	/// <param name="reply">sends the JSON reply line</param>
+	/// <param name="cache">the daemon's frame cache</param>
+	/// <param name="results">the daemon's cache of finished outputs, null for none</param>
+	/// <param name="jobCount">jobs run so far</param>
+	/// <returns>false if the daemon should stop</returns>
+	static bool handleRequest(const string &request, const JobServer::Reply &reply, FrameCache &cache, ResultCache *results, atomic<unsigned long long> &jobCount) {
+		BatchJob job;
+		try {
+			const JsonValue value = JsonValue::parse(request);
+			const JsonValue *command = value.find("command");
+			if (command != nullptr) {
+				if (command->isString() && command->text == "stop") {
+					reply("{\"ok\": true}");
+					return false;
+				}
+				if (command->isString() && command->text == "stats") {
+					reply("{\"ok\": true, \"jobs\": " + to_string(jobCount.load()) + cacheStatsJson(cache.getStats()) + "}");
+					return true;
+				}
+				throw runtime_error("unknown command, use stats or stop");
+			}
+			job = jobFromJson(value, jobCount + 1);
+		} catch (const exception &e) {
+			reply("{\"ok\": false, \"error\": \"" + jsonEscape(e.what()) + "\"}");
+			return true;
+		}
+
+		Timer timer;
+		timer.start();
+		string error;
+		const bool ok = runJob(job, error, &cache, results);
+		timer.stop();
+		jobCount++;
+		//the daemon never exits between jobs, so finished preview refinements are collected as it goes
+		reapRefinements();
+		JobReport result;
+		result.name = job.name;
+		result.started = true;
+		result.ok = ok;
+		result.error = error;
+		result.runSeconds = timer.getSeconds();
+		logJobReport(job, result);
+		ostringstream line;
+		line << "{\"name\": \"" << jsonEscape(job.name) << "\", \"ok\": " << (ok ? "true" : "false") << ", \"error\": \"" << jsonEscape(error)
+			<< "\", \"seconds\": " << result.runSeconds << cacheStatsJson(cache.getStats()) << "}";
+		reply(line.str());
+		return true;
+	}
+
+	/// <summary>
+	/// Format frame cache counters as JSON members, with a leading comma
+	/// </summary>
+	/// <param name="stats">counters to format</param>
+	/// <returns>JSON members</returns>
+	static string cacheStatsJson(const FrameCacheStats &stats) {
+		return ", \"cacheHits\": " + to_string(stats.hits) + ", \"cacheMisses\": " + to_string(stats.misses) + ", \"cacheBytes\": " + to_string(stats.bytes)
+			+ ", \"cacheCapacityBytes\": " + to_string(stats.capacityBytes) + ", \"cacheEntries\": " + to_string(stats.entries);
+	}
+
+	/// <summary>
+	/// Send jobs to a running daemon and report each result as it comes back
+	/// </summary>
+	/// <param name="socketPath">socket the daemon listens on</param>
+	/// <param name="jobs">validated jobs</param>
+	/// <param name="stopOnError">stop after the first failure</param>
+	/// <param name="report">stream for the results</param>
+	/// <returns>process exit code</returns>
+	static int submitJobs(const string &socketPath, const vector<BatchJob> &jobs, const bool &stopOnError, ostream &report) {
+		SocketConnection connection;
+		string error;
+		if (!connection.connectTo(socketPath, error)) {
+			report << "Error: " << error << "\n";
+			return kExitJobFailed;
+		}
+		size_t succeeded = 0;
+		for (const BatchJob &job : jobs) {
+			Timer timer;
+			timer.start();
+			string line;
+			if (!connection.sendLine(jobToJson(job)) || !connection.receiveLine(line)) {
+				report << "[failed] " << job.name << ": the daemon closed the connection\n";
+				break;
+			}
+			timer.stop();
+			bool ok = false;
+			try {
+				const JsonValue result = JsonValue::parse(line);
+				const JsonValue *okValue = result.find("ok");
+				ok = okValue != nullptr && okValue->boolean;
+				if (ok) {
+					report << "[ok] " << job.name << ": " << job.operation << " -> " << job.output << " in " << result.find("seconds")->number
+						<< "s (round trip " << timer.getSeconds() << "s, daemon frame cache so far " << result.find("cacheHits")->number << " hits, "
+						<< result.find("cacheMisses")->number << " misses)\n";
+				} else {
+					const JsonValue *reason = result.find("error");
+					report << "[failed] " << job.name << ": " << (reason != nullptr ? reason->text : "unknown error") << "\n";
+				}
+			} catch (const exception &e) {
+				report << "[failed] " << job.name << ": bad reply from the daemon, " << e.what() << "\n";
+			}
+			succeeded += ok ? 1 : 0;
+			if (!ok && stopOnError) {
+				break;
+			}
+		}
+		report << succeeded << " of " << jobs.size() << " jobs succeeded\n";
+		return succeeded == jobs.size() ? kExitSuccess : kExitJobFailed;
+	}
+
+	/// <summary>
+	/// Send a command to a running daemon and show its reply
+	/// </summary>
+	/// <param name="socketPath">socket the daemon listens on</param>
+	/// <param name="command">stats or stop</param>
+	/// <param name="report">stream for the reply</param>
+	/// <returns>process exit code</returns>
+	static int sendCommand(const string &socketPath, const string &command, ostream &report) {
+		SocketConnection connection;
+		string error, line;
+		if (!connection.connectTo(socketPath, error)) {
+			report << "Error: " << error << "\n";
+			return kExitJobFailed;
+		}
+		if (!connection.sendLine("{\"command\": \"" + command + "\"}") || !connection.receiveLine(line)) {
+			report << "Error: the daemon closed the connection\n";
+			return kExitJobFailed;
+		}
+		report << line << "\n";
+		return kExitSuccess;
+	}
+
+	/// <summary>
+	/// Describe a job in manifest form, with absolute paths so the daemon finds the same files
+	/// </summary>
+	/// <param name="job">job to describe</param>
+	/// <returns>one line of JSON</returns>
+	static string jobToJson(const BatchJob &job) {
+		ostringstream json;
+		json << "{\"name\": \"" << jsonEscape(job.name) << "\", \"operation\": \"" << jsonEscape(job.operation) << "\", \"method\": " << job.method << ", \"input\": [";
+		for (size_t i = 0; i < job.inputs.size(); i++) {
+			json << (i == 0 ? "" : ", ") << "\"" << jsonEscape(absolutePath(job.inputs[i])) << "\"";
+		}
+		json << "], \"output\": \"" << jsonEscape(absolutePath(job.output)) << "\"";
+		if (job.scale > 0) {
+			json << ", \"scale\": " << setprecision(17) << job.scale;
+		}
+		if (job.scaleMethod != 0) {
+			json << ", \"scaleMethod\": \"" << job.scaleMethod << "\"";
+		}
+		if (job.useRoi) {
+			json << ", \"roi\": [" << job.roiLeft << ", " << job.roiTop << ", " << job.roiWidth << ", " << job.roiHeight << "]";
+		}
+		if (!job.state.empty()) {
+			json << ", \"state\": \"" << jsonEscape(absolutePath(job.state)) << "\"";
+		}
+		if (job.window != 0) {
+			json << ", \"window\": " << job.window;
+		}
+		if (job.preview) {
+			json << ", \"preview\": true";
+		}
+		if (job.progressive != 0) {
+			json << ", \"progressive\": " << job.progressive;
+		}
+		if (job.align) {
+			json << ", \"align\": true";
+		}
+		if (job.normalise) {
+			json << ", \"normalise\": true";
+		}
+		if (job.planar) {
+			json << ", \"layout\": \"planar\"";
+		}
+		if (job.mappedOutput) {
+			json << ", \"mappedOutput\": true";
+		}
+		if (!job.dark.empty()) {
+			json << ", \"dark\": \"" << jsonEscape(absolutePath(job.dark)) << "\"";
+		}
+		if (!job.flat.empty()) {
+			json << ", \"flat\": \"" << jsonEscape(absolutePath(job.flat)) << "\"";
+		}
+		json << "}";
+		return json.str();
+	}
+
+	/// <summary>
+	/// Log the outcome of a job
+	/// </summary>
+	/// <param name="job">job that finished</param>
+	/// <param name="result">its report</param>
+	static void logJobReport(const BatchJob &job, const JobReport &result) {
+		LogRecord record(result.ok ? LogLevel::Info : LogLevel::Error, "Batch Job", result.ok ? "" : result.error);
+		record.add("Job", "job", job.name).add("Operation", "operation", job.operation).add("Output", "output", job.output)
+			.addBytes("Estimated Memory", "estimatedBytes", result.estimatedBytes)
+			.addNumber("Queued Seconds", "queuedSeconds", result.queuedSeconds).addNumber("Run Seconds", "runSeconds", result.runSeconds);
+		Logger::instance().log(std::move(record));
+	}
+
+	/// <summary>
+	/// Write batch throughput and job latency
+	/// </summary>
+	/// <param name="out">stream to write to</param>
+	/// <param name="reports">reports of every job</param>
+	/// <param name="jobs">the scheduled jobs</param>
+	/// <param name="wallSeconds">time taken by the whole batch</param>
+	static void writeSummary(ostream &out, const vector<JobReport> &reports, const vector<ScheduledJob> &jobs, const double &wallSeconds) {
+		vector<double> latencies;
+		double pixels = 0;
+		for (const JobReport &result : reports) {
+			if (result.started) {
+				latencies.push_back(result.latencySeconds());
+				pixels += (double)jobs[result.index].inputPixels;
+			}
+		}
+		if (latencies.empty() || wallSeconds <= 0) {
+			return;
+		}
+		sort(latencies.begin(), latencies.end());
+		out << "Batch took " << wallSeconds << "s: " << latencies.size() / wallSeconds << " jobs/s, "
+			<< pixels / 1e6 / wallSeconds << " input megapixels/s\n";
+		out << "Job latency: median " << latencies[(latencies.size() - 1) / 2] << "s, p95 "
+			<< latencies[(size_t)ceil(0.95 * latencies.size()) - 1] << "s, max " << latencies.back() << "s\n";
+	}
+
+	/// <summary>
+	/// Write every job's timings and the batch throughput as JSON
+	/// </summary>
+	/// <param name="path">file to write</param>
+	/// <param name="reports">reports of every job</param>
+	/// <param name="jobs">the scheduled jobs</param>
+	/// <param name="wallSeconds">time taken by the whole batch</param>
+	/// <param name="concurrentJobs">job concurrency limit</param>
+	/// <param name="memoryBudget">memory budget in bytes</param>
+	static void writeReport(const string &path, const vector<JobReport> &reports, const vector<ScheduledJob> &jobs, const double &wallSeconds,
+		const unsigned int &concurrentJobs, const unsigned long long &memoryBudget) {
+		ofstream out(path, ios::trunc);
+		out << "{\n  \"concurrentJobs\": " << concurrentJobs << ",\n  \"memoryBudgetBytes\": " << memoryBudget
+			<< ",\n  \"wallSeconds\": " << wallSeconds << ",\n  \"jobs\": [";
+		for (size_t i = 0; i < reports.size(); i++) {
+			const JobReport &result = reports[i];
+			out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << jsonEscape(result.name) << "\", \"started\": " << (result.started ? "true" : "false")
+				<< ", \"ok\": " << (result.ok ? "true" : "false") << ", \"error\": \"" << jsonEscape(result.error)
+				<< "\", \"estimatedBytes\": " << result.estimatedBytes << ", \"overBudget\": " << (result.overBudget ? "true" : "false")
+				<< ", \"inputPixels\": " << jobs[i].inputPixels << ", \"queuedSeconds\": " << result.queuedSeconds
+				<< ", \"runSeconds\": " << result.runSeconds << ", \"latencySeconds\": " << result.latencySeconds() << "}";
+		}
+		out << "\n  ]\n}\n";
+	}
+
+	/// <summary>
+	/// Write the command line help
+	/// </summary>
+	/// <param name="out">stream to write to</param>
+	static void printUsage(ostream &out) {
+		out << "Usage:\n"
+			<< "  stack --method <mean|median|sigma|median-serial|sigma-serial> --input <path or pattern>... [--roi left,top,width,height]\n"
+			<< "        [--scale-method <nearest|bilinear|bicubic>[-serial] --scale <factor>] [--state <file>] [--window K] [--preview] [--progressive F] [--align] [--normalise] [--mapped-output] [--dark <file.ppm>] [--flat <file.ppm>] --output <file.ppm>\n"
+			<< "  scale --method <nearest|bilinear|bicubic>[-serial] --scale <factor> [--roi left,top,width,height] --input <file.ppm> --output <file.ppm>\n"
+			<< "  --manifest <jobs.json> [--stop-on-error] [--jobs N] [--memory-budget SIZE] [--report report.json]\n"
+			<< "  serve [--socket <path>] [--cache-size SIZE]   run as a daemon that keeps decoded frames between jobs\n"
+			<< "  stats|stop [--socket <path>]                  show the daemon's cache counters, or stop it\n"
+			<< "Options:\n"
+			<< "  --input may be repeated, and its file name may contain * and ? (e.g. \"Images/ImageStacker_set1/*.ppm\")\n"
+			<< "  inputs may be ppm or greyscale pgm; greyscale sets, and colour ones with equal channels, are processed as\n"
+			<< "                         monochrome at a third of the cost, and an output ending in .pgm is then written as greyscale\n"
+			<< "  an output ending in .pfm is written as a float map, the blend kept unrounded; float map inputs need one\n"
+			<< "  --state <file>         add the inputs to the stack saved in the file (created if missing), save it and write the result\n"
+			<< "  --window K             median only, write the median of the last K inputs for every input; * in the output\n"
+			<< "                         is replaced by the input's name, e.g. --output \"background/*.ppm\"\n"
+			<< "  --preview              median only, write a fast preview within " << ApproximateMedian::kErrorBound << " levels first, then the exact median\n"
+			<< "  --progressive F        write a stack of the frames shrunk F times first (2 to 16), then refine it to full\n"
+			<< "                         resolution a row of " << ProgressiveStack::kTileSize << " pixel tiles at a time, rewriting the output each step\n"
+			<< "  --align                line the frames up with the first before stacking, the result covers the area they share\n"
+			<< "  --normalise            scale each frame so its per channel median matches the set's, for sets whose exposure drifts\n"
+			<< "  --layout <interleaved|planar>  keep 8-bit frames as r, g, b pixels (default) or as a 64 byte aligned plane\n"
+			<< "                         per channel while stacking and scaling, converting once after reading and before writing\n"
+			<< "  --mapped-output        create the output file at its final size and map it, so the last stack or scale writes\n"
+			<< "                         its pixels straight into the file; 8-bit .ppm and greyscale .pgm outputs, others are written normally\n"
+			<< "  --dark/--flat <file>   subtract a master dark and divide by a master flat as each input is read, e.g. median\n"
+			<< "                         stacks of dark and flat frames; scale jobs can be calibrated too. Flat gains are limited\n"
+			<< "                         to 16x, so samples darker than 1/16 of the flat's mean are under-corrected (logged as a warning)\n"
+			<< "  --jobs N               run up to N jobs at once, sharing the worker threads (default 1)\n"
+			<< "  --memory-budget SIZE   total estimated memory of running jobs, e.g. 8G (default half the physical memory)\n"
+			<< "  --report <path>        write per job latency and batch throughput as JSON\n"
+			<< "  --result-cache <dir>   reuse earlier outputs of the same operation on the same input contents\n"
+			<< "  --result-cache-size SIZE  most space the result cache may use (default 4G)\n"
+			<< "  --connect              send the jobs to the daemon instead of running them here\n"
+			<< "  --socket <path>        daemon socket, default " << kDefaultSocket << " in the working directory\n"
+			<< "  --cache-size SIZE      decoded frames the daemon keeps, e.g. 2G (default a quarter of the physical memory)\n"
+			<< "  --quiet                hide progress messages, only report each job\n"
+			<< "  --log-level <level>    debug, details, info (default), warning, error or off\n"
+			<< "  --log-file <path>      text log, default DetailsLog.txt\n"
+			<< "  --log-json <path>      also write the log as JSON lines\n"
+			<< "Exit codes: 0 all jobs succeeded, 1 a job failed, 2 bad arguments or manifest\n"
+			<< "Run without arguments for the interactive menu\n";
+	}
+
+private:
+	/// <summary>
+	/// Refinements of preview jobs still running
+	/// </summary>
+	static vector<future<bool>>& refinements() {
+		static vector<future<bool>> pending;
+		return pending;
+	}
+
+	static mutex& refinementLock() {
+		static mutex lock;
+		return lock;
+	}
+
+	/// <summary>
+	/// Check a progressive downscale factor
+	/// </summary>
+	static unsigned int parseProgressiveFactor(const double &value) {
+		if (value < 2 || value > 16 || value != floor(value)) {
+			throw runtime_error("the progressive factor must be a whole number from 2 to 16");
+		}
+		return (unsigned int)value;
+	}
+
+	/// <summary>
+	/// Read a layout name
+	/// </summary>
+	/// <returns>true for planar, false for interleaved</returns>
+	static bool parseLayout(const string &name) {
+		if (name != "planar" && name != "interleaved") {
+			throw runtime_error("the layout must be interleaved or planar");
+		}
+		return name == "planar";
+	}
+
+	/// <summary>
+	/// Take the value following an option
+	/// </summary>
+	static string optionValue(const vector<string> &args, size_t &i) {
+		if (i + 1 >= args.size()) {
+			throw runtime_error(args[i] + " needs a value");
+		}
+		return args[++i];
+	}
+
+	/// <summary>
+	/// Parse a number, throwing if it is not one
+	/// </summary>
+	static double parseNumber(const string &text, const string &what) {
+		char *end = nullptr;
+		const double value = strtod(text.c_str(), &end);
+		if (text.empty() || *end != '\0') {
+			throw runtime_error(what + " must be a number");
+		}
+		return value;
+	}
+
+	/// <summary>
+	/// Parse a size such as 512M or 8G into bytes
+	/// </summary>
+	static unsigned long long parseByteSize(const string &text, const string &option) {
+		if (text.empty()) {
+			throw runtime_error(option + " needs a size");
+		}
+		const char unit = (char)toupper((unsigned char)text.back());
+		const string number = isalpha((unsigned char)unit) ? text.substr(0, text.size() - 1) : text;
+		const double value = parseNumber(number, option);
+		const double multiplier = unit == 'K' ? 1024.0 : unit == 'M' ? 1024.0 * 1024 : unit == 'G' ? 1024.0 * 1024 * 1024 : unit == 'T' ? 1024.0 * 1024 * 1024 * 1024 : 1.0;
+		if (isalpha((unsigned char)unit) && multiplier == 1.0) {
+			throw runtime_error(option + " unit must be K, M, G or T");
+		}
+		if (value <= 0) {
+			throw runtime_error(option + " must be above 0");
+		}
+		return (unsigned long long)(value * multiplier);
+	}
+
+	/// <summary>
+	/// Parse left,top,width,height into a job
+	/// </summary>
+	static void parseRoi(const string &text, BatchJob &job) {
+		unsigned int *fields[] = { &job.roiLeft, &job.roiTop, &job.roiWidth, &job.roiHeight };
+		stringstream parts(text);
+		string part;
+		size_t count = 0;
+		while (getline(parts, part, ',')) {
+			if (count == 4) {
+				break;
+			}
+			const double value = parseNumber(part, "--roi");
+			if (value < 0 || value > numeric_limits<unsigned int>::max()) {
+				throw runtime_error("--roi values must be from 0 to " + to_string(numeric_limits<unsigned int>::max()));
+			}
+			*fields[count++] = (unsigned int)value;
+		}
+		if (count != 4 || getline(parts, part, ',')) {
+			throw runtime_error("--roi must be left,top,width,height");
+		}
+		job.useRoi = true;
+	}
+
+	/// <summary>
+	/// Resolve a method name for an operation
+	/// </summary>
+	static unsigned int parseMethod(const string &operation, const string &name) {
+		if (operation == "stack") {
+			return parseStackingMethod(name);
+		}
+		if (operation == "scale") {
+			return parseScalingMethod(name);
+		}
+		return 0;
+	}
+
+	/// <summary>
+	/// Get a string member of a job object, throwing if it is missing
+	/// </summary>
+	static string stringMember(const JsonValue &value, const string &key) {
+		const JsonValue *member = value.find(key);
+		if (member == nullptr || !member->isString()) {
+			throw runtime_error(key + " must be a string");
+		}
+		return member->text;
+	}
+};
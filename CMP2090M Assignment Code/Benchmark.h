@@ -0,0 +1,359 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <ctime>
+#include <memory>
+#include "Timer.h"
+#include "Utils.h"
+#include "PerfCounters.h"
+#include "MemoryTracker.h"
+#include "BufferPool.h"
+
+using namespace std;
+
+/// <summary>
+/// Timings and summary statistics for one measured benchmark case
+/// </summary>
+struct BenchmarkResult {
+	string suite; // group the case belongs to, e.g. Scaler
+	string name; // algorithm or operation name
+	string phase; // read, convert, compute or write
+	string params; // free form parameters, e.g. scale=2
+	unsigned int warmup = 0;
+	vector<double> wallSeconds; // one entry per measured iteration
+	vector<double> cpuSeconds; // one entry per measured iteration
+	double median = 0.0, p95 = 0.0, min = 0.0, max = 0.0, mean = 0.0, stdDev = 0.0;
+	double cpuMedian = 0.0;
+	map<string, double> metrics; // extra named values reported alongside the timings
+};
+
+/// <summary>
+/// Benchmark harness
+/// Runs each case for a number of untimed warmup iterations followed by timed iterations,
+/// and reports wall clock and CPU time statistics for every case.
+/// Setup and teardown run outside the timed region so I/O can be kept out of compute timings.
+/// </summary>
+class Benchmark {
+private:
+	unsigned int warmupIterations;
+	unsigned int measuredIterations;
+	time_t startTime;
+	vector<BenchmarkResult> results;
+	bool usePerfCounters = false;
+	string perfStatus = "disabled";
+
+	/// <summary>
+	/// Nearest rank percentile of sorted values
+	/// </summary>
+	/// <param name="sorted">values in ascending order</param>
+	/// <param name="percentile">percentile between 0 and 100</param>
+	/// <returns>value at the percentile</returns>
+	static double percentileOf(const vector<double> &sorted, const double &percentile) {
+		if (sorted.empty()) {
+			return 0.0;
+		}
+		size_t rank = (size_t)ceil((percentile / 100.0) * sorted.size());
+		rank = std::max((size_t)1, std::min(rank, sorted.size()));
+		return sorted[rank - 1];
+	}
+
+	/// <summary>
+	/// Fill in the summary statistics of a result from its samples
+	/// </summary>
+	/// <param name="result">result to summarise</param>
+	static void summarise(BenchmarkResult &result) {
+		vector<double> sorted = result.wallSeconds;
+		sort(sorted.begin(), sorted.end());
+		vector<double> sortedCpu = result.cpuSeconds;
+		sort(sortedCpu.begin(), sortedCpu.end());
+		if (sorted.empty()) {
+			return;
+		}
+		result.median = percentileOf(sorted, 50);
+		result.p95 = percentileOf(sorted, 95);
+		result.min = sorted.front();
+		result.max = sorted.back();
+		double sum = 0.0;
+		for (const double &s : sorted) {
+			sum += s;
+		}
+		result.mean = sum / sorted.size();
+		double variance = 0.0;
+		for (const double &s : sorted) {
+			variance += (s - result.mean) * (s - result.mean);
+		}
+		result.stdDev = sqrt(variance / sorted.size());
+		result.cpuMedian = percentileOf(sortedCpu, 50);
+	}
+
+	/// <summary>
+	/// Add per iteration counter averages and derived ratios to a result
+	/// </summary>
+	/// <param name="result">result to add metrics to</param>
+	/// <param name="totals">counter totals over the measured iterations</param>
+	/// <param name="outputPixels">pixels produced by one iteration</param>
+	static void addPerfMetrics(BenchmarkResult &result, const PerfReading &totals, const double &outputPixels) {
+		const double n = (double)result.wallSeconds.size();
+		result.metrics["cycles"] = totals.cycles / n;
+		result.metrics["instructions"] = totals.instructions / n;
+		result.metrics["ipc"] = totals.instructions / totals.cycles;
+		if (totals.branches > 0) {
+			result.metrics["branchMissRate"] = totals.branchMisses / totals.branches;
+		}
+		if (outputPixels > 0) {
+			result.metrics["llcMissesPerPixel"] = totals.llcMisses / n / outputPixels;
+		}
+	}
+
+public:
+	/// <summary>
+	/// Create a benchmark harness
+	/// </summary>
+	/// <param name="_warmup">untimed iterations to run before measuring each case</param>
+	/// <param name="_iterations">timed iterations for each case</param>
+	Benchmark(const unsigned int &_warmup = 1, const unsigned int &_iterations = 5) : warmupIterations(_warmup), measuredIterations(std::max(1u, _iterations)) {
+		startTime = time(&startTime);
+	}
+
+	/// <summary>
+	/// Record hardware performance counters around every timed region
+	/// If the counters cannot be opened the timings are still recorded and the reports say why
+	/// </summary>
+	/// <param name="enable">true to record counters</param>
+	void enablePerfCounters(const bool &enable) {
+		usePerfCounters = enable;
+		perfStatus = enable ? "enabled" : "disabled";
+	}
+
+	/// <summary>
+	/// Measure a case
+	/// </summary>
+	/// <param name="suite">group the case belongs to</param>
+	/// <param name="name">name of the case</param>
+	/// <param name="phase">read, convert, compute or write</param>
+	/// <param name="params">parameters of the case</param>
+	/// <param name="setup">run before every iteration, not timed</param>
+	/// <param name="body">the timed region</param>
+	/// <param name="teardown">run after every iteration, not timed</param>
+	/// <param name="outputPixels">pixels produced by one iteration, used to report cache misses per pixel</param>
+	/// <returns>index of the recorded result, for getResult() so callers can attach extra metrics</returns>
+	size_t measure(const string &suite, const string &name, const string &phase, const string &params,
+		const function<void()> &setup, const function<void()> &body, const function<void()> &teardown, const double &outputPixels = 0) {
+		BenchmarkResult result;
+		result.suite = suite;
+		result.name = name;
+		result.phase = phase;
+		result.params = params;
+		result.warmup = warmupIterations;
+		Timer timer;
+		//counters are opened per case so threads started since the last case are included
+		unique_ptr<PerfCounters> counters;
+		if (usePerfCounters) {
+			counters.reset(new PerfCounters());
+			if (!counters->isAvailable()) {
+				perfStatus = "unavailable: " + counters->unavailableReason();
+				counters.reset();
+			}
+		}
+		PerfReading totals;
+		MemoryUsage peakMemory;
+		BufferPoolStatistics poolBefore;
+		for (unsigned int i = 0; i < warmupIterations + measuredIterations; i++) {
+			//buffers released by the warmup iterations are reused by the measured ones, as between jobs
+			if (i == warmupIterations) {
+				poolBefore = BufferPool::instance().statistics();
+			}
+			setup();
+			MemoryScope memory;
+			if (counters) {
+				counters->start();
+			}
+			timer.start();
+			body();
+			timer.stop();
+			PerfReading reading;
+			if (counters) {
+				reading = counters->stop();
+			}
+			const MemoryUsage usage = memory.finish();
+			teardown();
+			//only keep timings once the warmup iterations are done
+			if (i >= warmupIterations) {
+				result.wallSeconds.push_back(timer.getSeconds());
+				result.cpuSeconds.push_back(timer.getCpuSeconds());
+				totals.cycles += reading.cycles;
+				totals.instructions += reading.instructions;
+				totals.llcMisses += reading.llcMisses;
+				totals.branches += reading.branches;
+				totals.branchMisses += reading.branchMisses;
+				//keep the worst iteration, which is what has to fit in memory
+				peakMemory.trackedPeakBytes = std::max(peakMemory.trackedPeakBytes, usage.trackedPeakBytes);
+				peakMemory.trackedStartBytes = std::max(peakMemory.trackedStartBytes, usage.trackedStartBytes);
+				peakMemory.residentPeakBytes = std::max(peakMemory.residentPeakBytes, usage.residentPeakBytes);
+			}
+		}
+		summarise(result);
+		result.metrics["peakTrackedBytes"] = (double)peakMemory.trackedPeakBytes;
+		result.metrics["peakTrackedExtraBytes"] = (double)peakMemory.trackedExtraBytes();
+		if (peakMemory.residentPeakBytes > 0) {
+			result.metrics["peakResidentBytes"] = (double)peakMemory.residentPeakBytes;
+		}
+		const BufferPoolStatistics poolAfter = BufferPool::instance().statistics();
+		const double poolRequests = (double)(poolAfter.hits - poolBefore.hits + poolAfter.misses - poolBefore.misses);
+		if (poolRequests > 0) {
+			result.metrics["poolHitRate"] = (poolAfter.hits - poolBefore.hits) / poolRequests;
+		}
+		if (counters && totals.cycles > 0) {
+			addPerfMetrics(result, totals, outputPixels);
+		}
+		results.push_back(result);
+		return results.size() - 1;
+	}
+
+	/// <summary>
+	/// Measure a case that needs no setup or teardown
+	/// </summary>
+	/// <param name="suite">group the case belongs to</param>
+	/// <param name="name">name of the case</param>
+	/// <param name="phase">read, convert, compute or write</param>
+	/// <param name="params">parameters of the case</param>
+	/// <param name="body">the timed region</param>
+	/// <returns>index of the recorded result</returns>
+	size_t measure(const string &suite, const string &name, const string &phase, const string &params, const function<void()> &body) {
+		return measure(suite, name, phase, params, [] {}, body, [] {}, 0);
+	}
+
+	/// <summary>
+	/// Record a case that could not be run, so it is still visible in the reports
+	/// </summary>
+	/// <param name="suite">group the case belongs to</param>
+	/// <param name="name">name of the case</param>
+	/// <param name="reason">why it was skipped</param>
+	void skip(const string &suite, const string &name, const string &reason) {
+		BenchmarkResult result;
+		result.suite = suite;
+		result.name = name;
+		result.phase = "skipped";
+		result.params = reason;
+		results.push_back(result);
+	}
+
+	/// <summary>
+	/// Get a recorded result
+	/// The reference is only valid until the next case is measured or skipped, which may move the results
+	/// </summary>
+	/// <param name="index">index returned by measure()</param>
+	/// <returns>the result</returns>
+	BenchmarkResult& getResult(const size_t &index) {
+		return results.at(index);
+	}
+
+	/// <summary>
+	/// Get all results recorded so far
+	/// </summary>
+	/// <returns>recorded results in the order they were measured</returns>
+	const vector<BenchmarkResult>& getResults() const {
+		return results;
+	}
+
+	/// <summary>
+	/// Append human readable results to a text file
+	/// </summary>
+	/// <param name="path">file to append to</param>
+	void writeText(const char *path = "Benchmark.txt") const {
+		ofstream logFile;
+		logFile.open(path, ios::app);
+		string start(ctime(&startTime));
+		logFile << "Starting Benchmark: " << start;
+		logFile << "Wall clock (steady clock) seconds, " << warmupIterations << " warmup + " << measuredIterations << " measured iterations, "
+			<< thread::hardware_concurrency() << " hardware threads\n";
+		logFile << "Read/write phases are timed separately from compute\n";
+		logFile << "Hardware counters: " << perfStatus << "\n";
+		string lastGroup;
+		logFile << fixed << setprecision(4);
+		for (const BenchmarkResult &r : results) {
+			const string group = r.suite + (r.params.empty() || r.phase == "skipped" ? "" : " (" + r.params + ")");
+			if (group != lastGroup) {
+				logFile << "\n" << group << ":";
+				lastGroup = group;
+			}
+			if (r.phase == "skipped") {
+				logFile << "\n\t" << r.name << ": skipped - " << r.params;
+				continue;
+			}
+			logFile << "\n\t[" << r.phase << "] " << r.name << ": median " << r.median << "s, p95 " << r.p95
+				<< "s, min " << r.min << "s, max " << r.max << "s, stddev " << r.stdDev << "s";
+			//CPU time over wall time shows how many cores were kept busy
+			if (r.median > 0) {
+				logFile << ", cpu/wall " << setprecision(2) << r.cpuMedian / r.median << setprecision(4);
+			}
+			for (const auto &metric : r.metrics) {
+				logFile << ", " << metric.first << " " << metric.second;
+			}
+		}
+		logFile << "\n\n";
+		logFile.close();
+	}
+
+	/// <summary>
+	/// Write machine readable results to a JSON file, replacing any previous run
+	/// </summary>
+	/// <param name="path">file to write</param>
+	void writeJson(const char *path = "Benchmark.json") const {
+		ofstream out;
+		out.open(path, ios::trunc);
+		out << setprecision(9);
+		out << "{\n";
+		out << "  \"startTime\": " << (long long)startTime << ",\n";
+		out << "  \"clock\": \"steady_clock\",\n";
+		out << "  \"hardwareThreads\": " << thread::hardware_concurrency() << ",\n";
+		out << "  \"warmupIterations\": " << warmupIterations << ",\n";
+		out << "  \"measuredIterations\": " << measuredIterations << ",\n";
+		out << "  \"perfCounters\": \"" << jsonEscape(perfStatus) << "\",\n";
+		out << "  \"results\": [";
+		for (size_t i = 0; i < results.size(); i++) {
+			const BenchmarkResult &r = results[i];
+			out << (i == 0 ? "\n" : ",\n");
+			out << "    {\"suite\": \"" << jsonEscape(r.suite) << "\", \"name\": \"" << jsonEscape(r.name)
+				<< "\", \"phase\": \"" << jsonEscape(r.phase) << "\", \"params\": \"" << jsonEscape(r.params) << "\"";
+			if (r.phase != "skipped") {
+				out << ", \"warmup\": " << r.warmup;
+				const pair<const char*, double> statistics[] = { { "median", r.median }, { "p95", r.p95 }, { "min", r.min }, { "max", r.max },
+					{ "mean", r.mean }, { "stdDev", r.stdDev }, { "cpuMedian", r.cpuMedian } };
+				for (const auto &statistic : statistics) {
+					out << ", \"" << statistic.first << "\": ";
+					writeJsonNumber(out, statistic.second);
+				}
+				out << ", \"wallSeconds\": [";
+				for (size_t s = 0; s < r.wallSeconds.size(); s++) {
+					out << (s == 0 ? "" : ", ");
+					writeJsonNumber(out, r.wallSeconds[s]);
+				}
+				out << "], \"cpuSeconds\": [";
+				for (size_t s = 0; s < r.cpuSeconds.size(); s++) {
+					out << (s == 0 ? "" : ", ");
+					writeJsonNumber(out, r.cpuSeconds[s]);
+				}
+				out << "], \"metrics\": {";
+				bool first = true;
+				for (const auto &metric : r.metrics) {
+					//a ratio of zero counts, e.g. ipc without cycles, is written as null
+					out << (first ? "" : ", ") << "\"" << jsonEscape(metric.first) << "\": ";
+					writeJsonNumber(out, metric.second);
+					first = false;
+				}
+				out << "}";
+			}
+			out << "}";
+		}
+		out << "\n  ]\n}\n";
+		out.close();
+	}
+};
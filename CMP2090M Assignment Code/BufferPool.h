@@ -0,0 +1,253 @@
+#pragma once
+//*********************************************
+//Pool of image and scratch buffers, kept in size classes and handed out again instead of being freed
+//A job, or a benchmark iteration, that needs the same sizes as the last one gets its buffers back
+//without asking the operating system for fresh pages, which it would zero and fault in one at a time.
+//Buffers of a couple of megabytes or more are allocated on huge page boundaries and marked for
+//transparent huge pages, so a frame is covered by a few TLB entries instead of thousands
+//*********************************************
+
+#include <cstddef>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "MemoryTracker.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+/// <summary>
+/// Counters of the buffer pool
+/// </summary>
+struct BufferPoolStatistics {
+	unsigned long long hits = 0; // buffers handed out from the pool
+	unsigned long long misses = 0; // buffers allocated from the operating system
+	unsigned long long retainedBytes = 0; // bytes of free buffers kept for reuse
+	unsigned long long hugePageBuffers = 0; // buffers allocated for transparent huge pages
+};
+
+/// <summary>
+/// Process wide pool of aligned buffers
+/// Every buffer starts on a cache line, and its contents are whatever the last user left there
+/// </summary>
+class BufferPool {
+public:
+	//alignment of every buffer
+	static const size_t kAlignment = 64;
+	//buffers of at least this size go on huge page boundaries, the size of an x86 huge page
+	static const size_t kHugePageBytes = 2 * 1024 * 1024;
+
+	/// <summary>
+	/// Get the pool
+	/// It is never destroyed, so images in static storage can still give their buffers back at exit
+	/// </summary>
+	static BufferPool& instance() {
+		static BufferPool *pool = new BufferPool();
+		return *pool;
+	}
+
+	/// <summary>
+	/// Take a tracked buffer from the pool, or allocate one if none of its size class is free
+	/// </summary>
+	/// <param name="bytes">size needed</param>
+	/// <returns>uninitialised storage aligned to kAlignment, give it back with releaseBytes()</returns>
+	unsigned char* acquireBytes(const size_t &bytes) {
+		const size_t size = classBytes(bytes);
+		unsigned char *block = nullptr;
+		{
+			lock_guard<mutex> lock(guard);
+			vector<unsigned char*> &available = freeBlocks[size];
+			if (!available.empty()) {
+				block = available.back();
+				available.pop_back();
+				retained -= size;
+				counters.hits++;
+			} else {
+				counters.misses++;
+			}
+		}
+		if (block == nullptr) {
+			block = allocateBlock(size);
+		}
+		MemoryTracker::recordAllocation(bytes);
+		return block + kAlignment;
+	}
+
+	/// <summary>
+	/// Give a buffer back to the pool, or to the operating system once the pool holds as much as it may keep
+	/// </summary>
+	/// <param name="data">buffer from acquireBytes(), may be null</param>
+	/// <param name="bytes">size it was acquired with, as recorded by the memory tracker</param>
+	void releaseBytes(unsigned char *data, const size_t &bytes) {
+		if (data == nullptr) {
+			return;
+		}
+		MemoryTracker::recordRelease(bytes);
+		unsigned char *block = data - kAlignment;
+		//the size class is kept in front of the buffer, a caller may have recorded part of it as released already
+		const size_t size = *reinterpret_cast<size_t*>(block);
+		{
+			lock_guard<mutex> lock(guard);
+			if (retained + size <= retainLimit) {
+				freeBlocks[size].push_back(block);
+				retained += size;
+				return;
+			}
+		}
+		freeBlock(block);
+	}
+
+	/// <summary>
+	/// Take a tracked array of elements from the pool, the elements are not constructed
+	/// </summary>
+	/// <param name="count">number of elements</param>
+	/// <returns>uninitialised array, give it back with release()</returns>
+	template <typename T>
+	static T* acquire(const size_t &count) {
+		if (count > numeric_limits<size_t>::max() / sizeof(T) - kHugePageBytes) {
+			throw bad_alloc();
+		}
+		return reinterpret_cast<T*>(instance().acquireBytes(count * sizeof(T)));
+	}
+
+	/// <summary>
+	/// Give an array from acquire() back to the pool
+	/// </summary>
+	/// <param name="data">array to release, may be null</param>
+	/// <param name="count">number of elements it was acquired with</param>
+	template <typename T>
+	static void release(T *data, const size_t &count) {
+		instance().releaseBytes(reinterpret_cast<unsigned char*>(data), count * sizeof(T));
+	}
+
+	/// <summary>
+	/// Set the most bytes of free buffers the pool keeps, freeing buffers above it
+	/// </summary>
+	/// <param name="bytes">limit, 0 to keep none</param>
+	void setRetainLimit(const unsigned long long &bytes) {
+		lock_guard<mutex> lock(guard);
+		retainLimit = bytes;
+		releaseAbove(retainLimit);
+	}
+
+	/// <summary>
+	/// Free every buffer the pool holds, e.g. before measuring a cold start
+	/// </summary>
+	void trim() {
+		lock_guard<mutex> lock(guard);
+		releaseAbove(0);
+	}
+
+	/// <summary>
+	/// Get the counters of the pool
+	/// </summary>
+	BufferPoolStatistics statistics() {
+		lock_guard<mutex> lock(guard);
+		BufferPoolStatistics current = counters;
+		current.retainedBytes = retained;
+		return current;
+	}
+
+	/// <summary>
+	/// Get the size class a request falls in
+	/// Four classes per power of two, so a buffer is never more than a quarter larger than it needs to be
+	/// </summary>
+	/// <param name="bytes">size needed</param>
+	/// <returns>bytes of the class</returns>
+	static size_t classBytes(const size_t &bytes) {
+		if (bytes <= kAlignment) {
+			return kAlignment;
+		}
+		size_t power = kAlignment;
+		while (power < bytes) {
+			power *= 2;
+		}
+		const size_t step = power / 8;
+		return (bytes + step - 1) / step * step;
+	}
+
+private:
+	mutex guard;
+	map<size_t, vector<unsigned char*>> freeBlocks; // free buffers of each size class, including their headers
+	unsigned long long retained = 0;
+	unsigned long long retainLimit;
+	BufferPoolStatistics counters;
+
+	/// <summary>
+	/// Keep up to an eighth of the machine's memory, or 1GB if it is unknown
+	/// </summary>
+	BufferPool() {
+		const unsigned long long physical = MemoryTracker::physicalMemoryBytes();
+		retainLimit = physical > 0 ? physical / 8 : 1ULL << 30;
+	}
+
+	/// <summary>
+	/// Free buffers until the pool holds no more than a number of bytes, largest classes first
+	/// </summary>
+	void releaseAbove(const unsigned long long &limit) {
+		for (auto it = freeBlocks.rbegin(); it != freeBlocks.rend() && retained > limit; ++it) {
+			while (!it->second.empty() && retained > limit) {
+				freeBlock(it->second.back());
+				it->second.pop_back();
+				retained -= it->first;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Allocate a buffer of a size class from the operating system, with a cache line in front for its header
+	/// </summary>
+	unsigned char* allocateBlock(const size_t &size) {
+		const bool huge = size >= kHugePageBytes;
+		const size_t alignment = huge ? kHugePageBytes : kAlignment;
+		const size_t total = blockBytes(size);
+#ifdef _WIN32
+		//large pages on Windows need the lock pages privilege, so huge buffers are only aligned
+		void *block = _aligned_malloc(total, alignment);
+#else
+		void *block = nullptr;
+		if (posix_memalign(&block, alignment, total) != 0) {
+			block = nullptr;
+		}
+#endif
+		if (block == nullptr) {
+			throw bad_alloc();
+		}
+#ifdef MADV_HUGEPAGE
+		if (huge) {
+			//a hint, kernels without transparent huge pages ignore it
+			madvise(block, total, MADV_HUGEPAGE);
+		}
+#endif
+		if (huge) {
+			lock_guard<mutex> lock(guard);
+			counters.hugePageBuffers++;
+		}
+		*static_cast<size_t*>(block) = size;
+		return static_cast<unsigned char*>(block);
+	}
+
+	/// <summary>
+	/// Bytes allocated for a size class, huge buffers rounded up to whole huge pages
+	/// </summary>
+	static size_t blockBytes(const size_t &size) {
+		const size_t total = size + kAlignment;
+		return size >= kHugePageBytes ? (total + kHugePageBytes - 1) / kHugePageBytes * kHugePageBytes : total;
+	}
+
+	static void freeBlock(unsigned char *block) {
+#ifdef _WIN32
+		_aligned_free(block);
+#else
+		free(block);
+#endif
+	}
+};
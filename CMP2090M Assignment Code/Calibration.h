@@ -0,0 +1,225 @@
+#pragma once
+//*********************************************
+//Dark frame subtraction and flat field division, applied while each frame is decoded
+//The master dark and master flat are ordinary images, e.g. median stacks of dark and flat frames.
+//The flat is turned into per channel gains once, in fixed point, so calibrating a sample is a
+//saturating subtract, a multiply and a shift over the row bytes just read from the file
+//*********************************************
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "Image.h"
+#include "Logger.h"
+#include "MemoryTracker.h"
+#include "Parallel.h"
+
+using namespace std;
+
+static_assert(sizeof(Image::Rgb) == 3, "calibration treats rows of pixels as rows of bytes");
+
+/// <summary>
+/// Master calibration frames, ready to apply to frames of the same size
+/// </summary>
+class Calibration {
+private:
+	unsigned int w = 0, h = 0;
+	string darkPath, flatPath;
+	//per sample dark level, zero without a master dark
+	unsigned char *darkLevels = nullptr;
+	//per sample flat correction in fixed point, kUnitGain without a master flat
+	uint16_t *gains = nullptr;
+	//flat samples whose gain was limited to kMaxGain
+	unsigned long long clampedSamples = 0;
+
+	size_t sampleCount() const {
+		return (size_t)w * h * 3;
+	}
+
+	/// <summary>
+	/// Read a master frame, checking it matches the size of the other one
+	/// </summary>
+	bool readMaster(const string &path, Image &master, string &error) {
+		master.readPPM(path.c_str());
+		if (master.pixels == nullptr) {
+			error = "could not read " + path;
+			return false;
+		}
+		if (w != 0 && (master.w != w || master.h != h)) {
+			master.freeMemory();
+			error = "the master dark and flat are not the same size";
+			return false;
+		}
+		w = master.w;
+		h = master.h;
+		return true;
+	}
+
+	void release() {
+		MemoryTracker::release(darkLevels, sampleCount());
+		MemoryTracker::release(gains, sampleCount());
+		darkLevels = nullptr;
+		gains = nullptr;
+	}
+
+public:
+	//fractional bits of the gains, so a gain of 1 is 1 << kGainBits
+	static const unsigned int kGainBits = 12;
+	static const uint16_t kUnitGain = 1 << kGainBits;
+	//largest gain a 16 bit fixed point gain holds, just under 16
+	static constexpr double kMaxGain = 65535.0 / kUnitGain;
+
+	Calibration() {}
+
+	~Calibration() {
+		release();
+	}
+
+	Calibration(const Calibration&) = delete;
+	Calibration& operator=(const Calibration&) = delete;
+
+	/// <summary>
+	/// Load the master frames
+	/// The flat is normalised by its mean per channel, so it corrects vignetting without changing the overall level.
+	/// Gains are limited to kMaxGain, so flat samples darker than about a sixteenth of their channel's mean are
+	/// under-corrected; how many were limited is logged as a warning and given by getClampedSamples()
+	/// </summary>
+	/// <param name="_darkPath">master dark, empty for none</param>
+	/// <param name="_flatPath">master flat, empty for none</param>
+	/// <param name="error">set to the reason if the masters cannot be used</param>
+	/// <returns>true if loaded</returns>
+	bool load(const string &_darkPath, const string &_flatPath, string &error) {
+		release();
+		w = h = 0;
+		clampedSamples = 0;
+		darkPath = _darkPath;
+		flatPath = _flatPath;
+		Image dark, flat;
+		if ((!darkPath.empty() && !readMaster(darkPath, dark, error)) || (!flatPath.empty() && !readMaster(flatPath, flat, error))) {
+			dark.freeMemory();
+			return false;
+		}
+		if (w == 0) {
+			error = "no calibration frames given";
+			return false;
+		}
+		darkLevels = MemoryTracker::allocate<unsigned char>(sampleCount());
+		gains = MemoryTracker::allocate<uint16_t>(sampleCount());
+		const unsigned char *darkBytes = dark.pixels != nullptr ? reinterpret_cast<const unsigned char*>(dark.pixels) : nullptr;
+		const unsigned char *flatBytes = flat.pixels != nullptr ? reinterpret_cast<const unsigned char*>(flat.pixels) : nullptr;
+		double means[3] = { 1.0, 1.0, 1.0 };
+		if (flatBytes != nullptr) {
+			unsigned long long sums[3] = { 0, 0, 0 };
+			for (size_t i = 0; i < sampleCount(); i++) {
+				sums[i % 3] += flatBytes[i];
+			}
+			for (size_t c = 0; c < 3; c++) {
+				means[c] = std::max(1.0, (double)sums[c] / ((double)w * h));
+			}
+		}
+		atomic<unsigned long long> clamped(0);
+		parallel_for(size_t(0), size_t(h), [this, darkBytes, flatBytes, &means, &clamped](size_t y) {
+			unsigned long long rowClamped = 0;
+			for (size_t i = y * w * 3; i < (y + 1) * w * 3; i++) {
+				darkLevels[i] = darkBytes != nullptr ? darkBytes[i] : 0;
+				//a dead flat pixel would divide by zero, treat it as level 1 so the gain stays finite
+				const double gain = flatBytes != nullptr ? means[i % 3] / std::max((unsigned char)1, flatBytes[i]) : 1.0;
+				//the fixed point gains stop just short of 16, a darker flat sample is corrected by that much only
+				const double fixedGain = gain * kUnitGain + 0.5;
+				rowClamped += fixedGain > 65535.0 ? 1 : 0;
+				gains[i] = (uint16_t)std::min(65535.0, fixedGain);
+			}
+			clamped += rowClamped;
+		});
+		clampedSamples = clamped;
+		if (clampedSamples > 0) {
+			Logger::instance().log(LogLevel::Warning, "Calibration", to_string(clampedSamples) + " samples of " + flatPath
+				+ " are darker than 1/16 of their channel's mean, their gain is limited to " + to_string(kMaxGain) + " so they are under-corrected");
+		}
+		dark.freeMemory();
+		flat.freeMemory();
+		return true;
+	}
+
+	/// <summary>
+	/// Get the number of flat samples whose gain was limited to kMaxGain
+	/// </summary>
+	unsigned long long getClampedSamples() const {
+		return clampedSamples;
+	}
+
+	/// <summary>
+	/// Check the masters can calibrate frames of a size
+	/// </summary>
+	bool matches(const unsigned int &width, const unsigned int &height) const {
+		return gains != nullptr && width == w && height == h;
+	}
+
+	/// <summary>
+	/// Calibrate a row of samples
+	/// Written as one flat loop over bytes with no branches, so the compiler vectorises it
+	/// </summary>
+	/// <param name="raw">r, g, b bytes of the row</param>
+	/// <param name="out">calibrated bytes, may be the same as raw</param>
+	/// <param name="x">x coordinate in the full frame of the first pixel</param>
+	/// <param name="y">y coordinate in the full frame of the row</param>
+	/// <param name="count">number of pixels</param>
+	void calibrateRow(const unsigned char *raw, unsigned char *out, const unsigned int &x, const unsigned int &y, const unsigned int &count) const {
+		const size_t start = ((size_t)y * w + x) * 3;
+		const unsigned char *dark = darkLevels + start;
+		const uint16_t *gain = gains + start;
+		const size_t n = (size_t)count * 3;
+		for (size_t i = 0; i < n; i++) {
+			const unsigned int level = raw[i] > dark[i] ? raw[i] - dark[i] : 0;
+			const unsigned int corrected = (level * gain[i] + (kUnitGain >> 1)) >> kGainBits;
+			out[i] = (unsigned char)std::min(corrected, 255u);
+		}
+	}
+
+	/// <summary>
+	/// Get a decoder that calibrates rows as they are read, for Image::readPPMRegion
+	/// </summary>
+	/// <returns>decoder, valid while this calibration is</returns>
+	Image::RowDecoder decoder() const {
+		return [this](const unsigned char *raw, Image::Rgb *pixels, const unsigned int &x, const unsigned int &y, const unsigned int &count) {
+			calibrateRow(raw, reinterpret_cast<unsigned char*>(pixels), x, y, count);
+		};
+	}
+
+	/// <summary>
+	/// Calibrate a frame that is already in memory, e.g. one taken from the frame cache
+	/// </summary>
+	/// <param name="frame">frame or region of a frame, calibrated in place</param>
+	/// <param name="left">x coordinate of the region in the full frame</param>
+	/// <param name="top">y coordinate of the region in the full frame</param>
+	void apply(Image &frame, const unsigned int &left, const unsigned int &top) const {
+		parallel_for(size_t(0), size_t(frame.h), [this, &frame, left, top](size_t y) {
+			unsigned char *row = reinterpret_cast<unsigned char*>(frame.pixels + y * frame.w);
+			calibrateRow(row, row, left, top + (unsigned int)y, frame.w);
+		});
+		frame.updateModified();
+	}
+
+	/// <summary>
+	/// Get the master frame files, for cache keys
+	/// </summary>
+	/// <returns>the master dark and flat paths that were given</returns>
+	vector<string> masterPaths() const {
+		vector<string> paths;
+		if (!darkPath.empty()) {
+			paths.push_back(darkPath);
+		}
+		if (!flatPath.empty()) {
+			paths.push_back(flatPath);
+		}
+		return paths;
+	}
+
+	/// <summary>
+	/// Describe the calibration for cache keys
+	/// </summary>
+	string describe() const {
+		return string("calibrate=") + (darkPath.empty() ? "" : "dark") + (flatPath.empty() ? "" : "flat") + ",bits=" + to_string(kGainBits);
+	}
+};
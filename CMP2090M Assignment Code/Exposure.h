@@ -0,0 +1,170 @@
+#pragma once
+//*********************************************
+//Exposure normalisation, so frames of a set that vary in brightness stack as if they did not
+//Each frame's per channel median comes from a 256 bin histogram counted while the frame is loaded.
+//Every frame is then scaled to the mean of those medians through a lookup table that the stackers
+//apply while gathering samples, so normalising never needs a pass of its own
+//*********************************************
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <vector>
+#include "Image.h"
+#include "Parallel.h"
+
+using namespace std;
+
+/// <summary>
+/// Per frame brightness levels of a set, and the tables that bring every frame to a common level
+/// </summary>
+class ExposureNormalisation {
+private:
+	//r, g and b histograms or tables one after another
+	typedef array<unsigned long long, 768> Histogram;
+	typedef array<unsigned char, 768> Table;
+
+	vector<Histogram> histograms;
+	vector<Table> tables;
+	vector<array<float, 3>> gains;
+
+	/// <summary>
+	/// Table that leaves every level as it is, used when there is no normalisation
+	/// </summary>
+	static const Table& identity() {
+		static const Table table = [] {
+			Table levels;
+			for (size_t i = 0; i < levels.size(); i++) {
+				levels[i] = (unsigned char)(i % 256);
+			}
+			return levels;
+		}();
+		return table;
+	}
+
+	/// <summary>
+	/// Lower median level of one channel's histogram, as in the median blends
+	/// </summary>
+	static unsigned int medianLevel(const unsigned long long *counts) {
+		unsigned long long total = 0;
+		for (unsigned int level = 0; level < 256; level++) {
+			total += counts[level];
+		}
+		if (total == 0) {
+			return 0;
+		}
+		const unsigned long long rank = (total - 1) / 2;
+		unsigned long long below = 0;
+		unsigned int level = 0;
+		while (below + counts[level] <= rank) {
+			below += counts[level];
+			level++;
+		}
+		return level;
+	}
+
+public:
+	/// <summary>
+	/// Prepare to measure a set of frames
+	/// </summary>
+	/// <param name="frameCount">number of frames in the set</param>
+	ExposureNormalisation(const size_t &frameCount) : histograms(frameCount), tables(frameCount, identity()), gains(frameCount) {
+		for (Histogram &histogram : histograms) {
+			histogram.fill(0);
+		}
+		for (array<float, 3> &gain : gains) {
+			gain.fill(1.0f);
+		}
+	}
+
+	/// <summary>
+	/// Count a row of a frame as it is decoded
+	/// A frame's rows must all be counted by the same thread, different frames may be counted at once
+	/// </summary>
+	/// <param name="frame">index of the frame in the set</param>
+	/// <param name="pixels">decoded pixels of the row</param>
+	/// <param name="count">number of pixels</param>
+	void countRow(const size_t &frame, const Image::Rgb *pixels, const unsigned int &count) {
+		unsigned long long *counts = histograms[frame].data();
+		for (unsigned int x = 0; x < count; x++) {
+			counts[pixels[x].r]++;
+			counts[256 + pixels[x].g]++;
+			counts[512 + pixels[x].b]++;
+		}
+	}
+
+	/// <summary>
+	/// Count a whole frame that is already in memory, e.g. one taken from the frame cache
+	/// Bands of rows are counted in parallel into their own histograms, which are then added together
+	/// </summary>
+	/// <param name="frame">index of the frame in the set</param>
+	/// <param name="img">the frame</param>
+	void measure(const size_t &frame, const Image &img) {
+		mutex mergeLock;
+		const size_t bandRows = std::max((size_t)1, (size_t)img.h / ((size_t)logicalCoreCount() * 4));
+		parallel_for(size_t(0), (img.h + bandRows - 1) / bandRows, [this, &frame, &img, &mergeLock, bandRows](size_t band) {
+			Histogram local;
+			local.fill(0);
+			const size_t end = std::min((size_t)img.h, (band + 1) * bandRows);
+			for (const Image::Rgb *p = img.pixels + band * bandRows * img.w; p < img.pixels + end * img.w; p++) {
+				local[p->r]++;
+				local[256 + p->g]++;
+				local[512 + p->b]++;
+			}
+			lock_guard<mutex> guard(mergeLock);
+			for (size_t i = 0; i < local.size(); i++) {
+				histograms[frame][i] += local[i];
+			}
+		});
+	}
+
+	/// <summary>
+	/// Work out the gains and tables once every frame has been counted
+	/// Each channel of each frame is scaled so its median matches the mean median of that channel over the set
+	/// </summary>
+	void finish() {
+		if (histograms.empty()) {
+			return;
+		}
+		vector<array<unsigned int, 3>> medians(histograms.size());
+		double reference[3] = { 0, 0, 0 };
+		for (size_t f = 0; f < histograms.size(); f++) {
+			for (size_t c = 0; c < 3; c++) {
+				medians[f][c] = medianLevel(histograms[f].data() + c * 256);
+				reference[c] += medians[f][c];
+			}
+		}
+		for (size_t c = 0; c < 3; c++) {
+			reference[c] /= histograms.size();
+		}
+		for (size_t f = 0; f < histograms.size(); f++) {
+			for (size_t c = 0; c < 3; c++) {
+				//a channel that is black at its median has nothing to scale by
+				const double gain = medians[f][c] == 0 ? 1.0 : reference[c] / medians[f][c];
+				gains[f][c] = (float)gain;
+				for (unsigned int level = 0; level < 256; level++) {
+					tables[f][c * 256 + level] = (unsigned char)std::min(255.0, level * gain + 0.5);
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// Get the gain applied to a channel of a frame
+	/// </summary>
+	/// <param name="frame">index of the frame in the set</param>
+	/// <param name="channel">0 red, 1 green, 2 blue</param>
+	float getGain(const size_t &frame, const size_t &channel) const {
+		return gains[frame][channel];
+	}
+
+	/// <summary>
+	/// Get the lookup table of a frame: level l of red, green and blue maps to entries l, 256 + l and 512 + l
+	/// </summary>
+	/// <param name="levels">normalisation of the set, null for none</param>
+	/// <param name="frame">index of the frame in the set</param>
+	/// <returns>table of the frame, or one that changes nothing without a normalisation</returns>
+	static const unsigned char* lookup(const ExposureNormalisation *levels, const size_t &frame) {
+		return levels == nullptr ? identity().data() : levels->tables[frame].data();
+	}
+};
@@ -0,0 +1,163 @@
+#pragma once
+//*********************************************
+//Cache of decoded frames, kept between requests by the job daemon
+//Entries are whole images or regions of them, evicted least recently used first
+//once the decoded pixels would exceed a byte limit
+//*********************************************
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "Image.h"
+
+using namespace std;
+
+/// <summary>
+/// Counters of a frame cache
+/// </summary>
+struct FrameCacheStats {
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+	unsigned long long bytes = 0; // pixel bytes currently cached
+	unsigned long long capacityBytes = 0;
+	size_t entries = 0;
+};
+
+/// <summary>
+/// Thread safe least recently used cache of decoded frames, bounded by bytes
+/// Callers get their own copy of a frame, since the stackers release the frames they are given
+/// </summary>
+class FrameCache {
+private:
+	struct Entry {
+		string key;
+		Image image; // owned by the cache
+	};
+
+	list<Entry> entries; // most recently used at the front
+	unordered_map<string, list<Entry>::iterator> index;
+	mutable mutex lock;
+	FrameCacheStats stats;
+
+	/// <summary>
+	/// Build the key of a frame, including the file size and modification time so edited files are read again
+	/// </summary>
+	/// <param name="path">ppm file</param>
+	/// <param name="left">x coordinate of the region</param>
+	/// <param name="top">y coordinate of the region</param>
+	/// <param name="width">width of the region, 0 for the whole image</param>
+	/// <param name="height">height of the region, 0 for the whole image</param>
+	/// <returns>cache key, empty if the file does not exist</returns>
+	static string makeKey(const string &path, const unsigned int &left, const unsigned int &top, const unsigned int &width, const unsigned int &height) {
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0) {
+			return "";
+		}
+		ostringstream key;
+		key << path << '|' << (long long)info.st_size << '|' << (long long)info.st_mtime << '|' << left << ',' << top << ',' << width << ',' << height;
+		return key.str();
+	}
+
+	/// <summary>
+	/// Drop least recently used entries until the given number of bytes fits, called with the lock held
+	/// </summary>
+	/// <param name="incoming">bytes about to be added</param>
+	void makeRoom(const unsigned long long &incoming) {
+		while (!entries.empty() && stats.bytes + incoming > stats.capacityBytes) {
+			Entry &oldest = entries.back();
+			stats.bytes -= oldest.image.pixelBytes();
+			oldest.image.freeMemory();
+			index.erase(oldest.key);
+			entries.pop_back();
+		}
+	}
+
+public:
+	/// <summary>
+	/// Create an empty cache
+	/// </summary>
+	/// <param name="capacityBytes">most pixel bytes to keep</param>
+	FrameCache(const unsigned long long &capacityBytes) {
+		stats.capacityBytes = capacityBytes;
+	}
+
+	~FrameCache() {
+		clear();
+	}
+
+	FrameCache(const FrameCache&) = delete;
+	FrameCache& operator=(const FrameCache&) = delete;
+
+	/// <summary>
+	/// Get a copy of a frame or a region of it, reading the file only if it is not cached
+	/// </summary>
+	/// <param name="path">ppm file</param>
+	/// <param name="left">x coordinate of the region</param>
+	/// <param name="top">y coordinate of the region</param>
+	/// <param name="width">width of the region</param>
+	/// <param name="height">height of the region</param>
+	/// <param name="wholeImage">read the whole file, ignoring the region</param>
+	/// <returns>frame with its own pixels, null pixels if it could not be read</returns>
+	Image get(const string &path, const unsigned int &left, const unsigned int &top, const unsigned int &width, const unsigned int &height, const bool &wholeImage) {
+		const string key = wholeImage ? makeKey(path, 0, 0, 0, 0) : makeKey(path, left, top, width, height);
+		{
+			lock_guard<mutex> guard(lock);
+			auto found = key.empty() ? index.end() : index.find(key);
+			if (found != index.end()) {
+				stats.hits++;
+				//move to the front as the most recently used
+				entries.splice(entries.begin(), entries, found->second);
+				return found->second->image.clone();
+			}
+			stats.misses++;
+		}
+
+		//read without the lock so other requests are not held up by the file
+		Image frame;
+		if (wholeImage) {
+			frame = Image((char*)path.c_str());
+		} else {
+			frame.readPPMRegion(path.c_str(), left, top, width, height);
+			frame.logDetails();
+		}
+		if (frame.pixels == nullptr || key.empty() || frame.pixelBytes() > stats.capacityBytes) {
+			return frame;
+		}
+
+		lock_guard<mutex> guard(lock);
+		if (index.find(key) == index.end()) {
+			makeRoom(frame.pixelBytes());
+			entries.push_front({ key, frame.clone() });
+			index[key] = entries.begin();
+			stats.bytes += frame.pixelBytes();
+		}
+		return frame;
+	}
+
+	/// <summary>
+	/// Release every cached frame
+	/// </summary>
+	void clear() {
+		lock_guard<mutex> guard(lock);
+		for (Entry &entry : entries) {
+			entry.image.freeMemory();
+		}
+		entries.clear();
+		index.clear();
+		stats.bytes = 0;
+	}
+
+	/// <summary>
+	/// Get the cache counters
+	/// </summary>
+	/// <returns>copy of the counters</returns>
+	FrameCacheStats getStats() const {
+		lock_guard<mutex> guard(lock);
+		FrameCacheStats current = stats;
+		current.entries = entries.size();
+		return current;
+	}
+};
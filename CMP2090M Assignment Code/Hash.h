@@ -0,0 +1,199 @@
+#pragma once
+//*********************************************
+//Fast non-cryptographic hashing of file contents
+//XXH64 from https://github.com/Cyan4973/xxHash, written out here so no library is needed
+//*********************************************
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/// <summary>
+/// Streaming 64 bit xxHash, data can be added in pieces of any size
+/// </summary>
+class XxHash64 {
+private:
+	static const uint64_t kPrime1 = 11400714785074694791ULL;
+	static const uint64_t kPrime2 = 14029467366897019727ULL;
+	static const uint64_t kPrime3 = 1609587929392839161ULL;
+	static const uint64_t kPrime4 = 9650029242287828579ULL;
+	static const uint64_t kPrime5 = 2870177450012600261ULL;
+
+	uint64_t seed;
+	uint64_t lanes[4];
+	unsigned char pending[32]; // bytes not yet making up a whole 32 byte stripe
+	size_t pendingSize = 0;
+	uint64_t totalSize = 0;
+
+	static uint64_t rotateLeft(const uint64_t &value, const int &bits) {
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	//the file formats read here are little endian, as are the machines this runs on
+	static uint64_t read64(const unsigned char *p) {
+		uint64_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	static uint32_t read32(const unsigned char *p) {
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	static uint64_t round(uint64_t lane, const uint64_t &input) {
+		lane += input * kPrime2;
+		lane = rotateLeft(lane, 31);
+		return lane * kPrime1;
+	}
+
+	static uint64_t mergeRound(uint64_t hash, const uint64_t &lane) {
+		hash ^= round(0, lane);
+		return hash * kPrime1 + kPrime4;
+	}
+
+	/// <summary>
+	/// Mix one 32 byte stripe into the lanes
+	/// </summary>
+	void consumeStripe(const unsigned char *p) {
+		lanes[0] = round(lanes[0], read64(p));
+		lanes[1] = round(lanes[1], read64(p + 8));
+		lanes[2] = round(lanes[2], read64(p + 16));
+		lanes[3] = round(lanes[3], read64(p + 24));
+	}
+
+public:
+	/// <summary>
+	/// Start a new hash
+	/// </summary>
+	/// <param name="_seed">seed, different seeds give unrelated hashes</param>
+	XxHash64(const uint64_t &_seed = 0) : seed(_seed) {
+		lanes[0] = seed + kPrime1 + kPrime2;
+		lanes[1] = seed + kPrime2;
+		lanes[2] = seed;
+		lanes[3] = seed - kPrime1;
+	}
+
+	/// <summary>
+	/// Add data to the hash
+	/// </summary>
+	/// <param name="data">bytes to add</param>
+	/// <param name="size">number of bytes</param>
+	void update(const void *data, size_t size) {
+		const unsigned char *p = static_cast<const unsigned char*>(data);
+		totalSize += size;
+		if (pendingSize + size < 32) {
+			memcpy(pending + pendingSize, p, size);
+			pendingSize += size;
+			return;
+		}
+		if (pendingSize > 0) {
+			//complete the partial stripe first
+			const size_t fill = 32 - pendingSize;
+			memcpy(pending + pendingSize, p, fill);
+			consumeStripe(pending);
+			p += fill;
+			size -= fill;
+			pendingSize = 0;
+		}
+		while (size >= 32) {
+			consumeStripe(p);
+			p += 32;
+			size -= 32;
+		}
+		memcpy(pending, p, size);
+		pendingSize = size;
+	}
+
+	/// <summary>
+	/// Add a string to the hash
+	/// </summary>
+	/// <param name="text">text to add</param>
+	void update(const string &text) {
+		update(text.data(), text.size());
+	}
+
+	/// <summary>
+	/// Get the hash of everything added so far
+	/// </summary>
+	/// <returns>64 bit hash</returns>
+	uint64_t digest() const {
+		uint64_t hash;
+		if (totalSize >= 32) {
+			hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18);
+			for (int i = 0; i < 4; i++) {
+				hash = mergeRound(hash, lanes[i]);
+			}
+		} else {
+			hash = seed + kPrime5;
+		}
+		hash += totalSize;
+
+		//fold in the bytes that did not fill a stripe
+		const unsigned char *p = pending;
+		size_t remaining = pendingSize;
+		while (remaining >= 8) {
+			hash ^= round(0, read64(p));
+			hash = rotateLeft(hash, 27) * kPrime1 + kPrime4;
+			p += 8;
+			remaining -= 8;
+		}
+		if (remaining >= 4) {
+			hash ^= (uint64_t)read32(p) * kPrime1;
+			hash = rotateLeft(hash, 23) * kPrime2 + kPrime3;
+			p += 4;
+			remaining -= 4;
+		}
+		while (remaining > 0) {
+			hash ^= (*p) * kPrime5;
+			hash = rotateLeft(hash, 11) * kPrime1;
+			p++;
+			remaining--;
+		}
+
+		//final avalanche
+		hash ^= hash >> 33;
+		hash *= kPrime2;
+		hash ^= hash >> 29;
+		hash *= kPrime3;
+		hash ^= hash >> 32;
+		return hash;
+	}
+
+	/// <summary>
+	/// Get the hash as hexadecimal text
+	/// </summary>
+	/// <returns>16 hex digits</returns>
+	string hexDigest() const {
+		const char *digits = "0123456789abcdef";
+		const uint64_t hash = digest();
+		string text(16, '0');
+		for (int i = 0; i < 16; i++) {
+			text[i] = digits[(hash >> (60 - i * 4)) & 0xF];
+		}
+		return text;
+	}
+
+	/// <summary>
+	/// Add the whole contents of a file to the hash
+	/// </summary>
+	/// <param name="path">file to read</param>
+	/// <returns>false if the file could not be read</returns>
+	bool updateFromFile(const string &path) {
+		ifstream in(path, ios::binary);
+		if (in.fail()) {
+			return false;
+		}
+		vector<char> buffer(1 << 20);
+		while (in) {
+			in.read(buffer.data(), buffer.size());
+			update(buffer.data(), (size_t)in.gcount());
+		}
+		return !in.bad();
+	}
+};
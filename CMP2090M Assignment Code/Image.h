@@ -7,12 +7,19 @@
 
 #include <cstdlib> 
 #include <cstdio>
+#include <cstring>
 #include "Timer.h"
 #include "Utils.h"
+#include "Trace.h"
+#include "MemoryTracker.h"
+#include "BufferPool.h"
+#include "MappedImageFile.h"
+#include "Logger.h"
 #include <iomanip>
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <functional>
 
 using namespace std;
 
@@ -81,6 +88,12 @@ public:
 		unsigned char r, g, b;
 	};
 
+	/// <summary>
+	/// Marks the constructors that leave the pixels uninitialised, for outputs whose every pixel is about to be written
+	/// </summary>
+	struct Uninitialised {};
+	static const Uninitialised kUninitialised;
+
 	/// <summary>
 	/// Empty image constructor
 	/// </summary>
@@ -100,16 +113,29 @@ public:
 		creationTime = time(&creationTime);
 		modifiedTime = time(&modifiedTime);
 		const unsigned int imageSize = w * h;
-		pixels = new Rgb[imageSize];
+		allocatePixels();
 		//set all pixels to default colour
 		for (unsigned int i = 0; i < imageSize; ++i)
 			pixels[i] = c;
 	}
 	/// <summary>
+	/// Constructor that skips filling the pixels, they hold whatever their buffer last held
+	/// Inside a MappedOutputScope the pixels may be the mapped output file instead
+	/// </summary>
+	/// <param name="_w">width</param>
+	/// <param name="_h">height</param>
+	/// <param name="_channels">1 for monochrome, 3 for colour</param>
+	/// <param name="_fileName">source file path</param>
+	Image(const unsigned int &_w, const unsigned int &_h, const Uninitialised&, const unsigned int &_channels = 3, char *_fileName = "No Source File") : w(_w), h(_h), pixels(NULL), channels(_channels), fileName(_fileName) {
+		creationTime = time(&creationTime);
+		modifiedTime = time(&modifiedTime);
+		allocatePixels(true);
+	}
+	/// <summary>
 	/// Construct image from file
 	/// </summary>
 	/// <param name="_filename">Source file path</param>
-	Image(char* _filename) : fileName(_filename) {
+	Image(char* _filename) : w(0), h(0), pixels(nullptr), fileName(_filename), colourDepth(0) {
 		creationTime = time(&creationTime);
 		modifiedTime = time(&modifiedTime);
 		//read from file
@@ -133,37 +159,169 @@ public:
 		return pixels[i];
 	}
 
+	/// <summary>
+	/// Create a deep copy of this image with its own pixel array
+	/// Copying an image normally shares the pixel array, this does not
+	/// </summary>
+	/// <returns>copy of this image</returns>
+	Image clone() const {
+		Image copy = *this;
+		copy.mapped = NULL;
+		if (pixels != NULL) {
+			copy.pixels = BufferPool::acquire<Rgb>(storedPixels());
+			std::copy(pixels, pixels + storedPixels(), copy.pixels);
+		}
+		return copy;
+	}
+
 	/// <summary>
 	/// Delete memory used by this object
 	/// </summary>
 	void freeMemory() {
+		if (mapped != NULL) {
+			//closing the mapping finishes the file
+			mapped->close();
+			delete mapped;
+			mapped = NULL;
+			pixels = NULL;
+		}
 		if (pixels != NULL) {
-			delete[] pixels;
+			BufferPool::release(pixels, storedPixels());
+			pixels = NULL;
 		}
 	}
 
+	/// <summary>
+	/// Get the number of Rgb entries in the pixel array
+	/// A monochrome image packs its samples three to an entry, so it needs a third of the entries of a colour one
+	/// </summary>
+	/// <returns>entries allocated for pixels</returns>
+	size_t storedPixels() const {
+		return channels == 1 ? ((size_t)w * h + 2) / 3 : (size_t)w * h;
+	}
+
+	/// <summary>
+	/// Get the pixel array as bytes, one sample per pixel for monochrome images and r, g, b for colour ones
+	/// </summary>
+	/// <returns>samples in row order</returns>
+	unsigned char* samples() {
+		return reinterpret_cast<unsigned char*>(pixels);
+	}
+
+	/// <summary>
+	/// Get the pixel array as bytes, one sample per pixel for monochrome images and r, g, b for colour ones
+	/// </summary>
+	/// <returns>samples in row order</returns>
+	const unsigned char* samples() const {
+		return reinterpret_cast<const unsigned char*>(pixels);
+	}
+
+	/// <summary>
+	/// Set the number of channels, replacing the pixel array with a black one of the matching size
+	/// Used to give a new output image the layout of its inputs
+	/// </summary>
+	/// <param name="count">1 for monochrome, 3 for colour</param>
+	void setChannels(const unsigned int &count) {
+		if (count == channels) {
+			return;
+		}
+		const bool allocated = pixels != NULL;
+		freeMemory();
+		channels = count;
+		if (allocated) {
+			allocatePixels();
+			std::fill(pixels, pixels + storedPixels(), kBlack);
+		}
+	}
+
+	/// <summary>
+	/// Convert a colour image whose channels are all equal to monochrome, a third of the size
+	/// </summary>
+	/// <returns>true if the image is now monochrome</returns>
+	bool toMonochrome() {
+		if (channels == 1) {
+			return true;
+		}
+		if (pixels == NULL) {
+			return false;
+		}
+		const size_t count = (size_t)w * h;
+		for (size_t i = 0; i < count; i++) {
+			if (pixels[i].r != pixels[i].g || pixels[i].r != pixels[i].b) {
+				return false;
+			}
+		}
+		Image colour = *this;
+		channels = 1;
+		mapped = NULL;
+		allocatePixels();
+		unsigned char *levels = samples();
+		for (size_t i = 0; i < count; i++) {
+			levels[i] = colour.pixels[i].r;
+		}
+		colour.freeMemory();
+		//log2(256) bits per pixel, as a greyscale file would give
+		colourDepth = 8;
+		return true;
+	}
+
+	/// <summary>
+	/// Convert a monochrome image to colour, copying each sample to r, g and b
+	/// </summary>
+	void toColour() {
+		if (channels == 3 || pixels == NULL) {
+			channels = 3;
+			return;
+		}
+		const size_t count = (size_t)w * h;
+		Rgb *expanded = BufferPool::acquire<Rgb>(count);
+		const unsigned char *levels = samples();
+		for (size_t i = 0; i < count; i++) {
+			expanded[i] = Rgb(levels[i]);
+		}
+		freeMemory();
+		pixels = expanded;
+		channels = 3;
+		colourDepth *= 3;
+	}
+
 	unsigned int w, h; // Image resolution 
 	Rgb *pixels; // 1D array of pixels 
+	unsigned int channels = 3; // 3 for colour, 1 for monochrome with the samples packed into the pixel array
+	MappedImageFile *mapped = NULL; // the output file the pixels are mapped from, null for pixels in memory
 	static const Rgb kBlack, kWhite, kRed, kGreen, kBlue; // Preset colours 
 
 	/// <summary>
 	/// write object details to log file
 	/// </summary>
 	void virtual logDetails() {
-		ofstream logFile;
-		logFile.open("DetailsLog.txt", ios::app);
-		logFile << "\n======Image======\n";
-		logFile << "Source Image: " << fileName << "\n";
-		logFile << "Image Width: " << w << "\n";
-		logFile << "Image Height: " << h << "\n";
-		logFile << "Colour Depth: " << colourDepth << " bit\n";
-		logFile << "Image Statistics: " << "\n\tImage Size in memory: " << bytesToAppropriate(sizeof(pixels[0].r) * 3 * h*w + sizeof(h) + sizeof(w) + sizeof(fileName)).str() << "\n";
-		string createStr(ctime(&creationTime));
-		string modifStr(ctime(&modifiedTime));
-		logFile << "\tCreated: " << createStr << "\tLast Modified: " << modifStr;
-		logFile << "=================\n";
-		logFile.close();
+		if (Logger::instance().isEnabled(LogLevel::Details)) {
+			Logger::instance().log(detailsRecord("Image"));
+		}
+	}
 
+	/// <summary>
+	/// Get the size of the pixel array
+	/// </summary>
+	/// <returns>bytes allocated for pixels</returns>
+	unsigned long long pixelBytes() const {
+		return (unsigned long long)sizeof(Rgb) * storedPixels();
+	}
+
+	/// <summary>
+	/// Record the memory used by the operation that produced this image, so it is logged with the details
+	/// </summary>
+	/// <param name="usage">measured memory usage</param>
+	void setMemoryUsage(const MemoryUsage &usage) {
+		memoryUsage = usage;
+	}
+
+	/// <summary>
+	/// Get the memory used by the operation that produced this image
+	/// </summary>
+	/// <returns>measured memory usage, not measured if unknown</returns>
+	const MemoryUsage& getMemoryUsage() const {
+		return memoryUsage;
 	}
 
 	/// <summary>
@@ -171,7 +329,7 @@ public:
 	/// </summary>
 	/// <param name="_fileName">Filename to set</param>
 	void setFileName(const char *_fileName) {
-		fileName = (char*)_fileName;
+		fileName = _fileName;
 	}
 
 	/// <summary>
@@ -197,6 +355,35 @@ public:
 		return colourDepth;
 	}
 	
+	/// <summary>
+	/// Turns one row of raw file bytes into pixels, e.g. to correct them while they are decoded
+	/// </summary>
+	/// <param name="raw">r, g, b bytes of the row as stored in the file</param>
+	/// <param name="pixels">pixels to fill</param>
+	/// <param name="x">x coordinate in the file of the first pixel</param>
+	/// <param name="y">y coordinate in the file of the row</param>
+	/// <param name="count">number of pixels</param>
+	typedef std::function<void(const unsigned char *raw, Rgb *pixels, const unsigned int &x, const unsigned int &y, const unsigned int &count)> RowDecoder;
+
+	/// <summary>
+	/// Read only the dimensions from a ppm or pgm file header, without reading the pixels
+	/// </summary>
+	/// <param name="filename">File path to read from</param>
+	/// <param name="width">set to the image width</param>
+	/// <param name="height">set to the image height</param>
+	/// <returns>true if the file is a binary ppm or pgm with a valid header</returns>
+	static bool readPPMSize(const char *filename, unsigned int &width, unsigned int &height) {
+		std::ifstream ifs(filename, std::ios::binary);
+		std::string header;
+		int w = 0, h = 0, b = 0;
+		if (!(ifs >> header >> w >> h >> b) || (header != "P6" && header != "P5") || w <= 0 || h <= 0) {
+			return false;
+		}
+		width = (unsigned int)w;
+		height = (unsigned int)h;
+		return true;
+	}
+
 	/// <summary>
 	/// Read ppm files into the code
 	/// They need to be in 'binary' format (P6) with no comments in the header
@@ -206,10 +393,13 @@ public:
 	///	3264 2448
 	///	255
 	/// Open a .ppm file in notepad++ to see this header (caution: they are large files!)
+	/// Greyscale pgm files (P5) are read the same way, with one byte per pixel
 	/// </summary>
 	/// <param name="filename">File path to read from</param>
-	void readPPM(const char *filename)
+	/// <param name="allowMonochrome">keep greyscale files, and colour files whose channels are all equal, as monochrome images; otherwise they are read as colour</param>
+	void readPPM(const char *filename, const bool &allowMonochrome = false)
 	{
+		TRACE_ZONE_DETAIL("Load frame", filename);
 		//Remove this cout to prevent multiple outputs
 		std::cout << "Reading image..." << std::endl;
 		Timer timer;
@@ -223,22 +413,123 @@ public:
 			std::string header;
 			int w, h, b;
 			ifs >> header;
-			if (strcmp(header.c_str(), "P6") != 0) throw("Can't read the input file - is it in binary format (Has P6 in the header)?");
+			const bool greyscale = strcmp(header.c_str(), "P5") == 0;
+			if (!greyscale && strcmp(header.c_str(), "P6") != 0) throw("Can't read the input file - is it in binary format (Has P6 or P5 in the header)?");
 			ifs >> w >> h >> b;
 			this->w = w;
 			this->h = h;
 			const unsigned int imageSize = w * h;
 			//calculate colour bit depth
-			this->setColourDepth((unsigned int)log2(pow(b + 1, 3)));
-
-			this->pixels = new Image::Rgb[w * h]; // this is throw an exception if bad_alloc 
+			//16-bit files are narrowed to the 8 bits an Image holds, PixelImage keeps them whole
+			this->setColourDepth((unsigned int)log2(pow(std::min(b, 255) + 1, greyscale ? 1 : 3)));
 			ifs.ignore(256, '\n'); // skip empty lines in necessary until we get to the binary data 
-			unsigned char pix[3]; // read each pixel one by one and convert bytes to floats 
-			for (unsigned int i = 0; i < imageSize; ++i) {
-				ifs.read(reinterpret_cast<char *>(pix), 3);
-				this->pixels[i].r = pix[0];
-				this->pixels[i].g = pix[1];
-				this->pixels[i].b = pix[2];
+
+			if (greyscale) {
+				//the samples are stored exactly as the monochrome layout keeps them
+				this->channels = 1;
+				allocatePixels();
+				readSamples(ifs, samples(), imageSize, b);
+				if (ifs.fail()) {
+					freeMemory();
+					throw("The input file is shorter than its header says");
+				}
+				if (!allowMonochrome) {
+					toColour();
+				}
+			} else {
+				this->channels = 3;
+				allocatePixels(); // this is throw an exception if bad_alloc 
+				if (b > 255) {
+					readSamples(ifs, samples(), (size_t)imageSize * 3, b);
+				} else {
+					unsigned char pix[3]; // read each pixel one by one and convert bytes to floats 
+					for (unsigned int i = 0; i < imageSize; ++i) {
+						ifs.read(reinterpret_cast<char *>(pix), 3);
+						this->pixels[i].r = pix[0];
+						this->pixels[i].g = pix[1];
+						this->pixels[i].b = pix[2];
+					}
+				}
+				//monochrome sensor data is often saved as colour, there is no need to process it three times
+				if (allowMonochrome) {
+					toMonochrome();
+				}
+			}
+			ifs.close();
+		} catch (const char *err) {
+			fprintf(stderr, "%s\n", err);
+			ifs.close();
+		}
+		this->setFileName(filename);
+		timer.stop();
+		cout << "\tFinished Reading in " << timer.getSeconds() << " seconds\n";
+	}
+
+	/// <summary>
+	/// Read only a rectangle of a ppm file, seeking past the rows and columns outside it
+	/// The image takes the size of the rectangle, pixels are left null if it cannot be read
+	/// Greyscale pgm files are read as colour, so row decoders always see r, g, b bytes
+	/// </summary>
+	/// <param name="filename">File path to read from</param>
+	/// <param name="left">x coordinate of the top left of the rectangle</param>
+	/// <param name="top">y coordinate of the top left of the rectangle</param>
+	/// <param name="width">width of the rectangle</param>
+	/// <param name="height">height of the rectangle</param>
+	/// <param name="decoder">decodes each row instead of copying the bytes, null to copy them</param>
+	void readPPMRegion(const char *filename, const unsigned int &left, const unsigned int &top, const unsigned int &width, const unsigned int &height, const RowDecoder *decoder = nullptr)
+	{
+		TRACE_ZONE_DETAIL("Load frame region", filename);
+		std::cout << "Reading image region..." << std::endl;
+		Timer timer;
+		timer.start();
+		std::ifstream ifs;
+		ifs.open(filename, std::ios::binary);
+		try {
+			if (ifs.fail()) {
+				throw("Can't open the input file - is it named correctly/is it in the right directory?");
+			}
+			std::string header;
+			int fileW, fileH, b;
+			ifs >> header;
+			const bool greyscale = strcmp(header.c_str(), "P5") == 0;
+			if (!greyscale && strcmp(header.c_str(), "P6") != 0) throw("Can't read the input file - is it in binary format (Has P6 or P5 in the header)?");
+			ifs >> fileW >> fileH >> b;
+			if (fileW <= 0 || fileH <= 0 || !regionInside(left, top, width, height, (unsigned int)fileW, (unsigned int)fileH)) {
+				throw("The region is outside the input image");
+			}
+			this->setColourDepth((unsigned int)log2(pow(std::min(b, 255) + 1, 3)));
+			ifs.ignore(256, '\n');
+			const std::streamoff dataStart = ifs.tellg();
+			const std::streamoff bytesPerPixel = (greyscale ? 1 : 3) * (b > 255 ? 2 : 1);
+			this->w = width;
+			this->h = height;
+			this->channels = 3;
+			allocatePixels();
+			//one row of the region at a time, the rest of the file is never read
+			std::vector<unsigned char> row((size_t)width * 3);
+			for (unsigned int y = 0; y < height; y++) {
+				ifs.seekg(dataStart + (((std::streamoff)(top + y) * fileW) + left) * bytesPerPixel);
+				readSamples(ifs, row.data(), (size_t)width * (greyscale ? 1 : 3), b);
+				if (greyscale) {
+					//spread the grey levels out to r, g, b from the end, so none is overwritten before it is copied
+					for (size_t x = width; x-- > 0;) {
+						row[x * 3] = row[x * 3 + 1] = row[x * 3 + 2] = row[x];
+					}
+				}
+				if (decoder != nullptr) {
+					(*decoder)(row.data(), this->pixels + (size_t)y * width, left, top + y, width);
+					continue;
+				}
+				for (unsigned int x = 0; x < width; x++) {
+					Image::Rgb &pixel = this->pixels[(size_t)y * width + x];
+					pixel.r = row[x * 3];
+					pixel.g = row[x * 3 + 1];
+					pixel.b = row[x * 3 + 2];
+				}
+			}
+			if (ifs.fail()) {
+				freeMemory();
+				throw("The input file is shorter than its header says");
 			}
 			ifs.close();
 		} catch (const char *err) {
@@ -254,47 +545,143 @@ public:
 	/// <summary>
 	/// Write data out to a ppm file
 	/// Constructs the header as above
+	/// A file name ending in .pgm is written as greyscale (P5), otherwise monochrome images are written as colour
 	/// </summary>
 	/// <param name="filename">File path to write to</param>
-	void writePPM(const char *filename)
+	/// <returns>true if the whole image was written</returns>
+	bool writePPM(const char *filename)
 	{
+		TRACE_ZONE_DETAIL("Write image", filename);
 		this->setFileName(filename);
 		std::cout << "\nWriting image..." << std::endl;
 		Timer timer;
 		timer.start();
-		if (this->w == 0 || this->h == 0) { fprintf(stderr, "Can't save an empty image\n"); return; }
+		if (this->w == 0 || this->h == 0) { fprintf(stderr, "Can't save an empty image\n"); return false; }
+		if (mapped != NULL && mapped->isFor(filename)) {
+			//the pixels were computed straight into the file, it is finished when they are released
+			cout << "\tAlready in the mapped output file\n";
+			return true;
+		}
 		std::ofstream ofs;
 		try {
+			//replace rather than overwrite, so a hard link to this file (e.g. in the result cache) keeps its contents
+			remove(filename);
 			ofs.open(filename, std::ios::binary); // need to specify binary mode for Windows users 
 			if (ofs.fail()) throw("Can't open output file");
-			ofs << "P6\n" << this->w << " " << this->h << "\n255\n";
-			unsigned char r, g, b;
-			// loop over each pixel in the image, clamp and convert to byte format
 			const unsigned int imageSize = this->w * this->h;
-			for (unsigned int i = 0; i < imageSize; ++i) {
-				r = std::min((unsigned char)255, this->pixels[i].r);
-				g = std::min((unsigned char)255, this->pixels[i].g);
-				b = std::min((unsigned char)255, this->pixels[i].b);
-				ofs << r << g << b;
+			const bool greyscale = hasExtension(filename, ".pgm");
+			if (greyscale && channels == 1) {
+				//the samples are already laid out as a greyscale file stores them
+				ofs << "P5\n" << this->w << " " << this->h << "\n255\n";
+				ofs.write(reinterpret_cast<const char *>(samples()), imageSize);
+			} else if (greyscale) {
+				//a colour image written as greyscale keeps the average of its channels
+				ofs << "P5\n" << this->w << " " << this->h << "\n255\n";
+				for (unsigned int i = 0; i < imageSize; ++i) {
+					unsigned char level = 0;
+					level += this->pixels[i];
+					ofs << level;
+				}
+			} else if (channels == 1) {
+				ofs << "P6\n" << this->w << " " << this->h << "\n255\n";
+				const unsigned char *levels = samples();
+				for (unsigned int i = 0; i < imageSize; ++i) {
+					ofs << levels[i] << levels[i] << levels[i];
+				}
+			} else {
+				ofs << "P6\n" << this->w << " " << this->h << "\n255\n";
+				unsigned char r, g, b;
+				// loop over each pixel in the image, clamp and convert to byte format
+				for (unsigned int i = 0; i < imageSize; ++i) {
+					r = std::min((unsigned char)255, this->pixels[i].r);
+					g = std::min((unsigned char)255, this->pixels[i].g);
+					b = std::min((unsigned char)255, this->pixels[i].b);
+					ofs << r << g << b;
+				}
 			}
 			ofs.close();
+			if (ofs.fail()) throw("Can't write output file - is the disk full?");
 			//Confirm image write
 			timer.stop();
 
 			cout << "\tFinished Writing in " << timer.getSeconds() << " seconds\n";
+			return true;
 		} catch (const char *err) {
 			fprintf(stderr, "%s\n", err);
 			ofs.close();
+			return false;
 		}
 	}
 
 
 
 protected:
-	char *fileName;
+	/// <summary>
+	/// Take a pixel array for the current size and channels from the buffer pool
+	/// The samples are left as they are, but the spare bytes at the end of a packed monochrome array
+	/// are zeroed so they are the same in every image of the size
+	/// </summary>
+	/// <param name="mappable">the array may be the output file of an open MappedOutputScope</param>
+	void allocatePixels(const bool &mappable = false) {
+		mapped = mappable ? MappedOutputScope::claim(w, h, channels, pixelBytes()) : NULL;
+		pixels = mapped != NULL ? reinterpret_cast<Rgb*>(mapped->pixels()) : BufferPool::acquire<Rgb>(storedPixels());
+		if (channels == 1) {
+			const size_t count = (size_t)w * h;
+			memset(samples() + count, 0, pixelBytes() - count);
+		}
+	}
+
+	/// <summary>
+	/// Read samples from a file, narrowing the two byte samples of files with a maxval above 255 to 8 bits
+	/// </summary>
+	/// <param name="ifs">file, at the first sample</param>
+	/// <param name="out">where to put the 8-bit samples</param>
+	/// <param name="count">number of samples</param>
+	/// <param name="maxval">maxval from the header</param>
+	static void readSamples(std::ifstream &ifs, unsigned char *out, const size_t &count, const int &maxval) {
+		if (maxval <= 255) {
+			ifs.read(reinterpret_cast<char *>(out), count);
+			return;
+		}
+		std::vector<unsigned char> wide(count * 2);
+		ifs.read(reinterpret_cast<char *>(wide.data()), wide.size());
+		for (size_t i = 0; i < count; i++) {
+			const unsigned int level = ((unsigned int)wide[2 * i] << 8) | wide[2 * i + 1];
+			out[i] = (unsigned char)std::min(255u, (level * 255u + maxval / 2) / maxval);
+		}
+	}
+
+	string fileName;
 	time_t creationTime;
 	time_t modifiedTime;
 	unsigned int colourDepth;
+	MemoryUsage memoryUsage; // peak memory of the operation that produced this image
+
+	/// <summary>
+	/// Build the details record shared by every kind of image
+	/// </summary>
+	/// <param name="category">kind of image, used as the heading</param>
+	/// <returns>record with the source, size, memory and times of this image</returns>
+	LogRecord detailsRecord(const string &category) const {
+		LogRecord record(LogLevel::Details, category);
+		record.add("Source Image", "source", fileName);
+		record.addNumber("Image Width", "width", w);
+		record.addNumber("Image Height", "height", h);
+		//the text log keeps the layout the details log has always had
+		record.addNumber("Colour Depth", "colourDepth", colourDepth).textLayout("Colour Depth: ", " bit\n");
+		record.addNumber("Channels", "channels", channels).jsonOnly();
+		record.addBytes("Image Size in memory", "pixelBytes", pixelBytes()).textLayout("Image Statistics: \n\tImage Size in memory: ", "\n");
+		if (memoryUsage.measured) {
+			record.addBytes("Peak Tracked Memory", "peakTrackedBytes", memoryUsage.trackedPeakBytes).textLayout("\tPeak Tracked Memory: ", "");
+			record.addBytes("Peak Tracked Memory above input", "peakTrackedExtraBytes", memoryUsage.trackedExtraBytes()).textLayout(" (", " above input)\n");
+			if (memoryUsage.residentPeakBytes > 0) {
+				record.addBytes("Peak Resident Memory", "peakResidentBytes", memoryUsage.residentPeakBytes).textLayout("\tPeak Resident Memory: ", "\n");
+			}
+		}
+		record.addTime("Created", "created", creationTime).textLayout("\tCreated: ", "");
+		record.addTime("Last Modified", "modified", modifiedTime).textLayout("\tLast Modified: ", "");
+		return record;
+	}
 };
 
 
@@ -324,6 +711,19 @@ public:
 		scalingMethod = _scalingMethod;
 	}
 	/// <summary>
+	/// Construct with the pixels left uninitialised, for scaling methods that write every output pixel
+	/// </summary>
+	/// <param name="_w">width</param>
+	/// <param name="_h">height</param>
+	/// <param name="_scaleFactor">scale factor multiplier</param>
+	/// <param name="_scalingMethod">method of scaling</param>
+	/// <param name="uninitialised">kUninitialised</param>
+	/// <param name="_channels">1 for monochrome, 3 for colour</param>
+	ScaledImage(const unsigned int &_w, const unsigned int &_h, double _scaleFactor, char* _scalingMethod, const Uninitialised &uninitialised, const unsigned int &_channels = 3) : Image(_w, _h, uninitialised, _channels) {
+		scaleFactor = _scaleFactor;
+		scalingMethod = _scalingMethod;
+	}
+	/// <summary>
 	/// Set scale factor value
 	/// </summary>
 	/// <param name="_scaleFactor">Scale factor to set</param>
@@ -342,20 +742,12 @@ public:
 	/// Write object details to log file
 	/// </summary>
 	void logDetails() {
-		ofstream logFile;
-		logFile.open("DetailsLog.txt", ios::app);
-		logFile << "\n======Scaled Image======\n";
-		logFile << "Source Image: " << fileName << "\n";
-		logFile << "Image Width: " << w << "\n";
-		logFile << "Image Height: " << h << "\n";
-		logFile << "Colour Depth: " << colourDepth << " bit\n";
-		logFile << "Image Statistics: " << "\n\tImage Size in memory: " << bytesToAppropriate(sizeof(pixels[0].r) * 3 * h * w + sizeof(h) + sizeof(w) + sizeof(fileName) + sizeof(scaleFactor) + sizeof(scalingMethod)).str() << "\n";
-		string createStr(ctime(&creationTime));
-		string modifStr(ctime(&modifiedTime));
-		logFile << "\tCreated: " << createStr << "\tLast Modified: " << modifStr;
-		logFile << "\tScale Factor: " << scaleFactor << "\n";
-		logFile << "========================\n";
-		logFile.close();
+		if (Logger::instance().isEnabled(LogLevel::Details)) {
+			LogRecord record = detailsRecord("Scaled Image");
+			record.addNumber("Scale Factor", "scaleFactor", scaleFactor).textLayout("\tScale Factor: ", "\n");
+			record.add("Scaling Method", "scalingMethod", scalingMethod).jsonOnly();
+			Logger::instance().log(std::move(record));
+		}
 	}
 };
 
@@ -381,6 +773,17 @@ public:
 	StackedImage(const unsigned int &_w, const unsigned int &_h, char* _stackingMethod, char *_fileName = "No Source File", const Rgb &c = kBlack) : Image(_w, _h, _fileName, c) {
 		stackingMethod = _stackingMethod;
 	}
+	/// <summary>
+	/// Constructor with the pixels left uninitialised, for stacking methods that write every output pixel
+	/// </summary>
+	/// <param name="_w">width</param>
+	/// <param name="_h">height</param>
+	/// <param name="_stackingMethod">method of stacking</param>
+	/// <param name="uninitialised">kUninitialised</param>
+	/// <param name="_channels">1 for monochrome, 3 for colour</param>
+	StackedImage(const unsigned int &_w, const unsigned int &_h, char* _stackingMethod, const Uninitialised &uninitialised, const unsigned int &_channels = 3) : Image(_w, _h, uninitialised, _channels) {
+		stackingMethod = _stackingMethod;
+	}
 
 	/// <summary>
 	/// Set the stacking method
@@ -402,20 +805,12 @@ public:
 	/// Logs object details to file
 	/// </summary>
 	void logDetails() {
-		ofstream logFile;
-		logFile.open("DetailsLog.txt", ios::app);
-		logFile << "\n======Stacked Image======\n";
-		logFile << "Source Image: " << fileName << "\n";
-		logFile << "Image Width: " << w << "\n";
-		logFile << "Image Height: " << h << "\n";
-		logFile << "Colour Depth: " << colourDepth << " bit\n";
-		logFile << "Image Statistics: " << "\n\tImage Size in memory: " << bytesToAppropriate(sizeof(pixels[0].r) * 3 * h*w + sizeof(h) + sizeof(w) + sizeof(fileName) + sizeof(stackingMethod)).str() << "\n";
-		string createStr(ctime(&creationTime));
-		string modifStr(ctime(&modifiedTime));
-		logFile << "\tCreated: " << createStr << "\tLast Modified: " << modifStr;
-		logFile << "\tStacking Method: " << stackingMethod << "\n";
-		logFile << "========================\n";
-		logFile.close();
+		if (Logger::instance().isEnabled(LogLevel::Details)) {
+			LogRecord record = detailsRecord("Stacked Image");
+			record.add("Stacking Method", "stackingMethod", stackingMethod).textLayout("\tStacking Method: ", "\n");
+			record.footer = string(24, '=');
+			Logger::instance().log(std::move(record));
+		}
 	}
 
 };
@@ -426,3 +821,4 @@ const Image::Rgb Image::kWhite = Image::Rgb(1);
 const Image::Rgb Image::kRed = Image::Rgb(1, 0, 0);
 const Image::Rgb Image::kGreen = Image::Rgb(0, 1, 0);
 const Image::Rgb Image::kBlue = Image::Rgb(0, 0, 1);
+const Image::Uninitialised Image::kUninitialised = Image::Uninitialised();
@@ -0,0 +1,338 @@
+#pragma once
+//*********************************************
+//Stack that frames can be added to one at a time, e.g. while they are being captured
+//Mean keeps running sums; median and sigma clipping keep every pixel's samples in sorted order,
+//so each new frame is one pass over the pixels rather than a restack of every frame.
+//The state can be saved and loaded again to carry on a stack later
+//*********************************************
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "Image.h"
+#include "Stacker.h"
+#include "Operations.h"
+#include "MemoryTracker.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+using namespace std;
+
+/// <summary>
+/// How an incremental stack combines its frames
+/// </summary>
+enum class StackMode {
+	Mean,
+	Median,
+	SigmaClippedMean
+};
+
+/// <summary>
+/// Persistent stacking state, updated as each frame is added
+/// </summary>
+class IncrementalStack {
+private:
+	//identifies a saved state file, and its layout version
+	static const uint32_t kMagic = 0x4B545349; // "ISTK"
+	static const uint32_t kVersion = 1;
+
+	StackMode mode;
+	unsigned int iterations; // sigma clipping only
+	float alpha; // sigma clipping only
+	unsigned int w = 0, h = 0;
+	unsigned int colourDepth = 24;
+	unsigned int frames = 0;
+	//mean: per channel sums of every frame
+	uint32_t *sums = nullptr;
+	//median and sigma: per channel runs of samples kept sorted, run i starts at i * capacity
+	unsigned char *samples = nullptr;
+	unsigned int capacity = 0;
+	StackedImage output;
+
+	size_t channelCount() const {
+		return (size_t)w * h * 3;
+	}
+
+	/// <summary>
+	/// Make room for at least one more sample per channel, doubling the space so growth stays cheap on average
+	/// </summary>
+	void reserveSample() {
+		if (frames < capacity) {
+			return;
+		}
+		const unsigned int grown = std::max(4u, capacity * 2);
+		unsigned char *larger = MemoryTracker::allocate<unsigned char>(channelCount() * grown);
+		const size_t channels = channelCount();
+		const unsigned int count = frames;
+		const unsigned int oldCapacity = capacity;
+		unsigned char *old = samples;
+		parallel_for(size_t(0), size_t(h), [&](size_t y) {
+			for (size_t c = y * w * 3; c < (y + 1) * w * 3; c++) {
+				memcpy(larger + c * grown, old + c * oldCapacity, count);
+			}
+		});
+		MemoryTracker::release(samples, channels * capacity);
+		samples = larger;
+		capacity = grown;
+	}
+
+	/// <summary>
+	/// Calculate one channel of the output from the state
+	/// </summary>
+	/// <param name="c">channel index, pixel * 3 + channel</param>
+	/// <param name="scratch">reusable buffer for sigma clipping</param>
+	/// <returns>stacked value</returns>
+	unsigned char channelValue(const size_t &c, Stacker::Samples &scratch) const {
+		if (mode == StackMode::Mean) {
+			return (unsigned char)((sums[c] + frames / 2) / frames);
+		}
+		const unsigned char *run = samples + c * capacity;
+		if (mode == StackMode::Median) {
+			//the same lower median as the median blends
+			return run[(frames - 1) / 2];
+		}
+		scratch.assign(run, run + frames);
+		return Stacker::clipAndAverage(scratch, iterations, alpha);
+	}
+
+	/// <summary>
+	/// Recalculate every output pixel from the state
+	/// </summary>
+	void refreshOutput() {
+		parallel_for(size_t(0), size_t(h), [this](size_t y) {
+			Stacker::Samples scratch;
+			for (size_t x = 0; x < w; x++) {
+				const size_t pixel = y * w + x;
+				output.pixels[pixel].r = channelValue(pixel * 3, scratch);
+				output.pixels[pixel].g = channelValue(pixel * 3 + 1, scratch);
+				output.pixels[pixel].b = channelValue(pixel * 3 + 2, scratch);
+			}
+		});
+		output.updateModified();
+	}
+
+	/// <summary>
+	/// Allocate the state and output for the first frame
+	/// </summary>
+	void start(const unsigned int &_w, const unsigned int &_h, const unsigned int &_colourDepth) {
+		w = _w;
+		h = _h;
+		colourDepth = _colourDepth;
+		output = StackedImage(w, h, methodName());
+		output.setColourDepth(colourDepth);
+		if (mode == StackMode::Mean) {
+			sums = MemoryTracker::allocate<uint32_t>(channelCount());
+			std::fill(sums, sums + channelCount(), 0u);
+		}
+	}
+
+public:
+	/// <summary>
+	/// Create an empty stack
+	/// </summary>
+	/// <param name="_mode">how frames are combined</param>
+	/// <param name="_iterations">sigma clipping iterations</param>
+	/// <param name="_alpha">sigma clipping multiplier</param>
+	IncrementalStack(const StackMode &_mode, const unsigned int &_iterations = kSigmaIterationsParallel, const float &_alpha = kSigmaAlpha)
+		: mode(_mode), iterations(_iterations), alpha(_alpha) {}
+
+	~IncrementalStack() {
+		clear();
+	}
+
+	IncrementalStack(const IncrementalStack&) = delete;
+	IncrementalStack& operator=(const IncrementalStack&) = delete;
+
+	/// <summary>
+	/// Release the state and output, leaving an empty stack
+	/// </summary>
+	void clear() {
+		MemoryTracker::release(sums, channelCount());
+		MemoryTracker::release(samples, channelCount() * capacity);
+		sums = nullptr;
+		samples = nullptr;
+		capacity = 0;
+		frames = 0;
+		output.freeMemory();
+		w = h = 0;
+	}
+
+	/// <summary>
+	/// Add a frame and update the output
+	/// </summary>
+	/// <param name="frame">frame to add, which is left untouched</param>
+	/// <param name="error">set to the reason if the frame cannot be added</param>
+	/// <returns>true if the frame was added</returns>
+	bool addFrame(const Image &frame, string &error) {
+		TRACE_ZONE_DETAIL("Add frame", frames);
+		if (frame.pixels == nullptr || frame.w == 0 || frame.h == 0) {
+			error = "the frame has no pixels";
+			return false;
+		}
+		if (frames == 0 && w == 0) {
+			start(frame.w, frame.h, const_cast<Image&>(frame).getColourDepth());
+		} else if (frame.w != w || frame.h != h) {
+			error = "the frame is " + to_string(frame.w) + "x" + to_string(frame.h) + " but the stack is " + to_string(w) + "x" + to_string(h);
+			return false;
+		}
+		if (mode != StackMode::Mean) {
+			reserveSample();
+		}
+		frames++;
+		parallel_for(size_t(0), size_t(h), [this, &frame](size_t y) {
+			Stacker::Samples scratch;
+			for (size_t x = 0; x < w; x++) {
+				const size_t pixel = y * w + x;
+				const unsigned char values[3] = { frame.pixels[pixel].r, frame.pixels[pixel].g, frame.pixels[pixel].b };
+				for (size_t channel = 0; channel < 3; channel++) {
+					const size_t c = pixel * 3 + channel;
+					if (mode == StackMode::Mean) {
+						sums[c] += values[channel];
+					} else {
+						//insert into the sorted run, runs are short so this is a few byte moves
+						unsigned char *run = samples + c * capacity;
+						unsigned int i = frames - 1;
+						while (i > 0 && run[i - 1] > values[channel]) {
+							run[i] = run[i - 1];
+							i--;
+						}
+						run[i] = values[channel];
+					}
+				}
+				output.pixels[pixel].r = channelValue(pixel * 3, scratch);
+				output.pixels[pixel].g = channelValue(pixel * 3 + 1, scratch);
+				output.pixels[pixel].b = channelValue(pixel * 3 + 2, scratch);
+			}
+		});
+		output.updateModified();
+		return true;
+	}
+
+	/// <summary>
+	/// Get the stacking mode used by a numbered stacking method, as in runStackingMethod
+	/// The parallel and serial versions of a method stack the same way
+	/// </summary>
+	/// <param name="method">numbered stacking method</param>
+	/// <returns>matching mode</returns>
+	static StackMode modeForMethod(const unsigned int &method) {
+		if (method == 2 || method == 4) {
+			return StackMode::Median;
+		}
+		return method == 3 || method == 5 ? StackMode::SigmaClippedMean : StackMode::Mean;
+	}
+
+	/// <summary>
+	/// Get how frames are combined
+	/// </summary>
+	StackMode getMode() const {
+		return mode;
+	}
+
+	/// <summary>
+	/// Get the number of frames added so far
+	/// </summary>
+	unsigned int getFrameCount() const {
+		return frames;
+	}
+
+	/// <summary>
+	/// Get the stacked image of every frame added so far
+	/// </summary>
+	/// <returns>the output, owned by the stack</returns>
+	StackedImage& getOutput() {
+		return output;
+	}
+
+	/// <summary>
+	/// Get the display name of the stacking mode
+	/// </summary>
+	char* methodName() const {
+		switch (mode) {
+		case StackMode::Mean: return "Incremental Mean Blend";
+		case StackMode::Median: return "Incremental Median Blend";
+		default: return "Incremental Sigma Clipped Mean";
+		}
+	}
+
+	/// <summary>
+	/// Save the state so the stack can be carried on later
+	/// </summary>
+	/// <param name="path">file to write</param>
+	/// <param name="error">set to the reason if saving fails</param>
+	/// <returns>true if saved</returns>
+	bool save(const string &path, string &error) const {
+		//write to a temporary file first so a failed save leaves the previous state intact
+		const string temporary = path + ".tmp";
+		ofstream out(temporary, ios::binary | ios::trunc);
+		const uint32_t header[] = { kMagic, kVersion, (uint32_t)mode, w, h, colourDepth, frames, iterations };
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(&alpha), sizeof(alpha));
+		if (frames > 0 && mode == StackMode::Mean) {
+			out.write(reinterpret_cast<const char*>(sums), channelCount() * sizeof(uint32_t));
+		} else if (frames > 0) {
+			//only the samples in use, so the file does not depend on the spare space
+			for (size_t c = 0; c < channelCount() && out; c++) {
+				out.write(reinterpret_cast<const char*>(samples + c * capacity), frames);
+			}
+		}
+		out.close();
+		if (out.fail()) {
+			remove(temporary.c_str());
+			error = "could not write " + path;
+			return false;
+		}
+		remove(path.c_str());
+		if (rename(temporary.c_str(), path.c_str()) != 0) {
+			error = "could not replace " + path;
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Replace this stack with a saved state
+	/// The stacking mode and sigma settings come from the file
+	/// </summary>
+	/// <param name="path">file written by save()</param>
+	/// <param name="error">set to the reason if loading fails</param>
+	/// <returns>true if loaded</returns>
+	bool load(const string &path, string &error) {
+		TRACE_ZONE_DETAIL("Load stack state", path.c_str());
+		ifstream in(path, ios::binary);
+		uint32_t header[8];
+		float savedAlpha = 0;
+		if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) || !in.read(reinterpret_cast<char*>(&savedAlpha), sizeof(savedAlpha))) {
+			error = "could not read " + path;
+			return false;
+		}
+		if (header[0] != kMagic || header[1] != kVersion || header[2] > (uint32_t)StackMode::SigmaClippedMean) {
+			error = path + " is not a stack state from this version";
+			return false;
+		}
+		clear();
+		mode = (StackMode)header[2];
+		iterations = header[7];
+		alpha = savedAlpha;
+		if (header[6] == 0) {
+			return true;
+		}
+		start(header[3], header[4], header[5]);
+		if (mode == StackMode::Mean) {
+			in.read(reinterpret_cast<char*>(sums), channelCount() * sizeof(uint32_t));
+		} else {
+			capacity = header[6];
+			samples = MemoryTracker::allocate<unsigned char>(channelCount() * capacity);
+			in.read(reinterpret_cast<char*>(samples), channelCount() * capacity);
+		}
+		frames = header[6];
+		if (!in) {
+			clear();
+			error = path + " is truncated";
+			return false;
+		}
+		refreshOutput();
+		return true;
+	}
+};
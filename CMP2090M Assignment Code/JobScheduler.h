@@ -0,0 +1,159 @@
+#pragma once
+//*********************************************
+//Runs independent jobs concurrently under a memory budget
+//Each running job has its own thread for reading and writing files, while its compute
+//goes to the shared parallel_for pool, so one job's I/O overlaps another job's compute
+//Memory figures logged per operation are process wide, so with several jobs running they include the other jobs' buffers
+//*********************************************
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/// <summary>
+/// A job submitted to the scheduler
+/// </summary>
+struct ScheduledJob {
+	string name;
+	unsigned long long estimatedBytes = 0; // memory the job is expected to need at its peak
+	unsigned long long inputPixels = 0; // pixels read by the job, for throughput reporting
+	function<bool(string &error)> run; // does the work, returns false and sets error on failure
+};
+
+/// <summary>
+/// Outcome and timings of one scheduled job
+/// </summary>
+struct JobReport {
+	size_t index = 0; // position of the job in the submitted list
+	string name;
+	bool started = false; // false if the batch stopped before the job was admitted
+	bool ok = false;
+	bool overBudget = false; // the job alone needed more than the budget, so it ran with nothing else
+	string error;
+	unsigned long long estimatedBytes = 0;
+	double queuedSeconds = 0.0; // from the start of the batch until the job was admitted
+	double runSeconds = 0.0;
+
+	/// <summary>
+	/// Get the time from submission to completion
+	/// </summary>
+	/// <returns>seconds</returns>
+	double latencySeconds() const {
+		return queuedSeconds + runSeconds;
+	}
+};
+
+/// <summary>
+/// Admits jobs in submission order while both a concurrency limit and a memory budget allow
+/// A job larger than the whole budget is still run, but only once nothing else is running
+/// </summary>
+class JobScheduler {
+private:
+	unsigned int maxConcurrent;
+	unsigned long long memoryBudget;
+	double wallSeconds = 0.0;
+
+public:
+	/// <summary>
+	/// Create a scheduler
+	/// </summary>
+	/// <param name="_maxConcurrent">most jobs to run at once</param>
+	/// <param name="_memoryBudget">total estimated bytes allowed for running jobs</param>
+	JobScheduler(const unsigned int &_maxConcurrent, const unsigned long long &_memoryBudget) : maxConcurrent(std::max(1u, _maxConcurrent)), memoryBudget(_memoryBudget) {}
+
+	/// <summary>
+	/// Run every job and wait for them all to finish
+	/// </summary>
+	/// <param name="jobs">jobs in the order they should be admitted</param>
+	/// <param name="stopOnError">stop admitting jobs after the first failure</param>
+	/// <param name="completed">called as each job finishes, one call at a time</param>
+	/// <returns>one report per job, in submission order</returns>
+	vector<JobReport> run(const vector<ScheduledJob> &jobs, const bool &stopOnError, const function<void(const JobReport&)> &completed) {
+		vector<JobReport> reports(jobs.size());
+		for (size_t i = 0; i < jobs.size(); i++) {
+			reports[i].index = i;
+			reports[i].name = jobs[i].name;
+			reports[i].estimatedBytes = jobs[i].estimatedBytes;
+		}
+		mutex lock;
+		condition_variable admitted;
+		size_t next = 0;
+		unsigned int running = 0;
+		unsigned long long reserved = 0;
+		bool stopping = false;
+		const chrono::steady_clock::time_point batchStart = chrono::steady_clock::now();
+
+		auto worker = [&]() {
+			unique_lock<mutex> guard(lock);
+			for (;;) {
+				//admit strictly in order, so a large job is not starved by smaller ones behind it
+				admitted.wait(guard, [&] {
+					return stopping || next >= jobs.size() || running == 0 || reserved + jobs[next].estimatedBytes <= memoryBudget;
+				});
+				if (stopping || next >= jobs.size()) {
+					return;
+				}
+				const size_t index = next++;
+				const ScheduledJob &job = jobs[index];
+				JobReport &report = reports[index];
+				report.started = true;
+				report.overBudget = job.estimatedBytes > memoryBudget;
+				reserved += job.estimatedBytes;
+				running++;
+				const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				report.queuedSeconds = chrono::duration<double>(start - batchStart).count();
+				guard.unlock();
+
+				string error;
+				bool ok = false;
+				try {
+					ok = job.run(error);
+				} catch (const exception &e) {
+					error = e.what();
+				} catch (...) {
+					error = "unexpected error";
+				}
+				const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+				guard.lock();
+				report.ok = ok;
+				report.error = error;
+				report.runSeconds = seconds;
+				reserved -= job.estimatedBytes;
+				running--;
+				if (!ok && stopOnError) {
+					stopping = true;
+				}
+				completed(report);
+				admitted.notify_all();
+			}
+		};
+
+		//one thread per job slot, each takes the next admitted job in turn
+		vector<thread> workers;
+		const size_t slots = std::min((size_t)maxConcurrent, jobs.size());
+		for (size_t i = 0; i < slots; i++) {
+			workers.emplace_back(worker);
+		}
+		for (thread &t : workers) {
+			t.join();
+		}
+		wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - batchStart).count();
+		return reports;
+	}
+
+	/// <summary>
+	/// Get how long the last batch took from start to the last job finishing
+	/// </summary>
+	/// <returns>seconds</returns>
+	double getWallSeconds() const {
+		return wallSeconds;
+	}
+};
@@ -0,0 +1,301 @@
+#pragma once
+//*********************************************
+//Local socket transport for the job daemon
+//Requests and replies are single lines of text (JSON) over a Unix domain socket,
+//which Windows 10 (1803 and later) also supports through afunix.h
+//*********************************************
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET SocketHandle;
+const SocketHandle kNoSocket = INVALID_SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int SocketHandle;
+const SocketHandle kNoSocket = -1;
+#endif
+
+using namespace std;
+
+/// <summary>
+/// One end of a connected local socket, read and written a line at a time
+/// </summary>
+class SocketConnection {
+private:
+	SocketHandle handle;
+	string buffered; // received text after the last complete line
+
+public:
+	/// <summary>
+	/// Wrap a connected socket, which is closed with this object
+	/// </summary>
+	/// <param name="_handle">connected socket</param>
+	SocketConnection(const SocketHandle &_handle = kNoSocket) : handle(_handle) {}
+
+	~SocketConnection() {
+		close();
+	}
+
+	SocketConnection(const SocketConnection&) = delete;
+	SocketConnection& operator=(const SocketConnection&) = delete;
+
+	/// <summary>
+	/// Connect to a server
+	/// </summary>
+	/// <param name="path">socket path the server listens on</param>
+	/// <param name="error">set to the reason if connecting fails</param>
+	/// <returns>true if connected</returns>
+	bool connectTo(const string &path, string &error) {
+		close();
+		if (!startSockets(error)) {
+			return false;
+		}
+		sockaddr_un address;
+		if (!makeAddress(path, address, error)) {
+			return false;
+		}
+		handle = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (handle == kNoSocket) {
+			error = "could not create a socket";
+			return false;
+		}
+		if (connect(handle, (sockaddr*)&address, sizeof(address)) != 0) {
+			close();
+			error = "no daemon is listening on " + path;
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Send one line, a newline is added
+	/// </summary>
+	/// <param name="line">text without a newline</param>
+	/// <returns>false if the other end has gone</returns>
+	bool sendLine(const string &line) {
+		const string message = line + "\n";
+		size_t sent = 0;
+		while (sent < message.size()) {
+			const int result = (int)send(handle, message.data() + sent, (int)(message.size() - sent), kSendFlags);
+			if (result <= 0) {
+				return false;
+			}
+			sent += result;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Wait for the next line
+	/// </summary>
+	/// <param name="line">set to the line, without its newline</param>
+	/// <returns>false once the other end has closed the connection</returns>
+	bool receiveLine(string &line) {
+		for (;;) {
+			const size_t end = buffered.find('\n');
+			if (end != string::npos) {
+				line = buffered.substr(0, end);
+				buffered.erase(0, end + 1);
+				return true;
+			}
+			char chunk[4096];
+			const int received = (int)recv(handle, chunk, sizeof(chunk), 0);
+			if (received <= 0) {
+				return false;
+			}
+			buffered.append(chunk, received);
+		}
+	}
+
+	/// <summary>
+	/// Close the connection
+	/// </summary>
+	void close() {
+		if (handle != kNoSocket) {
+			closeHandle(handle);
+			handle = kNoSocket;
+		}
+	}
+
+	/// <summary>
+	/// Start the socket library, needed once per process on Windows
+	/// </summary>
+	/// <param name="error">set to the reason if it cannot be started</param>
+	/// <returns>true if sockets can be used</returns>
+	static bool startSockets(string &error) {
+#ifdef _WIN32
+		static const int started = [] {
+			WSADATA data;
+			return WSAStartup(MAKEWORD(2, 2), &data);
+		}();
+		if (started != 0) {
+			error = "could not start Windows sockets";
+			return false;
+		}
+#else
+		//sockets need no start up elsewhere
+		(void)error;
+#endif
+		return true;
+	}
+
+	/// <summary>
+	/// Fill in the address of a socket path
+	/// </summary>
+	/// <param name="path">socket path</param>
+	/// <param name="address">set to the address</param>
+	/// <param name="error">set to the reason if the path is too long</param>
+	/// <returns>true if the path fits</returns>
+	static bool makeAddress(const string &path, sockaddr_un &address, string &error) {
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+			error = "socket path must be between 1 and " + to_string(sizeof(address.sun_path) - 1) + " characters";
+			return false;
+		}
+		memcpy(address.sun_path, path.c_str(), path.size());
+		return true;
+	}
+
+	/// <summary>
+	/// Close a socket handle
+	/// </summary>
+	/// <param name="socketHandle">socket to close</param>
+	static void closeHandle(const SocketHandle &socketHandle) {
+#ifdef _WIN32
+		closesocket(socketHandle);
+#else
+		::close(socketHandle);
+#endif
+	}
+
+private:
+#if defined(_WIN32) || !defined(MSG_NOSIGNAL)
+	static const int kSendFlags = 0;
+#else
+	//a client that disconnects early must not kill the daemon with SIGPIPE
+	static const int kSendFlags = MSG_NOSIGNAL;
+#endif
+};
+
+/// <summary>
+/// Accepts connections on a local socket and passes each request line to a handler
+/// Each connection is served on its own thread, so one slow client does not block the others
+/// </summary>
+class JobServer {
+public:
+	//sends one reply line back to the client that made the request
+	typedef function<void(const string &line)> Reply;
+	//handles one request line, returns false to stop the server
+	typedef function<bool(const string &request, const Reply &reply)> Handler;
+
+	/// <summary>
+	/// Serve requests until a handler asks to stop
+	/// Returns once every connected client has disconnected
+	/// </summary>
+	/// <param name="path">socket path to listen on, a stale socket file is replaced</param>
+	/// <param name="handler">called for every request line</param>
+	/// <param name="error">set to the reason if the server cannot start</param>
+	/// <param name="listening">called once the socket is ready for clients</param>
+	/// <returns>true if the server ran and was stopped</returns>
+	static bool serve(const string &path, const Handler &handler, string &error, const function<void()> &listening = nullptr) {
+		if (!SocketConnection::startSockets(error)) {
+			return false;
+		}
+		sockaddr_un address;
+		if (!SocketConnection::makeAddress(path, address, error)) {
+			return false;
+		}
+		//refuse to take over from a daemon that is still running
+		SocketConnection probe;
+		string probeError;
+		if (probe.connectTo(path, probeError)) {
+			error = "a daemon is already listening on " + path;
+			return false;
+		}
+		remove(path.c_str());
+
+		const SocketHandle listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener == kNoSocket) {
+			error = "could not create a socket";
+			return false;
+		}
+		if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+			SocketConnection::closeHandle(listener);
+			error = "could not listen on " + path;
+			return false;
+		}
+
+		if (listening) {
+			listening();
+		}
+		atomic<bool> stopping(false);
+		//connection threads are detached, so a long running daemon does not collect finished threads
+		mutex activeLock;
+		condition_variable idle;
+		unsigned int active = 0;
+		for (;;) {
+			const SocketHandle client = accept(listener, nullptr, nullptr);
+			if (stopping) {
+				if (client != kNoSocket) {
+					SocketConnection::closeHandle(client);
+				}
+				break;
+			}
+			if (client == kNoSocket) {
+				continue;
+			}
+			{
+				lock_guard<mutex> guard(activeLock);
+				active++;
+			}
+			thread([client, &handler, &stopping, &path, &activeLock, &idle, &active] {
+				SocketConnection connection(client);
+				mutex sendLock;
+				const Reply reply = [&connection, &sendLock](const string &line) {
+					lock_guard<mutex> guard(sendLock);
+					connection.sendLine(line);
+				};
+				string request;
+				while (!stopping && connection.receiveLine(request)) {
+					if (!handler(request, reply)) {
+						stopping = true;
+						//wake the accept loop with a connection of our own
+						SocketConnection wake;
+						string ignored;
+						wake.connectTo(path, ignored);
+						break;
+					}
+				}
+				connection.close();
+				lock_guard<mutex> guard(activeLock);
+				active--;
+				idle.notify_all();
+			}).detach();
+		}
+		unique_lock<mutex> guard(activeLock);
+		idle.wait(guard, [&active] { return active == 0; });
+		SocketConnection::closeHandle(listener);
+		remove(path.c_str());
+		return true;
+	}
+};
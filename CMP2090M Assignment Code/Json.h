@@ -0,0 +1,251 @@
+#pragma once
+//*********************************************
+//Minimal JSON reader, enough for job manifests and request messages
+//Parses the whole document into a tree of JsonValues, errors are thrown as runtime_error
+//*********************************************
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+/// <summary>
+/// A parsed JSON value
+/// </summary>
+class JsonValue {
+public:
+	enum Type { Null, Boolean, Number, String, Array, Object };
+
+	Type type = Null;
+	bool boolean = false;
+	double number = 0.0;
+	string text;
+	vector<JsonValue> items; // elements of an array
+	vector<pair<string, JsonValue>> members; // members of an object, in document order
+
+	/// <summary>
+	/// Parse a JSON document
+	/// </summary>
+	/// <param name="document">JSON text</param>
+	/// <returns>root value</returns>
+	static JsonValue parse(const string &document) {
+		size_t position = 0;
+		JsonValue value = parseValue(document, position, 0);
+		skipWhitespace(document, position);
+		if (position != document.size()) {
+			fail("unexpected text after the document", position);
+		}
+		return value;
+	}
+
+	/// <summary>
+	/// Read and parse a JSON file
+	/// </summary>
+	/// <param name="path">file to read</param>
+	/// <returns>root value</returns>
+	static JsonValue parseFile(const string &path) {
+		ifstream in(path, ios::binary);
+		if (in.fail()) {
+			throw runtime_error("cannot open " + path);
+		}
+		stringstream content;
+		content << in.rdbuf();
+		return parse(content.str());
+	}
+
+	/// <summary>
+	/// Find a member of an object
+	/// </summary>
+	/// <param name="key">member name</param>
+	/// <returns>the member, or null if this is not an object or has no such member</returns>
+	const JsonValue* find(const string &key) const {
+		for (const pair<string, JsonValue> &member : members) {
+			if (member.first == key) {
+				return &member.second;
+			}
+		}
+		return nullptr;
+	}
+
+	bool isNull() const { return type == Null; }
+	bool isBoolean() const { return type == Boolean; }
+	bool isNumber() const { return type == Number; }
+	bool isString() const { return type == String; }
+	bool isArray() const { return type == Array; }
+	bool isObject() const { return type == Object; }
+
+private:
+	//deeply nested documents are rejected rather than overflowing the stack
+	static const unsigned int kMaxDepth = 64;
+
+	/// <summary>
+	/// Throw a parse error
+	/// </summary>
+	/// <param name="message">what went wrong</param>
+	/// <param name="position">offset in the document</param>
+	static void fail(const string &message, const size_t &position) {
+		throw runtime_error("JSON " + message + " at offset " + to_string(position));
+	}
+
+	static void skipWhitespace(const string &s, size_t &i) {
+		while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r')) {
+			i++;
+		}
+	}
+
+	/// <summary>
+	/// Parse the value starting at a position, leaving the position after it
+	/// </summary>
+	static JsonValue parseValue(const string &s, size_t &i, const unsigned int &depth) {
+		if (depth > kMaxDepth) {
+			fail("is nested too deeply", i);
+		}
+		skipWhitespace(s, i);
+		if (i >= s.size()) {
+			fail("ended unexpectedly", i);
+		}
+		JsonValue value;
+		const char c = s[i];
+		if (c == '{') {
+			value.type = Object;
+			i++;
+			skipWhitespace(s, i);
+			if (i < s.size() && s[i] == '}') {
+				i++;
+				return value;
+			}
+			for (;;) {
+				skipWhitespace(s, i);
+				if (i >= s.size() || s[i] != '"') {
+					fail("expected a member name", i);
+				}
+				string key = parseString(s, i);
+				skipWhitespace(s, i);
+				if (i >= s.size() || s[i] != ':') {
+					fail("expected ':'", i);
+				}
+				i++;
+				value.members.push_back(make_pair(key, parseValue(s, i, depth + 1)));
+				skipWhitespace(s, i);
+				if (i < s.size() && s[i] == ',') {
+					i++;
+				} else if (i < s.size() && s[i] == '}') {
+					i++;
+					return value;
+				} else {
+					fail("expected ',' or '}'", i);
+				}
+			}
+		}
+		if (c == '[') {
+			value.type = Array;
+			i++;
+			skipWhitespace(s, i);
+			if (i < s.size() && s[i] == ']') {
+				i++;
+				return value;
+			}
+			for (;;) {
+				value.items.push_back(parseValue(s, i, depth + 1));
+				skipWhitespace(s, i);
+				if (i < s.size() && s[i] == ',') {
+					i++;
+				} else if (i < s.size() && s[i] == ']') {
+					i++;
+					return value;
+				} else {
+					fail("expected ',' or ']'", i);
+				}
+			}
+		}
+		if (c == '"') {
+			value.type = String;
+			value.text = parseString(s, i);
+			return value;
+		}
+		if (s.compare(i, 4, "true") == 0) {
+			value.type = Boolean;
+			value.boolean = true;
+			i += 4;
+			return value;
+		}
+		if (s.compare(i, 5, "false") == 0) {
+			value.type = Boolean;
+			i += 5;
+			return value;
+		}
+		if (s.compare(i, 4, "null") == 0) {
+			i += 4;
+			return value;
+		}
+		if (c == '-' || (c >= '0' && c <= '9')) {
+			const char *start = s.c_str() + i;
+			char *end = nullptr;
+			value.type = Number;
+			value.number = strtod(start, &end);
+			i += end - start;
+			return value;
+		}
+		fail("unexpected character", i);
+		return value;
+	}
+
+	/// <summary>
+	/// Parse a string literal starting at the opening quote
+	/// </summary>
+	static string parseString(const string &s, size_t &i) {
+		string result;
+		i++;
+		while (i < s.size() && s[i] != '"') {
+			char c = s[i++];
+			if (c != '\\') {
+				result += c;
+				continue;
+			}
+			if (i >= s.size()) {
+				break;
+			}
+			c = s[i++];
+			switch (c) {
+			case 'n': result += '\n'; break;
+			case 't': result += '\t'; break;
+			case 'r': result += '\r'; break;
+			case 'b': result += '\b'; break;
+			case 'f': result += '\f'; break;
+			case 'u': {
+				if (i + 4 > s.size()) {
+					fail("has a short unicode escape", i);
+				}
+				const unsigned int code = (unsigned int)strtoul(s.substr(i, 4).c_str(), nullptr, 16);
+				i += 4;
+				//encode as UTF-8, surrogate pairs are not combined
+				if (code < 0x80) {
+					result += (char)code;
+				} else if (code < 0x800) {
+					result += (char)(0xC0 | (code >> 6));
+					result += (char)(0x80 | (code & 0x3F));
+				} else {
+					result += (char)(0xE0 | (code >> 12));
+					result += (char)(0x80 | ((code >> 6) & 0x3F));
+					result += (char)(0x80 | (code & 0x3F));
+				}
+				break;
+			}
+			default:
+				//quote, backslash and slash stand for themselves
+				result += c;
+				break;
+			}
+		}
+		if (i >= s.size()) {
+			fail("has an unterminated string", i);
+		}
+		i++;
+		return result;
+	}
+};
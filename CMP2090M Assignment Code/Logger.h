@@ -0,0 +1,446 @@
+#pragma once
+//*********************************************
+//Asynchronous logging of structured records
+//Callers push records onto a lock-free queue and return straight away, taking a lock only to wake
+//the writer when it is asleep; a single background thread formats them and writes them in batches
+//to the text details log and, optionally, a JSON lines file
+//*********************************************
+
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Utils.h"
+
+using namespace std;
+
+/// <summary>
+/// Importance of a log record, records below the logger's level are discarded
+/// </summary>
+enum class LogLevel {
+	Debug,
+	Details, // image details, as written to DetailsLog.txt
+	Info,
+	Warning,
+	Error,
+	Off
+};
+
+/// <summary>
+/// Get the name of a log level
+/// </summary>
+/// <param name="level">level to name</param>
+/// <returns>lower case name</returns>
+const char* logLevelName(const LogLevel &level) {
+	switch (level) {
+	case LogLevel::Debug: return "debug";
+	case LogLevel::Details: return "details";
+	case LogLevel::Info: return "info";
+	case LogLevel::Warning: return "warning";
+	case LogLevel::Error: return "error";
+	default: return "off";
+	}
+}
+
+/// <summary>
+/// Parse a log level name
+/// </summary>
+/// <param name="name">name as returned by logLevelName</param>
+/// <param name="level">set to the parsed level</param>
+/// <returns>true if the name was recognised</returns>
+bool parseLogLevel(const string &name, LogLevel &level) {
+	const LogLevel levels[] = { LogLevel::Debug, LogLevel::Details, LogLevel::Info, LogLevel::Warning, LogLevel::Error, LogLevel::Off };
+	for (const LogLevel &l : levels) {
+		if (name == logLevelName(l)) {
+			level = l;
+			return true;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// One named value in a log record
+/// </summary>
+struct LogField {
+	enum Type { Text, Number, Time, Bytes };
+	string label; // shown in the text log, e.g. Image Width
+	string key; // used in JSON output, e.g. width
+	string value; // text, number, seconds since the epoch or a byte count
+	Type type;
+	bool inText = true; // false for values only written as JSON
+	bool customText = false; // written to the text log between textPrefix and textSuffix rather than as "label: value"
+	string textPrefix;
+	string textSuffix;
+
+	LogField(const string &_label, const string &_key, const string &_value, const Type &_type) : label(_label), key(_key), value(_value), type(_type) {}
+};
+
+/// <summary>
+/// A structured log record
+/// Values are stored unformatted so the cost of formatting falls on the writer thread
+/// </summary>
+struct LogRecord {
+	LogLevel level = LogLevel::Info;
+	time_t time = 0;
+	string category; // e.g. Stacked Image
+	string message;
+	vector<LogField> fields;
+	string footer; // closing line of the text log, empty for a line of = as long as the heading
+
+	/// <summary>
+	/// Create a record stamped with the current time
+	/// </summary>
+	/// <param name="_level">importance</param>
+	/// <param name="_category">what the record describes</param>
+	/// <param name="_message">optional free text</param>
+	LogRecord(const LogLevel &_level = LogLevel::Info, const string &_category = "", const string &_message = "") : level(_level), category(_category), message(_message) {
+		time = std::time(nullptr);
+	}
+
+	/// <summary>
+	/// Add a text value
+	/// </summary>
+	/// <param name="label">name shown in the text log</param>
+	/// <param name="key">name used in JSON</param>
+	/// <param name="value">value</param>
+	/// <returns>this record, so calls can be chained</returns>
+	LogRecord& add(const string &label, const string &key, const string &value) {
+		fields.push_back({ label, key, value, LogField::Text });
+		return *this;
+	}
+
+	/// <summary>
+	/// Add a numeric value
+	/// </summary>
+	/// <param name="label">name shown in the text log</param>
+	/// <param name="key">name used in JSON</param>
+	/// <param name="value">value</param>
+	/// <returns>this record, so calls can be chained</returns>
+	LogRecord& addNumber(const string &label, const string &key, const double &value) {
+		std::ostringstream text;
+		text << value;
+		fields.push_back({ label, key, text.str(), LogField::Number });
+		return *this;
+	}
+
+	/// <summary>
+	/// Add a size in bytes, shown with a suitable unit in the text log
+	/// </summary>
+	/// <param name="label">name shown in the text log</param>
+	/// <param name="key">name used in JSON</param>
+	/// <param name="value">number of bytes</param>
+	/// <returns>this record, so calls can be chained</returns>
+	LogRecord& addBytes(const string &label, const string &key, const unsigned long long &value) {
+		fields.push_back({ label, key, to_string(value), LogField::Bytes });
+		return *this;
+	}
+
+	/// <summary>
+	/// Add a time, formatted by the writer thread
+	/// </summary>
+	/// <param name="label">name shown in the text log</param>
+	/// <param name="key">name used in JSON</param>
+	/// <param name="value">time to add</param>
+	/// <returns>this record, so calls can be chained</returns>
+	LogRecord& addTime(const string &label, const string &key, const time_t &value) {
+		fields.push_back({ label, key, to_string((long long)value), LogField::Time });
+		return *this;
+	}
+
+	/// <summary>
+	/// Set how the last value added is laid out in the text log, e.g. to keep the layout of an existing log
+	/// </summary>
+	/// <param name="prefix">written before the value, in place of "label: "</param>
+	/// <param name="suffix">written after the value, including any line break</param>
+	/// <returns>this record, so calls can be chained</returns>
+	LogRecord& textLayout(const string &prefix, const string &suffix) {
+		fields.back().customText = true;
+		fields.back().textPrefix = prefix;
+		fields.back().textSuffix = suffix;
+		return *this;
+	}
+
+	/// <summary>
+	/// Leave the last value added out of the text log, it is only written as JSON
+	/// </summary>
+	/// <returns>this record, so calls can be chained</returns>
+	LogRecord& jsonOnly() {
+		fields.back().inText = false;
+		return *this;
+	}
+};
+
+/// <summary>
+/// Process wide asynchronous logger
+/// Logging never blocks on file I/O: records are handed to a background writer through a lock-free queue
+/// </summary>
+class Logger {
+private:
+	/// <summary>
+	/// Queue node, the queue always holds one node whose record has already been taken
+	/// </summary>
+	struct Node {
+		atomic<Node*> next;
+		LogRecord record;
+		Node() : next(nullptr) {}
+	};
+
+	//multiple producer, single consumer queue (Vyukov): producers swap the head, the writer follows the tail
+	atomic<Node*> head;
+	Node *tail;
+	atomic<unsigned long long> enqueued;
+	atomic<unsigned long long> written;
+	atomic<int> level;
+
+	mutex lock; // guards the sinks, held by the writer while it writes a batch
+	mutex sleepLock; // guards the writer's sleep, held only briefly, so a producer waking the writer never waits for file I/O
+	condition_variable wake; // the writer waits on it with sleepLock
+	condition_variable drained; // flush() waits on it with sleepLock
+	atomic<bool> sleeping; // the writer is waiting, or about to wait, for records
+	bool stopping = false; // guarded by sleepLock
+	string textPath = "DetailsLog.txt";
+	string jsonPath;
+	ofstream textFile;
+	ofstream jsonFile;
+	thread writer;
+
+	Logger() : enqueued(0), written(0), level((int)LogLevel::Details), sleeping(false) {
+		Node *stub = new Node();
+		head = stub;
+		tail = stub;
+		writer = thread([this] { writerLoop(); });
+	}
+
+	/// <summary>
+	/// Take the oldest record off the queue, called only by the writer thread
+	/// </summary>
+	/// <param name="record">set to the record taken</param>
+	/// <returns>false if the queue is empty</returns>
+	bool pop(LogRecord &record) {
+		Node *next = tail->next.load(memory_order_acquire);
+		if (next == nullptr) {
+			return false;
+		}
+		record = std::move(next->record);
+		delete tail;
+		tail = next;
+		return true;
+	}
+
+	/// <summary>
+	/// Write one record to the text log, in the same layout as the original details log
+	/// </summary>
+	/// <param name="record">record to write</param>
+	void writeText(const LogRecord &record) {
+		if (!textFile.is_open()) {
+			textFile.open(textPath, ios::app);
+		}
+		if (record.fields.empty()) {
+			//plain message
+			string stamp(ctime(&record.time));
+			stamp.pop_back();
+			textFile << stamp << " [" << logLevelName(record.level) << "] " << record.category << (record.category.empty() ? "" : ": ") << record.message << "\n";
+			return;
+		}
+		const string banner = "======" + record.category + "======";
+		textFile << "\n" << banner << "\n";
+		if (!record.message.empty()) {
+			textFile << record.message << "\n";
+		}
+		for (const LogField &field : record.fields) {
+			if (!field.inText) {
+				continue;
+			}
+			textFile << (field.customText ? field.textPrefix : field.label + ": ");
+			if (field.type == LogField::Time) {
+				//ctime ends the line itself
+				const time_t value = (time_t)stoll(field.value);
+				textFile << ctime(&value);
+			} else if (field.type == LogField::Bytes) {
+				textFile << bytesToAppropriate(stoull(field.value)).str();
+			} else {
+				textFile << field.value;
+			}
+			if (field.customText) {
+				textFile << field.textSuffix;
+			} else if (field.type != LogField::Time) {
+				textFile << "\n";
+			}
+		}
+		textFile << (record.footer.empty() ? string(banner.size(), '=') : record.footer) << "\n";
+	}
+
+	/// <summary>
+	/// Write one record as a line of JSON
+	/// </summary>
+	/// <param name="record">record to write</param>
+	void writeJson(const LogRecord &record) {
+		if (!jsonFile.is_open()) {
+			jsonFile.open(jsonPath, ios::app);
+		}
+		jsonFile << "{\"time\": " << (long long)record.time << ", \"level\": \"" << logLevelName(record.level)
+			<< "\", \"category\": \"" << jsonEscape(record.category) << "\"";
+		if (!record.message.empty()) {
+			jsonFile << ", \"message\": \"" << jsonEscape(record.message) << "\"";
+		}
+		for (const LogField &field : record.fields) {
+			jsonFile << ", \"" << jsonEscape(field.key) << "\": ";
+			if (field.type == LogField::Text) {
+				jsonFile << "\"" << jsonEscape(field.value) << "\"";
+			} else if (field.type == LogField::Number && !std::isfinite(strtod(field.value.c_str(), nullptr))) {
+				//JSON has no NaN or infinity
+				jsonFile << "null";
+			} else {
+				jsonFile << field.value;
+			}
+		}
+		jsonFile << "}\n";
+	}
+
+	/// <summary>
+	/// Writer thread body: sleep until records are queued, then write everything queued
+	/// </summary>
+	void writerLoop() {
+		for (;;) {
+			bool stop;
+			{
+				unique_lock<mutex> guard(sleepLock);
+				//announced before the queue is checked, so a producer either sees the flag or its record is seen here
+				sleeping = true;
+				wake.wait(guard, [this] { return stopping || tail->next.load() != nullptr; });
+				sleeping = false;
+				stop = stopping;
+			}
+			LogRecord record;
+			unsigned long long count = 0;
+			{
+				lock_guard<mutex> guard(lock);
+				while (pop(record)) {
+					if (!textPath.empty()) {
+						writeText(record);
+					}
+					if (!jsonPath.empty()) {
+						writeJson(record);
+					}
+					count++;
+				}
+				if (count > 0) {
+					//one flush per batch rather than per record
+					textFile.flush();
+					jsonFile.flush();
+				}
+			}
+			{
+				lock_guard<mutex> guard(sleepLock);
+				written += count;
+			}
+			drained.notify_all();
+			if (stop && tail->next.load() == nullptr) {
+				return;
+			}
+		}
+	}
+
+public:
+	~Logger() {
+		{
+			lock_guard<mutex> guard(sleepLock);
+			stopping = true;
+		}
+		wake.notify_one();
+		writer.join();
+		delete tail;
+	}
+
+	Logger(const Logger&) = delete;
+	Logger& operator=(const Logger&) = delete;
+
+	/// <summary>
+	/// Get the shared logger, starting its writer thread on first use
+	/// </summary>
+	/// <returns>the logger</returns>
+	static Logger& instance() {
+		static Logger logger;
+		return logger;
+	}
+
+	/// <summary>
+	/// Set the lowest level that is recorded
+	/// </summary>
+	/// <param name="_level">minimum level, Off to discard everything</param>
+	void setLevel(const LogLevel &_level) {
+		level = (int)_level;
+	}
+
+	/// <summary>
+	/// Check whether records of a level will be kept, so callers can skip building them
+	/// </summary>
+	/// <param name="_level">level to check</param>
+	/// <returns>true if records of this level are written</returns>
+	bool isEnabled(const LogLevel &_level) const {
+		return _level != LogLevel::Off && (int)_level >= level.load(memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Choose the output files, waiting for records already queued to be written to the old ones
+	/// </summary>
+	/// <param name="_textPath">text log to append to, empty for none</param>
+	/// <param name="_jsonPath">JSON lines file to append to, empty for none</param>
+	void setOutputs(const string &_textPath, const string &_jsonPath) {
+		flush();
+		lock_guard<mutex> guard(lock);
+		textFile.close();
+		jsonFile.close();
+		textPath = _textPath;
+		jsonPath = _jsonPath;
+	}
+
+	/// <summary>
+	/// Queue a record for writing, returns without waiting for any I/O
+	/// </summary>
+	/// <param name="record">record to write</param>
+	void log(LogRecord record) {
+		if (!isEnabled(record.level)) {
+			return;
+		}
+		Node *node = new Node();
+		node->record = std::move(record);
+		enqueued++;
+		Node *previous = head.exchange(node, memory_order_acq_rel);
+		//sequentially consistent with the writer's sleeping flag, so the record is never left queued with the writer asleep
+		previous->next.store(node);
+		if (sleeping.load()) {
+			//taking the lock waits until the writer is actually waiting, so the notification cannot be missed
+			lock_guard<mutex> guard(sleepLock);
+			wake.notify_one();
+		}
+	}
+
+	/// <summary>
+	/// Queue a plain message
+	/// </summary>
+	/// <param name="_level">importance</param>
+	/// <param name="category">where the message comes from</param>
+	/// <param name="message">text of the message</param>
+	void log(const LogLevel &_level, const string &category, const string &message) {
+		if (isEnabled(_level)) {
+			log(LogRecord(_level, category, message));
+		}
+	}
+
+	/// <summary>
+	/// Wait until every record queued so far has been written, e.g. before exiting
+	/// </summary>
+	void flush() {
+		const unsigned long long target = enqueued.load();
+		unique_lock<mutex> guard(sleepLock);
+		//every queued record wakes the writer, so waiting for the count is enough
+		drained.wait(guard, [this, target] { return written.load() >= target; });
+	}
+};
@@ -0,0 +1,253 @@
+#pragma once
+//*********************************************
+//Output images mapped straight onto their files
+//The file is created at its final size with its header already in place, and the pixel array of the
+//output image is the mapped region after the header, so the threads of a stacking or scaling kernel
+//write their results into the file's pages and there is no separate pass to write the image out.
+//The operating system writes the pages back in the background, and at the latest when the file is closed
+//*********************************************
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "Utils.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/// <summary>
+/// An 8-bit ppm or pgm file created at its final size and mapped into memory
+/// </summary>
+class MappedImageFile {
+public:
+	/// <summary>
+	/// Check a file can hold an image's samples exactly as they are stored,
+	/// greyscale files for monochrome images and colour files for colour ones
+	/// </summary>
+	/// <param name="path">file to write</param>
+	/// <param name="channels">1 for monochrome, 3 for colour</param>
+	/// <returns>true if the image can be mapped onto the file</returns>
+	static bool fits(const string &path, const unsigned int &channels) {
+		if (hasExtension(path, ".pfm")) {
+			return false;
+		}
+		return hasExtension(path, ".pgm") ? channels == 1 : channels == 3;
+	}
+
+	/// <summary>
+	/// Create a file with the header of an image and map it
+	/// An existing file is removed first rather than overwritten, so a hard link to it (e.g. in the result cache) keeps its contents
+	/// </summary>
+	/// <param name="path">file to create</param>
+	/// <param name="w">width</param>
+	/// <param name="h">height</param>
+	/// <param name="channels">1 for a greyscale (P5) file, 3 for a colour (P6) one</param>
+	/// <param name="bytes">size of the pixel array, which may run a few bytes past the samples and is cut back to them on close</param>
+	/// <returns>mapped file, or null if it could not be created</returns>
+	static MappedImageFile* create(const string &path, const unsigned int &w, const unsigned int &h, const unsigned int &channels, const size_t &bytes) {
+		MappedImageFile *file = new MappedImageFile();
+		file->path = path;
+		file->header = string(channels == 1 ? "P5\n" : "P6\n") + to_string(w) + " " + to_string(h) + "\n255\n";
+		file->finalBytes = file->header.size() + (size_t)w * h * channels;
+		file->mappedBytes = file->header.size() + bytes;
+		remove(path.c_str());
+		if (!file->open()) {
+			file->release();
+			remove(path.c_str());
+			delete file;
+			return nullptr;
+		}
+		memcpy(file->base, file->header.data(), file->header.size());
+		return file;
+	}
+
+	/// <summary>
+	/// Get the pixel array, the bytes after the header
+	/// </summary>
+	unsigned char* pixels() {
+		return base + header.size();
+	}
+
+	/// <summary>
+	/// Check this is the file an image is about to be written to
+	/// </summary>
+	bool isFor(const string &filename) const {
+		return path == filename;
+	}
+
+	/// <summary>
+	/// Unmap the pixels and cut the file to the length its header gives
+	/// </summary>
+	/// <returns>true if the file was finished</returns>
+	bool close() {
+		if (base == nullptr) {
+			return false;
+		}
+		return release();
+	}
+
+	~MappedImageFile() {
+		close();
+	}
+
+private:
+	string path;
+	string header;
+	size_t finalBytes = 0; // header and samples
+	size_t mappedBytes = 0; // header and the whole pixel array
+	unsigned char *base = nullptr; // start of the mapping, where the header is
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int file = -1;
+#endif
+
+	MappedImageFile() {}
+	MappedImageFile(const MappedImageFile&) = delete;
+	MappedImageFile& operator = (const MappedImageFile&) = delete;
+
+	/// <summary>
+	/// Create the file at the mapped size and map all of it for writing
+	/// </summary>
+	bool open() {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		//creating the mapping extends the file to its size
+		const unsigned long long size = mappedBytes;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+		if (mapping == NULL) {
+			return false;
+		}
+		base = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, mappedBytes));
+		return base != nullptr;
+#else
+		file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (file < 0) {
+			return false;
+		}
+#ifdef __linux__
+		//reserve the blocks now, so a full disk fails here instead of with a bus error when a worker touches a page
+		if (posix_fallocate(file, 0, (off_t)mappedBytes) != 0) {
+			return false;
+		}
+#else
+		if (ftruncate(file, (off_t)mappedBytes) != 0) {
+			return false;
+		}
+#endif
+		void *mapped = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		if (mapped == MAP_FAILED) {
+			return false;
+		}
+		base = static_cast<unsigned char*>(mapped);
+		return true;
+#endif
+	}
+
+	/// <summary>
+	/// Unmap and close whatever open() got as far as, cutting the file to its final length
+	/// </summary>
+	bool release() {
+		bool finished = base != nullptr;
+#ifdef _WIN32
+		if (base != nullptr) {
+			finished = UnmapViewOfFile(base) != 0;
+		}
+		if (mapping != NULL) {
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			LARGE_INTEGER length;
+			length.QuadPart = (LONGLONG)finalBytes;
+			finished = finished && SetFilePointerEx(file, length, NULL, FILE_BEGIN) != 0 && SetEndOfFile(file) != 0;
+			finished = CloseHandle(file) != 0 && finished;
+		}
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (base != nullptr) {
+			finished = munmap(base, mappedBytes) == 0;
+		}
+		if (file >= 0) {
+			finished = finished && ftruncate(file, (off_t)finalBytes) == 0;
+			finished = ::close(file) == 0 && finished;
+		}
+		file = -1;
+#endif
+		base = nullptr;
+		return finished;
+	}
+};
+
+/// <summary>
+/// Marks the stage whose output is the final image of a run, so that image is mapped onto the output file
+/// The first image of a fitting format constructed uninitialised on this thread while the scope is open claims the file;
+/// later images, and images of other threads, get ordinary pixel arrays
+/// </summary>
+class MappedOutputScope {
+public:
+	/// <summary>
+	/// Open a scope
+	/// </summary>
+	/// <param name="_path">output file</param>
+	/// <param name="enabled">false to leave every image in memory, so callers can open a scope unconditionally</param>
+	MappedOutputScope(const string &_path, const bool &enabled) : path(_path), pending(enabled), outer(current()) {
+		current() = this;
+	}
+
+	~MappedOutputScope() {
+		current() = outer;
+	}
+
+	/// <summary>
+	/// Map the output file for an image about to be allocated, if an open scope on this thread is waiting for one
+	/// </summary>
+	/// <param name="w">width</param>
+	/// <param name="h">height</param>
+	/// <param name="channels">1 for monochrome, 3 for colour</param>
+	/// <param name="bytes">size of the image's pixel array</param>
+	/// <returns>mapped file, or null to allocate the pixels normally</returns>
+	static MappedImageFile* claim(const unsigned int &w, const unsigned int &h, const unsigned int &channels, const size_t &bytes) {
+		MappedOutputScope *scope = current();
+		if (scope == nullptr || !scope->pending) {
+			return nullptr;
+		}
+		//only the stage's output is wanted, whether or not it can be mapped
+		scope->pending = false;
+		if (w == 0 || h == 0 || !MappedImageFile::fits(scope->path, channels)) {
+			return nullptr;
+		}
+		return MappedImageFile::create(scope->path, w, h, channels, bytes);
+	}
+
+private:
+	string path;
+	bool pending;
+	MappedOutputScope *outer;
+
+	MappedOutputScope(const MappedOutputScope&) = delete;
+	MappedOutputScope& operator = (const MappedOutputScope&) = delete;
+
+	static MappedOutputScope*& current() {
+		static thread_local MappedOutputScope *scope = nullptr;
+		return scope;
+	}
+};
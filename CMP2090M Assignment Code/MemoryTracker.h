@@ -0,0 +1,387 @@
+#pragma once
+//*********************************************
+//Memory accounting for image and scratch buffers
+//Tracked allocations keep a running total and a high-water mark,
+//and the process resident set size is sampled from the operating system,
+//so the real peak memory of an operation can be reported instead of an estimate
+//*********************************************
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <limits>
+#include <new>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/// <summary>
+/// Memory used by one operation
+/// </summary>
+struct MemoryUsage {
+	unsigned long long trackedStartBytes = 0; // tracked bytes live when the operation started, e.g. its input frames
+	unsigned long long trackedPeakBytes = 0; // most tracked bytes live at once during the operation
+	unsigned long long residentPeakBytes = 0; // process resident set high-water mark, 0 if it could not be read
+	bool measured = false; // false until the operation has been measured
+
+	/// <summary>
+	/// Get the extra tracked bytes the operation needed on top of what was already live
+	/// </summary>
+	/// <returns>peak bytes above the starting point</returns>
+	unsigned long long trackedExtraBytes() const {
+		return trackedPeakBytes > trackedStartBytes ? trackedPeakBytes - trackedStartBytes : 0;
+	}
+};
+
+/// <summary>
+/// Process wide counters of tracked allocations, and resident set sampling
+/// </summary>
+class MemoryTracker {
+public:
+	//most MemoryScopes that can keep their own high-water mark at once, e.g. nested scopes of concurrent jobs
+	static const size_t kMaxScopes = 64;
+
+private:
+	/// <summary>
+	/// High-water mark of one open MemoryScope, raised by every allocation while the slot is in use
+	/// </summary>
+	struct ScopeSlot {
+		atomic<bool> inUse;
+		atomic<unsigned long long> peak;
+		ScopeSlot() : inUse(false), peak(0) {}
+	};
+
+	static ScopeSlot* slots() {
+		static ScopeSlot scopes[kMaxScopes];
+		return scopes;
+	}
+
+	/// <summary>
+	/// One more than the highest slot ever used, so allocations only look at slots that may be in use
+	/// </summary>
+	static atomic<size_t>& slotLimit() {
+		static atomic<size_t> limit(0);
+		return limit;
+	}
+
+	/// <summary>
+	/// Number of MemoryScopes open
+	/// </summary>
+	static atomic<unsigned int>& openScopes() {
+		static atomic<unsigned int> count(0);
+		return count;
+	}
+
+	/// <summary>
+	/// Raise a high-water mark to a value unless another thread already raised it higher
+	/// </summary>
+	static void raise(atomic<unsigned long long> &mark, const unsigned long long &value) {
+		unsigned long long highest = mark.load();
+		while (value > highest && !mark.compare_exchange_weak(highest, value));
+	}
+
+	/// <summary>
+	/// Bytes currently allocated through the tracker
+	/// </summary>
+	static atomic<unsigned long long>& current() {
+		static atomic<unsigned long long> bytes(0);
+		return bytes;
+	}
+
+	/// <summary>
+	/// Most bytes allocated through the tracker at once since the process started
+	/// </summary>
+	static atomic<unsigned long long>& peak() {
+		static atomic<unsigned long long> bytes(0);
+		return bytes;
+	}
+
+	/// <summary>
+	/// Read a value in kB from /proc/self/status
+	/// </summary>
+	/// <param name="key">field name including the colon, e.g. VmRSS:</param>
+	/// <returns>value in bytes, or 0 if it could not be read</returns>
+	static unsigned long long readStatusField(const string &key) {
+		ifstream status("/proc/self/status");
+		string line;
+		while (getline(status, line)) {
+			if (line.compare(0, key.size(), key) == 0) {
+				return strtoull(line.c_str() + key.size(), nullptr, 10) * 1024ULL;
+			}
+		}
+		return 0;
+	}
+
+public:
+	/// <summary>
+	/// Record that memory has been allocated
+	/// </summary>
+	/// <param name="bytes">size of the allocation</param>
+	static void recordAllocation(const size_t &bytes) {
+		const unsigned long long now = current().fetch_add(bytes) + bytes;
+		raise(peak(), now);
+		if (openScopes().load() == 0) {
+			return;
+		}
+		//every open scope sees the allocation, however the scopes are nested or overlap
+		const size_t limit = slotLimit().load();
+		for (size_t i = 0; i < limit; i++) {
+			if (slots()[i].inUse.load()) {
+				raise(slots()[i].peak, now);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Record that memory has been released
+	/// </summary>
+	/// <param name="bytes">size of the allocation</param>
+	static void recordRelease(const size_t &bytes) {
+		current().fetch_sub(bytes);
+	}
+
+	/// <summary>
+	/// Allocate a tracked array
+	/// </summary>
+	/// <param name="count">number of elements</param>
+	/// <returns>new array, release with release()</returns>
+	template <typename T>
+	static T* allocate(const size_t &count) {
+		T *data = new T[count];
+		recordAllocation(count * sizeof(T));
+		return data;
+	}
+
+	/// <summary>
+	/// Release a tracked array
+	/// </summary>
+	/// <param name="data">array from allocate(), may be null</param>
+	/// <param name="count">number of elements it was allocated with</param>
+	template <typename T>
+	static void release(T *data, const size_t &count) {
+		if (data != nullptr) {
+			recordRelease(count * sizeof(T));
+			delete[] data;
+		}
+	}
+
+	/// <summary>
+	/// Get the bytes currently allocated through the tracker
+	/// </summary>
+	/// <returns>live tracked bytes</returns>
+	static unsigned long long currentBytes() {
+		return current().load();
+	}
+
+	/// <summary>
+	/// Get the most bytes allocated through the tracker at once since the process started
+	/// </summary>
+	/// <returns>tracked high-water mark</returns>
+	static unsigned long long peakBytes() {
+		return peak().load();
+	}
+
+	/// <summary>
+	/// Start a high-water mark of its own for a MemoryScope
+	/// </summary>
+	/// <param name="alone">set to true if no other scope was open, so the scope may reset the resident set peak</param>
+	/// <returns>slot to read with scopePeakBytes() and give back with closeScope(), or kMaxScopes if every slot is taken</returns>
+	static size_t openScope(bool &alone) {
+		alone = openScopes().fetch_add(1) == 0;
+		for (size_t i = 0; i < kMaxScopes; i++) {
+			bool expected = false;
+			if (slots()[i].inUse.load() || !slots()[i].inUse.compare_exchange_strong(expected, true)) {
+				continue;
+			}
+			//the mark starts at what is live now, allocations made meanwhile raise it from there
+			slots()[i].peak = current().load();
+			size_t limit = slotLimit().load();
+			while (limit < i + 1 && !slotLimit().compare_exchange_weak(limit, i + 1));
+			return i;
+		}
+		return kMaxScopes;
+	}
+
+	/// <summary>
+	/// Get the high-water mark of an open scope
+	/// </summary>
+	/// <param name="slot">slot from openScope()</param>
+	/// <returns>most tracked bytes live at once since the scope opened, or since the process started if it has no slot</returns>
+	static unsigned long long scopePeakBytes(const size_t &slot) {
+		return slot < kMaxScopes ? slots()[slot].peak.load() : peakBytes();
+	}
+
+	/// <summary>
+	/// Give back a scope's slot
+	/// </summary>
+	/// <param name="slot">slot from openScope()</param>
+	static void closeScope(const size_t &slot) {
+		if (slot < kMaxScopes) {
+			slots()[slot].inUse = false;
+		}
+		openScopes().fetch_sub(1);
+	}
+
+	/// <summary>
+	/// Start a new resident set high-water mark, where supported
+	/// The mark is process wide, so only a scope with no other scope open may reset it
+	/// </summary>
+	static void resetResidentPeak() {
+#ifndef _WIN32
+		//writing 5 resets the kernel's VmHWM to the current resident size (Linux 4.0+)
+		ofstream clearRefs("/proc/self/clear_refs");
+		clearRefs << "5";
+#endif
+	}
+
+	/// <summary>
+	/// Get the current resident set size of the process
+	/// </summary>
+	/// <returns>bytes in physical memory, or 0 if unknown</returns>
+	static unsigned long long residentBytes() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			return counters.WorkingSetSize;
+		}
+		return 0;
+#else
+		return readStatusField("VmRSS:");
+#endif
+	}
+
+	/// <summary>
+	/// Get the physical memory installed in the machine
+	/// </summary>
+	/// <returns>bytes, or 0 if unknown</returns>
+	static unsigned long long physicalMemoryBytes() {
+#ifdef _WIN32
+		MEMORYSTATUSEX status;
+		status.dwLength = sizeof(status);
+		if (GlobalMemoryStatusEx(&status)) {
+			return status.ullTotalPhys;
+		}
+		return 0;
+#else
+		const long pages = sysconf(_SC_PHYS_PAGES);
+		const long pageSize = sysconf(_SC_PAGE_SIZE);
+		return pages > 0 && pageSize > 0 ? (unsigned long long)pages * pageSize : 0;
+#endif
+	}
+
+	/// <summary>
+	/// Get the resident set high-water mark of the process
+	/// On Windows the peak working set cannot be reset, so it covers the whole run
+	/// </summary>
+	/// <returns>bytes, or 0 if unknown</returns>
+	static unsigned long long peakResidentBytes() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			return counters.PeakWorkingSetSize;
+		}
+		return 0;
+#else
+		return readStatusField("VmHWM:");
+#endif
+	}
+};
+
+/// <summary>
+/// Measures the peak memory of the code run while this object is in scope
+/// Every scope keeps its own tracked high-water mark, so scopes can be nested and concurrent jobs can each have one;
+/// the tracked bytes are process wide, so a scope overlapping another job's also counts that job's allocations.
+/// The resident set peak is only reported by a scope that opened when no other was open, as it is process wide
+/// </summary>
+class MemoryScope {
+private:
+	MemoryUsage usage;
+	size_t slot;
+	bool alone = false; // no other scope was open, so the resident set peak was reset for this one
+public:
+	/// <summary>
+	/// Start measuring
+	/// </summary>
+	MemoryScope() {
+		slot = MemoryTracker::openScope(alone);
+		if (alone) {
+			MemoryTracker::resetResidentPeak();
+		}
+		usage.trackedStartBytes = MemoryTracker::currentBytes();
+	}
+
+	~MemoryScope() {
+		MemoryTracker::closeScope(slot);
+	}
+
+	MemoryScope(const MemoryScope&) = delete;
+	MemoryScope& operator = (const MemoryScope&) = delete;
+
+	/// <summary>
+	/// Get the memory used since the scope started
+	/// </summary>
+	/// <returns>peak usage so far</returns>
+	MemoryUsage finish() {
+		usage.trackedPeakBytes = MemoryTracker::scopePeakBytes(slot);
+		usage.residentPeakBytes = alone ? MemoryTracker::peakResidentBytes() : 0;
+		usage.measured = true;
+		return usage;
+	}
+};
+
+/// <summary>
+/// Standard library allocator that records its allocations with the MemoryTracker
+/// Lets vectors used as scratch space count towards the peak
+/// </summary>
+template <typename T>
+struct TrackedAllocator {
+	typedef T value_type;
+
+	TrackedAllocator() {}
+	template <typename U>
+	TrackedAllocator(const TrackedAllocator<U>&) {}
+
+	/// <summary>
+	/// Allocate space for elements
+	/// </summary>
+	/// <param name="n">number of elements</param>
+	/// <returns>uninitialised storage</returns>
+	T* allocate(size_t n) {
+		if (n > numeric_limits<size_t>::max() / sizeof(T)) {
+			throw bad_alloc();
+		}
+		T *data = static_cast<T*>(::operator new(n * sizeof(T)));
+		MemoryTracker::recordAllocation(n * sizeof(T));
+		return data;
+	}
+
+	/// <summary>
+	/// Release space from allocate()
+	/// </summary>
+	/// <param name="data">storage to release</param>
+	/// <param name="n">number of elements it was allocated with</param>
+	void deallocate(T *data, size_t n) {
+		MemoryTracker::recordRelease(n * sizeof(T));
+		::operator delete(data);
+	}
+
+	template <typename U>
+	bool operator == (const TrackedAllocator<U>&) const { return true; }
+	template <typename U>
+	bool operator != (const TrackedAllocator<U>&) const { return false; }
+};
@@ -0,0 +1,349 @@
+#pragma once
+//*********************************************
+//Numbered stacking and scaling operations shared by the menus, the benchmarks and batch mode
+//*********************************************
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "Image.h"
+#include "Stacker.h"
+#include "Scaler.h"
+#include "PlanarImage.h"
+#include "MemoryTracker.h"
+#include "Trace.h"
+
+using namespace std;
+
+/// <summary>
+/// reads a list of image files into a vector
+/// Greyscale files, and colour files whose channels are all equal, are kept as monochrome images when every file in the list is,
+/// so the stackers and scalers do a third of the work
+/// </summary>
+/// <param name="paths">paths of the images to read</param>
+/// <returns>Vector containing the images, in the same order as the paths</returns>
+vector<Image> readImageFiles(const vector<string> &paths) {
+	vector<Image> images;
+	images.reserve(paths.size());
+	bool monochrome = true;
+	for (const string &path : paths) {
+		Image img;
+		img.readPPM(path.c_str(), true);
+		img.logDetails();
+		monochrome = monochrome && img.channels == 1;
+		images.push_back(img);
+	}
+	//a set is stacked in one layout, so one colour frame makes them all colour
+	if (!monochrome) {
+		for (Image &img : images) {
+			img.toColour();
+		}
+	}
+	return images;
+}
+
+/// <summary>
+/// Check every image in a set was read successfully
+/// </summary>
+/// <param name="images">images to check</param>
+/// <returns>true if there is at least one image and all have pixel data</returns>
+bool imagesLoaded(const vector<Image> &images) {
+	if (images.empty()) {
+		return false;
+	}
+	for (const Image &img : images) {
+		if (img.pixels == nullptr || img.w == 0 || img.h == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Deep copy a set of images
+/// The stackers release their input images, so each run needs its own copy
+/// </summary>
+/// <param name="images">images to copy</param>
+/// <returns>copies with their own pixel arrays</returns>
+vector<Image> cloneImages(const vector<Image> &images) {
+	vector<Image> copies;
+	copies.reserve(images.size());
+	for (const Image &img : images) {
+		copies.push_back(img.clone());
+	}
+	return copies;
+}
+
+/// <summary>
+/// Release the pixel memory of a set of images
+/// </summary>
+/// <param name="images">images to release</param>
+void freeImages(vector<Image> &images) {
+	for (Image &img : images) {
+		img.freeMemory();
+	}
+	images.clear();
+}
+
+/// <summary>
+/// Get the name of a numbered stacking method
+/// </summary>
+/// <param name="method">numbered stacking method</param>
+/// <returns>display name of the method</returns>
+string stackingMethodName(const unsigned int &method) {
+	switch (method) {
+	case 1: return "Mean Blending";
+	case 2: return "Median Blending Parallel";
+	case 3: return "Sigma Clipped Mean Parallel Blending";
+	case 4: return "Median Blending";
+	case 5: return "Sigma Clipped Mean Blending";
+	default: return "Unknown";
+	}
+}
+
+//sigma clipping settings used by the numbered stacking methods
+const unsigned int kSigmaIterationsParallel = 5;
+const unsigned int kSigmaIterationsSerial = 1;
+const float kSigmaAlpha = 0.5f;
+
+/// <summary>
+/// Describe a numbered stacking method and the settings it runs with, e.g. for cache keys
+/// </summary>
+/// <param name="method">numbered stacking method</param>
+/// <returns>description of the method and its settings</returns>
+string stackingMethodParameters(const unsigned int &method) {
+	string description = "stack=" + to_string(method);
+	if (method == 3 || method == 5) {
+		description += ",iterations=" + to_string(method == 3 ? kSigmaIterationsParallel : kSigmaIterationsSerial) + ",alpha=" + to_string(kSigmaAlpha);
+	}
+	return description;
+}
+
+/// <summary>
+/// Run a numbered stacking method on images already in memory
+/// The input images are released by the stacker, and the peak memory used is recorded on the output
+/// </summary>
+/// <param name="method">numbered stacking method to use</param>
+/// <param name="images">images to stack</param>
+/// <param name="levels">exposure normalisation applied while gathering, null for none</param>
+/// <returns>stacked image</returns>
+StackedImage runStackingMethod(const unsigned int &method, vector<Image> &images, const ExposureNormalisation *levels = nullptr) {
+	TRACE_ZONE_DETAIL("Stack", stackingMethodName(method).c_str());
+	MemoryScope memory;
+	StackedImage output;
+	switch (method) {
+	case 1:
+		//mean blending
+		output = Stacker::MeanBlend(images, levels);
+		break;
+	case 2:
+		//median blending (optimised)
+		output = Stacker::MedianBlendParallel(images, levels);
+		break;
+	case 3:
+		//sigma clipped mean blending (optimised)
+		output = Stacker::SigmaClippedMeanBlendParallel(images, kSigmaIterationsParallel, kSigmaAlpha, levels);
+		break;
+	case 4:
+		//median blending
+		output = Stacker::MedianBlend(images, levels);
+		break;
+	case 5:
+		//sigma clipped mean blending
+		output = Stacker::SigmaClippedMeanBlend(images, kSigmaIterationsSerial, kSigmaAlpha, levels);
+		break;
+	default:
+		throw invalid_argument("Invalid blend method");
+	}
+	output.setMemoryUsage(memory.finish());
+	return output;
+}
+
+/// <summary>
+/// Get the name of a numbered scaling method
+/// </summary>
+/// <param name="method">numbered scaling method</param>
+/// <returns>display name of the method</returns>
+string scalingMethodName(const unsigned int &method) {
+	switch (method) {
+	case 1: return "Nearest Neighbour Parallel";
+	case 2: return "Bilinear Parallel";
+	case 3: return "Bicubic Parallel";
+	case 4: return "Nearest Neighbour";
+	case 5: return "Bilinear";
+	case 6: return "Bicubic";
+	default: return "Unknown";
+	}
+}
+
+/// <summary>
+/// Run a numbered scaling method on an image already in memory
+/// The peak memory used is recorded on the output
+/// </summary>
+/// <param name="method">numbered scaling method to use</param>
+/// <param name="img">image to scale</param>
+/// <param name="scale">scale factor</param>
+/// <returns>scaled image</returns>
+ScaledImage runScalingMethod(const unsigned int &method, Image &img, const double &scale) {
+	TRACE_ZONE_DETAIL("Scale", scalingMethodName(method).c_str());
+	MemoryScope memory;
+	ScaledImage output;
+	switch (method) {
+	case 1:
+		//nearest neighbour (optimised)
+		output = Scaler::NearestNeighbourParallel(img, scale);
+		break;
+	case 2:
+		//bilinear (optimised)
+		output = Scaler::BilinearParallel(img, scale);
+		break;
+	case 3:
+		//bicubic (optimised)
+		output = Scaler::BiCubicParallel(img, scale);
+		break;
+	case 4:
+		//nearest neighbour
+		output = Scaler::NearestNeighbour(img, scale);
+		break;
+	case 5:
+		//bilinear
+		output = Scaler::Bilinear(img, scale);
+		break;
+	case 6:
+		//bicubic
+		output = Scaler::BiCubic(img, scale);
+		break;
+	default:
+		throw invalid_argument("Invalid scaling method");
+	}
+	output.setMemoryUsage(memory.finish());
+	return output;
+}
+
+/// <summary>
+/// Run a numbered stacking method on frames of any sample type
+/// The serial and parallel variants of a method share one kernel here
+/// </summary>
+/// <param name="method">numbered stacking method to use</param>
+/// <param name="frames">frames to stack, released by the stacker</param>
+/// <returns>stacked image</returns>
+template <typename T, typename Out = T>
+PixelImage<Out> runPixelStackingMethod(const unsigned int &method, vector<PixelImage<T>> &frames) {
+	TRACE_ZONE_DETAIL("Stack", stackingMethodName(method).c_str());
+	switch (method) {
+	case 1:
+		return Stacker::MeanBlend<T, Out>(frames);
+	case 2:
+	case 4:
+		return Stacker::MedianBlend<T, Out>(frames);
+	case 3:
+		return Stacker::SigmaClippedMeanBlend<T, Out>(frames, kSigmaIterationsParallel, kSigmaAlpha);
+	case 5:
+		return Stacker::SigmaClippedMeanBlend<T, Out>(frames, kSigmaIterationsSerial, kSigmaAlpha);
+	default:
+		throw invalid_argument("Invalid blend method");
+	}
+}
+
+/// <summary>
+/// Run a numbered scaling method on an image of any sample type
+/// </summary>
+/// <param name="method">numbered scaling method to use</param>
+/// <param name="img">image to scale, left untouched</param>
+/// <param name="scale">scale factor</param>
+/// <returns>scaled image</returns>
+template <typename T>
+PixelImage<T> runPixelScalingMethod(const unsigned int &method, const PixelImage<T> &img, const double &scale) {
+	TRACE_ZONE_DETAIL("Scale", scalingMethodName(method).c_str());
+	switch (method) {
+	case 1:
+	case 4:
+		return Scaler::NearestNeighbour(img, scale, method == 1);
+	case 2:
+	case 5:
+		return Scaler::Bilinear(img, scale, method == 2);
+	case 3:
+	case 6:
+		return Scaler::BiCubic(img, scale, method == 3);
+	default:
+		throw invalid_argument("Invalid scaling method");
+	}
+}
+
+/// <summary>
+/// Run a numbered stacking method on planar frames
+/// The serial and parallel variants of a method share one kernel here
+/// </summary>
+/// <param name="method">numbered stacking method to use</param>
+/// <param name="frames">frames to stack, released by the stacker</param>
+/// <returns>stacked planar image</returns>
+PlanarImage runPlanarStackingMethod(const unsigned int &method, vector<PlanarImage> &frames) {
+	TRACE_ZONE_DETAIL("Stack", stackingMethodName(method).c_str());
+	switch (method) {
+	case 1:
+		return Stacker::MeanBlendPlanar(frames);
+	case 2:
+	case 4:
+		return Stacker::MedianBlendPlanar(frames);
+	case 3:
+		return Stacker::SigmaClippedMeanBlendPlanar(frames, kSigmaIterationsParallel, kSigmaAlpha);
+	case 5:
+		return Stacker::SigmaClippedMeanBlendPlanar(frames, kSigmaIterationsSerial, kSigmaAlpha);
+	default:
+		throw invalid_argument("Invalid blend method");
+	}
+}
+
+/// <summary>
+/// Run a numbered scaling method on a planar image
+/// </summary>
+/// <param name="method">numbered scaling method to use</param>
+/// <param name="img">image to scale, left untouched</param>
+/// <param name="scale">scale factor</param>
+/// <returns>scaled planar image</returns>
+PlanarImage runPlanarScalingMethod(const unsigned int &method, const PlanarImage &img, const double &scale) {
+	TRACE_ZONE_DETAIL("Scale", scalingMethodName(method).c_str());
+	switch (method) {
+	case 1:
+	case 4:
+		return Scaler::NearestNeighbourPlanar(img, scale, method == 1);
+	case 2:
+	case 5:
+		return Scaler::BilinearPlanar(img, scale, method == 2);
+	case 3:
+	case 6:
+		return Scaler::BiCubicPlanar(img, scale, method == 3);
+	default:
+		throw invalid_argument("Invalid scaling method");
+	}
+}
+
+/// <summary>
+/// Find a stacking method by name, as used on the command line and in job manifests
+/// </summary>
+/// <param name="name">mean, median, sigma, median-serial or sigma-serial, or the method number</param>
+/// <returns>numbered stacking method, 0 if the name is not recognised</returns>
+unsigned int parseStackingMethod(const string &name) {
+	const char *names[] = { "mean", "median", "sigma", "median-serial", "sigma-serial" };
+	for (unsigned int i = 0; i < 5; i++) {
+		if (name == names[i] || name == to_string(i + 1)) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+/// <summary>
+/// Find a scaling method by name, as used on the command line and in job manifests
+/// </summary>
+/// <param name="name">nearest, bilinear or bicubic, optionally with -serial, or the method number</param>
+/// <returns>numbered scaling method, 0 if the name is not recognised</returns>
+unsigned int parseScalingMethod(const string &name) {
+	const char *names[] = { "nearest", "bilinear", "bicubic", "nearest-serial", "bilinear-serial", "bicubic-serial" };
+	for (unsigned int i = 0; i < 6; i++) {
+		if (name == names[i] || name == to_string(i + 1)) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,288 @@
+#pragma once
+//*********************************************
+//Parallel loop support
+//Uses the Parallel Patterns Library when building with Visual C++,
+//otherwise a small thread pool providing the same parallel_for
+//*********************************************
+
+#include <thread>
+#include <vector>
+#include <string>
+#include <set>
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#ifdef _MSC_VER
+#include <ppl.h>
+#include <concrt.h>
+#else
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+namespace Concurrency {
+	/// <summary>
+	/// Pool of worker threads shared by every parallel_for call
+	/// The calling thread always takes part in its own loop, so nested and concurrent loops cannot deadlock
+	/// </summary>
+	class ThreadPool {
+	private:
+		/// <summary>
+		/// One parallel_for call, shared between the caller and any workers helping it
+		/// </summary>
+		struct Batch {
+			std::function<void(size_t)> body;
+			size_t first = 0, last = 0, chunk = 1;
+			std::atomic<size_t> next;
+			std::atomic<size_t> done;
+			std::mutex lock;
+			std::condition_variable finished;
+			std::exception_ptr error;
+
+			/// <summary>
+			/// Take chunks of the range until none are left
+			/// </summary>
+			void work() {
+				for (;;) {
+					const size_t start = next.fetch_add(chunk);
+					if (start >= last) {
+						return;
+					}
+					const size_t end = std::min(start + chunk, last);
+					try {
+						for (size_t i = start; i < end; i++) {
+							body(i);
+						}
+					} catch (...) {
+						std::lock_guard<std::mutex> guard(lock);
+						if (!error) {
+							error = std::current_exception();
+						}
+					}
+					if (done.fetch_add(end - start) + (end - start) == last - first) {
+						std::lock_guard<std::mutex> guard(lock);
+						finished.notify_all();
+					}
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		std::deque<std::shared_ptr<Batch>> queue;
+		std::mutex queueLock;
+		std::condition_variable queueReady;
+		bool stopping = false;
+		std::atomic<unsigned int> limit;
+
+		/// <summary>
+		/// Create the pool with one worker per hardware thread, less the calling thread
+		/// </summary>
+		ThreadPool() : limit(0) {
+			const unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+			for (unsigned int i = 1; i < threads; i++) {
+				workers.emplace_back([this] { workerLoop(); });
+			}
+		}
+
+		/// <summary>
+		/// Worker thread body, helps with queued batches until the pool is destroyed
+		/// </summary>
+		void workerLoop() {
+			for (;;) {
+				std::shared_ptr<Batch> batch;
+				{
+					std::unique_lock<std::mutex> guard(queueLock);
+					queueReady.wait(guard, [this] { return stopping || !queue.empty(); });
+					if (stopping && queue.empty()) {
+						return;
+					}
+					batch = queue.front();
+					queue.pop_front();
+				}
+				batch->work();
+			}
+		}
+
+	public:
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> guard(queueLock);
+				stopping = true;
+			}
+			queueReady.notify_all();
+			for (std::thread &worker : workers) {
+				worker.join();
+			}
+		}
+
+		/// <summary>
+		/// Get the shared pool
+		/// </summary>
+		/// <returns>the pool</returns>
+		static ThreadPool& instance() {
+			static ThreadPool pool;
+			return pool;
+		}
+
+		/// <summary>
+		/// Number of threads a loop may use, including the calling thread
+		/// </summary>
+		/// <returns>thread count</returns>
+		unsigned int concurrency() const {
+			const unsigned int all = (unsigned int)workers.size() + 1;
+			const unsigned int current = limit.load();
+			return current == 0 ? all : std::min(current, all);
+		}
+
+		/// <summary>
+		/// Limit the number of threads used by later loops
+		/// </summary>
+		/// <param name="threads">thread count, 0 to use all threads</param>
+		void setLimit(const unsigned int &threads) {
+			limit = threads;
+		}
+
+		/// <summary>
+		/// Run body(i) for every i in [first, last)
+		/// </summary>
+		/// <param name="first">first index</param>
+		/// <param name="last">one past the last index</param>
+		/// <param name="body">loop body</param>
+		void run(const size_t &first, const size_t &last, const std::function<void(size_t)> &body) {
+			if (first >= last) {
+				return;
+			}
+			const unsigned int threads = concurrency();
+			std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+			batch->body = body;
+			batch->first = first;
+			batch->last = last;
+			//several chunks per thread keeps the load balanced without taking the counter for every index
+			batch->chunk = std::max((size_t)1, (last - first) / ((size_t)threads * 8));
+			batch->next = first;
+			batch->done = 0;
+			if (threads > 1) {
+				{
+					std::lock_guard<std::mutex> guard(queueLock);
+					for (unsigned int i = 1; i < threads; i++) {
+						queue.push_back(batch);
+					}
+				}
+				queueReady.notify_all();
+			}
+			batch->work();
+			{
+				std::unique_lock<std::mutex> guard(batch->lock);
+				batch->finished.wait(guard, [&batch] { return batch->done.load() == batch->last - batch->first; });
+			}
+			if (batch->error) {
+				std::rethrow_exception(batch->error);
+			}
+		}
+	};
+
+	/// <summary>
+	/// Run a loop body for every index in a range, using the shared thread pool
+	/// Matches the Parallel Patterns Library parallel_for
+	/// </summary>
+	/// <param name="first">first index</param>
+	/// <param name="last">one past the last index</param>
+	/// <param name="body">loop body taking the index</param>
+	template <typename Index, typename Function>
+	void parallel_for(Index first, Index last, const Function &body) {
+		ThreadPool::instance().run((size_t)first, (size_t)last, [&body](size_t i) { body((Index)i); });
+	}
+}
+#endif
+
+using namespace Concurrency;
+
+/// <summary>
+/// Limits how many threads parallel_for may use while this object is in scope
+/// Only one limit should be active at a time
+/// </summary>
+class ConcurrencyLimit {
+public:
+	/// <summary>
+	/// Apply the limit
+	/// </summary>
+	/// <param name="threads">maximum number of threads, including the calling thread</param>
+	ConcurrencyLimit(const unsigned int &threads) {
+#ifdef _MSC_VER
+		//loops started from this thread use the new scheduler until it is detached
+		CurrentScheduler::Create(SchedulerPolicy(2, MinConcurrency, threads, MaxConcurrency, threads));
+#else
+		ThreadPool::instance().setLimit(threads);
+#endif
+	}
+
+	/// <summary>
+	/// Remove the limit
+	/// </summary>
+	~ConcurrencyLimit() {
+#ifdef _MSC_VER
+		CurrentScheduler::Detach();
+#else
+		ThreadPool::instance().setLimit(0);
+#endif
+	}
+};
+
+/// <summary>
+/// Get the number of hardware threads
+/// </summary>
+/// <returns>logical processor count, at least 1</returns>
+unsigned int logicalCoreCount() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/// <summary>
+/// Get the number of physical cores, ignoring hyper-threads
+/// </summary>
+/// <returns>physical core count, or the logical count if it cannot be found</returns>
+unsigned int physicalCoreCount() {
+#ifdef _WIN32
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION) + 1);
+	if (!GetLogicalProcessorInformation(info.data(), &length)) {
+		return logicalCoreCount();
+	}
+	unsigned int cores = 0;
+	for (size_t i = 0; i < length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION); i++) {
+		if (info[i].Relationship == RelationProcessorCore) {
+			cores++;
+		}
+	}
+	return cores > 0 ? cores : logicalCoreCount();
+#else
+	//each core is listed once per logical processor, identified by its package and core id
+	std::ifstream cpuInfo("/proc/cpuinfo");
+	std::set<std::pair<int, int>> cores;
+	std::string line;
+	int physicalId = 0;
+	while (std::getline(cpuInfo, line)) {
+		if (line.compare(0, 11, "physical id") == 0) {
+			physicalId = atoi(line.substr(line.find(':') + 1).c_str());
+		} else if (line.compare(0, 7, "core id") == 0) {
+			cores.insert(std::make_pair(physicalId, atoi(line.substr(line.find(':') + 1).c_str())));
+		}
+	}
+	return cores.empty() ? logicalCoreCount() : (unsigned int)cores.size();
+#endif
+}
@@ -0,0 +1,222 @@
+#pragma once
+//*********************************************
+//Hardware performance counters around a measured region, using perf_event_open on Linux
+//Counts cycles, instructions, last level cache misses and branches for every thread of the process.
+//Where counters cannot be opened (other platforms, or perf_event_paranoid forbids it)
+//the counters report themselves unavailable and every reading is zero.
+//*********************************************
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#endif
+
+using namespace std;
+
+/// <summary>
+/// Counter totals for one measured region
+/// </summary>
+struct PerfReading {
+	double cycles = 0;
+	double instructions = 0;
+	double llcMisses = 0;
+	double branches = 0;
+	double branchMisses = 0;
+};
+
+/// <summary>
+/// Hardware counters for all threads of the process
+/// Threads are found when the counters are opened, so open them after any thread pool has started
+/// </summary>
+class PerfCounters {
+private:
+	static const int kEventCount = 5;
+	vector<int> fds; // kEventCount descriptors per thread, -1 where an event is not supported
+	bool available = false;
+	string reason;
+
+#ifdef __linux__
+	/// <summary>
+	/// Open one counter for one thread, disabled until start is called
+	/// </summary>
+	/// <param name="type">perf event type</param>
+	/// <param name="config">perf event config</param>
+	/// <param name="tid">thread to count</param>
+	/// <returns>file descriptor, or -1 on failure with errno set</returns>
+	static int openCounter(const unsigned int &type, const unsigned long long &config, const int &tid) {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		//user space only, which is allowed at perf_event_paranoid 2
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		//time enabled and running let readings be scaled when the PMU is multiplexed
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return (int)syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0);
+	}
+
+	/// <summary>
+	/// Read a counter, scaled for any time it was not scheduled on the PMU
+	/// </summary>
+	/// <param name="fd">counter descriptor</param>
+	/// <returns>estimated count</returns>
+	static double readCounter(const int &fd) {
+		unsigned long long values[3] = { 0, 0, 0 };
+		if (fd < 0 || read(fd, values, sizeof(values)) != (ssize_t)sizeof(values) || values[2] == 0) {
+			return 0;
+		}
+		return (double)values[0] * ((double)values[1] / values[2]);
+	}
+
+	/// <summary>
+	/// Get the ids of all threads in this process
+	/// </summary>
+	/// <returns>thread ids</returns>
+	static vector<int> processThreads() {
+		vector<int> tids;
+		DIR *dir = opendir("/proc/self/task");
+		if (dir == nullptr) {
+			tids.push_back(0);
+			return tids;
+		}
+		while (dirent *entry = readdir(dir)) {
+			if (entry->d_name[0] != '.') {
+				tids.push_back(atoi(entry->d_name));
+			}
+		}
+		closedir(dir);
+		return tids;
+	}
+
+	/// <summary>
+	/// Apply an ioctl to every open counter
+	/// </summary>
+	/// <param name="request">PERF_EVENT_IOC_ request</param>
+	void control(const unsigned long &request) {
+		for (const int &fd : fds) {
+			if (fd >= 0) {
+				ioctl(fd, request, 0);
+			}
+		}
+	}
+#endif
+
+public:
+	/// <summary>
+	/// Open counters for every current thread of the process
+	/// </summary>
+	PerfCounters() {
+#ifdef __linux__
+		const unsigned int types[kEventCount] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+		const unsigned long long configs[kEventCount] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+			PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
+		for (const int &tid : processThreads()) {
+			for (int e = 0; e < kEventCount; e++) {
+				int fd = openCounter(types[e], configs[e], tid);
+				//some CPUs have no last level cache read miss event, fall back to the generic cache miss count
+				if (fd < 0 && e == 2) {
+					fd = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, tid);
+				}
+				if (fd < 0 && e == 0 && fds.empty()) {
+					//cannot even count cycles on the first thread, so counters are not usable at all
+					reason = string("perf_event_open failed: ") + strerror(errno) + " (perf_event_paranoid " + paranoidLevel() + ")";
+					return;
+				}
+				fds.push_back(fd);
+			}
+		}
+		available = !fds.empty();
+#else
+		reason = "hardware counters are only supported on Linux";
+#endif
+	}
+
+	~PerfCounters() {
+#ifdef __linux__
+		for (const int &fd : fds) {
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+#endif
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	/// <summary>
+	/// Check the counters opened
+	/// </summary>
+	/// <returns>true if readings will be meaningful</returns>
+	bool isAvailable() const {
+		return available;
+	}
+
+	/// <summary>
+	/// Get why the counters are unavailable
+	/// </summary>
+	/// <returns>reason, empty when available</returns>
+	const string& unavailableReason() const {
+		return reason;
+	}
+
+	/// <summary>
+	/// Zero and start the counters
+	/// </summary>
+	void start() {
+#ifdef __linux__
+		control(PERF_EVENT_IOC_RESET);
+		control(PERF_EVENT_IOC_ENABLE);
+#endif
+	}
+
+	/// <summary>
+	/// Stop the counters and read their totals across all threads
+	/// </summary>
+	/// <returns>counts since start</returns>
+	PerfReading stop() {
+		PerfReading reading;
+#ifdef __linux__
+		control(PERF_EVENT_IOC_DISABLE);
+		for (size_t i = 0; i + kEventCount <= fds.size(); i += kEventCount) {
+			reading.cycles += readCounter(fds[i]);
+			reading.instructions += readCounter(fds[i + 1]);
+			reading.llcMisses += readCounter(fds[i + 2]);
+			reading.branches += readCounter(fds[i + 3]);
+			reading.branchMisses += readCounter(fds[i + 4]);
+		}
+#endif
+		return reading;
+	}
+
+	/// <summary>
+	/// Get the kernel's perf_event_paranoid setting, for error messages
+	/// </summary>
+	/// <returns>setting as text, or unknown</returns>
+	static string paranoidLevel() {
+		ifstream in("/proc/sys/kernel/perf_event_paranoid");
+		string level;
+		if (!(in >> level)) {
+			return "unknown";
+		}
+		return level;
+	}
+};
@@ -0,0 +1,524 @@
+#pragma once
+//*********************************************
+//Fused stack -> region of interest -> scale pipeline
+//Stages are chained in memory, so nothing is written until the final output,
+//and the region of interest is applied as the frames are read: stacking works per pixel,
+//so only the part of each frame that reaches the output is ever read or stacked
+//*********************************************
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Image.h"
+#include "Operations.h"
+#include "Alignment.h"
+#include "Calibration.h"
+#include "Exposure.h"
+#include "FrameCache.h"
+#include "ResultCache.h"
+#include "Trace.h"
+
+using namespace std;
+
+/// <summary>
+/// Chain of stacking, region of interest and scaling stages ending in one written image
+/// e.g. Pipeline().stack(2, paths).regionOfInterest(100, 100, 400, 300).scale(3, 4).run("zoom.ppm", error)
+/// </summary>
+class Pipeline {
+private:
+	vector<string> sources;
+	unsigned int stackMethod = 0; // numbered stacking method, 0 to use a single source as it is
+	bool alignFrames = false; // remove drift between the frames before stacking
+	bool normalise = false; // scale every frame to the same median brightness while stacking
+	bool planar = false; // stack and scale 8-bit frames as PlanarImages
+	bool mappedOutput = false; // let the last stage write its pixels straight into the mapped output file
+	const Calibration *calibration = nullptr; // dark and flat correction applied as frames are read, null for none
+	unsigned int scaleMethod = 0; // numbered scaling method, 0 to leave the size alone
+	double scaleFactor = 0.0;
+	bool useRoi = false;
+	unsigned int roiLeft = 0, roiTop = 0, roiWidth = 0, roiHeight = 0;
+	FrameCache *cache = nullptr; // where decoded frames are kept between runs, null to always read the files
+	ResultCache *results = nullptr; // where finished outputs are kept, null to always compute them
+
+	/// <summary>
+	/// Read the same rectangle of every source
+	/// </summary>
+	/// <param name="left">x coordinate of the top left of the rectangle</param>
+	/// <param name="top">y coordinate of the top left of the rectangle</param>
+	/// <param name="width">width of the rectangle</param>
+	/// <param name="height">height of the rectangle</param>
+	/// <param name="wholeImage">the rectangle covers the whole image, so read the files normally</param>
+	/// <param name="levels">where each frame's brightness is counted as it is read, null to not count it</param>
+	/// <returns>one image per source, in order</returns>
+	vector<Image> readSources(const unsigned int &left, const unsigned int &top, const unsigned int &width, const unsigned int &height, const bool &wholeImage, ExposureNormalisation *levels) const {
+		vector<Image> images;
+		images.reserve(sources.size());
+		if (cache != nullptr) {
+			for (const string &path : sources) {
+				images.push_back(cache->get(path, left, top, width, height, wholeImage));
+				//the cache keeps raw frames, so the same frames can be used with other calibrations
+				if (calibration != nullptr && images.back().pixels != nullptr) {
+					calibration->apply(images.back(), left, top);
+				}
+				if (levels != nullptr && images.back().pixels != nullptr) {
+					levels->measure(images.size() - 1, images.back());
+				}
+			}
+			return images;
+		}
+		if (wholeImage && calibration == nullptr && levels == nullptr) {
+			return readImageFiles(sources);
+		}
+		//calibrating and counting are fused into decoding each row, so they cost no extra pass over the frames
+		size_t frame = 0;
+		const Image::RowDecoder calibrate = calibration != nullptr ? calibration->decoder() : Image::RowDecoder();
+		const Image::RowDecoder decoder = [&calibrate, &frame, levels](const unsigned char *raw, Image::Rgb *pixels, const unsigned int &x, const unsigned int &y, const unsigned int &count) {
+			if (calibrate) {
+				calibrate(raw, pixels, x, y, count);
+			} else {
+				memcpy(pixels, raw, (size_t)count * sizeof(Image::Rgb));
+			}
+			if (levels != nullptr) {
+				levels->countRow(frame, pixels, count);
+			}
+		};
+		for (; frame < sources.size(); frame++) {
+			Image img;
+			img.readPPMRegion(sources[frame].c_str(), left, top, width, height, calibration != nullptr || levels != nullptr ? &decoder : nullptr);
+			img.logDetails();
+			images.push_back(img);
+		}
+		return images;
+	}
+
+	/// <summary>
+	/// Work out the exposure normalisation from the counted frames and log the gain of each
+	/// </summary>
+	/// <param name="levels">normalisation every frame has been counted into</param>
+	void finishNormalisation(ExposureNormalisation &levels) const {
+		levels.finish();
+		if (!Logger::instance().isEnabled(LogLevel::Details)) {
+			return;
+		}
+		for (size_t i = 0; i < sources.size(); i++) {
+			LogRecord record(LogLevel::Details, "Exposure", "");
+			record.add("Frame", "frame", sources[i]).addNumber("Red Gain", "redGain", levels.getGain(i, 0))
+				.addNumber("Green Gain", "greenGain", levels.getGain(i, 1)).addNumber("Blue Gain", "blueGain", levels.getGain(i, 2));
+			Logger::instance().log(std::move(record));
+		}
+	}
+
+	/// <summary>
+	/// Line the frames up and log the shift found for each
+	/// </summary>
+	/// <param name="frames">frames read from the sources, trimmed in place</param>
+	/// <param name="error">set to the reason if the frames cannot be aligned</param>
+	/// <returns>true if the frames are aligned</returns>
+	bool alignSources(vector<Image> &frames, string &error) const {
+		const vector<FrameShift> shifts = Aligner::estimate(frames);
+		for (size_t i = 1; i < shifts.size(); i++) {
+			if (Logger::instance().isEnabled(LogLevel::Details)) {
+				LogRecord record(LogLevel::Details, "Alignment", "");
+				record.add("Frame", "frame", sources[i]).addNumber("Shift X", "dx", shifts[i].dx).addNumber("Shift Y", "dy", shifts[i].dy)
+					.addNumber("Subpixel X", "subpixelX", shifts[i].subpixelX).addNumber("Subpixel Y", "subpixelY", shifts[i].subpixelY)
+					.addNumber("Mean Difference", "meanDifference", shifts[i].meanDifference);
+				Logger::instance().log(std::move(record));
+			}
+		}
+		if (!Aligner::apply(frames, shifts, error)) {
+			return false;
+		}
+		cout << "Aligned " << frames.size() << " frames, stacking the " << frames[0].w << "x" << frames[0].h << " area they share\n";
+		return true;
+	}
+
+	/// <summary>
+	/// Run the stages on PixelImages, so deep frames are stacked and scaled without losing precision
+	/// and float results keep the fractions of a level the blend produces
+	/// </summary>
+	/// <param name="left">x coordinate of the region to read</param>
+	/// <param name="top">y coordinate of the region to read</param>
+	/// <param name="width">width of the region to read</param>
+	/// <param name="height">height of the region to read</param>
+	/// <param name="outputPath">file to write, at the depth of Out</param>
+	/// <param name="error">set to the reason if the pipeline fails</param>
+	/// <returns>true if the output was written</returns>
+	template <typename T, typename Out>
+	bool runSamples(const unsigned int &left, const unsigned int &top, const unsigned int &width, const unsigned int &height, const string &outputPath, string &error) const {
+		vector<PixelImage<T>> frames(sources.size());
+		for (size_t i = 0; i < sources.size(); i++) {
+			if (!frames[i].read(sources[i], left, top, width, height, error)) {
+				for (PixelImage<T> &frame : frames) {
+					frame.freeMemory();
+				}
+				return false;
+			}
+		}
+		cout << "Processing " << frames.size() << " frames at " << SampleTraits<T>::name() << " precision";
+		if (!is_same<T, Out>::value) {
+			cout << ", keeping the result as " << SampleTraits<Out>::name();
+		}
+		cout << "\n";
+		PixelImage<Out> result;
+		if (stackMethod == 0) {
+			result = frames[0].template convertTo<Out>();
+			frames[0].freeMemory();
+		} else {
+			//the stacker releases the frames
+			result = runPixelStackingMethod<T, Out>(stackMethod, frames);
+		}
+		if (scaleMethod != 0) {
+			PixelImage<Out> scaled = runPixelScalingMethod(scaleMethod, result, scaleFactor);
+			result.freeMemory();
+			result = scaled;
+		}
+		const bool written = result.write(outputPath, error);
+		result.freeMemory();
+		return written;
+	}
+
+	/// <summary>
+	/// Scale an image if a scaling stage was added, then write it
+	/// </summary>
+	/// <param name="img">result of the earlier stages, released here</param>
+	/// <param name="outputPath">file to write</param>
+	/// <param name="error">set to the reason if writing fails</param>
+	/// <returns>true if the output was written</returns>
+	bool scaleAndWrite(Image &img, const string &outputPath, string &error) const {
+		if (scaleMethod == 0) {
+			return write(img, outputPath, error);
+		}
+		ScaledImage scaled;
+		{
+			MappedOutputScope output(outputPath, mappedOutput);
+			scaled = runScalingMethod(scaleMethod, img, scaleFactor);
+		}
+		img.freeMemory();
+		return write(scaled, outputPath, error);
+	}
+
+	/// <summary>
+	/// Stack and scale in the planar layout: the frames are split into planes once after reading,
+	/// and the result is interleaved again once before writing
+	/// </summary>
+	/// <param name="frames">frames read and aligned, released here</param>
+	/// <param name="outputPath">file to write</param>
+	/// <param name="error">set to the reason if writing fails</param>
+	/// <returns>true if the output was written</returns>
+	bool runPlanar(vector<Image> &frames, const string &outputPath, string &error) const {
+		const unsigned int colourDepth = frames[0].getColourDepth();
+		vector<PlanarImage> planes = PlanarImage::fromImages(frames);
+		PlanarImage result = planes[0];
+		if (stackMethod != 0) {
+			//the stacker releases the frames
+			result = runPlanarStackingMethod(stackMethod, planes);
+		}
+		if (scaleMethod != 0) {
+			PlanarImage scaled = runPlanarScalingMethod(scaleMethod, result, scaleFactor);
+			result.freeMemory();
+			result = scaled;
+		}
+		Image output;
+		{
+			MappedOutputScope mapping(outputPath, mappedOutput);
+			output = Image(result.w, result.h, Image::kUninitialised, result.channels);
+		}
+		output.setColourDepth(colourDepth);
+		result.copyTo(output);
+		result.freeMemory();
+		return write(output, outputPath, error);
+	}
+
+	/// <summary>
+	/// Write the final image, log its details and release it
+	/// </summary>
+	/// <param name="img">image to write</param>
+	/// <param name="outputPath">file to write</param>
+	/// <param name="error">set to the reason if writing fails</param>
+	/// <returns>true if the whole image was written</returns>
+	static bool write(Image &img, const string &outputPath, string &error) {
+		const bool written = img.writePPM(outputPath.c_str());
+		img.logDetails();
+		img.freeMemory();
+		if (!written) {
+			error = "could not write " + outputPath;
+		}
+		return written;
+	}
+
+public:
+	/// <summary>
+	/// Start from a single image
+	/// </summary>
+	/// <param name="path">ppm file to read</param>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& load(const string &path) {
+		sources.assign(1, path);
+		stackMethod = 0;
+		return *this;
+	}
+
+	/// <summary>
+	/// Start by stacking a set of images
+	/// </summary>
+	/// <param name="method">numbered stacking method, as in runStackingMethod</param>
+	/// <param name="paths">ppm files to stack, all the same size</param>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& stack(const unsigned int &method, const vector<string> &paths) {
+		sources = paths;
+		stackMethod = method;
+		return *this;
+	}
+
+	/// <summary>
+	/// Apply dark and flat calibration to every source as it is read
+	/// </summary>
+	/// <param name="_calibration">loaded master frames, must outlive the pipeline</param>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& calibrate(const Calibration *_calibration) {
+		calibration = _calibration;
+		return *this;
+	}
+
+	/// <summary>
+	/// Line the frames up with the first one before stacking, trimming the stacked image to the area they share
+	/// </summary>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& align() {
+		alignFrames = true;
+		return *this;
+	}
+
+	/// <summary>
+	/// Scale each frame so its per channel median matches the mean median of the set, for sets whose exposure drifts
+	/// The medians are counted as the frames are read and the scaling is applied as the stacker gathers samples
+	/// </summary>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& normaliseExposure() {
+		normalise = true;
+		return *this;
+	}
+
+	/// <summary>
+	/// Stack and scale 8-bit frames in the planar layout, one aligned plane per channel
+	/// The output is the same as with interleaved pixels; 16-bit and float runs keep their own layout
+	/// </summary>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& planarLayout() {
+		planar = true;
+		return *this;
+	}
+
+	/// <summary>
+	/// Create the 8-bit output file at its final size and map it, so the last stacking or scaling stage
+	/// writes its pixels into the file instead of into memory that is written out afterwards
+	/// Outputs the file cannot hold as they are, e.g. a monochrome image in a .ppm, are written normally
+	/// </summary>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& mapOutput() {
+		mappedOutput = true;
+		return *this;
+	}
+
+	/// <summary>
+	/// Keep only a region of the source or stacked image
+	/// </summary>
+	/// <param name="left">x coordinate of the top left of the region</param>
+	/// <param name="top">y coordinate of the top left of the region</param>
+	/// <param name="width">width of the region</param>
+	/// <param name="height">height of the region</param>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& regionOfInterest(const unsigned int &left, const unsigned int &top, const unsigned int &width, const unsigned int &height) {
+		useRoi = true;
+		roiLeft = left;
+		roiTop = top;
+		roiWidth = width;
+		roiHeight = height;
+		return *this;
+	}
+
+	/// <summary>
+	/// Scale the image as the last stage
+	/// </summary>
+	/// <param name="method">numbered scaling method, as in runScalingMethod</param>
+	/// <param name="factor">scale factor</param>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& scale(const unsigned int &method, const double &factor) {
+		scaleMethod = method;
+		scaleFactor = factor;
+		return *this;
+	}
+
+	/// <summary>
+	/// Take frames from a cache rather than reading every file
+	/// </summary>
+	/// <param name="_cache">cache to use, must outlive the pipeline</param>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& useFrameCache(FrameCache *_cache) {
+		cache = _cache;
+		return *this;
+	}
+
+	/// <summary>
+	/// Reuse earlier outputs of the same stages on the same input contents
+	/// </summary>
+	/// <param name="_results">cache to use, must outlive the pipeline</param>
+	/// <returns>this pipeline, so stages can be chained</returns>
+	Pipeline& useResultCache(ResultCache *_results) {
+		results = _results;
+		return *this;
+	}
+
+	/// <summary>
+	/// Describe the stages and every setting that affects the output
+	/// </summary>
+	/// <returns>description, equal for pipelines that give the same output from the same inputs</returns>
+	string describe() const {
+		ostringstream description;
+		if (calibration != nullptr) {
+			description << calibration->describe() << ";";
+		}
+		description << (stackMethod == 0 ? "load" : stackingMethodParameters(stackMethod));
+		if (alignFrames && stackMethod != 0) {
+			description << ";align=" << Aligner::kCoarseRadius << "," << Aligner::kFineRadius << "," << Aligner::kMinLevelSize;
+		}
+		if (normalise && stackMethod != 0) {
+			description << ";normalise=median";
+		}
+		if (useRoi) {
+			description << ";roi=" << roiLeft << "," << roiTop << "," << roiWidth << "," << roiHeight;
+		}
+		if (scaleMethod != 0) {
+			description << ";scale=" << scaleMethod << ",factor=" << setprecision(17) << scaleFactor;
+		}
+		return description.str();
+	}
+
+	/// <summary>
+	/// Run every stage and write the result
+	/// </summary>
+	/// <param name="outputPath">file to write</param>
+	/// <param name="error">set to the reason if the pipeline fails</param>
+	/// <returns>true if the output was written</returns>
+	bool run(const string &outputPath, string &error) const {
+		TRACE_ZONE_DETAIL("Pipeline", outputPath.c_str());
+		if (sources.empty()) {
+			error = "the pipeline has no input";
+			return false;
+		}
+		if (sources.size() > 1 && stackMethod == 0) {
+			error = "several inputs need a stacking method";
+			return false;
+		}
+		//check the headers first, so a bad set fails before any pixels are read
+		unsigned int w = 0, h = 0;
+		bool deepSources = false, floatSources = false;
+		for (size_t i = 0; i < sources.size(); i++) {
+			unsigned int frameW = 0, frameH = 0, channels, maxValue;
+			if (!PixelImage<uint8_t>::readFormat(sources[i], frameW, frameH, channels, maxValue)) {
+				error = "could not read " + sources[i];
+				return false;
+			}
+			deepSources = deepSources || maxValue > 255;
+			floatSources = floatSources || maxValue == PixelImage<uint8_t>::kFloatMap;
+			if (i == 0) {
+				w = frameW;
+				h = frameH;
+			} else if (frameW != w || frameH != h) {
+				error = "input images are not all the same size, " + sources[i] + " differs from " + sources[0];
+				return false;
+			}
+		}
+		if (useRoi && !regionInside(roiLeft, roiTop, roiWidth, roiHeight, w, h)) {
+			error = "region of interest is outside the image";
+			return false;
+		}
+
+		if (calibration != nullptr && !calibration->matches(w, h)) {
+			error = "the calibration frames are not the same size as the inputs";
+			return false;
+		}
+		const bool floatOutput = hasExtension(outputPath, ".pfm");
+		if (floatSources && !floatOutput) {
+			error = "float map inputs need a .pfm output";
+			return false;
+		}
+		if (planar && normalise) {
+			error = "the planar layout cannot be combined with normalisation";
+			return false;
+		}
+		if (floatOutput && (calibration != nullptr || alignFrames || normalise)) {
+			error = "a .pfm output cannot be combined with calibration, alignment or normalisation";
+			return false;
+		}
+
+		//the same work on the same input contents has been done before, the master frames count as inputs
+		vector<string> keyInputs = sources;
+		if (calibration != nullptr) {
+			const vector<string> masters = calibration->masterPaths();
+			keyInputs.insert(keyInputs.end(), masters.begin(), masters.end());
+		}
+		//deep frames keep their precision unless a stage needs 8-bit frames, then they are narrowed as they are read
+		const bool deep = calibration == nullptr && !alignFrames && !normalise && deepSources;
+		const string samples = floatOutput ? ";samples=float" : deep ? ";samples=16-bit" : "";
+		//the file format is chosen by the output's extension, so a cached pgm must not answer a ppm request
+		const string format = floatOutput ? ";format=pfm" : hasExtension(outputPath, ".pgm") ? ";format=pgm" : ";format=ppm";
+		const string key = results != nullptr ? ResultCache::makeKey(keyInputs, describe() + samples + format) : "";
+		if (results != nullptr && results->fetch(key, outputPath)) {
+			cout << "Reused the cached result for " << outputPath << "\n";
+			return true;
+		}
+
+		const unsigned int left = useRoi ? roiLeft : 0, top = useRoi ? roiTop : 0;
+		const unsigned int width = useRoi ? roiWidth : w, height = useRoi ? roiHeight : h;
+		if (deep || floatOutput) {
+			bool written;
+			if (floatSources) {
+				written = runSamples<float, float>(left, top, width, height, outputPath, error);
+			} else if (floatOutput) {
+				written = deep ? runSamples<uint16_t, float>(left, top, width, height, outputPath, error)
+					: runSamples<uint8_t, float>(left, top, width, height, outputPath, error);
+			} else {
+				written = runSamples<uint16_t, uint16_t>(left, top, width, height, outputPath, error);
+			}
+			if (written && results != nullptr) {
+				results->store(key, outputPath);
+			}
+			return written;
+		}
+		//a single source has nothing to be normalised against
+		unique_ptr<ExposureNormalisation> levels(normalise && stackMethod != 0 ? new ExposureNormalisation(sources.size()) : nullptr);
+		vector<Image> frames = readSources(left, top, width, height, width == w && height == h, levels.get());
+		if (!imagesLoaded(frames)) {
+			freeImages(frames);
+			error = sources.size() == 1 ? "could not read " + sources[0] : "could not read every input image";
+			return false;
+		}
+		if (stackMethod != 0 && alignFrames && !alignSources(frames, error)) {
+			freeImages(frames);
+			return false;
+		}
+		bool written;
+		if (planar) {
+			written = runPlanar(frames, outputPath, error);
+		} else if (stackMethod == 0) {
+			written = scaleAndWrite(frames[0], outputPath, error);
+		} else {
+			if (levels) {
+				finishNormalisation(*levels);
+			}
+			//the stacker releases the frames, and its output is the final image unless it is scaled
+			StackedImage stacked;
+			{
+				MappedOutputScope output(outputPath, mappedOutput && scaleMethod == 0);
+				stacked = runStackingMethod(stackMethod, frames, levels.get());
+			}
+			written = scaleAndWrite(stacked, outputPath, error);
+		}
+		if (written && results != nullptr) {
+			results->store(key, outputPath);
+		}
+		return written;
+	}
+};
@@ -0,0 +1,367 @@
+#pragma once
+//*********************************************
+//Images of any sample type, for frames deeper than the 8 bits Image holds
+//A PixelImage<T> keeps w * h * channels samples of type T in row order, r, g, b interleaved for colour,
+//so 16-bit frames from raw converters can be stacked and scaled at full precision.
+//Netpbm files with a maxval above 255 store two bytes per sample, most significant first.
+//Portable float maps (PFM) store 32-bit floats with white at 1, bottom row first
+//*********************************************
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "BufferPool.h"
+#include "Utils.h"
+
+using namespace std;
+
+/// <summary>
+/// What the kernels need to know about a sample type
+/// </summary>
+template <typename T>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<uint8_t> {
+	typedef uint32_t Sum; // exact for up to 16 million frames
+	static const unsigned int kMaxValue = 255;
+	static const char* name() { return "8-bit"; }
+	/// <summary>
+	/// Round and clamp a level to the sample range
+	/// </summary>
+	static uint8_t fromLevel(const double &level, const unsigned int &maxValue) {
+		return (uint8_t)std::min((double)maxValue, std::max(0.0, level + 0.5));
+	}
+};
+
+template <>
+struct SampleTraits<uint16_t> {
+	typedef uint64_t Sum;
+	static const unsigned int kMaxValue = 65535;
+	static const char* name() { return "16-bit"; }
+	static uint16_t fromLevel(const double &level, const unsigned int &maxValue) {
+		return (uint16_t)std::min((double)maxValue, std::max(0.0, level + 0.5));
+	}
+};
+
+template <>
+struct SampleTraits<float> {
+	typedef double Sum;
+	static const unsigned int kMaxValue = 65535;
+	static const char* name() { return "float"; }
+	//float samples keep levels outside the range and between whole numbers
+	static float fromLevel(const double &level, const unsigned int &) {
+		return (float)level;
+	}
+};
+
+/// <summary>
+/// Image with samples of type T, 1 (grey) or 3 (colour) channels
+/// Like Image, copies share the sample array and freeMemory() releases it
+/// </summary>
+template <typename T>
+class PixelImage {
+public:
+	unsigned int w = 0, h = 0;
+	unsigned int channels = 3;
+	unsigned int maxValue = SampleTraits<T>::kMaxValue; // level of white, the file's maxval
+	T *samples = nullptr;
+
+	//maxval reported by readFormat for float maps, which have none
+	static const unsigned int kFloatMap = 0;
+
+	/// <summary>
+	/// Empty image
+	/// </summary>
+	PixelImage() {}
+
+	/// <summary>
+	/// Image of a size with every sample zero
+	/// </summary>
+	/// <param name="_w">width</param>
+	/// <param name="_h">height</param>
+	/// <param name="_channels">1 for grey, 3 for colour</param>
+	/// <param name="_maxValue">level of white</param>
+	PixelImage(const unsigned int &_w, const unsigned int &_h, const unsigned int &_channels, const unsigned int &_maxValue) : w(_w), h(_h), channels(_channels), maxValue(_maxValue) {
+		samples = BufferPool::acquire<T>(sampleCount());
+		std::fill(samples, samples + sampleCount(), T(0));
+	}
+
+	/// <summary>
+	/// Get the number of samples, w * h * channels
+	/// </summary>
+	size_t sampleCount() const {
+		return (size_t)w * h * channels;
+	}
+
+	/// <summary>
+	/// Get the bytes used by the samples
+	/// </summary>
+	unsigned long long sampleBytes() const {
+		return (unsigned long long)sampleCount() * sizeof(T);
+	}
+
+	/// <summary>
+	/// Get the samples of a row
+	/// </summary>
+	T* row(const size_t &y) {
+		return samples + y * w * channels;
+	}
+
+	/// <summary>
+	/// Get the samples of a row
+	/// </summary>
+	const T* row(const size_t &y) const {
+		return samples + y * w * channels;
+	}
+
+	/// <summary>
+	/// Release the samples
+	/// </summary>
+	void freeMemory() {
+		BufferPool::release(samples, sampleCount());
+		samples = nullptr;
+	}
+
+	/// <summary>
+	/// Make a copy with another sample type, keeping the levels
+	/// </summary>
+	/// <returns>converted image with its own samples</returns>
+	template <typename U>
+	PixelImage<U> convertTo() const {
+		PixelImage<U> converted(w, h, channels, maxValue);
+		for (size_t i = 0; i < sampleCount(); i++) {
+			converted.samples[i] = SampleTraits<U>::fromLevel(samples[i], maxValue);
+		}
+		return converted;
+	}
+
+	/// <summary>
+	/// Read the size and format of a ppm (P6), pgm (P5) or float map (PF, Pf) file without reading the samples
+	/// </summary>
+	/// <param name="filename">file to read</param>
+	/// <param name="width">set to the width</param>
+	/// <param name="height">set to the height</param>
+	/// <param name="fileChannels">set to 3 for colour, 1 for grey</param>
+	/// <param name="fileMaxValue">set to the maxval, above 255 for 16-bit files and kFloatMap for float maps</param>
+	/// <returns>true if the header is valid</returns>
+	static bool readFormat(const string &filename, unsigned int &width, unsigned int &height, unsigned int &fileChannels, unsigned int &fileMaxValue) {
+		ifstream ifs(filename, ios::binary);
+		string header;
+		long long fileW = 0, fileH = 0;
+		if (!(ifs >> header >> fileW >> fileH) || fileW <= 0 || fileH <= 0) {
+			return false;
+		}
+		width = (unsigned int)fileW;
+		height = (unsigned int)fileH;
+		if (header == "PF" || header == "Pf") {
+			double scale = 0.0;
+			fileChannels = header == "PF" ? 3 : 1;
+			fileMaxValue = kFloatMap;
+			return (bool)(ifs >> scale) && scale != 0.0;
+		}
+		long long maxval = 0;
+		if (!(ifs >> maxval) || (header != "P6" && header != "P5") || maxval <= 0 || maxval > 65535) {
+			return false;
+		}
+		fileChannels = header == "P6" ? 3 : 1;
+		fileMaxValue = (unsigned int)maxval;
+		return true;
+	}
+
+	/// <summary>
+	/// Read a rectangle of a ppm, pgm or float map file of any depth, converting each sample to T
+	/// Samples too deep for T are scaled down to its range, otherwise levels are kept as they are.
+	/// Float maps read as float keep white at 1, other types scale it to their range
+	/// </summary>
+	/// <param name="filename">file to read</param>
+	/// <param name="left">x coordinate of the rectangle</param>
+	/// <param name="top">y coordinate of the rectangle</param>
+	/// <param name="width">width of the rectangle, 0 for the whole file</param>
+	/// <param name="height">height of the rectangle, 0 for the whole file</param>
+	/// <param name="error">set to the reason if the file cannot be read</param>
+	/// <returns>true if read</returns>
+	bool read(const string &filename, const unsigned int &left, const unsigned int &top, unsigned int width, unsigned int height, string &error) {
+		freeMemory();
+		unsigned int fileW, fileH, fileChannels, fileMaxValue;
+		if (!readFormat(filename, fileW, fileH, fileChannels, fileMaxValue)) {
+			error = "could not read " + filename;
+			return false;
+		}
+		if (width == 0 || height == 0) {
+			width = fileW;
+			height = fileH;
+		}
+		if (!regionInside(left, top, width, height, fileW, fileH)) {
+			error = "the region is outside " + filename;
+			return false;
+		}
+		ifstream ifs(filename, ios::binary);
+		string header;
+		unsigned int skip;
+		ifs >> header >> skip >> skip;
+		if (fileMaxValue == kFloatMap) {
+			return readFloatMap(ifs, filename, fileW, fileH, fileChannels, left, top, width, height, error);
+		}
+		ifs >> skip;
+		ifs.ignore(256, '\n');
+		const streamoff dataStart = ifs.tellg();
+		const size_t sampleSize = fileMaxValue > 255 ? 2 : 1;
+		//scale down only when T cannot hold the file's levels
+		const bool narrow = fileMaxValue > SampleTraits<T>::kMaxValue;
+		const double scale = narrow ? (double)SampleTraits<T>::kMaxValue / fileMaxValue : 1.0;
+
+		w = width;
+		h = height;
+		channels = fileChannels;
+		maxValue = narrow ? SampleTraits<T>::kMaxValue : fileMaxValue;
+		samples = BufferPool::acquire<T>(sampleCount());
+		const size_t rowSamples = (size_t)width * channels;
+		vector<unsigned char> bytes(rowSamples * sampleSize);
+		for (unsigned int y = 0; y < height; y++) {
+			ifs.seekg(dataStart + (streamoff)((((size_t)top + y) * fileW + left) * channels * sampleSize));
+			ifs.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+			T *out = row(y);
+			if (sampleSize == 1) {
+				for (size_t i = 0; i < rowSamples; i++) {
+					out[i] = narrow ? SampleTraits<T>::fromLevel(bytes[i] * scale, maxValue) : (T)bytes[i];
+				}
+			} else {
+				for (size_t i = 0; i < rowSamples; i++) {
+					const unsigned int level = ((unsigned int)bytes[2 * i] << 8) | bytes[2 * i + 1];
+					out[i] = narrow ? SampleTraits<T>::fromLevel(level * scale, maxValue) : (T)level;
+				}
+			}
+		}
+		if (ifs.fail()) {
+			freeMemory();
+			error = filename + " is shorter than its header says";
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Write a ppm (colour) or pgm (grey) file, two bytes per sample when maxValue is above 255
+	/// Float samples are rounded and clamped to the range. A file name ending in .pfm is written as a float map instead
+	/// </summary>
+	/// <param name="filename">file to write</param>
+	/// <param name="error">set to the reason if the file cannot be written</param>
+	/// <returns>true if written</returns>
+	bool write(const string &filename, string &error) const {
+		//replace rather than overwrite, so a hard link to this file (e.g. in the result cache) keeps its contents
+		remove(filename.c_str());
+		ofstream ofs(filename, ios::binary);
+		if (ofs.fail()) {
+			error = "could not write " + filename;
+			return false;
+		}
+		if (hasExtension(filename, ".pfm")) {
+			writeFloatMap(ofs);
+		} else {
+			writeNetpbm(ofs);
+		}
+		ofs.close();
+		if (ofs.fail()) {
+			error = "could not write " + filename + " - is the disk full?";
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static bool littleEndian() {
+		const uint16_t probe = 1;
+		return *reinterpret_cast<const unsigned char*>(&probe) == 1;
+	}
+
+	/// <summary>
+	/// Read a rectangle of a float map, the stream just past the width and height
+	/// </summary>
+	bool readFloatMap(ifstream &ifs, const string &filename, const unsigned int &fileW, const unsigned int &fileH, const unsigned int &fileChannels,
+		const unsigned int &left, const unsigned int &top, const unsigned int &width, const unsigned int &height, string &error) {
+		double scale = 0.0;
+		ifs >> scale;
+		ifs.ignore(256, '\n');
+		const streamoff dataStart = ifs.tellg();
+		//a negative scale means little endian floats
+		const bool swap = (scale < 0) != littleEndian();
+		w = width;
+		h = height;
+		channels = fileChannels;
+		maxValue = is_floating_point<T>::value ? 1 : SampleTraits<T>::kMaxValue;
+		samples = BufferPool::acquire<T>(sampleCount());
+		const size_t rowSamples = (size_t)width * channels;
+		vector<float> levels(rowSamples);
+		for (unsigned int y = 0; y < height; y++) {
+			//rows are stored bottom first
+			ifs.seekg(dataStart + (streamoff)((((size_t)fileH - 1 - top - y) * fileW + left) * channels * sizeof(float)));
+			ifs.read(reinterpret_cast<char*>(levels.data()), rowSamples * sizeof(float));
+			T *out = row(y);
+			for (size_t i = 0; i < rowSamples; i++) {
+				if (swap) {
+					unsigned char *bytes = reinterpret_cast<unsigned char*>(&levels[i]);
+					std::swap(bytes[0], bytes[3]);
+					std::swap(bytes[1], bytes[2]);
+				}
+				out[i] = SampleTraits<T>::fromLevel((double)levels[i] * maxValue, maxValue);
+			}
+		}
+		if (ifs.fail()) {
+			freeMemory();
+			error = filename + " is shorter than its header says";
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Write the samples as a float map in the host's byte order, white at 1, a row per write
+	/// </summary>
+	void writeFloatMap(ofstream &ofs) const {
+		ofs << (channels == 1 ? "Pf" : "PF") << "\n" << w << " " << h << "\n" << (littleEndian() ? "-1.0" : "1.0") << "\n";
+		const size_t rowSamples = (size_t)w * channels;
+		const bool direct = is_same<T, float>::value && maxValue == 1;
+		vector<float> levels(direct ? 0 : rowSamples);
+		const float unit = 1.0f / maxValue;
+		for (size_t y = h; y-- > 0;) {
+			const T *in = row(y);
+			if (direct) {
+				ofs.write(reinterpret_cast<const char*>(in), rowSamples * sizeof(float));
+				continue;
+			}
+			for (size_t i = 0; i < rowSamples; i++) {
+				levels[i] = in[i] * unit;
+			}
+			ofs.write(reinterpret_cast<const char*>(levels.data()), rowSamples * sizeof(float));
+		}
+	}
+
+	/// <summary>
+	/// Write the samples as a ppm or pgm
+	/// </summary>
+	void writeNetpbm(ofstream &ofs) const {
+		ofs << (channels == 1 ? "P5" : "P6") << "\n" << w << " " << h << "\n" << maxValue << "\n";
+		const size_t sampleSize = maxValue > 255 ? 2 : 1;
+		const size_t rowSamples = (size_t)w * channels;
+		vector<unsigned char> bytes(rowSamples * sampleSize);
+		for (unsigned int y = 0; y < h; y++) {
+			const T *in = row(y);
+			for (size_t i = 0; i < rowSamples; i++) {
+				const unsigned int level = (unsigned int)std::min((double)maxValue, std::max(0.0, (double)in[i] + (is_floating_point<T>::value ? 0.5 : 0.0)));
+				if (sampleSize == 1) {
+					bytes[i] = (unsigned char)level;
+				} else {
+					bytes[2 * i] = (unsigned char)(level >> 8);
+					bytes[2 * i + 1] = (unsigned char)(level & 0xFF);
+				}
+			}
+			ofs.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		}
+	}
+};
@@ -0,0 +1,262 @@
+#pragma once
+//*********************************************
+//Planar image layout: a plane of bytes per channel instead of interleaved r, g, b pixels
+//Every row of every plane starts on a 64 byte boundary and is padded to a whole number of 64 byte lines,
+//so kernels can run along one channel at a time with aligned vector loads and no shuffling.
+//Frames are converted from and to the interleaved Image layout once, where they are read and written
+//*********************************************
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "Image.h"
+#include "BufferPool.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PLANAR_SSE2 1
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define PLANAR_SSSE3 1
+#endif
+
+using namespace std;
+
+/// <summary>
+/// Image stored as 1 (grey) or 3 (colour) aligned planes with a padded row stride
+/// Like Image, copies share the planes and freeMemory() releases them
+/// </summary>
+class PlanarImage {
+public:
+	//alignment of the planes and of every row, a cache line as the buffer pool gives
+	static const size_t kAlignment = BufferPool::kAlignment;
+
+	unsigned int w = 0, h = 0;
+	unsigned int channels = 3;
+	size_t stride = 0; // bytes from a row of a plane to the next, w rounded up to kAlignment
+	unsigned char *data = nullptr; // the planes one after another
+
+	/// <summary>
+	/// Empty image
+	/// </summary>
+	PlanarImage() {}
+
+	/// <summary>
+	/// Image of a size, its planes taken from the buffer pool
+	/// The samples are left for the producer to write, only the padding at the end of each row is zeroed
+	/// </summary>
+	/// <param name="_w">width</param>
+	/// <param name="_h">height</param>
+	/// <param name="_channels">1 for grey, 3 for colour</param>
+	PlanarImage(const unsigned int &_w, const unsigned int &_h, const unsigned int &_channels) : w(_w), h(_h), channels(_channels) {
+		stride = ((size_t)w + kAlignment - 1) / kAlignment * kAlignment;
+		data = BufferPool::acquire<unsigned char>(allocatedBytes());
+		if (stride > w) {
+			for (size_t row = 0; row < (size_t)h * channels; row++) {
+				memset(data + row * stride + w, 0, stride - w);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Get the bytes of one plane, padding included
+	/// </summary>
+	size_t planeBytes() const {
+		return stride * h;
+	}
+
+	/// <summary>
+	/// Get the bytes of every plane, padding included
+	/// </summary>
+	size_t bytes() const {
+		return planeBytes() * channels;
+	}
+
+	/// <summary>
+	/// Get the bytes allocated, at least one line so an empty image still has storage
+	/// </summary>
+	size_t allocatedBytes() const {
+		return bytes() > kAlignment ? bytes() : kAlignment;
+	}
+
+	/// <summary>
+	/// Get a plane
+	/// </summary>
+	/// <param name="c">0 red, 1 green, 2 blue, or 0 for grey</param>
+	unsigned char* plane(const unsigned int &c) {
+		return data + c * planeBytes();
+	}
+
+	/// <summary>
+	/// Get a plane
+	/// </summary>
+	/// <param name="c">0 red, 1 green, 2 blue, or 0 for grey</param>
+	const unsigned char* plane(const unsigned int &c) const {
+		return data + c * planeBytes();
+	}
+
+	/// <summary>
+	/// Release the planes
+	/// </summary>
+	void freeMemory() {
+		BufferPool::release(data, allocatedBytes());
+		data = nullptr;
+	}
+
+	/// <summary>
+	/// Convert an interleaved image, a row per task across all CPU cores
+	/// </summary>
+	/// <param name="img">colour or monochrome image, left untouched</param>
+	/// <returns>planar copy</returns>
+	static PlanarImage fromImage(const Image &img) {
+		TRACE_ZONE("To planar");
+		PlanarImage planar(img.w, img.h, img.channels);
+		parallel_for(size_t(0), size_t(img.h), [&img, &planar](size_t y) {
+			const unsigned char *source = img.samples() + y * img.w * img.channels;
+			if (img.channels == 1) {
+				memcpy(planar.plane(0) + y * planar.stride, source, img.w);
+				return;
+			}
+			deinterleaveRow(source, planar.plane(0) + y * planar.stride, planar.plane(1) + y * planar.stride, planar.plane(2) + y * planar.stride, img.w);
+		});
+		return planar;
+	}
+
+	/// <summary>
+	/// Convert frames, releasing each interleaved frame once it is converted
+	/// </summary>
+	/// <param name="imgs">frames to convert, released</param>
+	/// <returns>planar frames in the same order</returns>
+	static vector<PlanarImage> fromImages(vector<Image> &imgs) {
+		vector<PlanarImage> planar;
+		planar.reserve(imgs.size());
+		for (Image &img : imgs) {
+			planar.push_back(fromImage(img));
+			img.freeMemory();
+		}
+		return planar;
+	}
+
+	/// <summary>
+	/// Copy the planes into an interleaved image of the same size, a row per task across all CPU cores
+	/// </summary>
+	/// <param name="img">image to fill, e.g. a new StackedImage, given this image's channels</param>
+	void copyTo(Image &img) const {
+		TRACE_ZONE("From planar");
+		if (img.w != w || img.h != h) {
+			throw new invalid_argument("A planar image can only be copied to an image of the same size");
+		}
+		img.setChannels(channels);
+		parallel_for(size_t(0), size_t(h), [this, &img](size_t y) {
+			unsigned char *target = img.samples() + y * w * channels;
+			if (channels == 1) {
+				memcpy(target, plane(0) + y * stride, w);
+				return;
+			}
+			interleaveRow(plane(0) + y * stride, plane(1) + y * stride, plane(2) + y * stride, target, w);
+		});
+		img.updateModified();
+	}
+
+	/// <summary>
+	/// Split a row of r, g, b pixels into three channel rows
+	/// </summary>
+	/// <param name="rgb">interleaved pixels</param>
+	/// <param name="r">red row, 16 byte aligned</param>
+	/// <param name="g">green row, 16 byte aligned</param>
+	/// <param name="b">blue row, 16 byte aligned</param>
+	/// <param name="count">number of pixels</param>
+	static void deinterleaveRow(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, const size_t &count) {
+		size_t x = 0;
+#ifdef PLANAR_SSSE3
+		//16 pixels at a time: each channel gathers its bytes from the three 16 byte blocks and ors them together
+		const Shuffles &masks = shuffles();
+		unsigned char *planes[3] = { r, g, b };
+		for (; x + 16 <= count; x += 16) {
+			const __m128i blocks[3] = {
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + 3 * x)),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + 3 * x + 16)),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + 3 * x + 32)) };
+			for (int c = 0; c < 3; c++) {
+				const __m128i channel = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(blocks[0], masks.split[c][0]), _mm_shuffle_epi8(blocks[1], masks.split[c][1])),
+					_mm_shuffle_epi8(blocks[2], masks.split[c][2]));
+				_mm_store_si128(reinterpret_cast<__m128i*>(planes[c] + x), channel);
+			}
+		}
+#endif
+		for (; x < count; x++) {
+			r[x] = rgb[3 * x];
+			g[x] = rgb[3 * x + 1];
+			b[x] = rgb[3 * x + 2];
+		}
+	}
+
+	/// <summary>
+	/// Merge three channel rows into a row of r, g, b pixels
+	/// </summary>
+	/// <param name="r">red row, 16 byte aligned</param>
+	/// <param name="g">green row, 16 byte aligned</param>
+	/// <param name="b">blue row, 16 byte aligned</param>
+	/// <param name="rgb">interleaved pixels</param>
+	/// <param name="count">number of pixels</param>
+	static void interleaveRow(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb, const size_t &count) {
+		size_t x = 0;
+#ifdef PLANAR_SSSE3
+		const Shuffles &masks = shuffles();
+		for (; x + 16 <= count; x += 16) {
+			const __m128i planes[3] = {
+				_mm_load_si128(reinterpret_cast<const __m128i*>(r + x)),
+				_mm_load_si128(reinterpret_cast<const __m128i*>(g + x)),
+				_mm_load_si128(reinterpret_cast<const __m128i*>(b + x)) };
+			for (int k = 0; k < 3; k++) {
+				const __m128i block = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(planes[0], masks.merge[k][0]), _mm_shuffle_epi8(planes[1], masks.merge[k][1])),
+					_mm_shuffle_epi8(planes[2], masks.merge[k][2]));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + 3 * x + 16 * k), block);
+			}
+		}
+#endif
+		for (; x < count; x++) {
+			rgb[3 * x] = r[x];
+			rgb[3 * x + 1] = g[x];
+			rgb[3 * x + 2] = b[x];
+		}
+	}
+
+private:
+#ifdef PLANAR_SSSE3
+	/// <summary>
+	/// Byte shuffles between 48 interleaved bytes and 16 bytes of each channel, a 0x80 entry gives zero
+	/// </summary>
+	struct Shuffles {
+		__m128i split[3][3]; // [channel][interleaved block]
+		__m128i merge[3][3]; // [interleaved block][channel]
+	};
+
+	static const Shuffles& shuffles() {
+		static const Shuffles masks = [] {
+			Shuffles built;
+			for (int c = 0; c < 3; c++) {
+				for (int k = 0; k < 3; k++) {
+					alignas(16) unsigned char split[16], merge[16];
+					for (int i = 0; i < 16; i++) {
+						//sample i of channel c is interleaved byte 3i + c
+						const int source = 3 * i + c;
+						split[i] = source / 16 == k ? (unsigned char)(source % 16) : 0x80;
+						//byte i of block k is channel (16k + i) % 3 of pixel (16k + i) / 3
+						const int target = 16 * k + i;
+						merge[i] = target % 3 == c ? (unsigned char)(target / 3) : 0x80;
+					}
+					built.split[c][k] = _mm_load_si128(reinterpret_cast<const __m128i*>(split));
+					built.merge[k][c] = _mm_load_si128(reinterpret_cast<const __m128i*>(merge));
+				}
+			}
+			return built;
+		}();
+		return masks;
+	}
+#endif
+};
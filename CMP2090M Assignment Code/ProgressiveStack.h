@@ -0,0 +1,143 @@
+#pragma once
+//*********************************************
+//Progressive stacking, for a quick look at large sets before the full result is ready
+//Every frame is box downscaled as it is added, and the small frames are stacked first for a preview.
+//The full resolution result is then stacked a tile at a time with the same stacking method,
+//each finished row of tiles replacing that part of the enlarged preview
+//*********************************************
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include "Image.h"
+#include "Operations.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+using namespace std;
+
+/// <summary>
+/// Coarse to fine stacker that publishes its result as it improves
+/// </summary>
+class ProgressiveStack {
+public:
+	//width and height of the full resolution tiles
+	static constexpr unsigned int kTileSize = 256;
+
+	/// <summary>
+	/// Called with the current result, first the enlarged preview then after each row of tiles
+	/// </summary>
+	/// <param name="current">full size result so far, owned by the stacker</param>
+	/// <param name="tilesDone">full resolution tiles stacked so far, 0 for the preview</param>
+	/// <param name="tileCount">full resolution tiles in total</param>
+	typedef function<void(StackedImage &current, const unsigned int &tilesDone, const unsigned int &tileCount)> Publish;
+
+private:
+	unsigned int method;
+	unsigned int factor;
+	vector<Image> frames;
+	vector<Image> smallFrames;
+
+	/// <summary>
+	/// Copy a rectangle of a frame into a new image
+	/// </summary>
+	static Image crop(const Image &frame, const unsigned int &left, const unsigned int &top, const unsigned int &width, const unsigned int &height) {
+		Image tile(width, height);
+		tile.setColourDepth(const_cast<Image&>(frame).getColourDepth());
+		for (unsigned int y = 0; y < height; y++) {
+			const Image::Rgb *row = frame.pixels + (size_t)(top + y) * frame.w + left;
+			std::copy(row, row + width, tile.pixels + (size_t)y * width);
+		}
+		return tile;
+	}
+
+public:
+	/// <summary>
+	/// Create an empty progressive stack
+	/// </summary>
+	/// <param name="_method">numbered stacking method, as in runStackingMethod, used at every level</param>
+	/// <param name="_factor">how much smaller the preview frames are, e.g. 4 or 8</param>
+	ProgressiveStack(const unsigned int &_method, const unsigned int &_factor) : method(_method), factor(std::max(_factor, 1u)) {}
+
+	~ProgressiveStack() {
+		freeImages(frames);
+		freeImages(smallFrames);
+	}
+
+	ProgressiveStack(const ProgressiveStack&) = delete;
+	ProgressiveStack& operator=(const ProgressiveStack&) = delete;
+
+	/// <summary>
+	/// Add a frame as it is loaded, making its preview copy straight away
+	/// </summary>
+	/// <param name="frame">frame to stack, now owned by the stack</param>
+	void addFrame(const Image &frame) {
+		smallFrames.push_back(Scaler::BoxDownscale(frame, factor));
+		frames.push_back(frame);
+	}
+
+	/// <summary>
+	/// Stack the preview, then the full resolution tiles, publishing the result after each step
+	/// The frames are released as they are used
+	/// </summary>
+	/// <param name="publish">called with each improved result</param>
+	/// <returns>full resolution result, the same as stacking the whole frames at once</returns>
+	StackedImage run(const Publish &publish) {
+		if (frames.empty()) {
+			throw new invalid_argument("There must be at least one image to stack");
+		}
+		const unsigned int w = frames[0].w, h = frames[0].h;
+		for (const Image &frame : frames) {
+			if (frame.w != w || frame.h != h) {
+				throw new invalid_argument("Images must all be the same size");
+			}
+		}
+		const unsigned int tilesAcross = (w + kTileSize - 1) / kTileSize;
+		const unsigned int tilesDown = (h + kTileSize - 1) / kTileSize;
+		const unsigned int tileCount = tilesAcross * tilesDown;
+
+		//the preview, enlarged to full size so it can be refined in place
+		StackedImage current(w, h, "Progressive Stack");
+		current.setColourDepth(frames[0].getColourDepth());
+		{
+			TRACE_ZONE("Progressive preview");
+			//the stacker releases the small frames
+			StackedImage preview = runStackingMethod(method, smallFrames);
+			smallFrames.clear();
+			parallel_for(size_t(0), size_t(h), [this, &current, &preview, w](size_t y) {
+				for (unsigned int x = 0; x < w; x++) {
+					current.pixels[y * w + x] = preview.pixels[(y / factor) * preview.w + x / factor];
+				}
+			});
+			preview.freeMemory();
+			current.updateModified();
+		}
+		publish(current, 0, tileCount);
+
+		unsigned int tilesDone = 0;
+		for (unsigned int tileY = 0; tileY < tilesDown; tileY++) {
+			for (unsigned int tileX = 0; tileX < tilesAcross; tileX++) {
+				TRACE_ZONE_DETAIL("Progressive tile", tilesDone);
+				const unsigned int left = tileX * kTileSize, top = tileY * kTileSize;
+				const unsigned int width = std::min(kTileSize, w - left), height = std::min(kTileSize, h - top);
+				vector<Image> tiles;
+				tiles.reserve(frames.size());
+				for (const Image &frame : frames) {
+					tiles.push_back(crop(frame, left, top, width, height));
+				}
+				//the stacker releases the tiles
+				StackedImage stacked = runStackingMethod(method, tiles);
+				for (unsigned int y = 0; y < height; y++) {
+					const Image::Rgb *row = stacked.pixels + (size_t)y * width;
+					std::copy(row, row + width, current.pixels + (size_t)(top + y) * w + left);
+				}
+				stacked.freeMemory();
+				tilesDone++;
+			}
+			current.updateModified();
+			publish(current, tilesDone, tileCount);
+		}
+		freeImages(frames);
+		return current;
+	}
+};
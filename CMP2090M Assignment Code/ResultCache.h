@@ -0,0 +1,235 @@
+#pragma once
+//*********************************************
+//On-disk cache of finished outputs, addressed by the contents of their inputs
+//An entry's name is a hash of every input file and of the operation and its parameters,
+//so re-running the same work finds the earlier output instead of computing it again
+//*********************************************
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "Hash.h"
+#include "Logger.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+using namespace std;
+
+/// <summary>
+/// Size bounded directory of cached outputs, least recently used entries are removed first
+/// Safe to share between threads, and between processes using the same directory
+/// </summary>
+class ResultCache {
+private:
+	//bump when a change to the algorithms means old outputs must not be reused
+	static const unsigned int kFormatVersion = 1;
+
+	string directory;
+	unsigned long long capacityBytes;
+	atomic<unsigned long long> hits;
+	atomic<unsigned long long> misses;
+	mutex evictLock;
+
+	/// <summary>
+	/// Get the path of an entry
+	/// </summary>
+	string entryPath(const string &key) const {
+		return directory + "/" + key + ".ppm";
+	}
+
+	/// <summary>
+	/// Make a file appear at a second path, as a hard link where possible and a copy otherwise
+	/// </summary>
+	/// <param name="from">existing file</param>
+	/// <param name="to">path to create, replaced if it exists</param>
+	/// <returns>true if the file is now at the second path</returns>
+	static bool linkOrCopy(const string &from, const string &to) {
+		remove(to.c_str());
+#ifdef _WIN32
+		if (CreateHardLinkA(to.c_str(), from.c_str(), nullptr)) {
+			return true;
+		}
+#else
+		if (link(from.c_str(), to.c_str()) == 0) {
+			return true;
+		}
+#endif
+		//different volumes, or a file system without hard links
+		ifstream in(from, ios::binary);
+		ofstream out(to, ios::binary | ios::trunc);
+		if (in.fail() || out.fail()) {
+			return false;
+		}
+		out << in.rdbuf();
+		out.close();
+		return !out.fail();
+	}
+
+	/// <summary>
+	/// Log a lookup and the running hit rate
+	/// </summary>
+	void logLookup(const string &key, const string &outputPath, const bool &hit) {
+		if (!Logger::instance().isEnabled(LogLevel::Info)) {
+			return;
+		}
+		const unsigned long long hitCount = hits, missCount = misses;
+		LogRecord record(LogLevel::Info, "Result Cache", hit ? "hit" : "miss");
+		record.add("Key", "key", key).add("Output", "output", outputPath)
+			.addNumber("Hits", "hits", (double)hitCount).addNumber("Misses", "misses", (double)missCount)
+			.addNumber("Hit Rate", "hitRate", getHitRate());
+		Logger::instance().log(std::move(record));
+	}
+
+	/// <summary>
+	/// Remove least recently used entries until the cache fits its capacity
+	/// </summary>
+	void evict() {
+		lock_guard<mutex> guard(evictLock);
+		struct Entry {
+			string path;
+			unsigned long long bytes;
+			time_t used;
+		};
+		vector<Entry> entries;
+		unsigned long long total = 0;
+		for (const string &path : expandFilePattern(directory + "/*.ppm")) {
+			struct stat info;
+			if (stat(path.c_str(), &info) == 0) {
+				entries.push_back({ path, (unsigned long long)info.st_size, info.st_mtime });
+				total += info.st_size;
+			}
+		}
+		sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used < b.used; });
+		for (const Entry &entry : entries) {
+			if (total <= capacityBytes) {
+				break;
+			}
+			if (remove(entry.path.c_str()) == 0) {
+				total -= entry.bytes;
+			}
+		}
+	}
+
+public:
+	/// <summary>
+	/// Open a cache directory, creating it if needed
+	/// </summary>
+	/// <param name="_directory">directory holding the entries</param>
+	/// <param name="_capacityBytes">most bytes of entries to keep</param>
+	ResultCache(const string &_directory, const unsigned long long &_capacityBytes) : directory(_directory), capacityBytes(_capacityBytes), hits(0), misses(0) {
+		makeDirectory(directory);
+	}
+
+	/// <summary>
+	/// Build the key for an operation from its inputs' contents and a description of the operation
+	/// </summary>
+	/// <param name="inputs">input files, in the order the operation uses them</param>
+	/// <param name="operation">the operation and every parameter that affects its output</param>
+	/// <returns>key, empty if an input could not be read</returns>
+	static string makeKey(const vector<string> &inputs, const string &operation) {
+		TRACE_ZONE("Hash inputs");
+		XxHash64 hash;
+		hash.update("v" + to_string(kFormatVersion) + "|" + operation + "|" + to_string(inputs.size()));
+		for (const string &input : inputs) {
+			//each input is hashed on its own so files cannot run into each other
+			XxHash64 file;
+			if (!file.updateFromFile(input)) {
+				return "";
+			}
+			hash.update("|" + file.hexDigest());
+		}
+		return hash.hexDigest();
+	}
+
+	/// <summary>
+	/// Put the cached output for a key at the output path, if there is one
+	/// </summary>
+	/// <param name="key">key from makeKey</param>
+	/// <param name="outputPath">where the output should go</param>
+	/// <returns>true on a hit, the output is then in place</returns>
+	bool fetch(const string &key, const string &outputPath) {
+		if (key.empty()) {
+			return false;
+		}
+		const string entry = entryPath(key);
+		struct stat info;
+		const bool hit = stat(entry.c_str(), &info) == 0 && linkOrCopy(entry, outputPath);
+		if (hit) {
+			hits++;
+			//mark the entry as recently used
+			utime(entry.c_str(), nullptr);
+		} else {
+			misses++;
+		}
+		logLookup(key, outputPath, hit);
+		return hit;
+	}
+
+	/// <summary>
+	/// Add a finished output to the cache, then trim the cache to its capacity
+	/// </summary>
+	/// <param name="key">key from makeKey</param>
+	/// <param name="outputPath">output that was written</param>
+	void store(const string &key, const string &outputPath) {
+		if (key.empty()) {
+			return;
+		}
+		//link under a temporary name first, so other processes never see a partial entry
+		const string entry = entryPath(key);
+		const string temporary = entry + "." + to_string(random_device()()) + ".tmp";
+		if (!linkOrCopy(outputPath, temporary)) {
+			remove(temporary.c_str());
+			return;
+		}
+		remove(entry.c_str());
+		if (rename(temporary.c_str(), entry.c_str()) != 0) {
+			remove(temporary.c_str());
+			return;
+		}
+		evict();
+	}
+
+	/// <summary>
+	/// Get the number of lookups that found an output
+	/// </summary>
+	unsigned long long getHits() const {
+		return hits;
+	}
+
+	/// <summary>
+	/// Get the number of lookups that found nothing
+	/// </summary>
+	unsigned long long getMisses() const {
+		return misses;
+	}
+
+	/// <summary>
+	/// Get the fraction of lookups that were hits
+	/// </summary>
+	/// <returns>between 0 and 1, 0 before any lookups</returns>
+	double getHitRate() const {
+		const unsigned long long total = hits + misses;
+		return total == 0 ? 0.0 : (double)hits / total;
+	}
+};
@@ -1,7 +1,62 @@
 #pragma once
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "PlanarImage.h"
+#include "PixelImage.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+/// <summary>
+/// The samples of an image without owning them, one plane per channel: the planes of a PlanarImage,
+/// or the channels of an interleaved Image or PixelImage, whose samples lie a pixel apart along a row.
+/// One scaling kernel serves every layout and sample type this way
+/// </summary>
+template <typename T>
+struct SampleView {
+	T *planes[3] = { nullptr, nullptr, nullptr };
+	unsigned int count = 0;
+	unsigned int w = 0, h = 0;
+	size_t stride = 0; // distance between rows
+	size_t step = 1; // distance between neighbouring samples of a row
+	float minLevel = 0.0f, maxLevel = 255.0f; // range interpolated levels are clamped to
+
+	/// <summary>
+	/// Get a row of a plane
+	/// </summary>
+	T* row(const unsigned int &c, const size_t &y) const {
+		return planes[c] + y * stride;
+	}
+
+	/// <summary>
+	/// View the channels of an interleaved image as planes
+	/// Kernels view their sources this way too, they only write through views of their outputs
+	/// </summary>
+	/// <param name="samples">first sample of the image</param>
+	/// <param name="_w">width</param>
+	/// <param name="_h">height</param>
+	/// <param name="channels">samples per pixel</param>
+	/// <param name="_minLevel">lowest level an interpolated sample can take</param>
+	/// <param name="_maxLevel">highest level an interpolated sample can take</param>
+	static SampleView interleaved(const T *samples, const unsigned int &_w, const unsigned int &_h, const unsigned int &channels, const float &_minLevel, const float &_maxLevel) {
+		SampleView view;
+		for (unsigned int c = 0; c < channels; c++) {
+			view.planes[c] = const_cast<T*>(samples) + c;
+		}
+		view.count = channels;
+		view.w = _w;
+		view.h = _h;
+		view.stride = (size_t)_w * channels;
+		view.step = channels;
+		view.minLevel = _minLevel;
+		view.maxLevel = _maxLevel;
+		return view;
+	}
+};
 
 /// <summary>
 /// Class for scaling images
+/// Images, planar images and PixelImages of any sample type are all scaled by the same kernels
 /// </summary>
 class Scaler {
 public:
@@ -12,32 +67,7 @@ public:
 	/// <param name="scaleFactor">scale multiplier</param>
 	/// <returns>original image scaled by scale factor</returns>
 	static ScaledImage NearestNeighbourParallel(Image &img, const double &scaleFactor) {
-		//height of scaled image
-		const unsigned int newH = (unsigned int)floor(img.h * scaleFactor);
-		//width of scaled image
-		const unsigned int newW = (unsigned int)floor(img.w * scaleFactor);
-		//declare output image
-		ScaledImage *output = new ScaledImage(newW, newH, scaleFactor, "Nearest Neighbour");
-		//set colour depth 
-		output->setColourDepth(img.getColourDepth());
-		//ratios
-		const float xRatio = img.w / (float)newW;
-		const float yRatio = img.h / (float)newH;
-		//parallel iteration through the rows
-		parallel_for(size_t(0), size_t(newH), [&newW, &img, &xRatio, &yRatio, &output](size_t i) {
-			float px, py;
-			//serial iteration through columns
-			//the overhead incurred by making this loop parallel outweighs the speed up
-			for (unsigned int j = 0; j < newW; j++) {
-				//get pixel coordinates on original image
-				px = floor(j*xRatio);
-				py = floor(i*yRatio);
-				//set pixel on output image
-				output->pixels[(i*newW) + j] = img.pixels[(int)((py*img.w) + px)];
-			}
-		});
-		output->updateModified();
-		return *output;
+		return NearestNeighbourImage(img, scaleFactor, true);
 	}
 
 	/// <summary>
@@ -46,32 +76,8 @@ public:
 	/// <param name="img">image to scale</param>
 	/// <param name="scaleFactor">scale multiplier</param>
 	/// <returns>original image scaled by scale factor</returns>
-	static ScaledImage NearestNeighbour(Image &img, const double &scaleFactor) {	
-		//height of scaled image
-		const unsigned int newH = (unsigned int)floor(img.h * scaleFactor);
-		//width of scaled image
-		const unsigned int newW = (unsigned int)floor(img.w * scaleFactor);
-		//declare output image
-		ScaledImage *output = new ScaledImage(newW, newH, scaleFactor, "Nearest Neighbour");
-		//set colour depth 
-		output->setColourDepth(img.getColourDepth());
-		//ratios
-		const float xRatio = img.w / (float)newW;
-		const float yRatio = img.h / (float)newH;
-		float px, py;
-		//iterate through rows
-		for (unsigned int i = 0; i < newH; i++) {
-			//iterate through columns
-			for (unsigned int j = 0; j < newW; j++) {
-				//get pixel coordinates on original image
-				px = floor(j*xRatio);
-				py = floor(i*yRatio);
-				//set pixel on output image
-				output->pixels[(i*newW) + j] = img.pixels[(int)((py*img.w) + px)];
-			}
-		}
-		output->updateModified();
-		return *output;
+	static ScaledImage NearestNeighbour(Image &img, const double &scaleFactor) {
+		return NearestNeighbourImage(img, scaleFactor, false);
 	}
 
 	/// <summary>
@@ -81,52 +87,7 @@ public:
 	/// <param name="scaleFactor">scale multiplier</param>
 	/// <returns>original image scaled by scale factor</returns>
 	static ScaledImage BilinearParallel(Image &img, const double &scaleFactor) {
-		//height of scaled image
-		const unsigned int newH = (unsigned int)floor(img.h * scaleFactor);
-		//width of scaled image
-		const unsigned int newW = (unsigned int)floor(img.w * scaleFactor);
-		//declare output image
-		ScaledImage *output = new ScaledImage(newW, newH, scaleFactor, "Bilinear");
-		//get colour depth
-		output->setColourDepth(img.getColourDepth());
-		//calculate ratios
-		const float xRatio = (img.w - 1) / (float)newW;
-		const float yRatio = (img.h - 1) / (float)newH;
-
-		//iterate through the rows in parallel
-		parallel_for(size_t(0), size_t(newH), [&img, &newW, &xRatio,&yRatio, &output](size_t i) {
-			float px, py, diffX, diffY;
-			Image::Rgb a, b, c, d;
-			//serial iteration through columns
-			//the overhead incurred by making this loop parallel outweighs the speed up
-			for (unsigned int j = 0; j < newW; j++) {
-				//get pixel coordinates on original image
-				px = floor(j*xRatio);
-				py = floor(i*yRatio);
-				
-				//get the fractional part left over when calculating original coordinates
-				diffX = (xRatio*j) - px;
-				diffY = (yRatio*i) - py;
-				//get index of pixel on original image
-				const unsigned int index = (unsigned int)((py*img.w) + px);
-				// get 2x2 grid of pixels from original image to interpolate
-				a = img.pixels[index];
-				b = img.pixels[index + 1];
-				c = img.pixels[index + img.w];
-				d = img.pixels[index + img.w + 1];
-
-				//interpolate for each channel
-				//red
-				output->pixels[(i*newW) + j].r = (unsigned char)BilinearInterpolate(a.r, b.r, c.r, d.r, diffX, diffY);
-				//green
-				output->pixels[(i*newW) + j].g = (unsigned char)BilinearInterpolate(a.g, b.g, c.g, d.g, diffX, diffY);
-				//blue
-				output->pixels[(i*newW) + j].b = (unsigned char)BilinearInterpolate(a.b, b.b, c.b, d.b, diffX, diffY);
-			}
-		});
-
-		output->updateModified();
-		return *output;
+		return BilinearImage(img, scaleFactor, true);
 	}
 
 	/// <summary>
@@ -136,65 +97,7 @@ public:
 	/// <param name="scaleFactor">scale multiplier</param>
 	/// <returns>Original image scaled by scale factor</returns>
 	static ScaledImage Bilinear(Image &img, const double &scaleFactor) {
-		//height of scaled image
-		const unsigned int newH = (unsigned int)floor(img.h * scaleFactor);
-		//width of scaled image
-		const unsigned int newW = (unsigned int)floor(img.w * scaleFactor);
-		//declare output image
-		ScaledImage *output = new ScaledImage(newW, newH,scaleFactor, "Bilinear");
-		//set colour depth
-		output->setColourDepth(img.getColourDepth());
-		//calculate ratios
-		const float xRatio = (img.w-1) / (float)newW;
-		const float yRatio = (img.h-1) / (float)newH;
-		float px, py,diffX,diffY;
-		Image::Rgb a, b, c, d;
-		//iterate through rows of scaled image
-		for (unsigned int i = 0; i < newH; i++) {
-			//iterate through columns of scaled image
-			for (unsigned int j = 0; j < newW; j++) {
-				//get pixel coordinates on original image
-				px = floor(j*xRatio);
-				py = floor(i*yRatio);
-
-				//get the fractional part left over when calculating original coordinates
-				diffX = (xRatio*j) - px;
-				diffY = (yRatio*i) - py;
-				//get index of pixel on original image
-				const unsigned int index = (unsigned int)((py*img.w) + px);
-				// get 2x2 grid of pixels from original image to interpolate
-				a = img.pixels[index];
-				b = img.pixels[index + 1];
-				c = img.pixels[index + img.w];
-				d = img.pixels[index + img.w + 1];
-
-				//interpolate for each channel
-				//red
-				output->pixels[(i*newW) + j].r = (unsigned char)BilinearInterpolate(a.r, b.r, c.r, d.r, diffX, diffY);
-				//green
-				output->pixels[(i*newW) + j].g = (unsigned char)BilinearInterpolate(a.g, b.g, c.g, d.g, diffX, diffY);
-				//blue
-				output->pixels[(i*newW) + j].b = (unsigned char)BilinearInterpolate(a.b, b.b, c.b, d.b, diffX, diffY);
-			}
-		}
-		output->updateModified();
-		return *output;
-	}
-
-	/// <summary>
-	/// Get a pixel from clamping x and y coordinates
-	/// </summary>
-	/// <param name="src">image to get pixel from</param>
-	/// <param name="x">x coordinate</param>
-	/// <param name="y">y coordinate</param>
-	/// <returns>Closest pixel to (x,y) that is in range</returns>
-	static Image::Rgb getPixel(const Image &src, const int &x, const int &y) {
-		//clamp values
-		unsigned int xP, yP;
-		xP = (unsigned int)Clamp((float)x, (float)0, (float)src.w-1);
-		yP = (unsigned int)Clamp((float)y, (float)0, (float)src.h-1);
-		//get pixel from clamped values
-		return src.pixels[(yP * src.w) + xP];
+		return BilinearImage(img, scaleFactor, false);
 	}
 
 	/// <summary>
@@ -204,89 +107,7 @@ public:
 	/// <param name="scaleFactor">scale multiplier</param>
 	/// <returns>Original image scaled by scale factor</returns>
 	static ScaledImage BiCubicParallel(Image &img, const double &scaleFactor) {
-		//height of scaled image
-		const unsigned int newH = (unsigned int)floor(img.h * scaleFactor);
-		//width of scaled image
-		const unsigned int newW = (unsigned int)floor(img.w * scaleFactor);
-		//declare output image
-		ScaledImage *output = new ScaledImage(newW, newH, scaleFactor, "Bicubic");
-		//set colour depth
-		output->setColourDepth(img.getColourDepth());
-		//calculate ratios
-		const float xRatio = (img.w - 1) / (float)newW;
-		const float yRatio = (img.h - 1) / (float)newH;
-		//iterate through rows in parallel
-		parallel_for(size_t(0), size_t(newH), [&newW, &xRatio, &yRatio, &img, &output](size_t i) {
-			float ax, ay, xfract, yfract;
-			unsigned int px, py;
-			Image::Rgb p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16;
-			//iterate through columns in serial
-			for (unsigned int j = 0; j < newW; j++) {
-				//get pixel coordinates of original image
-				ax = j*xRatio;
-				ay = i*yRatio;
-
-				//floor coordinates to get integer indexes
-				px = (unsigned int)floor(ax);
-				py = (unsigned int)floor(ay);
-
-				//get leftover fractional values from flooring
-				xfract = ax - px;
-				yfract = ay - py;
-
-				//4x4 grid of pixels required for bicubic interpolation
-				//1st row
-				p1 = getPixel(img, px - 1, py - 1);
-				p2 = getPixel(img, px, py - 1);
-				p3 = getPixel(img, px + 1, py - 1);
-				p4 = getPixel(img, px + 2, py - 1);
-				//2nd row
-				p5 = getPixel(img, px - 1, py);
-				p6 = getPixel(img, px, py);
-				p7 = getPixel(img, px + 1, py);
-				p8 = getPixel(img, px + 2, py);
-				//3rd row
-				p9 = getPixel(img, px - 1, py + 1);
-				p10 = getPixel(img, px, py + 1);
-				p11 = getPixel(img, px + 1, py + 1);
-				p12 = getPixel(img, px + 2, py + 1);
-				//4th row
-				p13 = getPixel(img, px - 1, py + 2);
-				p14 = getPixel(img, px, py + 2);
-				p15 = getPixel(img, px + 1, py + 2);
-				p16 = getPixel(img, px + 2, py + 2);
-
-				//interpolate rows, clamp values between 0 and 255 to avoid overflow when assigning to image
-				//reds
-				float Ar = Clamp(cubicInterpolate(p1.r, p2.r, p3.r, p4.r, xfract),0,255);
-				float Br = Clamp(cubicInterpolate(p5.r, p6.r, p7.r, p8.r, xfract), 0, 255);
-				float Cr = Clamp(cubicInterpolate(p9.r, p10.r, p11.r, p12.r, xfract), 0, 255);
-				float Dr = Clamp(cubicInterpolate(p13.r, p14.r, p15.r, p16.r, xfract), 0, 255);
-
-				//greens
-				float Ag = Clamp(cubicInterpolate(p1.g, p2.g, p3.g, p4.g, xfract), 0, 255);
-				float Bg = Clamp(cubicInterpolate(p5.g, p6.g, p7.g, p8.g, xfract), 0, 255);
-				float Cg = Clamp(cubicInterpolate(p9.g, p10.g, p11.g, p12.g, xfract), 0, 255);
-				float Dg = Clamp(cubicInterpolate(p13.g, p14.g, p15.g, p16.g, xfract), 0, 255);
-
-				//blues
-				float Ab = Clamp(cubicInterpolate(p1.b, p2.b, p3.b, p4.b, xfract), 0, 255);
-				float Bb = Clamp(cubicInterpolate(p5.b, p6.b, p7.b, p8.b, xfract), 0, 255);
-				float Cb = Clamp(cubicInterpolate(p9.b, p10.b, p11.b, p12.b, xfract), 0, 255);
-				float Db = Clamp(cubicInterpolate(p13.b, p14.b, p15.b, p16.b, xfract), 0, 255);
-
-				//interpolate in the y direction on each channel, clamp result between 0 and 255 again.
-				//red
-				output->pixels[(i*newW) + j].r = (unsigned char)Clamp(cubicInterpolate(Ar, Br, Cr, Dr, yfract), 0, 255);
-				//green
-				output->pixels[(i*newW) + j].g = (unsigned char)Clamp(cubicInterpolate(Ag, Bg, Cg, Dg, yfract), 0, 255);
-				//blue
-				output->pixels[(i*newW) + j].b = (unsigned char)Clamp(cubicInterpolate(Ab, Bb, Cb, Db, yfract), 0, 255);
-			}
-		});
-
-		output->updateModified();
-		return *output;
+		return BiCubicImage(img, scaleFactor, true);
 	}
 
 	/// <summary>
@@ -296,94 +117,57 @@ public:
 	/// <param name="scaleFactor">scale multiplier</param>
 	/// <returns>Original image scaled by scale factor</returns>
 	static ScaledImage BiCubic(Image &img, const double &scaleFactor) {
-		//height of scaled image
-		const unsigned int newH = (unsigned int)floor(img.h * scaleFactor);
-		//width of scaled image
-		const unsigned int newW = (unsigned int)floor(img.w * scaleFactor);
-		//declare output image
-		ScaledImage *output = new ScaledImage(newW, newH, scaleFactor, "Bicubic");
-		//set colour depth
-		output->setColourDepth(img.getColourDepth());
-		//calculate ratios
-		const float xRatio = (img.w - 1) / (float)newW;
-		const float yRatio = (img.h - 1) / (float)newH;
-	
-		float ax, ay, xfract, yfract;
-		unsigned int px, py;
-		Image::Rgb p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16;
-		//iterate through the rows
-		for (unsigned int i = 0; i < newH; i++) {
-			//iterate through the 
-			for (unsigned int j = 0; j < newW; j++) {
-				//get pixel coordinates of original image
-				ax = j * xRatio;
-				ay = i * yRatio;
-
-				//floor coordinates to get integer indexes
-				px = (unsigned int)floor(ax);
-				py = (unsigned int)floor(ay);
-
-				//get leftover fractional values from flooring
-				xfract = ax - px;
-				yfract = ay - py;
-
-				//4x4 grid of pixels required for bicubic interpolation
-				//1st row
-				p1 = getPixel(img, px-1, py-1);
-				p2 = getPixel(img, px, py-1);
-				p3 = getPixel(img, px+1, py-1);
-				p4 = getPixel(img, px+2,py-1);
-
-				//2nd row
-				p5 = getPixel(img,px-1, py);
-				p6 = getPixel(img,px,py);
-				p7 = getPixel(img,px+1,py);
-				p8 = getPixel(img,px+2,py);
-
-				//3rd row
-				p9 = getPixel(img,px-1,py+1);
-				p10 = getPixel(img,px,py+1);
-				p11 = getPixel(img,px+1,py+1);
-				p12 = getPixel(img,px+2,py+1);
-
-				//4th row
-				p13 = getPixel(img,px-1,py+2);
-				p14 = getPixel(img,px,py+2);
-				p15 = getPixel(img,px+1,py+2);
-				p16 = getPixel(img,px+2,py+2);
-
-				//interpolate rows, clamp values between 0 and 255 to avoid overflow when assigning to image
-				//reds
-				float Ar = Clamp(cubicInterpolate(p1.r, p2.r, p3.r, p4.r, xfract), 0, 255);
-				float Br = Clamp(cubicInterpolate(p5.r, p6.r, p7.r, p8.r, xfract), 0, 255);
-				float Cr = Clamp(cubicInterpolate(p9.r, p10.r, p11.r, p12.r, xfract), 0, 255);
-				float Dr = Clamp(cubicInterpolate(p13.r, p14.r, p15.r, p16.r, xfract), 0, 255);
-
-				//greens
-				float Ag = Clamp(cubicInterpolate(p1.g, p2.g, p3.g, p4.g, xfract), 0, 255);
-				float Bg = Clamp(cubicInterpolate(p5.g, p6.g, p7.g, p8.g, xfract), 0, 255);
-				float Cg = Clamp(cubicInterpolate(p9.g, p10.g, p11.g, p12.g, xfract), 0, 255);
-				float Dg = Clamp(cubicInterpolate(p13.g, p14.g, p15.g, p16.g, xfract), 0, 255);
-
-				//blues
-				float Ab = Clamp(cubicInterpolate(p1.b, p2.b, p3.b, p4.b, xfract), 0, 255);
-				float Bb = Clamp(cubicInterpolate(p5.b, p6.b, p7.b, p8.b, xfract), 0, 255);
-				float Cb = Clamp(cubicInterpolate(p9.b, p10.b, p11.b, p12.b, xfract), 0, 255);
-				float Db = Clamp(cubicInterpolate(p13.b, p14.b, p15.b, p16.b, xfract), 0, 255);
-
-				//interpolate in the y direction on each channel, clamp result between 0 and 255 again.
-				//red
-				output->pixels[(i*newW) + j].r = (unsigned char)Clamp(cubicInterpolate(Ar, Br, Cr, Dr, yfract),0,255);
-				//green
-				output->pixels[(i*newW) + j].g = (unsigned char)Clamp(cubicInterpolate(Ag, Bg, Cg, Dg, yfract),0,255);
-				//blue
-				output->pixels[(i*newW) + j].b = (unsigned char)Clamp(cubicInterpolate(Ab, Bb, Cb, Db, yfract),0,255);
-			}
-		}
-		output->updateModified();
-		return *output;
+		return BiCubicImage(img, scaleFactor, false);
 	}
 
+	/// <summary>
+	/// Shrink an image by a whole factor, each output pixel the average of a block of input pixels
+	/// Much cheaper than the interpolating methods, for previews
+	/// </summary>
+	/// <param name="img">image to shrink, left untouched</param>
+	/// <param name="factor">block size, the output is 1/factor of the size rounded up</param>
+	/// <returns>shrunk image, blocks at the right and bottom edges may be partial</returns>
+	static ScaledImage BoxDownscale(const Image &img, const unsigned int &factor) {
+		const unsigned int newW = (img.w + factor - 1) / factor;
+		const unsigned int newH = (img.h + factor - 1) / factor;
+		ScaledImage output(newW, newH, 1.0 / factor, "Box Downscale", Image::kUninitialised, img.channels);
+		output.setColourDepth(const_cast<Image&>(img).getColourDepth());
+		const size_t bandRows = rowsPerBand(newH);
+		parallel_for(size_t(0), (newH + bandRows - 1) / bandRows, [&img, &output, &factor, newW, newH, bandRows](size_t band) {
+			const size_t bandEnd = std::min((size_t)newH, (band + 1) * bandRows);
+			for (size_t y = band * bandRows; y < bandEnd; y++) {
+				const size_t top = y * factor, bottom = std::min((size_t)img.h, top + factor);
+				for (size_t x = 0; x < newW; x++) {
+					const size_t left = x * factor, right = std::min((size_t)img.w, left + factor);
+					const unsigned int count = (unsigned int)((bottom - top) * (right - left));
+					if (img.channels == 1) {
+						unsigned int sum = 0;
+						for (size_t sy = top; sy < bottom; sy++) {
+							for (size_t sx = left; sx < right; sx++) {
+								sum += img.samples()[sy * img.w + sx];
+							}
+						}
+						output.samples()[y * newW + x] = (unsigned char)((sum + count / 2) / count);
+						continue;
+					}
+					unsigned int r = 0, g = 0, b = 0;
+					for (size_t sy = top; sy < bottom; sy++) {
+						for (size_t sx = left; sx < right; sx++) {
+							const Image::Rgb &p = img.pixels[sy * img.w + sx];
+							r += p.r;
+							g += p.g;
+							b += p.b;
+						}
+					}
+					output.pixels[y * newW + x].r = (unsigned char)((r + count / 2) / count);
+					output.pixels[y * newW + x].g = (unsigned char)((g + count / 2) / count);
+					output.pixels[y * newW + x].b = (unsigned char)((b + count / 2) / count);
+				}
+			}
+		});
+		output.updateModified();
+		return output;
+	}
 
 	/// <summary>
 	/// Extract a region of interest from a given image
@@ -399,22 +183,27 @@ public:
 		Image *output = new Image(width, height);
 		//set colour depth
 		output->setColourDepth(img.getColourDepth());
+		output->setChannels(img.channels);
 		cout << "\nExtracting ROI...\n";
+		//ensure ROI is within bounds of original image, before the end coordinates are added up
+		if (left >= img.w || top >= img.h || !regionInside(left, top, width, height, img.w, img.h)) {
+			return *output;
+		}
 		//calculate width coordinate on original image
 		const unsigned int newWidth = width + left;
 		//calculate height coordinate on original image
 		const unsigned int newHeight = height + top;
-		//ensure ROI is within bounds of original image
-		if (left >= img.w || top >= img.h || newWidth > img.w || newHeight > img.h) {
-			return *output;
-		}
 		unsigned int outCount = 0;
 		//iterate through rows
 		for (unsigned int y = top; y < newHeight; y++) {
 			//iterate through columns
 			for (unsigned int x = left; x < newWidth; x++) {
 				//add pixel from original image to output image
-				output->pixels[outCount] = img.pixels[(y*img.h) + x];
+				if (img.channels == 1) {
+					output->samples()[outCount] = img.samples()[(y*img.w) + x];
+				} else {
+					output->pixels[outCount] = img.pixels[(y*img.w) + x];
+				}
 				outCount++;
 			}
 		}
@@ -423,7 +212,320 @@ public:
 		return *output;
 	}
 
+	/// <summary>
+	/// Nearest neighbour scaling of a planar image, with the same kernel as every other image
+	/// </summary>
+	/// <param name="img">image to scale, left untouched</param>
+	/// <param name="scaleFactor">scale multiplier</param>
+	/// <param name="parallel">use all CPU cores</param>
+	/// <returns>scaled planar image</returns>
+	static PlanarImage NearestNeighbourPlanar(const PlanarImage &img, const double &scaleFactor, const bool &parallel) {
+		PlanarImage output((unsigned int)floor(img.w * scaleFactor), (unsigned int)floor(img.h * scaleFactor), img.channels);
+		nearestNeighbourPlanes(viewOf(img), viewOf(output), parallel);
+		return output;
+	}
+
+	/// <summary>
+	/// Bilinear scaling of a planar image, with the same kernel as every other image
+	/// </summary>
+	/// <param name="img">image to scale, left untouched</param>
+	/// <param name="scaleFactor">scale multiplier</param>
+	/// <param name="parallel">use all CPU cores</param>
+	/// <returns>scaled planar image</returns>
+	static PlanarImage BilinearPlanar(const PlanarImage &img, const double &scaleFactor, const bool &parallel) {
+		PlanarImage output((unsigned int)floor(img.w * scaleFactor), (unsigned int)floor(img.h * scaleFactor), img.channels);
+		bilinearPlanes(viewOf(img), viewOf(output), parallel);
+		return output;
+	}
+
+	/// <summary>
+	/// Bicubic scaling of a planar image, with the same kernel as every other image
+	/// </summary>
+	/// <param name="img">image to scale, left untouched</param>
+	/// <param name="scaleFactor">scale multiplier</param>
+	/// <param name="parallel">use all CPU cores</param>
+	/// <returns>scaled planar image</returns>
+	static PlanarImage BiCubicPlanar(const PlanarImage &img, const double &scaleFactor, const bool &parallel) {
+		PlanarImage output((unsigned int)floor(img.w * scaleFactor), (unsigned int)floor(img.h * scaleFactor), img.channels);
+		biCubicPlanes(viewOf(img), viewOf(output), parallel);
+		return output;
+	}
+
+
+	/// <summary>
+	/// Nearest neighbour scaling of an image of any sample type
+	/// </summary>
+	/// <param name="img">image to scale, left untouched</param>
+	/// <param name="scaleFactor">scale multiplier</param>
+	/// <param name="parallel">use all CPU cores</param>
+	/// <returns>scaled image</returns>
+	template <typename T>
+	static PixelImage<T> NearestNeighbour(const PixelImage<T> &img, const double &scaleFactor, const bool &parallel) {
+		TRACE_ZONE("Pixel nearest neighbour");
+		PixelImage<T> output = pixelOutput(img, scaleFactor);
+		nearestNeighbourPlanes(viewOf(img), viewOf(output), parallel);
+		return output;
+	}
+
+	/// <summary>
+	/// Bilinear scaling of an image of any sample type
+	/// </summary>
+	/// <param name="img">image to scale, left untouched</param>
+	/// <param name="scaleFactor">scale multiplier</param>
+	/// <param name="parallel">use all CPU cores</param>
+	/// <returns>scaled image</returns>
+	template <typename T>
+	static PixelImage<T> Bilinear(const PixelImage<T> &img, const double &scaleFactor, const bool &parallel) {
+		TRACE_ZONE("Pixel bilinear");
+		PixelImage<T> output = pixelOutput(img, scaleFactor);
+		bilinearPlanes(viewOf(img), viewOf(output), parallel);
+		return output;
+	}
+
+	/// <summary>
+	/// Bicubic scaling of an image of any sample type
+	/// </summary>
+	/// <param name="img">image to scale, left untouched</param>
+	/// <param name="scaleFactor">scale multiplier</param>
+	/// <param name="parallel">use all CPU cores</param>
+	/// <returns>scaled image</returns>
+	template <typename T>
+	static PixelImage<T> BiCubic(const PixelImage<T> &img, const double &scaleFactor, const bool &parallel) {
+		TRACE_ZONE("Pixel bicubic");
+		PixelImage<T> output = pixelOutput(img, scaleFactor);
+		biCubicPlanes(viewOf(img), viewOf(output), parallel);
+		return output;
+	}
+
 private:
+	/// <summary>
+	/// Run a function for every output row, in bands across all CPU cores or in order on this thread
+	/// </summary>
+	/// <param name="rows">number of output rows</param>
+	/// <param name="parallel">use all CPU cores</param>
+	/// <param name="scaleRow">called with each row index</param>
+	template <typename RowFunction>
+	static void forEachRow(const unsigned int &rows, const bool &parallel, const RowFunction &scaleRow) {
+		if (!parallel) {
+			for (size_t i = 0; i < rows; i++) {
+				scaleRow(i);
+			}
+			return;
+		}
+		const size_t bandRows = rowsPerBand(rows);
+		parallel_for(size_t(0), (rows + bandRows - 1) / bandRows, [&rows, &bandRows, &scaleRow](size_t band) {
+			TRACE_ZONE_DETAIL("Plane band", band);
+			const size_t lastRow = std::min((band + 1) * bandRows, (size_t)rows);
+			for (size_t i = band * bandRows; i < lastRow; i++) {
+				scaleRow(i);
+			}
+		});
+	}
+
+
+	/// <summary>
+	/// Make the output of a scaling method, with the channels of the image
+	/// </summary>
+	static ScaledImage scaledOutput(Image &img, const unsigned int &newW, const unsigned int &newH, const double &scaleFactor, char *method) {
+		ScaledImage output(newW, newH, scaleFactor, method, Image::kUninitialised, img.channels);
+		output.setColourDepth(img.getColourDepth());
+		return output;
+	}
+
+	/// <summary>
+	/// Make the output of a scaling method for an image of any sample type
+	/// </summary>
+	template <typename T>
+	static PixelImage<T> pixelOutput(const PixelImage<T> &img, const double &scaleFactor) {
+		return PixelImage<T>((unsigned int)floor(img.w * scaleFactor), (unsigned int)floor(img.h * scaleFactor), img.channels, img.maxValue);
+	}
+
+	/// <summary>
+	/// Nearest neighbour scaling of a colour or monochrome image
+	/// </summary>
+	static ScaledImage NearestNeighbourImage(Image &img, const double &scaleFactor, const bool &parallel) {
+		const unsigned int newH = (unsigned int)floor(img.h * scaleFactor);
+		const unsigned int newW = (unsigned int)floor(img.w * scaleFactor);
+		ScaledImage output = scaledOutput(img, newW, newH, scaleFactor, "Nearest Neighbour");
+		nearestNeighbourPlanes(viewOf(img), viewOf(output), parallel);
+		output.updateModified();
+		return output;
+	}
+
+	/// <summary>
+	/// Bilinear scaling of a colour or monochrome image
+	/// </summary>
+	static ScaledImage BilinearImage(Image &img, const double &scaleFactor, const bool &parallel) {
+		const unsigned int newH = (unsigned int)floor(img.h * scaleFactor);
+		const unsigned int newW = (unsigned int)floor(img.w * scaleFactor);
+		ScaledImage output = scaledOutput(img, newW, newH, scaleFactor, "Bilinear");
+		bilinearPlanes(viewOf(img), viewOf(output), parallel);
+		output.updateModified();
+		return output;
+	}
+
+	/// <summary>
+	/// Bicubic scaling of a colour or monochrome image
+	/// </summary>
+	static ScaledImage BiCubicImage(Image &img, const double &scaleFactor, const bool &parallel) {
+		const unsigned int newH = (unsigned int)floor(img.h * scaleFactor);
+		const unsigned int newW = (unsigned int)floor(img.w * scaleFactor);
+		ScaledImage output = scaledOutput(img, newW, newH, scaleFactor, "Bicubic");
+		biCubicPlanes(viewOf(img), viewOf(output), parallel);
+		output.updateModified();
+		return output;
+	}
+
+	/// <summary>
+	/// View the samples of an 8-bit image, colour or monochrome
+	/// </summary>
+	static SampleView<unsigned char> viewOf(const Image &img) {
+		return SampleView<unsigned char>::interleaved(img.samples(), img.w, img.h, img.channels, 0.0f, 255.0f);
+	}
+
+	/// <summary>
+	/// View the planes of a planar image
+	/// </summary>
+	static SampleView<unsigned char> viewOf(const PlanarImage &img) {
+		SampleView<unsigned char> view;
+		for (unsigned int c = 0; c < img.channels; c++) {
+			view.planes[c] = const_cast<unsigned char*>(img.plane(c));
+		}
+		view.count = img.channels;
+		view.w = img.w;
+		view.h = img.h;
+		view.stride = img.stride;
+		return view;
+	}
+
+	/// <summary>
+	/// View the samples of an image of any sample type
+	/// Integer samples are clamped to the image's range, float samples keep levels outside it
+	/// </summary>
+	template <typename T>
+	static SampleView<T> viewOf(const PixelImage<T> &img) {
+		const bool whole = numeric_limits<T>::is_integer;
+		const float unbounded = numeric_limits<float>::infinity();
+		return SampleView<T>::interleaved(img.samples, img.w, img.h, img.channels, whole ? 0.0f : -unbounded, whole ? (float)img.maxValue : unbounded);
+	}
+
+	/// <summary>
+	/// Nearest neighbour scaling of sample planes, with the same arithmetic for every sample type
+	/// The source column of every output column is worked out once, for all rows and planes
+	/// </summary>
+	/// <param name="source">planes to scale</param>
+	/// <param name="target">planes of the output size to fill</param>
+	/// <param name="parallel">use all CPU cores</param>
+	template <typename T>
+	static void nearestNeighbourPlanes(const SampleView<T> &source, const SampleView<T> &target, const bool &parallel) {
+		const float xRatio = source.w / (float)target.w;
+		const float yRatio = source.h / (float)target.h;
+		vector<size_t> columns(target.w);
+		for (unsigned int j = 0; j < target.w; j++) {
+			columns[j] = (size_t)floor(j*xRatio) * source.step;
+		}
+		forEachRow(target.h, parallel, [&](size_t i) {
+			const size_t py = (size_t)floor(i*yRatio);
+			for (unsigned int c = 0; c < source.count; c++) {
+				const T *in = source.row(c, py);
+				T *out = target.row(c, i);
+				for (unsigned int j = 0; j < target.w; j++) {
+					out[j * target.step] = in[columns[j]];
+				}
+			}
+		});
+	}
+
+	/// <summary>
+	/// Bilinear scaling of sample planes, with the same arithmetic for every sample type
+	/// Integer samples drop the fraction of the interpolated level, as 8-bit images always have
+	/// </summary>
+	/// <param name="source">planes to scale</param>
+	/// <param name="target">planes of the output size to fill</param>
+	/// <param name="parallel">use all CPU cores</param>
+	template <typename T>
+	static void bilinearPlanes(const SampleView<T> &source, const SampleView<T> &target, const bool &parallel) {
+		const float xRatio = (source.w - 1) / (float)target.w;
+		const float yRatio = (source.h - 1) / (float)target.h;
+		//left and right columns and fraction of every output column, the right one clamped for images one pixel wide
+		vector<size_t> lefts(target.w), rights(target.w);
+		vector<float> fractions(target.w);
+		for (unsigned int j = 0; j < target.w; j++) {
+			const float px = floor(j*xRatio);
+			lefts[j] = (size_t)px * source.step;
+			rights[j] = std::min((size_t)px + 1, (size_t)source.w - 1) * source.step;
+			fractions[j] = (xRatio*j) - px;
+		}
+		forEachRow(target.h, parallel, [&](size_t i) {
+			const float py = floor(i*yRatio);
+			const float diffY = (yRatio*i) - py;
+			for (unsigned int c = 0; c < source.count; c++) {
+				const T *above = source.row(c, (size_t)py);
+				const T *below = source.row(c, std::min((size_t)py + 1, (size_t)source.h - 1));
+				T *out = target.row(c, i);
+				for (unsigned int j = 0; j < target.w; j++) {
+					const size_t left = lefts[j], right = rights[j];
+					out[j * target.step] = (T)BilinearInterpolate(above[left], above[right], below[left], below[right], fractions[j], diffY);
+				}
+			}
+		});
+	}
+
+	/// <summary>
+	/// Bicubic scaling of sample planes, with the same arithmetic and edge clamping for every sample type
+	/// Each pass is clamped to the levels of the source, and integer samples drop the fraction as with bilinear
+	/// </summary>
+	/// <param name="source">planes to scale</param>
+	/// <param name="target">planes of the output size to fill</param>
+	/// <param name="parallel">use all CPU cores</param>
+	template <typename T>
+	static void biCubicPlanes(const SampleView<T> &source, const SampleView<T> &target, const bool &parallel) {
+		const float xRatio = (source.w - 1) / (float)target.w;
+		const float yRatio = (source.h - 1) / (float)target.h;
+		const float low = source.minLevel, high = source.maxLevel;
+		//the four clamped source columns and the fraction of every output column
+		vector<size_t> taps((size_t)target.w * 4);
+		vector<float> fractions(target.w);
+		for (unsigned int j = 0; j < target.w; j++) {
+			const float ax = j * xRatio;
+			const unsigned int px = (unsigned int)floor(ax);
+			fractions[j] = ax - px;
+			for (int k = 0; k < 4; k++) {
+				taps[(size_t)j * 4 + k] = (size_t)std::min(std::max((int)px + k - 1, 0), (int)source.w - 1) * source.step;
+			}
+		}
+		forEachRow(target.h, parallel, [&](size_t i) {
+			const float ay = i * yRatio;
+			const unsigned int py = (unsigned int)floor(ay);
+			const float yfract = ay - py;
+			for (unsigned int c = 0; c < source.count; c++) {
+				const T *lines[4];
+				for (int k = 0; k < 4; k++) {
+					lines[k] = source.row(c, (size_t)std::min(std::max((int)py + k - 1, 0), (int)source.h - 1));
+				}
+				T *out = target.row(c, i);
+				for (unsigned int j = 0; j < target.w; j++) {
+					const size_t *x = &taps[(size_t)j * 4];
+					float rows[4];
+					for (int k = 0; k < 4; k++) {
+						rows[k] = Clamp(cubicInterpolate(lines[k][x[0]], lines[k][x[1]], lines[k][x[2]], lines[k][x[3]], fractions[j]), low, high);
+					}
+					out[j * target.step] = (T)Clamp(cubicInterpolate(rows[0], rows[1], rows[2], rows[3], yfract), low, high);
+				}
+			}
+		});
+	}
+
+	/// <summary>
+	/// Number of output rows each parallel task handles
+	/// Aims for several bands per thread so uneven bands still balance
+	/// </summary>
+	/// <param name="rows">number of output rows</param>
+	/// <returns>rows per band, at least 1</returns>
+	static size_t rowsPerBand(const unsigned int &rows) {
+		return std::max((size_t)1, (size_t)rows / ((size_t)logicalCoreCount() * 8));
+	}
+
 	/// <summary>
 	/// Bilinear interpolate values
 	/// </summary>
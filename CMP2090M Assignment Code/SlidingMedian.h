@@ -0,0 +1,175 @@
+#pragma once
+//*********************************************
+//Rolling median over the last K frames of a sequence, e.g. to extract the background of a time-lapse
+//Each pixel channel keeps a 256 bin histogram of the frames in the window and its current median.
+//A new frame is added to the histograms and the frame leaving the window removed, then each median
+//only moves past the bins that changed, so the work per frame does not grow with the window
+//*********************************************
+
+#include <algorithm>
+#include <string>
+#include "Image.h"
+#include "MemoryTracker.h"
+#include "Parallel.h"
+#include "Trace.h"
+
+using namespace std;
+
+/// <summary>
+/// Sliding window median stacker, fed one frame at a time
+/// </summary>
+class SlidingMedian {
+private:
+	unsigned int window;
+	unsigned int w = 0, h = 0;
+	unsigned int count = 0; // frames currently in the window
+	//per channel histograms, channel c uses bins c * 256 to c * 256 + 255
+	//counts fit a byte since the window is at most kMaxWindow frames
+	unsigned char *histograms = nullptr;
+	unsigned char *medians = nullptr; // current median of each channel
+	unsigned char *below = nullptr; // samples in the window below the current median
+	StackedImage output;
+
+	size_t channelCount() const {
+		return (size_t)w * h * 3;
+	}
+
+	/// <summary>
+	/// Allocate the histograms and output for the first frame
+	/// </summary>
+	void start(const Image &frame) {
+		w = frame.w;
+		h = frame.h;
+		histograms = MemoryTracker::allocate<unsigned char>(channelCount() * 256);
+		medians = MemoryTracker::allocate<unsigned char>(channelCount());
+		below = MemoryTracker::allocate<unsigned char>(channelCount());
+		std::fill(histograms, histograms + channelCount() * 256, (unsigned char)0);
+		std::fill(medians, medians + channelCount(), (unsigned char)0);
+		std::fill(below, below + channelCount(), (unsigned char)0);
+		output = StackedImage(w, h, "Sliding Window Median");
+		output.setColourDepth(const_cast<Image&>(frame).getColourDepth());
+	}
+
+public:
+	//largest window, so histogram counts fit in a byte
+	static constexpr unsigned int kMaxWindow = 255;
+
+	/// <summary>
+	/// Create a stacker with an empty window
+	/// </summary>
+	/// <param name="_window">number of frames each output is the median of, 1 to kMaxWindow</param>
+	SlidingMedian(const unsigned int &_window) : window(std::min(std::max(_window, 1u), kMaxWindow)) {}
+
+	~SlidingMedian() {
+		MemoryTracker::release(histograms, channelCount() * 256);
+		MemoryTracker::release(medians, channelCount());
+		MemoryTracker::release(below, channelCount());
+		output.freeMemory();
+	}
+
+	SlidingMedian(const SlidingMedian&) = delete;
+	SlidingMedian& operator=(const SlidingMedian&) = delete;
+
+	/// <summary>
+	/// Get the number of frames each output covers once the window is full
+	/// </summary>
+	unsigned int getWindow() const {
+		return window;
+	}
+
+	/// <summary>
+	/// Check whether the next push() must be given the frame leaving the window
+	/// </summary>
+	/// <returns>true once the window is full, the frame pushed window frames earlier must then be passed</returns>
+	bool needsExpired() const {
+		return count == window;
+	}
+
+	/// <summary>
+	/// Bytes held by a stacker for a frame size, for memory estimates
+	/// </summary>
+	static unsigned long long stateBytes(const unsigned long long &pixels) {
+		return pixels * 3 * (256 + 2) + pixels * sizeof(Image::Rgb);
+	}
+
+	/// <summary>
+	/// Move a frame into the window, and the oldest frame out of it once the window is full
+	/// Until the window fills, the output is the median of every frame so far
+	/// </summary>
+	/// <param name="frame">newest frame, left untouched</param>
+	/// <param name="expired">frame leaving the window, the one pushed window frames ago; null until needsExpired()</param>
+	/// <param name="error">set to the reason if the frames cannot be used</param>
+	/// <returns>true if the output now holds the median of the window</returns>
+	bool push(const Image &frame, const Image *expired, string &error) {
+		TRACE_ZONE("Sliding median frame");
+		if (frame.pixels == nullptr || (expired != nullptr && expired->pixels == nullptr)) {
+			error = "the frame has no pixels";
+			return false;
+		}
+		if (histograms == nullptr) {
+			start(frame);
+		}
+		if (frame.w != w || frame.h != h || (expired != nullptr && (expired->w != w || expired->h != h))) {
+			error = "every frame must be " + to_string(w) + "x" + to_string(h);
+			return false;
+		}
+		if (needsExpired() != (expired != nullptr)) {
+			error = needsExpired() ? "the window is full, the oldest frame must be removed" : "the window is not full yet";
+			return false;
+		}
+		if (expired == nullptr) {
+			count++;
+		}
+		//lower median, as in the median blends
+		const unsigned int rank = (count - 1) / 2;
+		parallel_for(size_t(0), size_t(h), [this, &frame, expired, rank](size_t y) {
+			for (size_t pixel = y * w; pixel < (y + 1) * w; pixel++) {
+				const unsigned char added[3] = { frame.pixels[pixel].r, frame.pixels[pixel].g, frame.pixels[pixel].b };
+				unsigned char removed[3] = { 0, 0, 0 };
+				if (expired != nullptr) {
+					removed[0] = expired->pixels[pixel].r;
+					removed[1] = expired->pixels[pixel].g;
+					removed[2] = expired->pixels[pixel].b;
+				}
+				unsigned char result[3];
+				for (size_t channel = 0; channel < 3; channel++) {
+					const size_t c = pixel * 3 + channel;
+					unsigned char *bins = histograms + c * 256;
+					unsigned int median = medians[c];
+					unsigned int lower = below[c];
+					bins[added[channel]]++;
+					lower += added[channel] < median ? 1 : 0;
+					if (expired != nullptr) {
+						bins[removed[channel]]--;
+						lower -= removed[channel] < median ? 1 : 0;
+					}
+					//walk the median to the bin holding the wanted rank, usually a step or two
+					while (lower > rank) {
+						median--;
+						lower -= bins[median];
+					}
+					while (lower + bins[median] <= rank) {
+						lower += bins[median];
+						median++;
+					}
+					medians[c] = (unsigned char)median;
+					below[c] = (unsigned char)lower;
+					result[channel] = (unsigned char)median;
+				}
+				output.pixels[pixel].r = result[0];
+				output.pixels[pixel].g = result[1];
+				output.pixels[pixel].b = result[2];
+			}
+		});
+		output.updateModified();
+		return true;
+	}
+
+	/// <summary>
+	/// Get the median of the frames currently in the window
+	/// </summary>
+	/// <returns>the output, owned by the stacker and overwritten by the next push()</returns>
+	StackedImage& getOutput() {
+		return output;
+	}
+};
@@ -1,38 +1,55 @@
 #pragma once
 #include <vector>
-#include <ppl.h>
+#include "Parallel.h"
+#include "Trace.h"
+#include "MemoryTracker.h"
+#include "BufferPool.h"
+#include "Exposure.h"
+#include "PlanarImage.h"
+#include "PixelImage.h"
 #include <math.h>
 #include <stdexcept>
 using namespace std;
-using namespace Concurrency;
 
 /// <summary>
 /// Class for image stacking
+/// Images, planar images and PixelImages of any sample type share the per sample kernels: the lower median and the sigma clipping
 /// </summary>
 class Stacker {
 public:
+	//samples of one pixel for clipAndAverage, counted by the memory tracker
+	typedef vector<unsigned char, TrackedAllocator<unsigned char>> Samples;
 
 	/// <summary>
 	/// Mean blend images
 	/// </summary>
 	/// <param name="imgs">images to blend</param>
+	/// <param name="levels">exposure normalisation applied while gathering, null for none</param>
 	/// <returns>Blended output image</returns>
-	static StackedImage MeanBlend(vector<Image> &imgs) {
-		const unsigned int imageNumber = (unsigned int)imgs.size();
+	static StackedImage MeanBlend(vector<Image> &imgs, const ExposureNormalisation *levels = nullptr) {
 		vector<Image>::const_iterator it;
 		//declare output image
-		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Mean Blend");
+		//monochrome frames are stacked in their packed layout, every byte is one sample either way
+		//the first frame sets every pixel, so the output is not filled first
+		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Mean Blend", Image::kUninitialised, imgs[0].channels);
 		//set colour depth
 		output->setColourDepth(imgs[0].getColourDepth());
 		//calculate imageSize
-		const unsigned int imageSize = output->h * output->w;
+		const unsigned int imageSize = (unsigned int)output->storedPixels();
 		unsigned char imageCount = 1;
 		//iterate through images
 		for (it = imgs.begin(); it != imgs.end(); it++, imageCount++) {
+			TRACE_ZONE_DETAIL("Accumulate frame", imageCount);
 			Image cur = *it;
+			const unsigned char *table = ExposureNormalisation::lookup(levels, imageCount - 1);
 			//iterate through pixels on
 			for (unsigned int pixelIndex = 0; pixelIndex < imageSize; pixelIndex++) {
-				Image::Rgb curRgb = cur.pixels[pixelIndex];
+				const Image::Rgb curRgb(table[cur.pixels[pixelIndex].r], table[256 + cur.pixels[pixelIndex].g], table[512 + cur.pixels[pixelIndex].b]);
+				if (imageCount == 1) {
+					//the mean of one frame, as blending it into black gives
+					output->pixels[pixelIndex] = curRgb;
+					continue;
+				}
 				//calculate mean iteratively to avoid overflow: http://www.heikohoffmann.de/htmlthesis/node134.html
 				output->pixels[pixelIndex].r += (curRgb.r - output->pixels[pixelIndex].r) / imageCount;
 				output->pixels[pixelIndex].g += (curRgb.g - output->pixels[pixelIndex].g) / imageCount;
@@ -50,63 +67,53 @@ public:
 	/// Median blend, using all CPU cores
 	/// </summary>
 	/// <param name="imgs">images to blend</param>
+	/// <param name="levels">exposure normalisation applied while gathering, null for none</param>
 	/// <returns>Blended output image</returns>
-	static StackedImage MedianBlendParallel(vector<Image> &imgs) {
+	static StackedImage MedianBlendParallel(vector<Image> &imgs, const ExposureNormalisation *levels = nullptr) {
 		const unsigned int imageNum = (unsigned int)imgs.size();
 		vector<Image>::const_iterator it;
 		//declare output image
-		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Median Blend");
+		//every pixel is written with its median, so the output is not filled first
+		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Median Blend", Image::kUninitialised, imgs[0].channels);
 		//set colour depth
 		output->setColourDepth(imgs[0].getColourDepth());
-		const unsigned int imageSize = output->h * output->w;
+		const unsigned int imageSize = (unsigned int)output->storedPixels();
 		//we need to store the values in arrays so they can be easily sorted
-		//create these arrays.
-		unsigned char** reds = new unsigned char*[imageSize];
-		unsigned char** greens = new unsigned char*[imageSize];
-		unsigned char** blues = new unsigned char*[imageSize];
-		for (unsigned int i = 0; i < imageSize; i++) {
-			reds[i] = new unsigned char[imageNum];
-			greens[i] = new unsigned char[imageNum];
-			blues[i] = new unsigned char[imageNum];
-		}
+		//each channel is one contiguous array, with the samples of a pixel next to each other
+		const size_t sampleCount = (size_t)imageSize * imageNum;
+		unsigned char* reds = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned char* greens = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned char* blues = BufferPool::acquire<unsigned char>(sampleCount);
 
 		//iterate through the images in parallel
-		parallel_for(size_t(0), imgs.size(), [&imgs, &imageSize, &output, &reds, &greens, &blues](size_t i) {
+		parallel_for(size_t(0), imgs.size(), [&imgs, &imageSize, &imageNum, &output, &reds, &greens, &blues, levels](size_t i) {
+			TRACE_ZONE_DETAIL("Gather frame", i);
 			//get the current image
 			Image cur = imgs.at(i);
+			const unsigned char *table = ExposureNormalisation::lookup(levels, i);
 			//iterate through the pixels in serial
 			for (unsigned int pixelIndex = 0; pixelIndex < imageSize; pixelIndex++) {
 				//store the RGB values in the arrays
-				reds[pixelIndex][i] = cur.pixels[pixelIndex].r;
-				greens[pixelIndex][i] = cur.pixels[pixelIndex].g;
-				blues[pixelIndex][i] = cur.pixels[pixelIndex].b;
+				const size_t sample = (size_t)pixelIndex * imageNum + i;
+				reds[sample] = table[cur.pixels[pixelIndex].r];
+				greens[sample] = table[256 + cur.pixels[pixelIndex].g];
+				blues[sample] = table[512 + cur.pixels[pixelIndex].b];
 			}
 			//release the memory of the original image now we have the pixels in arrays
 			cur.freeMemory();
 		});
 
-		//get the mid point
-		const unsigned int mid = (unsigned int)ceil((imageNum - 1) / 2);
-
 		//iterate through the pixels in parallel
-		parallel_for(size_t(0), size_t(imageSize), [&reds, &greens, &blues, &output, &imageNum, &mid](size_t i) {
-			//sort the arrays
-			sort(reds[i], reds[i] + imageNum);
-			sort(greens[i], greens[i] + imageNum);
-			sort(blues[i], blues[i] + imageNum);
-			//get the mid point (median) from the array and assign it to the output image, for each channel
-			output->pixels[i].r = reds[i][mid];
-			output->pixels[i].g = greens[i][mid];
-			output->pixels[i].b = blues[i][mid];
-			//release memory we no longer need
-			delete reds[i];
-			delete greens[i];
-			delete blues[i];
+		parallel_for(size_t(0), size_t(imageSize), [&reds, &greens, &blues, &output, &imageNum](size_t i) {
+			//get the median of the samples of this pixel and assign it to the output image, for each channel
+			output->pixels[i].r = lowerMedian(reds + i * imageNum, imageNum);
+			output->pixels[i].g = lowerMedian(greens + i * imageNum, imageNum);
+			output->pixels[i].b = lowerMedian(blues + i * imageNum, imageNum);
 		});
-		//release last of memory used by the arrays
-		delete[] reds;
-		delete[] greens;
-		delete[] blues;
+		//release memory used by the arrays
+		BufferPool::release(reds, sampleCount);
+		BufferPool::release(greens, sampleCount);
+		BufferPool::release(blues, sampleCount);
 		output->updateModified();
 		return *output;
 	}
@@ -115,65 +122,56 @@ public:
 	/// Median blend images
 	/// </summary>
 	/// <param name="imgs">images to blend</param>
+	/// <param name="levels">exposure normalisation applied while gathering, null for none</param>
 	/// <returns>Blended output image</returns>
-	static StackedImage MedianBlend(vector<Image> &imgs) {
+	static StackedImage MedianBlend(vector<Image> &imgs, const ExposureNormalisation *levels = nullptr) {
 		const unsigned int imageNum = (unsigned int)imgs.size();
 		vector<Image>::const_iterator it;
 		//declare output image
-		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Median Blend");
+		//every pixel is written with its median, so the output is not filled first
+		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Median Blend", Image::kUninitialised, imgs[0].channels);
 		//set colour depth
 		output->setColourDepth(imgs[0].getColourDepth());
 		//calculate image size
-		const unsigned int imageSize = output->h * output->w;
+		const unsigned int imageSize = (unsigned int)output->storedPixels();
 		//we need to store the values in arrays so they can be easily sorted
-		//create these arrays.
-		unsigned char** reds = new unsigned char*[imageSize];
-		unsigned char** greens = new unsigned char*[imageSize];
-		unsigned char** blues = new unsigned char*[imageSize];
-		for (unsigned int i = 0; i < imageSize; i++) {
-			reds[i] = new unsigned char[imageNum];
-			greens[i] = new unsigned char[imageNum];
-			blues[i] = new unsigned char[imageNum];
-		}
+		//each channel is one contiguous array, with the samples of a pixel next to each other
+		const size_t sampleCount = (size_t)imageSize * imageNum;
+		unsigned char* reds = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned char* greens = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned char* blues = BufferPool::acquire<unsigned char>(sampleCount);
 		
 		unsigned int imgCount = 0;
 		//iterate through the images
 		for (it = imgs.begin(); it != imgs.end(); it++, imgCount++) {
+			TRACE_ZONE_DETAIL("Gather frame", imgCount);
 			//get current image
 			Image cur = *it;
+			const unsigned char *table = ExposureNormalisation::lookup(levels, imgCount);
 			//iterate through the pixels of the current image
 			for (unsigned int pixelIndex = 0; pixelIndex < imageSize; pixelIndex++) {
 				//add RGB values to arrays
-				reds[pixelIndex][imgCount] = cur.pixels[pixelIndex].r;
-				greens[pixelIndex][imgCount] = cur.pixels[pixelIndex].g;
-				blues[pixelIndex][imgCount] = cur.pixels[pixelIndex].b;
+				const size_t sample = (size_t)pixelIndex * imageNum + imgCount;
+				reds[sample] = table[cur.pixels[pixelIndex].r];
+				greens[sample] = table[256 + cur.pixels[pixelIndex].g];
+				blues[sample] = table[512 + cur.pixels[pixelIndex].b];
 			}
 			//release memory of original array
 			cur.freeMemory();
 		}
 
-		//get midpoint
-		const unsigned int mid = (unsigned int)ceil((imageNum - 1) / 2);
-
 		//iterate through the pixels
 		for (unsigned int pixelIndex = 0; pixelIndex < imageSize; pixelIndex++) {
-			//sort the RGB values
-			sort(reds[pixelIndex], reds[pixelIndex] + imageNum);
-			sort(greens[pixelIndex], greens[pixelIndex] + imageNum);
-			sort(blues[pixelIndex], blues[pixelIndex] + imageNum);
 			//assign the median value to the output image
-			output->pixels[pixelIndex].r = reds[pixelIndex][mid];
-			output->pixels[pixelIndex].g = greens[pixelIndex][mid];
-			output->pixels[pixelIndex].b = blues[pixelIndex][mid];
-			//release memory for these RGB values
-			delete reds[pixelIndex];
-			delete greens[pixelIndex];
-			delete blues[pixelIndex];
+			const size_t first = (size_t)pixelIndex * imageNum;
+			output->pixels[pixelIndex].r = lowerMedian(reds + first, imageNum);
+			output->pixels[pixelIndex].g = lowerMedian(greens + first, imageNum);
+			output->pixels[pixelIndex].b = lowerMedian(blues + first, imageNum);
 		}
-		//release last memory of these arrays
-		delete[] reds;
-		delete[] greens;
-		delete[] blues;
+		//release memory of these arrays
+		BufferPool::release(reds, sampleCount);
+		BufferPool::release(greens, sampleCount);
+		BufferPool::release(blues, sampleCount);
 		output->updateModified();
 		return *output;
 	}
@@ -184,8 +182,9 @@ public:
 	/// <param name="imgs">images to blend</param>
 	/// <param name="iterations">how many times to repeat</param>
 	/// <param name="alphaValue">sigma multiplier</param>
+	/// <param name="levels">exposure normalisation applied while gathering, null for none</param>
 	/// <returns>Blended output image</returns>
-	static StackedImage SigmaClippedMeanBlendParallel(vector<Image> &imgs, const unsigned int &iterations, const float &alphaValue = 0.5) {
+	static StackedImage SigmaClippedMeanBlendParallel(vector<Image> &imgs, const unsigned int &iterations, const float &alphaValue = 0.5, const ExposureNormalisation *levels = nullptr) {
 		//check iterations is valid
 		if (iterations < 1) {
 			throw new invalid_argument("The number of iterations cannot be less than 1!");
@@ -194,38 +193,36 @@ public:
 		vector<Image>::const_iterator it;
 		cout << "Allocating Memory...\n";
 		//declare output image
-		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Sigma Clipped Mean");
+		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Sigma Clipped Mean", Image::kUninitialised, imgs[0].channels);
 		//set colour depth
 		output->setColourDepth(imgs[0].getColourDepth());
-		const unsigned int imageSize = output->h * output->w;
-		//similar to median blend, we need to be able to easily sort and remove the RGB values, so we store them in vectors
-		//e.g. reds[i][j], where i is the index of a pixel, and j is the index of an original image, giving the value of that pixel for any given image
-		vector<vector<unsigned char>> reds(imageSize);
-		vector<vector<unsigned char>> greens(imageSize);
-		vector<vector<unsigned char>> blues(imageSize);
-		//allocate memory for the vectors to reduce overhead during the main loop
-		parallel_for(size_t(0), size_t(imageSize), [&reds, &greens, &blues, &imageNum](size_t i) {
-			reds[i].reserve(imageNum);
-			greens[i].reserve(imageNum);
-			blues[i].reserve(imageNum);
-			reds[i].resize(imageNum);
-			greens[i].resize(imageNum);
-			blues[i].resize(imageNum);
-		});
+		const unsigned int imageSize = (unsigned int)output->storedPixels();
+		//similar to median blend, the samples of a pixel sit next to each other in one array per channel
+		//e.g. reds[i * imageNum + j] is the value of pixel i in original image j
+		//clipping moves the kept samples to the front, and counts says how many are left for each pixel and channel
+		const size_t sampleCount = (size_t)imageSize * imageNum;
+		unsigned char *reds = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned char *greens = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned char *blues = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned int *counts = BufferPool::acquire<unsigned int>((size_t)imageSize * 3);
+		std::fill(counts, counts + (size_t)imageSize * 3, imageNum);
 
 		cout << "Memory Allocated.\n";
 
 		cout << "Reading Pixel Values...\n";
 		//read pixel RGB values from original images
 		//iterate through images, in parallel
-		parallel_for(size_t(0), imgs.size(), [&imageSize, &reds, &greens, &blues, &imgs](size_t i) {
+		parallel_for(size_t(0), imgs.size(), [&imageSize, &imageNum, reds, greens, blues, &imgs, levels](size_t i) {
+			TRACE_ZONE_DETAIL("Gather frame", i);
 			Image cur = imgs[i];
+			const unsigned char *table = ExposureNormalisation::lookup(levels, i);
 			//iterate through pixels
 			for (unsigned int pixelIndex = 0; pixelIndex < imageSize; pixelIndex++) {
-				//assign the values to a vector index
-				reds[pixelIndex][i] = cur.pixels[pixelIndex].r;
-				greens[pixelIndex][i] = cur.pixels[pixelIndex].g;
-				blues[pixelIndex][i] = cur.pixels[pixelIndex].b;
+				//assign the values to the pixel's samples
+				const size_t sample = (size_t)pixelIndex * imageNum + i;
+				reds[sample] = table[cur.pixels[pixelIndex].r];
+				greens[sample] = table[256 + cur.pixels[pixelIndex].g];
+				blues[sample] = table[512 + cur.pixels[pixelIndex].b];
 			}
 			//release the memory used by the original image as it is no longer needed
 			cur.freeMemory();
@@ -235,61 +232,31 @@ public:
 		cout << "Performing Sigma Clipped Mean...\n";
 		// repeat the given number of times
 		for (unsigned int iter = 0; iter < iterations; iter++) {
+			TRACE_ZONE_DETAIL("Sigma iteration", iter);
 			//iterate through the pixels, in parallel
-			parallel_for(size_t(0), size_t(imageSize), [&reds, &greens, &blues, &output, &alphaValue](size_t pixelIndex) {
-				//sort the relevant vector
-				sort(reds[pixelIndex].begin(), reds[pixelIndex].end());
-				sort(greens[pixelIndex].begin(), greens[pixelIndex].end());
-				sort(blues[pixelIndex].begin(), blues[pixelIndex].end());
-
-				//calculate the median values for this pixel
-				const unsigned char redMedian = reds[pixelIndex][(int)ceil((reds[pixelIndex].size()-1) / 2)];
-				const unsigned char greenMedian = greens[pixelIndex][(int)ceil((greens[pixelIndex].size()-1) / 2)];
-				const unsigned char blueMedian = blues[pixelIndex][(int)ceil((blues[pixelIndex].size()-1) / 2)];
-
-				//calculate the standard deviation values for this pixel
-				const float redStandardDev = calculateStandardDeviation(reds[pixelIndex], reds[pixelIndex].size());
-				const float greenStandardDev = calculateStandardDeviation(greens[pixelIndex], greens[pixelIndex].size());
-				const float blueStandardDev = calculateStandardDeviation(blues[pixelIndex], blues[pixelIndex].size());
-
-				//calculate the upper and lower bound values for this pixel
-				const float redMin = redMedian - (alphaValue*redStandardDev);
-				const float redMax = redMedian + (alphaValue*redStandardDev);
-
-				const float greenMin = greenMedian - (alphaValue*greenStandardDev);
-				const float greenMax = greenMedian + (alphaValue*greenStandardDev);
-
-				const float blueMin = blueMedian - (alphaValue*blueStandardDev);
-				const float blueMax = blueMedian + (alphaValue*blueStandardDev);
-
-				//remove any values outside the bounds for all channels
-				for (unsigned int i = 0; i < reds[pixelIndex].size(); i++) {
-					const unsigned char redVal = reds[pixelIndex][i];
-					if (redVal < redMin || redVal > redMax) {
-						remove(reds[pixelIndex], i);
-					}
-				}
-
-				for (unsigned int i = 0; i < greens[pixelIndex].size(); i++) {
-					const unsigned char greenVal = greens[pixelIndex][i];
-					if (greenVal < greenMin || greenVal > greenMax) {
-						remove(greens[pixelIndex], i);
-					}
-				}
-
-				for (unsigned int i = 0; i < blues[pixelIndex].size(); i++) {
-					const unsigned char blueVal = blues[pixelIndex][i];
-					if (blueVal < blueMin || blueVal > blueMax) {
-						remove(blues[pixelIndex], i);
-					}
-				}
-
-				//calculate the mean of the remaining values
-				output->pixels[pixelIndex].r = (unsigned char)calculateMean(reds[pixelIndex], reds[pixelIndex].size());
-				output->pixels[pixelIndex].g = (unsigned char)calculateMean(greens[pixelIndex], greens[pixelIndex].size());
-				output->pixels[pixelIndex].b = (unsigned char)calculateMean(blues[pixelIndex], blues[pixelIndex].size());
+			parallel_for(size_t(0), size_t(imageSize), [reds, greens, blues, counts, &imageNum, &output, &alphaValue](size_t pixelIndex) {
+				//the samples of this pixel and how many are left
+				unsigned char *red = reds + pixelIndex * imageNum;
+				unsigned char *green = greens + pixelIndex * imageNum;
+				unsigned char *blue = blues + pixelIndex * imageNum;
+				unsigned int &redCount = counts[pixelIndex * 3];
+				unsigned int &greenCount = counts[pixelIndex * 3 + 1];
+				unsigned int &blueCount = counts[pixelIndex * 3 + 2];
+				//clip the samples of each channel, the same clipping as every other sigma clipped stack
+				clip(red, redCount, alphaValue);
+				clip(green, greenCount, alphaValue);
+				clip(blue, blueCount, alphaValue);
+
+				//calculate the mean of the remaining values, truncated to a level
+				output->pixels[pixelIndex].r = (unsigned char)calculateMean(red, redCount);
+				output->pixels[pixelIndex].g = (unsigned char)calculateMean(green, greenCount);
+				output->pixels[pixelIndex].b = (unsigned char)calculateMean(blue, blueCount);
 			});
 		}
+		BufferPool::release(reds, sampleCount);
+		BufferPool::release(greens, sampleCount);
+		BufferPool::release(blues, sampleCount);
+		BufferPool::release(counts, (size_t)imageSize * 3);
 		output->updateModified();
 		return *output;
 	}
@@ -300,8 +267,9 @@ public:
 	/// <param name="imgs">images to blend</param>
 	/// <param name="iterations">how many times to repeat</param>
 	/// <param name="alphaValue">sigma multiplier</param>
+	/// <param name="levels">exposure normalisation applied while gathering, null for none</param>
 	/// <returns>Blended output image</returns>
-	static StackedImage SigmaClippedMeanBlend(vector<Image> &imgs, const unsigned int &iterations, const float &alphaValue = 0.5) {
+	static StackedImage SigmaClippedMeanBlend(vector<Image> &imgs, const unsigned int &iterations, const float &alphaValue = 0.5, const ExposureNormalisation *levels = nullptr) {
 		//ensure iterations is valid
 		if (iterations < 1) {
 			throw new invalid_argument("The number of iterations cannot be less than 1!");
@@ -310,25 +278,17 @@ public:
 		vector<Image>::const_iterator it;
 		cout << "Allocating Memory...\n";
 		//declare output image
-		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Sigma Clipped Mean");
+		StackedImage *output = new StackedImage(imgs.at(0).w, imgs.at(0).h, "Sigma Clipped Mean", Image::kUninitialised, imgs[0].channels);
 		//set colour depth
 		output->setColourDepth(imgs[0].getColourDepth());
-		const unsigned int imageSize = output->h * output->w;
-		//similar to median blend, we need to be able to easily sort and remove the RGB values, so we store them in vectors
-		//e.g. reds[i][j], where i is the index of a pixel, and j is the index of an original image, giving the value of that pixel for any given image
-		vector<vector<unsigned char>> reds(imageSize);
-		vector<vector<unsigned char>> greens(imageSize);
-		vector<vector<unsigned char>> blues(imageSize);
-
-		//allocate memory for the vectors to reduce overhead during the main loop
-		for (unsigned int i = 0; i < imageSize; i++) {
-			reds[i].reserve(imageNum);
-			greens[i].reserve(imageNum);
-			blues[i].reserve(imageNum);
-			reds[i].resize(imageNum);
-			greens[i].resize(imageNum);
-			blues[i].resize(imageNum);
-		}
+		const unsigned int imageSize = (unsigned int)output->storedPixels();
+		//the samples of each pixel next to each other in one array per channel, as in the parallel version
+		const size_t sampleCount = (size_t)imageSize * imageNum;
+		unsigned char *reds = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned char *greens = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned char *blues = BufferPool::acquire<unsigned char>(sampleCount);
+		unsigned int *counts = BufferPool::acquire<unsigned int>((size_t)imageSize * 3);
+		std::fill(counts, counts + (size_t)imageSize * 3, imageNum);
 		cout << "Memory Allocated.\n";
 
 		cout << "Reading Pixel Values...\n";
@@ -336,13 +296,16 @@ public:
 		//read pixel RGB values from original images
 		//iterate through images
 		for (it = imgs.begin(); it != imgs.end(); it++, imageCount++) {
+			TRACE_ZONE_DETAIL("Gather frame", imageCount);
 			Image cur = *it;
+			const unsigned char *table = ExposureNormalisation::lookup(levels, imageCount);
 			//iterate through the pixels
 			for (unsigned int pixelIndex = 0; pixelIndex < imageSize; pixelIndex++) {
-				//assign the values to a vector index
-				reds[pixelIndex][imageCount] = cur.pixels[pixelIndex].r;
-				greens[pixelIndex][imageCount] = cur.pixels[pixelIndex].g;
-				blues[pixelIndex][imageCount] = cur.pixels[pixelIndex].b;
+				//assign the values to the pixel's samples
+				const size_t sample = (size_t)pixelIndex * imageNum + imageCount;
+				reds[sample] = table[cur.pixels[pixelIndex].r];
+				greens[sample] = table[256 + cur.pixels[pixelIndex].g];
+				blues[sample] = table[512 + cur.pixels[pixelIndex].b];
 			}
 			//release memory used by the original image as it is no longer used
 			cur.freeMemory();
@@ -352,89 +315,393 @@ public:
 		cout << "Performing Sigma Clipped Mean...\n";
 		// repeat the given number of times
 		for (unsigned int iter = 0; iter < iterations; iter++) {
+			TRACE_ZONE_DETAIL("Sigma iteration", iter);
 			//iterate through the pixels, in parallel
 			for (unsigned int pixelIndex = 0; pixelIndex < imageSize; pixelIndex++) {
-				//sort the relevant vector
-				sort(reds[pixelIndex].begin(), reds[pixelIndex].end());
-				sort(greens[pixelIndex].begin(), greens[pixelIndex].end());
-				sort(blues[pixelIndex].begin(), blues[pixelIndex].end());
-
-				//calculate the median for each channel
-				const unsigned char redMedian = reds[pixelIndex][(int)ceil((reds[pixelIndex].size()-1) / 2)];
-				const unsigned char greenMedian = greens[pixelIndex][(int)ceil((greens[pixelIndex].size()-1) / 2)];
-				const unsigned char blueMedian = blues[pixelIndex][(int)ceil((blues[pixelIndex].size()-1) / 2)];
-
-				//calculate the standard deviation for each channel
-				const float redStandardDev = calculateStandardDeviation(reds[pixelIndex], reds[pixelIndex].size());
-				const float greenStandardDev = calculateStandardDeviation(greens[pixelIndex], greens[pixelIndex].size());
-				const float blueStandardDev = calculateStandardDeviation(blues[pixelIndex], blues[pixelIndex].size());
-
-				//calculate the lower and upper bounds for each channel
-				const float redMin = redMedian - (alphaValue*redStandardDev);
-				const float redMax = redMedian + (alphaValue*redStandardDev);
-
-				const float greenMin = greenMedian - (alphaValue*greenStandardDev);
-				const float greenMax = greenMedian + (alphaValue*greenStandardDev);
-
-				const float blueMin = blueMedian - (alphaValue*blueStandardDev);
-				const float blueMax = blueMedian + (alphaValue*blueStandardDev);
-
-				//remove any values outside of the bounds for each channel
-				for (unsigned int i = 0; i < reds[pixelIndex].size(); i++) {
-					const unsigned char redVal = reds[pixelIndex][i];
-					if (redVal < redMin || redVal > redMax) {
-						remove(reds[pixelIndex], i);
-					}
+				//the samples of this pixel and how many are left
+				unsigned char *red = reds + (size_t)pixelIndex * imageNum;
+				unsigned char *green = greens + (size_t)pixelIndex * imageNum;
+				unsigned char *blue = blues + (size_t)pixelIndex * imageNum;
+				unsigned int &redCount = counts[(size_t)pixelIndex * 3];
+				unsigned int &greenCount = counts[(size_t)pixelIndex * 3 + 1];
+				unsigned int &blueCount = counts[(size_t)pixelIndex * 3 + 2];
+				//clip the samples of each channel, the same clipping as every other sigma clipped stack
+				clip(red, redCount, alphaValue);
+				clip(green, greenCount, alphaValue);
+				clip(blue, blueCount, alphaValue);
+
+				//calculate the mean of the remaining values, truncated to a level
+				output->pixels[pixelIndex].r = (unsigned char)calculateMean(red, redCount);
+				output->pixels[pixelIndex].g = (unsigned char)calculateMean(green, greenCount);
+				output->pixels[pixelIndex].b = (unsigned char)calculateMean(blue, blueCount);
+			}
+		}
+		BufferPool::release(reds, sampleCount);
+		BufferPool::release(greens, sampleCount);
+		BufferPool::release(blues, sampleCount);
+		BufferPool::release(counts, (size_t)imageSize * 3);
+		output->updateModified();
+		return *output;
+	}
+
+	/// <summary>
+	/// Sigma clipped mean of one channel of one pixel, as calculated by the sigma clipped blends
+	/// </summary>
+	/// <param name="values">samples of the pixel, reordered and reduced by the clipping</param>
+	/// <param name="iterations">how many times to repeat</param>
+	/// <param name="alphaValue">sigma multiplier</param>
+	/// <returns>mean of the samples that remain</returns>
+	static unsigned char clipAndAverage(Samples &values, const unsigned int &iterations, const float &alphaValue) {
+		unsigned int count = (unsigned int)values.size();
+		const float mean = clippedMean(values.data(), count, iterations, alphaValue);
+		values.resize(count);
+		return (unsigned char)mean;
+	}
+
+	/// <summary>
+	/// Sigma clipped mean of the samples of one channel of one pixel, of any sample type
+	/// The 8-bit blends truncate the mean to a level, a float output keeps it exactly,
+	/// so the two differ by less than a level for the same frames
+	/// </summary>
+	/// <param name="values">samples of the pixel, reordered by the clipping with the kept ones at the front</param>
+	/// <param name="count">number of samples, reduced to the number kept</param>
+	/// <param name="iterations">how many times to repeat</param>
+	/// <param name="alphaValue">sigma multiplier</param>
+	/// <returns>mean of the samples that remain</returns>
+	template <typename T>
+	static float clippedMean(T *values, unsigned int &count, const unsigned int &iterations, const float &alphaValue) {
+		for (unsigned int iter = 0; iter < iterations; iter++) {
+			clip(values, count, alphaValue);
+		}
+		return calculateMean(values, count);
+	}
+
+	/// <summary>
+	/// Clip the samples of one channel of one pixel once, dropping those further than alphaValue standard deviations from the median
+	/// </summary>
+	/// <param name="values">samples of the pixel, sorted and then reordered with the kept ones at the front</param>
+	/// <param name="count">number of samples, reduced to the number kept</param>
+	/// <param name="alphaValue">sigma multiplier</param>
+	template <typename T>
+	static void clip(T *values, unsigned int &count, const float &alphaValue) {
+		//sort the samples
+		sort(values, values + count);
+		//calculate the median and standard deviation
+		const T median = values[(int)ceil((count - 1) / 2)];
+		const float standardDev = calculateStandardDeviation(values, count);
+		//calculate the lower and upper bounds
+		const float minValue = median - (alphaValue*standardDev);
+		const float maxValue = median + (alphaValue*standardDev);
+		//remove any values outside the bounds
+		for (unsigned int i = 0; i < count; i++) {
+			const T value = values[i];
+			if (value < minValue || value > maxValue) {
+				remove(values, count, i);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Lower median of the samples of one channel of one pixel, of any sample type
+	/// </summary>
+	/// <param name="values">samples of the pixel, reordered</param>
+	/// <param name="n">number of samples</param>
+	/// <returns>the middle sample, the lower of the two middle ones for an even number</returns>
+	template <typename T>
+	static T lowerMedian(T *values, const size_t &n) {
+		const size_t mid = (n - 1) / 2;
+		nth_element(values, values + mid, values + n);
+		return values[mid];
+	}
+
+	//samples each task of the planar and sample-type blends stacks at a time, for 8-bit planes a whole number of cache lines
+	static const size_t kBlockSamples = 4096;
+	//most frames the planar blends sort with a network of byte min and max, larger sets sort each sample
+	static const size_t kPlanarNetworkFrames = 32;
+
+	/// <summary>
+	/// Mean blend of planar frames, with the same iterative arithmetic as MeanBlend
+	/// The frames are added a block at a time, so the running means stay in cache
+	/// </summary>
+	/// <param name="frames">frames of the same size and channels, released</param>
+	/// <returns>Blended output image</returns>
+	static PlanarImage MeanBlendPlanar(vector<PlanarImage> &frames) {
+		TRACE_ZONE("Planar mean");
+		PlanarImage output = planarOutput(frames);
+		forEachBlock(output.bytes(), [&frames, &output](const size_t &first, const size_t &last) {
+			unsigned char *out = output.data;
+			//the running mean of one frame is the frame
+			memcpy(out + first, frames[0].data + first, last - first);
+			for (size_t f = 1; f < frames.size(); f++) {
+				const unsigned char *in = frames[f].data;
+				//a difference of two bytes over the count truncates the same in float as in int, and float division vectorises
+				const float count = (float)(f + 1);
+				for (size_t i = first; i < last; i++) {
+					out[i] += (int)((float)(in[i] - out[i]) / count);
+				}
+			}
+		});
+		release(frames);
+		return output;
+	}
+
+	/// <summary>
+	/// Median blend of planar frames, the lower median as in MedianBlend
+	/// </summary>
+	/// <param name="frames">frames of the same size and channels, released</param>
+	/// <returns>Blended output image</returns>
+	static PlanarImage MedianBlendPlanar(vector<PlanarImage> &frames) {
+		TRACE_ZONE("Planar median");
+		PlanarImage output = planarOutput(frames);
+		const size_t mid = (frames.size() - 1) / 2;
+		forEachBlock(output.bytes(), [&frames, &output, mid](const size_t &first, const size_t &last) {
+			if (frames.size() <= kPlanarNetworkFrames) {
+				const vector<unsigned char> lanes = sortBlock(frames, first, last);
+				memcpy(output.data + first, lanes.data() + mid * (last - first), last - first);
+				return;
+			}
+			vector<unsigned char> values(frames.size());
+			for (size_t i = first; i < last; i++) {
+				for (size_t f = 0; f < frames.size(); f++) {
+					values[f] = frames[f].data[i];
+				}
+				output.data[i] = lowerMedian(values.data(), values.size());
+			}
+		});
+		release(frames);
+		return output;
+	}
+
+	/// <summary>
+	/// Sigma clipped mean blend of planar frames, each sample clipped as in the sigma clipped blends
+	/// </summary>
+	/// <param name="frames">frames of the same size and channels, released</param>
+	/// <param name="iterations">how many times to repeat</param>
+	/// <param name="alphaValue">sigma multiplier</param>
+	/// <returns>Blended output image</returns>
+	static PlanarImage SigmaClippedMeanBlendPlanar(vector<PlanarImage> &frames, const unsigned int &iterations, const float &alphaValue = 0.5) {
+		if (iterations < 1) {
+			throw new invalid_argument("The number of iterations cannot be less than 1!");
+		}
+		TRACE_ZONE("Planar sigma clipped mean");
+		PlanarImage output = planarOutput(frames);
+		const size_t n = frames.size();
+		forEachBlock(output.bytes(), [&frames, &output, n, iterations, alphaValue](const size_t &first, const size_t &last) {
+			//samples arrive sorted from the network, so the first sort of the clipping has nothing to do
+			const bool sorted = n <= kPlanarNetworkFrames;
+			const vector<unsigned char> lanes = sorted ? sortBlock(frames, first, last) : vector<unsigned char>();
+			Samples values;
+			values.reserve(n);
+			for (size_t i = first; i < last; i++) {
+				values.resize(n);
+				for (size_t f = 0; f < n; f++) {
+					values[f] = sorted ? lanes[f * (last - first) + i - first] : frames[f].data[i];
 				}
+				output.data[i] = clipAndAverage(values, iterations, alphaValue);
+			}
+		});
+		release(frames);
+		return output;
+	}
 
-				for (unsigned int i = 0; i < greens[pixelIndex].size(); i++) {
-					const unsigned char greenVal = greens[pixelIndex][i];
-					if (greenVal < greenMin || greenVal > greenMax) {
-						remove(greens[pixelIndex], i);
-					}
+	/// <summary>
+	/// Mean blend of frames of any sample type, summed exactly and rounded once at the end
+	/// Frame by frame over a block, a flat loop the compiler vectorises for each sample type
+	/// </summary>
+	/// <param name="frames">frames of the same size, channels and depth, released</param>
+	/// <returns>mean of the frames, with samples of type Out</returns>
+	template <typename T, typename Out = T>
+	static PixelImage<Out> MeanBlend(vector<PixelImage<T>> &frames) {
+		TRACE_ZONE("Pixel mean");
+		PixelImage<Out> output = pixelOutput<Out>(frames);
+		const size_t n = frames.size();
+		forEachBlock(output.sampleCount(), [&frames, &output, n](const size_t &first, const size_t &last) {
+			typename SampleTraits<T>::Sum sums[kBlockSamples] = {};
+			for (size_t f = 0; f < n; f++) {
+				const T *in = frames[f].samples + first;
+				for (size_t i = 0; i < last - first; i++) {
+					sums[i] += in[i];
 				}
+			}
+			for (size_t i = 0; i < last - first; i++) {
+				output.samples[first + i] = SampleTraits<Out>::fromLevel((double)sums[i] / n, output.maxValue);
+			}
+		});
+		release(frames);
+		return output;
+	}
 
-				for (unsigned int i = 0; i < blues[pixelIndex].size(); i++) {
-					const unsigned char blueVal = blues[pixelIndex][i];
-					if (blueVal < blueMin || blueVal > blueMax) {
-						remove(blues[pixelIndex], i);
-					}
+	/// <summary>
+	/// Median blend of frames of any sample type, the lower median as in MedianBlend
+	/// </summary>
+	/// <param name="frames">frames of the same size, channels and depth, released</param>
+	/// <returns>median of the frames, with samples of type Out</returns>
+	template <typename T, typename Out = T>
+	static PixelImage<Out> MedianBlend(vector<PixelImage<T>> &frames) {
+		TRACE_ZONE("Pixel median");
+		PixelImage<Out> output = pixelOutput<Out>(frames);
+		const size_t n = frames.size();
+		forEachBlock(output.sampleCount(), [&frames, &output, n](const size_t &first, const size_t &last) {
+			vector<T> values(n);
+			for (size_t i = first; i < last; i++) {
+				for (size_t f = 0; f < n; f++) {
+					values[f] = frames[f].samples[i];
 				}
+				output.samples[i] = SampleTraits<Out>::fromLevel(lowerMedian(values.data(), n), output.maxValue);
+			}
+		});
+		release(frames);
+		return output;
+	}
 
-				//calculate the mean of remaining values and assign to output
-				output->pixels[pixelIndex].r = (unsigned char)calculateMean(reds[pixelIndex], reds[pixelIndex].size());
-				output->pixels[pixelIndex].g = (unsigned char)calculateMean(greens[pixelIndex], greens[pixelIndex].size());
-				output->pixels[pixelIndex].b = (unsigned char)calculateMean(blues[pixelIndex], blues[pixelIndex].size());
+	/// <summary>
+	/// Sigma clipped mean blend of frames of any sample type, clipped with clippedMean as the 8-bit blends are
+	/// The mean of the kept samples is only rounded if Out is an integer type
+	/// </summary>
+	/// <param name="frames">frames of the same size, channels and depth, released</param>
+	/// <param name="iterations">how many times to clip</param>
+	/// <param name="alphaValue">sigma multiplier</param>
+	/// <returns>clipped mean of the frames, with samples of type Out</returns>
+	template <typename T, typename Out = T>
+	static PixelImage<Out> SigmaClippedMeanBlend(vector<PixelImage<T>> &frames, const unsigned int &iterations, const float &alphaValue = 0.5) {
+		if (iterations < 1) {
+			throw new invalid_argument("The number of iterations cannot be less than 1!");
+		}
+		TRACE_ZONE("Pixel sigma clipped mean");
+		PixelImage<Out> output = pixelOutput<Out>(frames);
+		const size_t n = frames.size();
+		forEachBlock(output.sampleCount(), [&frames, &output, n, iterations, alphaValue](const size_t &first, const size_t &last) {
+			vector<T> values(n);
+			for (size_t i = first; i < last; i++) {
+				for (size_t f = 0; f < n; f++) {
+					values[f] = frames[f].samples[i];
+				}
+				unsigned int count = (unsigned int)n;
+				const float mean = clippedMean(values.data(), count, iterations, alphaValue);
+				output.samples[i] = SampleTraits<Out>::fromLevel(mean, output.maxValue);
 			}
+		});
+		release(frames);
+		return output;
+	}
+
+private:
+	/// <summary>
+	/// Check planar frames can be stacked together and make the output
+	/// </summary>
+	static PlanarImage planarOutput(const vector<PlanarImage> &frames) {
+		if (frames.empty()) {
+			throw new invalid_argument("There must be at least one image to stack");
 		}
-		output->updateModified();
-		return *output;
+		for (const PlanarImage &frame : frames) {
+			if (frame.w != frames[0].w || frame.h != frames[0].h || frame.channels != frames[0].channels) {
+				throw new invalid_argument("Images must all be the same size");
+			}
+		}
+		return PlanarImage(frames[0].w, frames[0].h, frames[0].channels);
 	}
 
+	/// <summary>
+	/// Check frames of any sample type can be stacked together and make the output, at the frames' levels
+	/// </summary>
+	template <typename Out, typename T>
+	static PixelImage<Out> pixelOutput(const vector<PixelImage<T>> &frames) {
+		if (frames.empty()) {
+			throw new invalid_argument("There must be at least one image to stack");
+		}
+		for (const PixelImage<T> &frame : frames) {
+			if (frame.w != frames[0].w || frame.h != frames[0].h || frame.channels != frames[0].channels) {
+				throw new invalid_argument("Images must all be the same size");
+			}
+			if (frame.maxValue != frames[0].maxValue) {
+				throw new invalid_argument("Images must all have the same depth");
+			}
+		}
+		return PixelImage<Out>(frames[0].w, frames[0].h, frames[0].channels, frames[0].maxValue);
+	}
+
+	/// <summary>
+	/// Run a function over the samples of an output in blocks, across all CPU cores
+	/// For planar outputs the padding at the end of each row is stacked too, it is cheaper than skipping it
+	/// </summary>
+	/// <param name="count">number of samples, the bytes of the planes for planar outputs</param>
+	/// <param name="stackBlock">called with the first sample of each block and the sample after it</param>
+	template <typename Function>
+	static void forEachBlock(const size_t &count, const Function &stackBlock) {
+		parallel_for(size_t(0), (count + kBlockSamples - 1) / kBlockSamples, [&stackBlock, count](size_t block) {
+			stackBlock(block * kBlockSamples, std::min(count, (block + 1) * kBlockSamples));
+		});
+	}
+
+	/// <summary>
+	/// Sort the samples of a block of the planes across the frames
+	/// Odd-even transposition sort, every compare and exchange a byte min and max along a run of samples,
+	/// 16 samples to an instruction
+	/// </summary>
+	/// <param name="frames">frames being stacked</param>
+	/// <param name="first">first byte of the block</param>
+	/// <param name="last">byte after the block</param>
+	/// <returns>a lane of last - first samples per frame, each sample's values in ascending order down the lanes</returns>
+	static vector<unsigned char> sortBlock(const vector<PlanarImage> &frames, const size_t &first, const size_t &last) {
+		const size_t n = frames.size(), length = last - first;
+		vector<unsigned char> lanes(n * length);
+		for (size_t f = 0; f < n; f++) {
+			memcpy(lanes.data() + f * length, frames[f].data + first, length);
+		}
+		for (size_t pass = 0; pass < n; pass++) {
+			for (size_t f = pass % 2; f + 1 < n; f += 2) {
+				unsigned char *lower = lanes.data() + f * length;
+				unsigned char *upper = lower + length;
+				size_t i = 0;
+#ifdef PLANAR_SSE2
+				for (; i + 16 <= length; i += 16) {
+					const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lower + i));
+					const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(upper + i));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(lower + i), _mm_min_epu8(a, b));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(upper + i), _mm_max_epu8(a, b));
+				}
+#endif
+				for (; i < length; i++) {
+					const unsigned char a = lower[i], b = upper[i];
+					lower[i] = std::min(a, b);
+					upper[i] = std::max(a, b);
+				}
+			}
+		}
+		return lanes;
+	}
+
+	template <typename Frame>
+	static void release(vector<Frame> &frames) {
+		for (Frame &frame : frames) {
+			frame.freeMemory();
+		}
+	}
 
-private:
 	/// <summary>
-	/// remove a element from a vector
-	/// does not preserve sorted order but is faster than .erase()
+	/// remove a element from the samples of a pixel, the same way as from a vector
 	/// </summary>
-	/// <param name="set">vector to remove from</param>
+	/// <param name="set">samples to remove from</param>
+	/// <param name="count">number of samples, reduced by one if the element is removed</param>
 	/// <param name="index">index of element to remove</param>
-	static void remove(vector<unsigned char> &set, const size_t &index) {
-		if (set.size() > 0 && index > 0 && index < set.size()) {
-			//overwrite the element to remove with the element at the back of the vector
-			set[index] = set.back();
-			//pop the element at the back off
-			set.pop_back();
+	template <typename T>
+	static void remove(T *set, unsigned int &count, const size_t &index) {
+		if (count > 0 && index > 0 && index < count) {
+			//overwrite the element to remove with the element at the back
+			set[index] = set[count - 1];
+			//drop the element at the back
+			count--;
 		}
 	}
 
 	/// <summary>
 	/// Calculate the mean of a set of values
 	/// </summary>
-	/// <param name="values">vector of values</param>
-	/// <param name="n">size of vector</param>
+	/// <param name="values">values</param>
+	/// <param name="n">number of values</param>
 	/// <returns>mean of values</returns>
-	static float calculateMean(const vector<unsigned char> &values, const size_t &n) {
+	template <typename T>
+	static float calculateMean(const T *values, const size_t &n) {
 		float sum = 0.0;
 		for (size_t i = size_t(0); i < n; ++i) {
 			sum += values[i];
@@ -446,13 +713,14 @@ private:
 	/// Calculate the standard deviation of a set of values
 	/// </summary>
 	/// <param name="values">values to perform calculation on</param>
-	/// <param name="n">size of the values vector</param>
+	/// <param name="n">number of values</param>
 	/// <returns>Standard deviation of values</returns>
-	static float calculateStandardDeviation(const vector<unsigned char> &values, const size_t &n) {
-		float sum = 0.0, mean, standardDeviation = 0.0;
+	template <typename T>
+	static float calculateStandardDeviation(const T *values, const size_t &n) {
+		float standardDeviation = 0.0;
 
 		//calculate mean
-		mean = calculateMean(values, n);
+		const float mean = calculateMean(values, n);
 
 		//calculate standard deviation
 		for (size_t i = size_t(0); i < n; ++i) {
@@ -0,0 +1,291 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <math.h>
+#include "Parallel.h"
+#include "Image.h"
+#include "Utils.h"
+
+using namespace std;
+
+/// <summary>
+/// Settings for generating a synthetic stack of frames
+/// Every value has a default so a stack can be described by only what differs
+/// </summary>
+struct SyntheticStackSettings {
+	unsigned int width = 1024;
+	unsigned int height = 768;
+	unsigned int frameCount = 10;
+	unsigned long long seed = 1;
+	float skyLevel = 30.0f; // background brightness in levels
+	float gradientStrength = 60.0f; // brightness added across the frame by a sky gradient
+	float noiseSigma = 8.0f; // standard deviation of the per frame gaussian noise
+	unsigned int starCount = 300; // point sources present in every frame
+	unsigned int hotPixelCount = 50; // pixels stuck at full brightness in every frame
+	float satelliteProbability = 0.3f; // chance of a frame containing a satellite trail
+	float outlierFraction = 0.0002f; // fraction of pixels hit by single frame outliers, e.g. cosmic rays
+};
+
+/// <summary>
+/// Small deterministic random number generator (SplitMix64)
+/// The standard library distributions are implemented differently by each compiler,
+/// so they are not used to keep generated frames identical between builds
+/// </summary>
+class SyntheticRandom {
+private:
+	unsigned long long state;
+public:
+	/// <summary>
+	/// Create a generator
+	/// </summary>
+	/// <param name="seed">starting state</param>
+	SyntheticRandom(const unsigned long long &seed) : state(seed) {}
+
+	/// <summary>
+	/// Scramble a value, used to derive independent seeds
+	/// </summary>
+	/// <param name="z">value to scramble</param>
+	/// <returns>scrambled value</returns>
+	static unsigned long long mix(unsigned long long z) {
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	/// <summary>
+	/// Derive the seed of an independent stream, e.g. one row of one frame
+	/// </summary>
+	/// <param name="seed">stack seed</param>
+	/// <param name="a">first stream index</param>
+	/// <param name="b">second stream index</param>
+	/// <returns>seed for the stream</returns>
+	static unsigned long long streamSeed(const unsigned long long &seed, const unsigned long long &a, const unsigned long long &b) {
+		return mix(seed ^ mix((a + 1) * 0x9E3779B97F4A7C15ULL + (b + 1) * 0xD1B54A32D192ED03ULL));
+	}
+
+	/// <summary>
+	/// Get the next random value
+	/// </summary>
+	/// <returns>64 random bits</returns>
+	unsigned long long next() {
+		state += 0x9E3779B97F4A7C15ULL;
+		return mix(state);
+	}
+
+	/// <summary>
+	/// Get a uniformly distributed value
+	/// </summary>
+	/// <returns>value in [0, 1)</returns>
+	double nextDouble() {
+		return (next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	/// <summary>
+	/// Get a uniformly distributed value in a range
+	/// </summary>
+	/// <param name="min">lowest value</param>
+	/// <param name="max">highest value</param>
+	/// <returns>value in [min, max)</returns>
+	double nextRange(const double &min, const double &max) {
+		return min + (max - min) * nextDouble();
+	}
+
+	/// <summary>
+	/// Get a uniformly distributed integer
+	/// </summary>
+	/// <param name="n">number of possible values</param>
+	/// <returns>value in [0, n)</returns>
+	unsigned int nextBelow(const unsigned int &n) {
+		return (unsigned int)(nextDouble() * n);
+	}
+
+	/// <summary>
+	/// Get a normally distributed value using the Box-Muller transform
+	/// </summary>
+	/// <returns>value with mean 0 and standard deviation 1</returns>
+	double nextGaussian() {
+		const double u1 = std::max(nextDouble(), 1e-12);
+		const double u2 = nextDouble();
+		return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+	}
+};
+
+/// <summary>
+/// Generates reproducible synthetic frame stacks for benchmarking
+/// The same settings always produce the same frames, whatever the number of threads
+/// </summary>
+class SyntheticImages {
+public:
+	/// <summary>
+	/// Generate a whole stack in memory
+	/// </summary>
+	/// <param name="settings">description of the stack</param>
+	/// <returns>generated frames</returns>
+	static vector<Image> generateStack(const SyntheticStackSettings &settings) {
+		vector<float> scene = renderScene(settings);
+		vector<Image> frames;
+		frames.reserve(settings.frameCount);
+		for (unsigned int i = 0; i < settings.frameCount; i++) {
+			frames.push_back(generateFrame(settings, scene, i));
+		}
+		return frames;
+	}
+
+	/// <summary>
+	/// Generate a stack and write it to disk as IMG_1.ppm, IMG_2.ppm, ... like the real image sets
+	/// Frames are written one at a time so the whole stack is never held in memory
+	/// </summary>
+	/// <param name="settings">description of the stack</param>
+	/// <param name="directory">directory to write to, created if missing</param>
+	/// <returns>paths of the written frames</returns>
+	static vector<string> writeStack(const SyntheticStackSettings &settings, const string &directory) {
+		makeDirectory(directory);
+		vector<float> scene = renderScene(settings);
+		vector<string> paths;
+		for (unsigned int i = 0; i < settings.frameCount; i++) {
+			Image frame = generateFrame(settings, scene, i);
+			const string path = directory + "/IMG_" + to_string(i + 1) + ".ppm";
+			frame.writePPM(path.c_str());
+			frame.freeMemory();
+			paths.push_back(path);
+		}
+		return paths;
+	}
+
+	/// <summary>
+	/// Describe a stack in a short form for file names and benchmark parameters
+	/// </summary>
+	/// <param name="settings">description of the stack</param>
+	/// <returns>e.g. 1024x768x10_seed1</returns>
+	static string describe(const SyntheticStackSettings &settings) {
+		return to_string(settings.width) + "x" + to_string(settings.height) + "x" + to_string(settings.frameCount) + "_seed" + to_string(settings.seed);
+	}
+
+private:
+	/// <summary>
+	/// Render the noise free scene shared by every frame: sky gradient and stars
+	/// </summary>
+	/// <param name="settings">description of the stack</param>
+	/// <returns>interleaved RGB brightness values</returns>
+	static vector<float> renderScene(const SyntheticStackSettings &settings) {
+		const unsigned int w = settings.width;
+		const unsigned int h = settings.height;
+		vector<float> scene((size_t)w * h * 3);
+		//sky is slightly blue and brightens towards the bottom right
+		parallel_for(size_t(0), size_t(h), [&scene, &settings, &w, &h](size_t y) {
+			for (unsigned int x = 0; x < w; x++) {
+				const float level = settings.skyLevel + settings.gradientStrength * (0.7f * x / w + 0.3f * y / h);
+				float *px = &scene[(y * w + x) * 3];
+				px[0] = level * 0.9f;
+				px[1] = level;
+				px[2] = level * 1.15f;
+			}
+		});
+
+		//stars are gaussian spots with a little colour
+		SyntheticRandom random(SyntheticRandom::streamSeed(settings.seed, 0xFFFFFFFFULL, 0));
+		for (unsigned int s = 0; s < settings.starCount; s++) {
+			const double cx = random.nextRange(0, w);
+			const double cy = random.nextRange(0, h);
+			const double sigma = random.nextRange(0.8, 2.5);
+			const double peak = random.nextRange(60, 220);
+			const double tint[3] = { random.nextRange(0.8, 1.1), 1.0, random.nextRange(0.8, 1.2) };
+			const int radius = (int)ceil(sigma * 3);
+			for (int y = (int)cy - radius; y <= (int)cy + radius; y++) {
+				for (int x = (int)cx - radius; x <= (int)cx + radius; x++) {
+					if (x < 0 || y < 0 || x >= (int)w || y >= (int)h) {
+						continue;
+					}
+					const double d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+					const double value = peak * exp(-d2 / (2 * sigma * sigma));
+					float *px = &scene[((size_t)y * w + x) * 3];
+					for (unsigned int c = 0; c < 3; c++) {
+						px[c] += (float)(value * tint[c]);
+					}
+				}
+			}
+		}
+		return scene;
+	}
+
+	/// <summary>
+	/// Generate one frame from the scene
+	/// </summary>
+	/// <param name="settings">description of the stack</param>
+	/// <param name="scene">noise free scene</param>
+	/// <param name="frameIndex">index of the frame in the stack</param>
+	/// <returns>generated frame</returns>
+	static Image generateFrame(const SyntheticStackSettings &settings, const vector<float> &scene, const unsigned int &frameIndex) {
+		const unsigned int w = settings.width;
+		const unsigned int h = settings.height;
+		Image frame(w, h, "Synthetic Frame");
+		frame.setColourDepth(24);
+
+		//gaussian noise, each row has its own random stream so the result does not depend on scheduling
+		parallel_for(size_t(0), size_t(h), [&frame, &scene, &settings, &frameIndex, &w](size_t y) {
+			SyntheticRandom random(SyntheticRandom::streamSeed(settings.seed, frameIndex, y));
+			for (unsigned int x = 0; x < w; x++) {
+				const size_t index = y * w + x;
+				const float *px = &scene[index * 3];
+				frame.pixels[index].r = toLevel(px[0] + settings.noiseSigma * random.nextGaussian());
+				frame.pixels[index].g = toLevel(px[1] + settings.noiseSigma * random.nextGaussian());
+				frame.pixels[index].b = toLevel(px[2] + settings.noiseSigma * random.nextGaussian());
+			}
+		});
+
+		SyntheticRandom random(SyntheticRandom::streamSeed(settings.seed, frameIndex, 0xFFFFFFFFULL));
+		//single frame outliers such as cosmic ray hits
+		const unsigned int outliers = (unsigned int)(settings.outlierFraction * w * h);
+		for (unsigned int i = 0; i < outliers; i++) {
+			const unsigned int index = random.nextBelow(w) + random.nextBelow(h) * w;
+			frame.pixels[index] = Image::Rgb((unsigned char)random.nextRange(200, 256));
+		}
+
+		//satellite trail crossing the whole frame
+		if (random.nextDouble() < settings.satelliteProbability) {
+			drawTrail(frame, random);
+		}
+
+		//hot pixels are in the same place in every frame
+		SyntheticRandom hotRandom(SyntheticRandom::streamSeed(settings.seed, 0xFFFFFFFEULL, 0));
+		for (unsigned int i = 0; i < settings.hotPixelCount; i++) {
+			const unsigned int index = hotRandom.nextBelow(w) + hotRandom.nextBelow(h) * w;
+			frame.pixels[index] = Image::Rgb(255);
+		}
+		frame.updateModified();
+		return frame;
+	}
+
+	/// <summary>
+	/// Draw a bright straight trail between two random points on the frame edges
+	/// </summary>
+	/// <param name="frame">frame to draw on</param>
+	/// <param name="random">random stream of the frame</param>
+	static void drawTrail(Image &frame, SyntheticRandom &random) {
+		const double x0 = 0, y0 = random.nextRange(0, frame.h);
+		const double x1 = frame.w - 1, y1 = random.nextRange(0, frame.h);
+		const unsigned char brightness = (unsigned char)random.nextRange(180, 256);
+		const double length = sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+		//step half a pixel at a time so the trail has no gaps, and make it two pixels wide
+		const unsigned int steps = (unsigned int)(length * 2);
+		for (unsigned int s = 0; s <= steps; s++) {
+			const double t = (double)s / steps;
+			const int x = (int)(x0 + t * (x1 - x0));
+			const int y = (int)(y0 + t * (y1 - y0));
+			for (int dy = 0; dy < 2; dy++) {
+				if (y + dy >= 0 && y + dy < (int)frame.h) {
+					frame.pixels[(y + dy) * frame.w + x] = Image::Rgb(brightness);
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// Round and clamp a brightness to a channel value
+	/// </summary>
+	/// <param name="value">brightness</param>
+	/// <returns>value between 0 and 255</returns>
+	static unsigned char toLevel(const double &value) {
+		return (unsigned char)Clamp((float)(value + 0.5), 0, 255);
+	}
+};
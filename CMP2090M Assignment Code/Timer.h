@@ -1,33 +1,80 @@
 #pragma once
+#include <chrono>
 #include <ctime>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
 
 /// <summary>
 /// Class for timing durations
+/// Wall time comes from a steady clock so parallel work is not counted once per thread,
+/// CPU time is the total used by every thread in the process over the same interval
 /// </summary>
 class Timer {
 private:
-	clock_t startT;
-	clock_t endT;
+	std::chrono::steady_clock::time_point startT;
+	std::chrono::steady_clock::time_point endT;
+	double startCpu = 0.0;
+	double endCpu = 0.0;
 public:
 	/// <summary>
 	/// Start the stopwatch
 	/// </summary>
 	void start() {
-		startT = clock();
+		startCpu = processCpuSeconds();
+		startT = std::chrono::steady_clock::now();
 	}
 
 	/// <summary>
 	/// Stop the stopwatch
 	/// </summary>
 	void stop() {
-		endT = clock();
+		endT = std::chrono::steady_clock::now();
+		endCpu = processCpuSeconds();
 	}
 
 	/// <summary>
 	/// Get the duration
 	/// </summary>
-	/// <returns>Number of seconds between start and stop</returns>
+	/// <returns>Number of wall clock seconds between start and stop</returns>
 	double getSeconds() {
-		return (endT - startT) / static_cast<double>(CLOCKS_PER_SEC);
+		return std::chrono::duration<double>(endT - startT).count();
+	}
+
+	/// <summary>
+	/// Get the CPU time used between start and stop, summed across all threads
+	/// </summary>
+	/// <returns>Number of CPU seconds between start and stop</returns>
+	double getCpuSeconds() {
+		return endCpu - startCpu;
+	}
+
+	/// <summary>
+	/// Get the total CPU time used by this process so far
+	/// </summary>
+	/// <returns>CPU seconds used by all threads of the process</returns>
+	static double processCpuSeconds() {
+#ifdef _WIN32
+		FILETIME creation, exit, kernel, user;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+			return 0.0;
+		}
+		//FILETIME values are in 100 nanosecond units
+		const unsigned long long k = ((unsigned long long)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+		const unsigned long long u = ((unsigned long long)user.dwHighDateTime << 32) | user.dwLowDateTime;
+		return (k + u) / 1e7;
+#else
+		timespec ts;
+		if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+			return 0.0;
+		}
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
 	}
 };
@@ -0,0 +1,214 @@
+#pragma once
+//*********************************************
+//Low overhead tracing of scoped zones, written out as Chrome trace event JSON
+//View the output in chrome://tracing or https://ui.perfetto.dev
+//
+//Tracing is compiled out unless ENABLE_TRACING is defined before this header is included,
+//in which case TRACE_ZONE and friends expand to nothing
+//*********************************************
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Utils.h"
+
+using namespace std;
+
+/// <summary>
+/// One completed zone
+/// </summary>
+struct TraceEvent {
+	const char *name; // zone name, must be a string literal
+	char detail[40]; // optional short description, e.g. a file name or iteration number
+	unsigned long long startNs; // nanoseconds since tracing started
+	unsigned long long durationNs;
+};
+
+/// <summary>
+/// Ring buffer of events recorded by one thread
+/// Only the owning thread writes, so recording needs no locks; when full the oldest events are overwritten
+/// </summary>
+class TraceBuffer {
+private:
+	static const size_t kCapacity = 1 << 16;
+	vector<TraceEvent> events;
+	atomic<unsigned long long> head;
+	unsigned int threadIndex;
+
+public:
+	/// <summary>
+	/// Create a buffer for a thread
+	/// </summary>
+	/// <param name="_threadIndex">small number identifying the thread in the trace</param>
+	TraceBuffer(const unsigned int &_threadIndex) : events(kCapacity), head(0), threadIndex(_threadIndex) {}
+
+	/// <summary>
+	/// Record an event, called only by the owning thread
+	/// </summary>
+	/// <param name="e">event to record</param>
+	void push(const TraceEvent &e) {
+		const unsigned long long h = head.load(memory_order_relaxed);
+		events[h & (kCapacity - 1)] = e;
+		//publish the event to readers
+		head.store(h + 1, memory_order_release);
+	}
+
+	/// <summary>
+	/// Copy out the events currently held, oldest first
+	/// Should be called while the owning thread is not recording, e.g. between operations
+	/// </summary>
+	/// <returns>recorded events</returns>
+	vector<TraceEvent> snapshot() const {
+		const unsigned long long h = head.load(memory_order_acquire);
+		const unsigned long long count = h < kCapacity ? h : kCapacity;
+		vector<TraceEvent> result;
+		result.reserve((size_t)count);
+		for (unsigned long long i = h - count; i < h; i++) {
+			result.push_back(events[i & (kCapacity - 1)]);
+		}
+		return result;
+	}
+
+	/// <summary>
+	/// Get the thread number used in the trace
+	/// </summary>
+	/// <returns>thread number</returns>
+	unsigned int getThreadIndex() const {
+		return threadIndex;
+	}
+};
+
+/// <summary>
+/// Global tracing state: the clock origin and every thread's buffer
+/// </summary>
+class Trace {
+private:
+	/// <summary>
+	/// Buffers of every thread that has recorded an event, kept after the thread exits
+	/// </summary>
+	static vector<unique_ptr<TraceBuffer>>& buffers() {
+		static vector<unique_ptr<TraceBuffer>> all;
+		return all;
+	}
+
+	/// <summary>
+	/// Lock protecting the buffer list, only taken when a thread records its first event
+	/// </summary>
+	static mutex& buffersLock() {
+		static mutex lock;
+		return lock;
+	}
+
+public:
+	/// <summary>
+	/// Get the time since tracing started
+	/// </summary>
+	/// <returns>nanoseconds since the first call</returns>
+	static unsigned long long now() {
+		static const chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+		return (unsigned long long)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+	}
+
+	/// <summary>
+	/// Get the calling thread's buffer, creating it on first use
+	/// </summary>
+	/// <returns>buffer of the calling thread</returns>
+	static TraceBuffer& threadBuffer() {
+		static thread_local TraceBuffer *buffer = nullptr;
+		if (buffer == nullptr) {
+			lock_guard<mutex> guard(buffersLock());
+			buffers().push_back(unique_ptr<TraceBuffer>(new TraceBuffer((unsigned int)buffers().size())));
+			buffer = buffers().back().get();
+		}
+		return *buffer;
+	}
+
+	/// <summary>
+	/// Write every recorded event as Chrome trace event JSON
+	/// </summary>
+	/// <param name="path">file to write</param>
+	static void writeChromeTrace(const char *path) {
+		ofstream out;
+		out.open(path, ios::trunc);
+		out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+		bool first = true;
+		lock_guard<mutex> guard(buffersLock());
+		for (const unique_ptr<TraceBuffer> &buffer : buffers()) {
+			const unsigned int tid = buffer->getThreadIndex();
+			//name the thread so the viewer shows a readable track
+			out << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+				<< ", \"args\": {\"name\": \"" << (tid == 0 ? "Main" : "Worker " + to_string(tid)) << "\"}}";
+			first = false;
+			for (const TraceEvent &e : buffer->snapshot()) {
+				//trace event times are in microseconds
+				out << ",\n{\"name\": \"" << jsonEscape(e.name) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+					<< ", \"ts\": " << e.startNs / 1000.0 << ", \"dur\": " << e.durationNs / 1000.0;
+				if (e.detail[0] != '\0') {
+					out << ", \"args\": {\"detail\": \"" << jsonEscape(e.detail) << "\"}";
+				}
+				out << "}";
+			}
+		}
+		out << "\n]}\n";
+		out.close();
+	}
+};
+
+/// <summary>
+/// Records the time from construction to destruction as a zone
+/// </summary>
+class TraceZone {
+private:
+	TraceEvent e;
+public:
+	/// <summary>
+	/// Start a zone
+	/// </summary>
+	/// <param name="name">zone name, must be a string literal</param>
+	/// <param name="detail">optional short description, truncated to fit</param>
+	TraceZone(const char *name, const char *detail = nullptr) {
+		e.name = name;
+		e.detail[0] = '\0';
+		if (detail != nullptr) {
+			strncpy(e.detail, detail, sizeof(e.detail) - 1);
+			e.detail[sizeof(e.detail) - 1] = '\0';
+		}
+		e.startNs = Trace::now();
+	}
+
+	/// <summary>
+	/// Start a zone described by a number, e.g. a frame index
+	/// </summary>
+	/// <param name="name">zone name, must be a string literal</param>
+	/// <param name="value">number to show with the zone</param>
+	TraceZone(const char *name, const unsigned long long &value) : TraceZone(name, to_string(value).c_str()) {}
+
+	/// <summary>
+	/// End the zone and record it
+	/// </summary>
+	~TraceZone() {
+		e.durationNs = Trace::now() - e.startNs;
+		Trace::threadBuffer().push(e);
+	}
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef ENABLE_TRACING
+//record the rest of the enclosing scope as a zone
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+//record the rest of the enclosing scope as a zone, with a description or number
+#define TRACE_ZONE_DETAIL(name, detail) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name, detail)
+//write everything recorded so far to a Chrome trace file
+#define TRACE_WRITE(path) Trace::writeChromeTrace(path)
+#else
+#define TRACE_ZONE(name)
+#define TRACE_ZONE_DETAIL(name, detail)
+#define TRACE_WRITE(path)
+#endif
@@ -1,6 +1,20 @@
 #pragma once
 #include <math.h>
+#include <cmath>
+#include <cstdio>
 #include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -9,13 +23,13 @@ using namespace std;
 /// </summary>
 /// <param name="numberOfBytes">number of bytes to convert</param>
 /// <returns>A string in the form "[Number] [Suffix]"</returns>
-std::stringstream bytesToAppropriate(const unsigned long numberOfBytes) {
+std::stringstream bytesToAppropriate(const unsigned long long numberOfBytes) {
 	std::stringstream result;
 
 	//constants for number of bytes in each order of magnitude
-	unsigned long const Gigabyte = (unsigned long)pow(2, 30);
-	unsigned long const Megabyte = (unsigned long)pow(2, 20);
-	unsigned long const Kilobyte = (unsigned long)pow(2, 10);
+	unsigned long long const Gigabyte = 1ULL << 30;
+	unsigned long long const Megabyte = 1ULL << 20;
+	unsigned long long const Kilobyte = 1ULL << 10;
 
 	//are there more bytes than one gigabyte?
 	if (numberOfBytes >= Gigabyte) {
@@ -34,6 +48,49 @@ std::stringstream bytesToAppropriate(const unsigned long numberOfBytes) {
 	return result;
 }
 
+/// <summary>
+/// Escape a string so it can be written inside a JSON string literal
+/// </summary>
+/// <param name="value">string to escape</param>
+/// <returns>escaped string, without surrounding quotes</returns>
+std::string jsonEscape(const std::string &value) {
+	std::string result;
+	result.reserve(value.size());
+	for (const char c : value) {
+		switch (c) {
+		case '"': result += "\\\""; break;
+		case '\\': result += "\\\\"; break;
+		case '\n': result += "\\n"; break;
+		case '\r': result += "\\r"; break;
+		case '\t': result += "\\t"; break;
+		default:
+			if ((unsigned char)c < 0x20) {
+				//other control characters must be written as unicode escapes
+				char buffer[8];
+				snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned int)(unsigned char)c);
+				result += buffer;
+			} else {
+				result += c;
+			}
+		}
+	}
+	return result;
+}
+
+/// <summary>
+/// Write a number as a JSON value, using the stream's precision
+/// JSON has no NaN or infinity, so those are written as null
+/// </summary>
+/// <param name="out">stream to write to</param>
+/// <param name="value">number to write</param>
+void writeJsonNumber(std::ostream &out, const double &value) {
+	if (std::isfinite(value)) {
+		out << value;
+	} else {
+		out << "null";
+	}
+}
+
 /// <summary>
 /// Clamp a value between min and Max
 /// </summary>
@@ -51,6 +108,231 @@ float Clamp(const float &val, const float &min, const float &max) {
 	return val;
 }
 
+/// <summary>
+/// Create a directory, including any missing parent directories
+/// </summary>
+/// <param name="path">directory to create</param>
+void makeDirectory(const std::string &path) {
+	for (size_t i = 1; i <= path.size(); i++) {
+		//create each parent in turn, existing directories are left alone
+		if (i == path.size() || path[i] == '/' || path[i] == '\\') {
+			const std::string part = path.substr(0, i);
+#ifdef _WIN32
+			_mkdir(part.c_str());
+#else
+			mkdir(part.c_str(), 0755);
+#endif
+		}
+	}
+}
+
+/// <summary>
+/// Match a file name against a pattern where * matches any run of characters and ? any single character
+/// </summary>
+/// <param name="pattern">pattern to match</param>
+/// <param name="name">file name to test</param>
+/// <returns>true if the whole name matches</returns>
+bool wildcardMatch(const char *pattern, const char *name) {
+	const char *star = nullptr, *resume = nullptr;
+	while (*name != '\0') {
+		if (*pattern == '*') {
+			//remember where to retry if the rest does not match
+			star = pattern++;
+			resume = name;
+		} else if (*pattern == '?' || *pattern == *name) {
+			pattern++;
+			name++;
+		} else if (star != nullptr) {
+			pattern = star + 1;
+			name = ++resume;
+		} else {
+			return false;
+		}
+	}
+	while (*pattern == '*') {
+		pattern++;
+	}
+	return *pattern == '\0';
+}
+
+/// <summary>
+/// Compare file names so that embedded numbers sort by value, e.g. IMG_2 before IMG_10
+/// </summary>
+/// <param name="a">first name</param>
+/// <param name="b">second name</param>
+/// <returns>true if a sorts before b</returns>
+bool naturalLess(const std::string &a, const std::string &b) {
+	size_t i = 0, j = 0;
+	while (i < a.size() && j < b.size()) {
+		if (isdigit((unsigned char)a[i]) && isdigit((unsigned char)b[j])) {
+			size_t endA = i, endB = j;
+			while (endA < a.size() && isdigit((unsigned char)a[endA])) endA++;
+			while (endB < b.size() && isdigit((unsigned char)b[endB])) endB++;
+			const unsigned long long numberA = strtoull(a.substr(i, endA - i).c_str(), nullptr, 10);
+			const unsigned long long numberB = strtoull(b.substr(j, endB - j).c_str(), nullptr, 10);
+			if (numberA != numberB) {
+				return numberA < numberB;
+			}
+			i = endA;
+			j = endB;
+		} else {
+			if (a[i] != b[j]) {
+				return a[i] < b[j];
+			}
+			i++;
+			j++;
+		}
+	}
+	return a.size() - i < b.size() - j;
+}
+
+/// <summary>
+/// Check a rectangle lies inside an image and is not empty
+/// The sums are never formed, so coordinates near the top of the unsigned range cannot wrap round
+/// </summary>
+/// <param name="left">x coordinate of the top left of the rectangle</param>
+/// <param name="top">y coordinate of the top left of the rectangle</param>
+/// <param name="width">width of the rectangle</param>
+/// <param name="height">height of the rectangle</param>
+/// <param name="w">width of the image</param>
+/// <param name="h">height of the image</param>
+/// <returns>true if the rectangle is inside the image</returns>
+bool regionInside(const unsigned int &left, const unsigned int &top, const unsigned int &width, const unsigned int &height, const unsigned int &w, const unsigned int &h) {
+	return width > 0 && height > 0 && left <= w && top <= h && width <= w - left && height <= h - top;
+}
+
+/// <summary>
+/// Expand a path whose file name may contain * and ? wildcards
+/// Only the file name part is matched, the directory must be given exactly
+/// </summary>
+/// <param name="pattern">path, e.g. Images/ImageStacker_set1/*.ppm, IMG_*.ppm or /IMG_*.ppm</param>
+/// <returns>matching paths in natural order, or the path itself if it has no wildcards</returns>
+std::vector<std::string> expandFilePattern(const std::string &pattern) {
+	std::vector<std::string> paths;
+	const size_t slash = pattern.find_last_of("/\\");
+	//the file name follows the last separator, or a drive (e.g. C:*.ppm) on Windows
+	size_t nameStart = slash == std::string::npos ? 0 : slash + 1;
+#ifdef _WIN32
+	if (slash == std::string::npos && pattern.size() >= 2 && pattern[1] == ':') {
+		nameStart = 2;
+	}
+#endif
+	//the prefix is kept on every match as it was given; an empty one is the working directory, and a
+	//prefix that is only a separator or a drive (e.g. / or C:\) is listed as it is rather than without its separator
+	const std::string prefix = pattern.substr(0, nameStart);
+	const std::string namePattern = pattern.substr(nameStart);
+	std::string directory = prefix.empty() ? "." : prefix;
+	if (directory.size() > 1 && (directory.back() == '/' || directory.back() == '\\') && directory[directory.size() - 2] != ':') {
+		directory.pop_back();
+	}
+	if (namePattern.find_first_of("*?") == std::string::npos) {
+		paths.push_back(pattern);
+		return paths;
+	}
+	std::vector<std::string> names;
+#ifdef _WIN32
+	_finddata_t entry;
+	const char last = directory.back();
+	intptr_t handle = _findfirst((directory + (last == '/' || last == '\\' || last == ':' ? "*" : "/*")).c_str(), &entry);
+	if (handle != -1) {
+		do {
+			if (!(entry.attrib & _A_SUBDIR) && wildcardMatch(namePattern.c_str(), entry.name)) {
+				names.push_back(entry.name);
+			}
+		} while (_findnext(handle, &entry) == 0);
+		_findclose(handle);
+	}
+#else
+	DIR *dir = opendir(directory.c_str());
+	if (dir != nullptr) {
+		while (dirent *entry = readdir(dir)) {
+			if (entry->d_name[0] != '.' && wildcardMatch(namePattern.c_str(), entry->d_name)) {
+				names.push_back(entry->d_name);
+			}
+		}
+		closedir(dir);
+	}
+#endif
+	sort(names.begin(), names.end(), naturalLess);
+	for (const std::string &name : names) {
+		paths.push_back(prefix + name);
+	}
+	return paths;
+}
+
+/// <summary>
+/// Get the directory part of a path
+/// </summary>
+/// <param name="path">file path</param>
+/// <returns>directory, empty if the path has none</returns>
+std::string parentDirectory(const std::string &path) {
+	const size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? "" : path.substr(0, slash);
+}
+
+/// <summary>
+/// Get the file name of a path without its directory or extension
+/// </summary>
+/// <param name="path">file path</param>
+/// <returns>file name stem, e.g. IMG_1 for Images/IMG_1.ppm</returns>
+std::string fileStem(const std::string &path) {
+	const size_t slash = path.find_last_of("/\\");
+	const std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+	const size_t dot = name.find_last_of('.');
+	return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+/// <summary>
+/// Check whether a path ends in an extension, ignoring case
+/// </summary>
+/// <param name="path">file path</param>
+/// <param name="extension">extension with its dot, e.g. .pgm</param>
+/// <returns>true if the path has the extension</returns>
+bool hasExtension(const std::string &path, const std::string &extension) {
+	if (path.size() < extension.size()) {
+		return false;
+	}
+	return std::equal(extension.begin(), extension.end(), path.end() - extension.size(), [](const char &a, const char &b) {
+		return tolower((unsigned char)a) == tolower((unsigned char)b);
+	});
+}
+
+/// <summary>
+/// Name a file to write before it replaces another, keeping the extension so the file is written in the same format
+/// </summary>
+/// <param name="path">file to be replaced, e.g. out.pgm</param>
+/// <param name="tag">word to insert before the extension, e.g. refining for out.refining.pgm</param>
+/// <returns>temporary path in the same directory</returns>
+std::string temporaryPath(const std::string &path, const std::string &tag) {
+	const size_t slash = path.find_last_of("/\\");
+	const size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash) || dot == (slash == std::string::npos ? 0 : slash + 1)) {
+		return path + "." + tag;
+	}
+	return path.substr(0, dot) + "." + tag + path.substr(dot);
+}
+
+/// <summary>
+/// Make a path absolute by prefixing the current directory, so it means the same to another process
+/// </summary>
+/// <param name="path">file path, which need not exist</param>
+/// <returns>absolute path</returns>
+std::string absolutePath(const std::string &path) {
+	const bool absolute = (!path.empty() && (path[0] == '/' || path[0] == '\\')) || (path.size() > 1 && path[1] == ':');
+	if (absolute) {
+		return path;
+	}
+	char directory[4096];
+#ifdef _WIN32
+	if (_getcwd(directory, sizeof(directory)) == nullptr) {
+#else
+	if (getcwd(directory, sizeof(directory)) == nullptr) {
+#endif
+		return path;
+	}
+	return std::string(directory) + "/" + path;
+}
+
 /// <summary>
 /// Clear the console screen
 /// </summary>
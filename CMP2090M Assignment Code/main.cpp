@@ -1,5 +1,7 @@
 //main.cpp
 #define _CRT_SECURE_NO_WARNINGS
+//uncomment (or define when compiling) to record load, stack, scale and write zones to Trace.json
+//#define ENABLE_TRACING
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -10,8 +12,36 @@
 #include "Stacker.h"
 #include "Scaler.h"
 #include "Utils.h"
+#include "Benchmark.h"
+#include "SyntheticImages.h"
+#include "PlanarImage.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include "MemoryTracker.h"
+#include "Logger.h"
+#include "Operations.h"
+#include "BatchMode.h"
+#include "ResultCache.h"
 using namespace std;
 
+/// <summary>
+/// Get the paths of the images in a numbered set
+/// </summary>
+/// <param name="set">the numbered image set</param>
+/// <returns>paths of the images, empty if there is no such set</returns>
+vector<string> imageSetPaths(const unsigned int &set) {
+	//sets 1 to 4 with the number of images in each
+	const unsigned int setSizes[] = { 13, 10, 10, 10 };
+	vector<string> paths;
+	if (set < 1 || set > 4) {
+		return paths;
+	}
+	for (unsigned int i = 1; i <= setSizes[set - 1]; i++) {
+		paths.push_back("Images/ImageStacker_set" + to_string(set) + "/IMG_" + to_string(i) + ".ppm");
+	}
+	return paths;
+}
+
 /// <summary>
 /// reads images into a vector
 /// </summary>
@@ -23,76 +53,11 @@ vector<Image> readImagesForStacking(const unsigned int &set) {
 	cout << "************************************\n";
 	Timer timer;
 	timer.start();
-	vector<Image> images;
-	//switch on the given set
-	switch (set) {
-	case 1:
-		//set 1
-		images = {
-			Image("Images/ImageStacker_set1/IMG_1.ppm"),
-			Image("Images/ImageStacker_set1/IMG_2.ppm"),
-			Image("Images/ImageStacker_set1/IMG_3.ppm"),
-			Image("Images/ImageStacker_set1/IMG_4.ppm"),
-			Image("Images/ImageStacker_set1/IMG_5.ppm"),
-			Image("Images/ImageStacker_set1/IMG_6.ppm"),
-			Image("Images/ImageStacker_set1/IMG_7.ppm"),
-			Image("Images/ImageStacker_set1/IMG_8.ppm"),
-			Image("Images/ImageStacker_set1/IMG_9.ppm"),
-			Image("Images/ImageStacker_set1/IMG_10.ppm"),
-			Image("Images/ImageStacker_set1/IMG_11.ppm"),
-			Image("Images/ImageStacker_set1/IMG_12.ppm"),
-			Image("Images/ImageStacker_set1/IMG_13.ppm")
-		};
-		break;
-	case 2:
-		//set 2
-		images = {
-			Image("Images/ImageStacker_set2/IMG_1.ppm"),
-			Image("Images/ImageStacker_set2/IMG_2.ppm"),
-			Image("Images/ImageStacker_set2/IMG_3.ppm"),
-			Image("Images/ImageStacker_set2/IMG_4.ppm"),
-			Image("Images/ImageStacker_set2/IMG_5.ppm"),
-			Image("Images/ImageStacker_set2/IMG_6.ppm"),
-			Image("Images/ImageStacker_set2/IMG_7.ppm"),
-			Image("Images/ImageStacker_set2/IMG_8.ppm"),
-			Image("Images/ImageStacker_set2/IMG_9.ppm"),
-			Image("Images/ImageStacker_set2/IMG_10.ppm")
-		};
-		break;
-	case 3:
-		//set 3
-		images = {
-			Image("Images/ImageStacker_set3/IMG_1.ppm"),
-			Image("Images/ImageStacker_set3/IMG_2.ppm"),
-			Image("Images/ImageStacker_set3/IMG_3.ppm"),
-			Image("Images/ImageStacker_set3/IMG_4.ppm"),
-			Image("Images/ImageStacker_set3/IMG_5.ppm"),
-			Image("Images/ImageStacker_set3/IMG_6.ppm"),
-			Image("Images/ImageStacker_set3/IMG_7.ppm"),
-			Image("Images/ImageStacker_set3/IMG_8.ppm"),
-			Image("Images/ImageStacker_set3/IMG_9.ppm"),
-			Image("Images/ImageStacker_set3/IMG_10.ppm")
-		};
-		break;
-	case 4:
-		//set 4
-		images = {
-			Image("Images/ImageStacker_set4/IMG_1.ppm"),
-			Image("Images/ImageStacker_set4/IMG_2.ppm"),
-			Image("Images/ImageStacker_set4/IMG_3.ppm"),
-			Image("Images/ImageStacker_set4/IMG_4.ppm"),
-			Image("Images/ImageStacker_set4/IMG_5.ppm"),
-			Image("Images/ImageStacker_set4/IMG_6.ppm"),
-			Image("Images/ImageStacker_set4/IMG_7.ppm"),
-			Image("Images/ImageStacker_set4/IMG_8.ppm"),
-			Image("Images/ImageStacker_set4/IMG_9.ppm"),
-			Image("Images/ImageStacker_set4/IMG_10.ppm")
-		};
-		break;
-	default:
+	const vector<string> paths = imageSetPaths(set);
+	if (paths.empty()) {
 		cout << "\nInvalid Image Set" << endl;
-		break;
 	}
+	vector<Image> images = readImageFiles(paths);
 	cout << "************************************\n";
 
 	timer.stop();
@@ -101,61 +66,74 @@ vector<Image> readImagesForStacking(const unsigned int &set) {
 	return images;
 }
 
+/// <summary>
+/// Get the cache of stacked outputs shared by every stacker run
+/// </summary>
+/// <returns>the result cache, kept in the ResultCache directory beside the program</returns>
+ResultCache& stackerResultCache() {
+	static ResultCache cache("ResultCache", 4ULL << 30);
+	return cache;
+}
+
 /// <summary>
 /// Runs the image stacker
 /// </summary>
 /// <param name="method">numbered stacking method to use</param>
 /// <param name="imageSet">numbered image set to stack</param>
 void ImageStacker(const unsigned int &method, const unsigned int &imageSet) {
-	//read images into memory
-	vector<Image> images = readImagesForStacking(imageSet);
-	StackedImage output;
-	Timer timer;
-	timer.start();
 	string fileName = "default.ppm";
 	//switch on the stacking method
 	switch (method) {
 	case 1:
-		//mean blending
 		cout << "\nMean Blending Images...\n";
 		fileName = "MeanOutput.ppm";
-		output = Stacker::MeanBlend(images);
 		break;
 	case 2:
-		//median blending (optimised)
 		cout << "\nMedian Blending Images...\n";
 		fileName = "MedianOutput.ppm";
-		output = Stacker::MedianBlendParallel(images);
 		break;
 	case 3:
-		//sigma clipped mean blending (optimised)
 		cout << "\nSigma Clipped Mean Blending Images...\n";
 		fileName = "SigmaClippedMeanOutput.ppm";
-		output = Stacker::SigmaClippedMeanBlendParallel(images, 5);
 		break;
 	case 4:
-		//median blending
 		cout << "\nMedian Blending Images...\n";
 		fileName = "MedianOutput2.ppm";
-		output = Stacker::MedianBlend(images);
 		break;
 	case 5:
-		//sigma clipped mean blending
 		cout << "\nSigma Clipped Mean Blending Images...\n";
 		fileName = "SigmaClippedMeanOutput2.ppm";
-		output = Stacker::SigmaClippedMeanBlend(images, 1);
 		break;
 	default:
 		cout << "Invalid blend method\n";
 		return;
 	}
 
+	//the same set stacked the same way before can be reused without reading or blending anything
+	const string filePath = "Images/ImageStacker_set" + to_string(imageSet) + "/" + fileName;
+	const string cacheKey = ResultCache::makeKey(imageSetPaths(imageSet), stackingMethodParameters(method));
+	if (stackerResultCache().fetch(cacheKey, filePath)) {
+		cout << "Found the same blend in the result cache, written to " << filePath << "\n";
+		return;
+	}
+
+	//read images into memory
+	vector<Image> images = readImagesForStacking(imageSet);
+	if (!imagesLoaded(images)) {
+		cout << "Could not read image set " << imageSet << "\n";
+		freeImages(images);
+		return;
+	}
+	Timer timer;
+	timer.start();
+	StackedImage output = runStackingMethod(method, images);
 	timer.stop();
 	cout << "Finished Blending in " << timer.getSeconds() << " seconds\n";
 	
-	//write to file
-	string filePath = "Images/ImageStacker_set" + to_string(imageSet) + "/" + fileName;
-	output.writePPM(filePath.c_str());
+	//write to file, and keep a copy for next time
+	if (output.writePPM(filePath.c_str())) {
+		stackerResultCache().store(cacheKey, filePath);
+	}
 
 	//log output
 	output.logDetails();
@@ -176,64 +154,54 @@ void ImageStacker(const unsigned int &method, const unsigned int &imageSet) {
 /// <param name="roiWidth">width of ROI</param>
 /// <param name="roiHeight">height of ROI</param>
 void ImageScaler(const unsigned int &method, const double &scale, const bool &scaleROI = false, const unsigned int &roiLeft = 0, const unsigned int &roiTop = 0, const unsigned int &roiWidth = 0, const unsigned int &roiHeight = 0) {
-	Image img;
 	std::stringstream fileName;
-	cout << "\n";
-	Timer timer;
-	timer.start();
-
-	//are we using a ROI?
-	if (scaleROI) {
-		//yes get the region of interest first
-		img = Scaler::ExtractRegionOfInterest(Image("Images/Zoom/zImg_1.ppm"), roiLeft, roiTop, roiWidth, roiHeight);
-	} else {
-		//no, load the whole image
-		img = Image("Images/Zoom/zImg_1.ppm");
-	}
-
-	ScaledImage output;
 	//switch on the scaling method
 	switch (method) {
 	case 1:
-		//nearest neighbour (optimised)
 		cout << "\nNearest Neighbour Scaling...\n";
 		fileName << "NearestNeighbourScaled" << scale << "x.ppm";
-		output = Scaler::NearestNeighbourParallel(img, scale);
 		break;
 	case 2:
-		//bilinear (optimised)
 		cout << "\nBilinear Scaling...\n";
 		fileName << "BilinearScaled" << scale << "x.ppm";
-		output = Scaler::BilinearParallel(img, scale);
 		break;
 	case 3:
-		//bicubic (optimised)
 		cout << "\nBicubic Scaling...\n";
 		fileName << "BicubicScaled" << scale << "x.ppm";
-		output = Scaler::BiCubicParallel(img, scale);
 		break;
 	case 4:
-		//nearest neighbour
 		cout << "\nNearest Neighbour Scaling...\n";
 		fileName << "NearestNeighbourScaledSerial" << scale << "x.ppm";
-		output = Scaler::NearestNeighbour(img, scale);
 		break;
 	case 5:
-		//bilinear
 		cout << "\nBilinear Scaling...\n";
 		fileName << "BilinearScaledSerial" << scale << "x.ppm";
-		output = Scaler::Bilinear(img, scale);
 		break;
 	case 6:
-		//bicubic
 		cout << "\nBicubic Scaling...\n";
 		fileName << "BicubicScaledSerial" << scale << "x.ppm";
-		output = Scaler::BiCubic(img, scale);
 		break;
 	default:
 		cout << "Invalid Scaling Method";
 		return;
 	}
+
+	Image img;
+	//are we using a ROI?
+	if (scaleROI) {
+		//yes get the region of interest first
+		Image source("Images/Zoom/zImg_1.ppm");
+		img = Scaler::ExtractRegionOfInterest(source, roiLeft, roiTop, roiWidth, roiHeight);
+		source.freeMemory();
+	} else {
+		//no, load the whole image
+		img = Image("Images/Zoom/zImg_1.ppm");
+	}
+
+	cout << "\n";
+	Timer timer;
+	timer.start();
+	ScaledImage output = runScalingMethod(method, img, scale);
 	timer.stop();
 
 	cout << "Finished Scaling in " << timer.getSeconds() << " seconds\n";
@@ -315,249 +283,370 @@ void showImageScalerMenu() {
 
 /// <summary>
 /// Run the scaler benchmark
+/// Reading, scaling and writing are measured as separate phases
 /// </summary>
-void benchmarkScaler() {
-	//output timings to log file
-	ofstream logFile;
-	logFile.open("Benchmark.txt", ios::app);
-	Timer timer;
-	time_t benchStart = time(&benchStart);
-
-	string startTime(ctime(&benchStart));
-	logFile << "Starting Scaler Benchmark: " << startTime;
-	logFile << "Timings include read/write of images";
-	
-	//run all algorithms at 2x scale factor
-	logFile << "\nScale 2x:";
-
-	timer.start();
-	ImageScaler(4, 2);
-	timer.stop();
-	logFile << "\n\tNearest Neighbour: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(1, 2);
-	timer.stop();
-	logFile << "\n\tNearest Neighbour Parallel: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(5, 2);
-	timer.stop();
-	logFile << "\n\n\tBilinear: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(2, 2);
-	timer.stop();
-	logFile << "\n\tBilinear Parallel: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(6, 2);
-	timer.stop();
-	logFile << "\n\n\tBicubic: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(3, 2);
-	timer.stop();
-	logFile << "\n\tBicubic Parallel: " << timer.getSeconds();
-
-	//run all algorithms at 4x scale factor
-	logFile << "\nScale 4x:";
-
-	timer.start();
-	ImageScaler(4, 4);
-	timer.stop();
-	logFile << "\n\tNearest Neighbour: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(1, 4);
-	timer.stop();
-	logFile << "\n\tNearest Neighbour Parallel: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(5, 4);
-	timer.stop();
-	logFile << "\n\n\tBilinear: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(2, 4);
-	timer.stop();
-	logFile << "\n\tBilinear Parallel: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(6, 4);
-	timer.stop();
-	logFile << "\n\n\tBicubic: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(3, 4);
-	timer.stop();
-	logFile << "\n\tBicubic Parallel: " << timer.getSeconds();
-
-	//run all algorithms at 10x scale factor
-	logFile << "\nScale 10x:";
-
-	timer.start();
-	ImageScaler(4, 10);
-	timer.stop();
-	logFile << "\n\tNearest Neighbour: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(1, 10);
-	timer.stop();
-	logFile << "\n\tNearest Neighbour Parallel: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(5, 10);
-	timer.stop();
-	logFile << "\n\n\tBilinear: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(2, 10);
-	timer.stop();
-	logFile << "\n\tBilinear Parallel: " << timer.getSeconds();
-
-	timer.start();
-	ImageScaler(6, 10);
-	timer.stop();
-	logFile << "\n\n\tBicubic: " << timer.getSeconds();
+/// <param name="bench">benchmark harness to record results in</param>
+void benchmarkScaler(Benchmark &bench) {
+	char *source = "Images/Zoom/zImg_1.ppm";
+	Image img(source);
+	if (img.pixels == nullptr) {
+		bench.skip("Scaler", source, "source image could not be read");
+		return;
+	}
 
-	timer.start();
-	ImageScaler(3, 10);
-	timer.stop();
-	logFile << "\n\tBicubic Parallel: " << timer.getSeconds();
+	//time decoding the source image on its own
+	Image readImg;
+	bench.measure("Scaler", "PPM Read", "read", "source=" + string(source), [] {},
+		[&readImg, &source] { readImg = Image(source); },
+		[&readImg] { readImg.freeMemory(); });
+
+	const double scales[] = { 2, 4, 10 };
+	//serial then parallel version of each algorithm, numbered as in runScalingMethod
+	const unsigned int methods[] = { 4, 1, 5, 2, 6, 3 };
+	for (const double &scale : scales) {
+		std::stringstream params;
+		params << "scale=" << scale;
+		ScaledImage output;
+		for (const unsigned int &method : methods) {
+			bench.measure("Scaler", scalingMethodName(method), "compute", params.str(), [] {},
+				[&output, &method, &img, &scale] { output = runScalingMethod(method, img, scale); },
+				[&output] { output.freeMemory(); }, floor(img.w * scale) * floor(img.h * scale));
+		}
+
+		//write cost only depends on the output size, so measure it once per scale factor
+		output = runScalingMethod(1, img, scale);
+		const string outPath = "Images/Zoom/BenchmarkScaled" + to_string((int)scale) + "x.ppm";
+		bench.measure("Scaler", "PPM Write", "write", params.str(), [&output, &outPath] { output.writePPM(outPath.c_str()); });
+		output.freeMemory();
+	}
+	img.freeMemory();
+}
 
-	logFile << "\n\n";
-	logFile.close();
+/// <summary>
+/// Measure stacking methods on a set of frames already in memory
+/// </summary>
+/// <param name="bench">benchmark harness to record results in</param>
+/// <param name="suite">suite to record results under</param>
+/// <param name="params">parameters describing the frames</param>
+/// <param name="frames">frames to stack, left untouched</param>
+/// <param name="methods">numbered stacking methods to measure</param>
+void benchmarkStackingMethods(Benchmark &bench, const string &suite, const string &params, const vector<Image> &frames, const vector<unsigned int> &methods) {
+	const double outputPixels = (double)frames[0].w * frames[0].h;
+	StackedImage output;
+	vector<Image> working;
+	for (const unsigned int &method : methods) {
+		//stackers release their input, so give each iteration a fresh copy outside the timed region
+		bench.measure(suite, stackingMethodName(method), "compute", params,
+			[&working, &frames] { working = cloneImages(frames); },
+			[&output, &working, &method] { output = runStackingMethod(method, working); },
+			[&output, &working] { output.freeMemory(); working.clear(); }, outputPixels);
+	}
 }
 
 /// <summary>
 /// Run image stacker benchmark
+/// Reading, stacking and writing are measured as separate phases
 /// </summary>
-void benchmarkStacker() {
-	//output timings to log file
-	ofstream logFile;
-	logFile.open("Benchmark.txt", ios::app);
-	Timer timer;
-	time_t benchStart = time(&benchStart);
-
-	string startTime(ctime(&benchStart));
-	logFile << "Starting Stacking Benchmark: " << startTime;
-	logFile << "Timings include read/write of images";
-
-	//run all algorithms on image set 1
-	logFile << "\nImage Set 1:";
-
-	timer.start();
-	ImageStacker(1, 1);
-	timer.stop();
-	logFile << "\n\tMean Blending Time: " << timer.getSeconds() << " seconds";
-
-	timer.start();
-	ImageStacker(4, 1);
-	timer.stop();
-	logFile << "\n\tMedian Blending Time: " << timer.getSeconds() << " seconds";
-
-	timer.start();
-	ImageStacker(2, 1);
-	timer.stop();
-	logFile << "\n\tMedian Blending Parallel Time: " << timer.getSeconds() << " seconds";
-
-	timer.start();
-	ImageStacker(5, 1);
-	timer.stop();
-	logFile << "\n\tSigma Clipped Mean Blending Time: " << timer.getSeconds() << " seconds";
-
-	timer.start();
-	ImageStacker(3, 1);
-	timer.stop();
-	logFile << "\n\tSigma Clipped Mean Parallel Blending Time: " << timer.getSeconds() << " seconds";
-
-	//run all algorithms on image set 2
-	logFile << "\nImage Set 2:";
-
-	timer.start();
-	ImageStacker(1, 2);
-	timer.stop();
-	logFile << "\n\tMean Blending Time: " << timer.getSeconds() << " seconds";
-
-	timer.start();
-	ImageStacker(4, 2);
-	timer.stop();
-	logFile << "\n\tMedian Blending Time: " << timer.getSeconds() << " seconds";
-
-	timer.start();
-	ImageStacker(2, 2);
-	timer.stop();
-	logFile << "\n\tMedian Blending Parallel Time: " << timer.getSeconds() << " seconds";
-
-	timer.start();
-	ImageStacker(5, 2);
-	timer.stop();
-	logFile << "\n\tSigma Clipped Mean Blending Time: " << timer.getSeconds() << " seconds";
-
-	timer.start();
-	ImageStacker(3, 2);
-	timer.stop();
-	logFile << "\n\tSigma Clipped Mean Parallel Blending Time: " << timer.getSeconds() << " seconds";
-
-	//run all algorithms on image set 3
-	logFile << "\nImage Set 3:";
+/// <param name="bench">benchmark harness to record results in</param>
+void benchmarkStacker(Benchmark &bench) {
+	//serial then parallel version of each algorithm, numbered as in runStackingMethod
+	const unsigned int methods[] = { 1, 4, 2, 5, 3 };
+	for (unsigned int set = 1; set <= 4; set++) {
+		const string params = "set=" + to_string(set);
+		vector<Image> frames = readImagesForStacking(set);
+		if (!imagesLoaded(frames)) {
+			bench.skip("Stacker", "Image Set " + to_string(set), "images could not be read");
+			freeImages(frames);
+			continue;
+		}
+
+		//time decoding all frames of the set
+		vector<Image> readFrames;
+		bench.measure("Stacker", "PPM Read (" + to_string(frames.size()) + " frames)", "read", params, [] {},
+			[&readFrames, &set] { readFrames = readImagesForStacking(set); },
+			[&readFrames] { freeImages(readFrames); });
+
+		benchmarkStackingMethods(bench, "Stacker", params, frames, vector<unsigned int>(begin(methods), end(methods)));
+
+		//write cost only depends on the output size, so measure it once per set
+		vector<Image> working = cloneImages(frames);
+		StackedImage output = runStackingMethod(1, working);
+		const string outPath = "Images/ImageStacker_set" + to_string(set) + "/BenchmarkOutput.ppm";
+		bench.measure("Stacker", "PPM Write", "write", params, [&output, &outPath] { output.writePPM(outPath.c_str()); });
+		output.freeMemory();
+		freeImages(frames);
+	}
+}
 
-	timer.start();
-	ImageStacker(1, 3);
-	timer.stop();
-	logFile << "\n\tMean Blending Time: " << timer.getSeconds() << " seconds";
+/// <summary>
+/// Run the stacker benchmark on generated frames
+/// Sweeps the frame size at a fixed frame count, then the frame count at a fixed size,
+/// so scaling curves can be measured on any machine without the real image sets
+/// </summary>
+/// <param name="bench">benchmark harness to record results in</param>
+void benchmarkSynthetic(Benchmark &bench) {
+	vector<SyntheticStackSettings> stacks;
+	const unsigned int sizes[][2] = { { 1024, 768 }, { 2048, 1536 }, { 4096, 3072 } };
+	for (const auto &size : sizes) {
+		SyntheticStackSettings settings;
+		settings.width = size[0];
+		settings.height = size[1];
+		settings.frameCount = 10;
+		stacks.push_back(settings);
+	}
+	const unsigned int frameCounts[] = { 5, 20 };
+	for (const unsigned int &frameCount : frameCounts) {
+		SyntheticStackSettings settings;
+		settings.width = 2048;
+		settings.height = 1536;
+		settings.frameCount = frameCount;
+		stacks.push_back(settings);
+	}
 
-	timer.start();
-	ImageStacker(4, 3);
-	timer.stop();
-	logFile << "\n\tMedian Blending Time: " << timer.getSeconds() << " seconds";
+	//parallel algorithms only, the serial ones are covered by the real image sets
+	const vector<unsigned int> methods = { 1, 2, 3 };
+	for (const SyntheticStackSettings &settings : stacks) {
+		const string params = SyntheticImages::describe(settings);
+		vector<Image> frames = SyntheticImages::generateStack(settings);
+
+		//write the same stack to disk to measure decoding
+		const vector<string> paths = SyntheticImages::writeStack(settings, "Images/Synthetic/" + params);
+		vector<Image> readFrames;
+		bench.measure("Synthetic", "PPM Read (" + to_string(paths.size()) + " frames)", "read", params, [] {},
+			[&readFrames, &paths] { readFrames = readImageFiles(paths); },
+			[&readFrames] { freeImages(readFrames); });
+
+		benchmarkStackingMethods(bench, "Synthetic", params, frames, methods);
+		freeImages(frames);
+	}
+}
 
-	timer.start();
-	ImageStacker(2, 3);
-	timer.stop();
-	logFile << "\n\tMedian Blending Parallel Time: " << timer.getSeconds() << " seconds";
+/// <summary>
+/// Compare the interleaved and planar layouts on generated frames
+/// Each parallel method is measured on both layouts with the same frames, and the conversions
+/// between them are measured on their own, as they are paid once per frame read and output written
+/// </summary>
+/// <param name="bench">benchmark harness to record results in</param>
+void benchmarkLayouts(Benchmark &bench) {
+	SyntheticStackSettings settings;
+	settings.width = 2048;
+	settings.height = 1536;
+	settings.frameCount = 10;
+	vector<Image> frames = SyntheticImages::generateStack(settings);
+	const string params = SyntheticImages::describe(settings);
+	const double framePixels = (double)settings.width * settings.height;
+	vector<PlanarImage> planarFrames;
+	for (const Image &frame : frames) {
+		planarFrames.push_back(PlanarImage::fromImage(frame));
+	}
 
-	timer.start();
-	ImageStacker(5, 3);
-	timer.stop();
-	logFile << "\n\tSigma Clipped Mean Blending Time: " << timer.getSeconds() << " seconds";
+	PlanarImage planar;
+	Image interleaved(settings.width, settings.height);
+	bench.measure("Layout", "To Planar", "convert", params, [] {},
+		[&planar, &frames] { planar = PlanarImage::fromImage(frames[0]); },
+		[&planar] { planar.freeMemory(); }, framePixels);
+	bench.measure("Layout", "From Planar", "convert", params, [&interleaved, &planarFrames] { planarFrames[0].copyTo(interleaved); });
+	interleaved.freeMemory();
+
+	const unsigned int stackMethods[] = { 1, 2, 3 };
+	StackedImage stacked;
+	vector<Image> working;
+	vector<PlanarImage> planarWorking;
+	for (const unsigned int &method : stackMethods) {
+		bench.measure("Layout", stackingMethodName(method), "compute", params + " layout=interleaved",
+			[&working, &frames] { working = cloneImages(frames); },
+			[&stacked, &working, &method] { stacked = runStackingMethod(method, working); },
+			[&stacked, &working] { stacked.freeMemory(); working.clear(); }, framePixels);
+		//the planar stackers release their input too, so each iteration stacks fresh copies
+		bench.measure("Layout", stackingMethodName(method), "compute", params + " layout=planar",
+			[&planarWorking, &planarFrames] {
+				planarWorking.clear();
+				for (const PlanarImage &frame : planarFrames) {
+					PlanarImage copy(frame.w, frame.h, frame.channels);
+					memcpy(copy.data, frame.data, frame.bytes());
+					planarWorking.push_back(copy);
+				}
+			},
+			[&planar, &planarWorking, &method] { planar = runPlanarStackingMethod(method, planarWorking); },
+			[&planar, &planarWorking] { planar.freeMemory(); planarWorking.clear(); }, framePixels);
+	}
 
-	timer.start();
-	ImageStacker(3, 3);
-	timer.stop();
-	logFile << "\n\tSigma Clipped Mean Parallel Blending Time: " << timer.getSeconds() << " seconds";
+	const double scale = 2;
+	const double outputPixels = floor(settings.width * scale) * floor(settings.height * scale);
+	const unsigned int scaleMethods[] = { 1, 2, 3 };
+	ScaledImage scaled;
+	for (const unsigned int &method : scaleMethods) {
+		bench.measure("Layout", scalingMethodName(method), "compute", params + " scale=2 layout=interleaved", [] {},
+			[&scaled, &method, &frames, &scale] { scaled = runScalingMethod(method, frames[0], scale); },
+			[&scaled] { scaled.freeMemory(); }, outputPixels);
+		bench.measure("Layout", scalingMethodName(method), "compute", params + " scale=2 layout=planar", [] {},
+			[&planar, &method, &planarFrames, &scale] { planar = runPlanarScalingMethod(method, planarFrames[0], scale); },
+			[&planar] { planar.freeMemory(); }, outputPixels);
+	}
+	freeImages(frames);
+	for (PlanarImage &frame : planarFrames) {
+		frame.freeMemory();
+	}
+}
 
-	//run all algorithms on image set 4
-	logFile << "\nImage Set 4:";
+/// <summary>
+/// Estimate the bytes a stacking method reads and writes in memory
+/// Counts the frames, the output (including its initial fill) and the per pixel sample arrays
+/// </summary>
+/// <param name="method">numbered stacking method, as in runStackingMethod</param>
+/// <param name="frameCount">number of frames stacked</param>
+/// <param name="frameBytes">size of one frame's pixels in bytes</param>
+/// <returns>estimated bytes touched</returns>
+double stackingBytesTouched(const unsigned int &method, const unsigned int &frameCount, const size_t &frameBytes) {
+	const double n = frameCount;
+	const double f = (double)frameBytes;
+	switch (method) {
+	case 1:
+		//every frame is read once, and the running mean is read and written once per frame
+		return f + n * f + 2 * n * f;
+	case 2:
+	case 4:
+		//frames are read into the sample arrays, which are then sorted in place
+		return 2 * f + 2 * n * f + 2 * n * f;
+	case 3:
+	case 5: {
+		//as median, then every iteration sorts the samples and writes the output
+		const double iterations = method == 3 ? 5 : 1;
+		return 2 * f + 2 * n * f + iterations * (2 * n * f + f);
+	}
+	default:
+		return 0;
+	}
+}
 
-	timer.start();
-	ImageStacker(1, 4);
-	timer.stop();
-	logFile << "\n\tMean Blending Time: " << timer.getSeconds() << " seconds";
+/// <summary>
+/// Estimate the bytes a scaling method reads and writes in memory
+/// </summary>
+/// <param name="sourceBytes">size of the source pixels in bytes</param>
+/// <param name="outputBytes">size of the output pixels in bytes</param>
+/// <returns>estimated bytes touched</returns>
+double scalingBytesTouched(const size_t &sourceBytes, const size_t &outputBytes) {
+	//the source is read, and the output is filled then written
+	return (double)sourceBytes + 2.0 * outputBytes;
+}
 
-	timer.start();
-	ImageStacker(4, 4);
-	timer.stop();
-	logFile << "\n\tMedian Blending Time: " << timer.getSeconds() << " seconds";
+/// <summary>
+/// Get the thread counts to run the scaling benchmark with
+/// </summary>
+/// <returns>powers of two up to the hardware thread count, plus the physical core count</returns>
+vector<unsigned int> sweepThreadCounts() {
+	vector<unsigned int> counts;
+	const unsigned int logical = logicalCoreCount();
+	for (unsigned int n = 1; n <= logical; n *= 2) {
+		counts.push_back(n);
+	}
+	counts.push_back(physicalCoreCount());
+	sort(counts.begin(), counts.end());
+	counts.erase(unique(counts.begin(), counts.end()), counts.end());
+	return counts;
+}
 
-	timer.start();
-	ImageStacker(2, 4);
-	timer.stop();
-	logFile << "\n\tMedian Blending Parallel Time: " << timer.getSeconds() << " seconds";
+/// <summary>
+/// Add speedup, parallel efficiency and bandwidth to a thread scaling result
+/// </summary>
+/// <param name="result">result to add metrics to</param>
+/// <param name="threads">thread count the result was measured with</param>
+/// <param name="oneThreadSeconds">median time of the same algorithm on one thread</param>
+/// <param name="bytesTouched">estimated bytes read and written by one run</param>
+void addScalingMetrics(BenchmarkResult &result, const unsigned int &threads, const double &oneThreadSeconds, const double &bytesTouched) {
+	result.metrics["threads"] = threads;
+	if (result.median > 0) {
+		const double speedup = oneThreadSeconds / result.median;
+		result.metrics["speedup"] = speedup;
+		result.metrics["efficiency"] = speedup / threads;
+		result.metrics["bandwidthGBs"] = bytesTouched / result.median / 1e9;
+	}
+}
 
-	timer.start();
-	ImageStacker(5, 4);
-	timer.stop();
-	logFile << "\n\tSigma Clipped Mean Blending Time: " << timer.getSeconds() << " seconds";
+/// <summary>
+/// Run every scaler and stacker algorithm across a range of thread counts
+/// Parallel algorithms are measured at every thread count, serial ones once as a reference.
+/// Speedup and efficiency are relative to the same algorithm on one thread;
+/// bandwidth is the estimated bytes touched divided by the median time.
+/// </summary>
+/// <param name="bench">benchmark harness to record results in</param>
+void benchmarkThreadScaling(Benchmark &bench) {
+	const vector<unsigned int> threadCounts = sweepThreadCounts();
+	SyntheticStackSettings settings;
+	settings.width = 2048;
+	settings.height = 1536;
+	settings.frameCount = 10;
+	vector<Image> frames = SyntheticImages::generateStack(settings);
+	const size_t frameBytes = (size_t)settings.width * settings.height * 3;
+	const double framePixels = (double)settings.width * settings.height;
+	const string params = SyntheticImages::describe(settings);
+
+	//stacking, mean blending only has a serial version
+	const unsigned int serialStackMethods[] = { 1, 4, 5 };
+	const unsigned int parallelStackMethods[] = { 2, 3 };
+	StackedImage stacked;
+	vector<Image> working;
+	for (const unsigned int &method : serialStackMethods) {
+		BenchmarkResult &result = bench.getResult(bench.measure("Thread Scaling", stackingMethodName(method), "compute", params,
+			[&working, &frames] { working = cloneImages(frames); },
+			[&stacked, &working, &method] { stacked = runStackingMethod(method, working); },
+			[&stacked, &working] { stacked.freeMemory(); working.clear(); }, framePixels));
+		addScalingMetrics(result, 1, result.median, stackingBytesTouched(method, settings.frameCount, frameBytes));
+	}
+	for (const unsigned int &method : parallelStackMethods) {
+		double oneThread = 0.0;
+		for (const unsigned int &threads : threadCounts) {
+			ConcurrencyLimit limit(threads);
+			BenchmarkResult &result = bench.getResult(bench.measure("Thread Scaling", stackingMethodName(method), "compute", params,
+				[&working, &frames] { working = cloneImages(frames); },
+				[&stacked, &working, &method] { stacked = runStackingMethod(method, working); },
+				[&stacked, &working] { stacked.freeMemory(); working.clear(); }, framePixels));
+			if (threads == 1) {
+				oneThread = result.median;
+			}
+			addScalingMetrics(result, threads, oneThread, stackingBytesTouched(method, settings.frameCount, frameBytes));
+		}
+	}
 
-	timer.start();
-	ImageStacker(3, 4);
-	timer.stop();
-	logFile << "\n\tSigma Clipped Mean Parallel Blending Time: " << timer.getSeconds() << " seconds";
+	//scaling, using the first frame as the source
+	const double scale = 2;
+	Image &source = frames[0];
+	const size_t outputBytes = (size_t)floor(source.w * scale) * (size_t)floor(source.h * scale) * 3;
+	const double outputPixels = floor(source.w * scale) * floor(source.h * scale);
+	const string scaleParams = to_string(source.w) + "x" + to_string(source.h) + " scale=2";
+	const unsigned int serialScaleMethods[] = { 4, 5, 6 };
+	const unsigned int parallelScaleMethods[] = { 1, 2, 3 };
+	ScaledImage scaled;
+	for (const unsigned int &method : serialScaleMethods) {
+		BenchmarkResult &result = bench.getResult(bench.measure("Thread Scaling", scalingMethodName(method), "compute", scaleParams, [] {},
+			[&scaled, &method, &source, &scale] { scaled = runScalingMethod(method, source, scale); },
+			[&scaled] { scaled.freeMemory(); }, outputPixels));
+		addScalingMetrics(result, 1, result.median, scalingBytesTouched(frameBytes, outputBytes));
+	}
+	for (const unsigned int &method : parallelScaleMethods) {
+		double oneThread = 0.0;
+		for (const unsigned int &threads : threadCounts) {
+			ConcurrencyLimit limit(threads);
+			BenchmarkResult &result = bench.getResult(bench.measure("Thread Scaling", scalingMethodName(method), "compute", scaleParams, [] {},
+				[&scaled, &method, &source, &scale] { scaled = runScalingMethod(method, source, scale); },
+				[&scaled] { scaled.freeMemory(); }, outputPixels));
+			if (threads == 1) {
+				oneThread = result.median;
+			}
+			addScalingMetrics(result, threads, oneThread, scalingBytesTouched(frameBytes, outputBytes));
+		}
+	}
+	freeImages(frames);
+}
 
-	logFile << "\n\n";
-	logFile.close();
+/// <summary>
+/// Ask whether to record hardware performance counters during a benchmark
+/// </summary>
+/// <param name="bench">benchmark harness to configure</param>
+void askPerfCounters(Benchmark &bench) {
+	cout << "Record hardware performance counters (IPC, cache misses, branch misses)?\n\t1. Yes\n\t2. No\n";
+	cout << "Choose an option: ";
+	bench.enablePerfCounters(getUserInputInteger() == 1);
 }
 
 /// <summary>
@@ -570,7 +659,7 @@ int showMainMenu() {
 	cout << "Image Stacker / Image Scaler\n";
 	cout << "************************************\n";
 	cout << "MAIN MENU\n";
-	cout << "\t1. Image Stacker\n\t2. Image Scaler\n\t3. Benchmark (Outputs results to benchmark.txt, takes about 10 mins)\n\t4. Quit\n";
+	cout << "\t1. Image Stacker\n\t2. Image Scaler\n\t3. Benchmark (Outputs results to Benchmark.txt and Benchmark.json, takes about 45 mins)\n\t4. Thread Scaling Benchmark (Outputs results to Benchmark.txt and Benchmark.json)\n\t5. Quit\n";
 	cout << "Choose an option: ";
 	int choice = getUserInputInteger();
 
@@ -581,13 +670,33 @@ int showMainMenu() {
 	case 2:
 		showImageScalerMenu();
 		break;
-	case 3:
-		benchmarkScaler();
-		benchmarkStacker();
+	case 3: {
+		Benchmark bench;
+		askPerfCounters(bench);
+		benchmarkScaler(bench);
+		benchmarkStacker(bench);
+		benchmarkSynthetic(bench);
+		benchmarkLayouts(bench);
+		//human readable summary and machine readable results
+		bench.writeText("Benchmark.txt");
+		bench.writeJson("Benchmark.json");
 		break;
-	case 4:
+	}
+	case 4: {
+		Benchmark bench;
+		askPerfCounters(bench);
+		benchmarkThreadScaling(bench);
+		bench.writeText("Benchmark.txt");
+		bench.writeJson("Benchmark.json");
+		break;
+	}
+	case 5:
 		return 0;
 	}
+	//write the zones recorded so far, does nothing unless tracing is enabled
+	TRACE_WRITE("Trace.json");
+	//make sure the details log is complete before handing back to the user
+	Logger::instance().flush();
 	//wait for user to continue
 	system("pause");
 	return 1;
@@ -608,15 +717,26 @@ int showMainMenu() {
 ///			set 4 images...
 ///		Zoom:
 ///			zImg_1.ppm
+///		Synthetic:
+///			generated stacks, written by the benchmark (or by the Frame Generator project)
 /// 
 /// For best results run from the provided CMP2090M Assignment Code.exe in: Dev\CMP2090M Assignment Code
 /// For best results when running from IDE run in Release x64
 /// 
 /// text file outputs will be written in the same directory as the program executable
 /// Image outputs will be written in the same directory as their source image(s)
+///
+/// Given any arguments the program runs in batch mode instead of showing the menu,
+/// run with --help for the options
 /// </summary>
+/// <param name="argc">argument count</param>
+/// <param name="argv">arguments</param>
 /// <returns>Exit code</returns>
-int main() {
+int main(int argc, char *argv[]) {
+	if (argc > 1) {
+		//non-interactive jobs from the command line or a manifest
+		return BatchMode::run(argc, argv);
+	}
 	//repeat until user chooses to quit
 	while (showMainMenu() != 0);
 	return 0;
@@ -0,0 +1,83 @@
+//FrameGenerator.cpp
+//Writes reproducible synthetic frame stacks for benchmarking the image stacker
+#define _CRT_SECURE_NO_WARNINGS
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include "../CMP2090M Assignment Code/SyntheticImages.h"
+using namespace std;
+
+/// <summary>
+/// Print how to use the generator
+/// </summary>
+void printUsage() {
+	cout << "Usage: FrameGenerator <output directory> [options]\n";
+	cout << "\t--width N            frame width (default 1024)\n";
+	cout << "\t--height N           frame height (default 768)\n";
+	cout << "\t--frames N           number of frames (default 10)\n";
+	cout << "\t--seed N             random seed, the same seed gives the same frames (default 1)\n";
+	cout << "\t--noise S            standard deviation of the noise in levels (default 8)\n";
+	cout << "\t--gradient G         brightness added by the sky gradient (default 60)\n";
+	cout << "\t--stars N            number of stars (default 300)\n";
+	cout << "\t--hot-pixels N       number of hot pixels (default 50)\n";
+	cout << "\t--satellites P       chance of a frame having a satellite trail (default 0.3)\n";
+	cout << "\t--outliers F         fraction of pixels hit by single frame outliers (default 0.0002)\n";
+}
+
+/// <summary>
+/// Generate a synthetic stack from command line settings
+/// </summary>
+/// <returns>0 on success, 1 on invalid arguments</returns>
+int main(int argc, char *argv[]) {
+	if (argc < 2 || string(argv[1]) == "--help") {
+		printUsage();
+		return argc < 2 ? 1 : 0;
+	}
+	const string directory = argv[1];
+	SyntheticStackSettings settings;
+	for (int i = 2; i < argc; i++) {
+		const string option = argv[i];
+		if (i + 1 >= argc) {
+			cerr << "Missing value for " << option << "\n";
+			return 1;
+		}
+		const char *value = argv[++i];
+		if (option == "--width") {
+			settings.width = (unsigned int)atoi(value);
+		} else if (option == "--height") {
+			settings.height = (unsigned int)atoi(value);
+		} else if (option == "--frames") {
+			settings.frameCount = (unsigned int)atoi(value);
+		} else if (option == "--seed") {
+			settings.seed = strtoull(value, nullptr, 10);
+		} else if (option == "--noise") {
+			settings.noiseSigma = (float)atof(value);
+		} else if (option == "--gradient") {
+			settings.gradientStrength = (float)atof(value);
+		} else if (option == "--stars") {
+			settings.starCount = (unsigned int)atoi(value);
+		} else if (option == "--hot-pixels") {
+			settings.hotPixelCount = (unsigned int)atoi(value);
+		} else if (option == "--satellites") {
+			settings.satelliteProbability = (float)atof(value);
+		} else if (option == "--outliers") {
+			settings.outlierFraction = (float)atof(value);
+		} else {
+			cerr << "Unknown option " << option << "\n";
+			printUsage();
+			return 1;
+		}
+	}
+	if (settings.width == 0 || settings.height == 0 || settings.frameCount == 0) {
+		cerr << "Width, height and frame count must be greater than 0\n";
+		return 1;
+	}
+
+	cout << "Generating " << SyntheticImages::describe(settings) << " in " << directory << "\n";
+	Timer timer;
+	timer.start();
+	SyntheticImages::writeStack(settings, directory);
+	timer.stop();
+	cout << "Finished in " << timer.getSeconds() << " seconds\n";
+	return 0;
+}